@@ -84,4 +84,76 @@
  * if (ssim == INFINITY)
  *     // Error
  * @endcode
+ *
+ * <br>
+ * @section example_3 Example 3
+ * When scoring many images of the same size (e.g. video frames), an SSIM plan avoids allocating and freeing the working buffers on every call:
+ *
+ * @code
+ * #include "iqa.h"
+ *
+ * struct iqa_ssim_plan *plan;
+ * float ssim;
+ *
+ * plan = iqa_ssim_plan_create(width, height, stride, 0); // Gaussian window, default args
+ * if (!plan)
+ *     // Error
+ *
+ * for (i=0; i<frames; ++i) {
+ *     // Load reference and modified frames.
+ *     ssim = iqa_ssim_plan_execute(plan, frame_ref, frame_mod);
+ * }
+ *
+ * iqa_ssim_plan_destroy(plan);
+ * @endcode
+ *
+ * If the reference stays the same and only the modified image changes (e.g. comparing encoder candidates), prepare the reference once so its statistics aren't recalculated:
+ *
+ * @code
+ * struct iqa_ssim_ref *prep = iqa_ssim_ref_prepare(img_ref, width, height, stride, 0);
+ *
+ * for (i=0; i<candidates; ++i)
+ *     ssim[i] = iqa_ssim_compare(prep, img_candidate[i]);
+ *
+ * iqa_ssim_ref_destroy(prep);
+ * @endcode
+ *
+ * <br>
+ * @section example_4 Example 4
+ * Images too large to hold in memory can be streamed a few rows at a time. Only a small band of rows is kept, and the result is the same as iqa_ssim():
+ *
+ * @code
+ * #include "iqa.h"
+ *
+ * struct iqa_ssim_stream *stream = iqa_ssim_stream_create(width, height, 0);
+ * int complete;
+ * float ssim;
+ *
+ * while (rows_left) {
+ *     // Read the next 'rows' rows of both images into row_ref and row_mod.
+ *     if (iqa_ssim_stream_push(stream, row_ref, row_mod, stride, rows))
+ *         // Error
+ * }
+ * ssim = iqa_ssim_stream_result(stream, &complete);
+ * iqa_ssim_stream_destroy(stream);
+ * @endcode
+ *
+ * <br>
+ * @section example_5 Example 5
+ * A plan can also write the local SSIM values to a buffer, e.g. to draw a heatmap of where the distortion is:
+ *
+ * @code
+ * #include "iqa.h"
+ *
+ * struct iqa_ssim_maps maps;
+ * int mw, mh;
+ *
+ * iqa_ssim_plan_map_size(plan, &mw, &mh);
+ * memset(&maps, 0, sizeof(maps));   // Skip the l, c and s maps
+ * maps.ssim.data   = malloc(mw*mh);
+ * maps.ssim.stride = mw;
+ * maps.ssim.format = IQA_MAP_U8;     // 0..255
+ *
+ * ssim = iqa_ssim_plan_execute_maps(plan, img_ref, img_mod, &maps);
+ * @endcode
  */
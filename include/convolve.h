@@ -34,14 +34,18 @@
 #ifndef _CONVOLVE_H_
 #define _CONVOLVE_H_
 
-typedef float (*_iqa_get_pixel)(const float *img, int w, int h, int x, int y, float bnd_const);
+/**
+ * Returns the value of pixel (x,y), which may lie outside the image. Rows of
+ * 'img' start 'stride' values apart.
+ */
+typedef float (*_iqa_get_pixel)(const float *img, int w, int h, int stride, int x, int y, float bnd_const);
 
 /** Out-of-bounds array values are a mirrored reflection of the border values*/
-float KBND_SYMMETRIC(const float *img, int w, int h, int x, int y, float bnd_const);
+float KBND_SYMMETRIC(const float *img, int w, int h, int stride, int x, int y, float bnd_const);
 /** Out-of-bounds array values are set to the nearest border value */
-float KBND_REPLICATE(const float *img, int w, int h, int x, int y, float bnd_const);
+float KBND_REPLICATE(const float *img, int w, int h, int stride, int x, int y, float bnd_const);
 /** Out-of-bounds array values are set to 'bnd_const' */
-float KBND_CONSTANT(const float *img, int w, int h, int x, int y, float bnd_const);
+float KBND_CONSTANT(const float *img, int w, int h, int stride, int x, int y, float bnd_const);
 
 
 /** Defines a convolution kernel */
@@ -52,14 +56,33 @@ struct _kernel {
     int normalized;         /**< 1 if the kernel values add up to 1. 0 otherwise */
     _iqa_get_pixel bnd_opt; /**< Defines how out-of-bounds image values are handled */
     float bnd_const;        /**< If 'bnd_opt' is KBND_CONSTANT, this specifies the out-of-bounds value */
+    float *kernel_h;        /**< Optional. Horizontal 1-D taps ('w' values). 0 if not separable */
+    float *kernel_v;        /**< Optional. Vertical 1-D taps ('h' values). 0 if not separable */
 };
 
+/**
+ * Returns the factor that normalizes the kernel values to a sum of 1. This is
+ * 1 for normalized kernels.
+ */
+float _iqa_kernel_scale(const struct _kernel *k);
+
+/**
+ * Returns 1 if all the kernel values are equal (a box filter), 0 otherwise.
+ * Box filters can be evaluated from running sums in constant time per pixel,
+ * independent of the kernel size.
+ */
+int _iqa_kernel_is_uniform(const struct _kernel *k);
+
 /**
  * @brief Applies the specified kernel to the image.
  * The kernel will be applied to all areas where it fits completely within
  * the image. The resulting image will be smaller by half the kernel width 
  * and height (w - kw/2 and h - kh/2).
  *
+ * If the kernel carries both 'kernel_h' and 'kernel_v', it is applied as two
+ * 1-D passes (rows, then columns), which costs kw+kh taps per pixel instead
+ * of kw*kh. The 2-D 'kernel' must be the outer product of the two.
+ *
  * @param img Image to modify
  * @param w Image width
  * @param h Image height
@@ -72,6 +95,16 @@ struct _kernel {
  */
 void _iqa_convolve(float *img, int w, int h, const struct _kernel *k, float *result, int *rw, int *rh);
 
+/**
+ * The same as _iqa_convolve() for images whose rows are 'stride' values apart
+ * (such as a view into a larger or padded buffer). 'img' is only read.
+ * @param dst Buffer to hold the resulting image. Required. It may only be the
+ *            same as 'img' when 'dst_stride' is no larger than 'stride'.
+ * @param dst_stride The number of values between rows of 'dst'
+ */
+void _iqa_convolve_strided(const float *img, int w, int h, int stride, const struct _kernel *k,
+    float *dst, int dst_stride, int *rw, int *rh);
+
 /**
  * The same as _iqa_convolve() except the kernel is applied to the entire image.
  * In other words, the kernel is applied to all areas where the top-left corner
@@ -98,6 +131,7 @@ int _iqa_img_filter(float *img, int w, int h, const struct _kernel *k, float *re
  * @param img Source image
  * @param w Image width
  * @param h Image height
+ * @param stride The number of values from the start of one row to the next
  * @param x The x location of the pixel to filter
  * @param y The y location of the pixel to filter
  * @param k Optional. The convolution kernel to apply to the pixel.
@@ -105,7 +139,7 @@ int _iqa_img_filter(float *img, int w, int h, const struct _kernel *k, float *re
  *               kernels. Required if 'k' is not null.
  * @return The filtered pixel value.
  */
-float _iqa_filter_pixel(const float *img, int w, int h, int x, int y, const struct _kernel *k, const float kscale);
+float _iqa_filter_pixel(const float *img, int w, int h, int stride, int x, int y, const struct _kernel *k, const float kscale);
 
 
 #endif /*_CONVOLVE_H_*/
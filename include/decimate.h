@@ -35,10 +35,14 @@
 #define _DECIMATE_H_
 
 #include "convolve.h"
+#include <stddef.h>
 
 /**
  * @brief Downsamples (decimates) an image.
  *
+ * If the kernel carries both 'kernel_h' and 'kernel_v', only the kept rows
+ * and columns are filtered, as two 1-D passes.
+ *
  * @param img Image to modify
  * @param w Image width
  * @param h Image height
@@ -52,4 +56,63 @@
  */
 int _iqa_decimate(float *img, int w, int h, int factor, const struct _kernel *k, float *result, int *rw, int *rh);
 
+/**
+ * The same as _iqa_decimate(), except that temporary storage is taken from
+ * 'scratch' so nothing is allocated.
+ * @param scratch At least _iqa_decimate_scratch() bytes, suitably aligned for
+ *                doubles. If 0, the storage is allocated internally.
+ */
+int _iqa_decimate_ws(float *img, int w, int h, int factor, const struct _kernel *k, float *result,
+    int *rw, int *rh, void *scratch);
+
+/**
+ * Decimates an image without modifying it. Rows of 'img' start 'stride'
+ * values apart, and rows of 'result' 'dst_stride' values apart, so either can
+ * be a view into a larger (or padded) buffer.
+ * @param result Buffer to hold the resulting image. Required. It may only be
+ *               the same as 'img' when 'dst_stride' is no larger than
+ *               'stride'.
+ * @param scratch As for _iqa_decimate_ws()
+ */
+int _iqa_decimate_strided(const float *img, int w, int h, int stride, int factor, const struct _kernel *k,
+    float *result, int dst_stride, int *rw, int *rh, void *scratch);
+
+/**
+ * Returns the number of bytes of scratch space that _iqa_decimate_ws() and
+ * _iqa_decimate_strided() needs
+ * for an image 'w' pixels wide.
+ */
+size_t _iqa_decimate_scratch(int w, int factor, const struct _kernel *k);
+
+/**
+ * Decimates two images of the same size and layout with the same kernel, with
+ * the same results as two _iqa_decimate_strided() calls. Separable kernels,
+ * and 2-D kernels at the SIMD levels, are applied to both images in a single
+ * sweep, each tap to the rows of both.
+ * @param scratch At least _iqa_decimate_pair_scratch() bytes, suitably
+ *                aligned for doubles. If 0, the storage is allocated
+ *                internally.
+ */
+int _iqa_decimate_pair(const float *img0, const float *img1, int w, int h, int stride, int factor,
+    const struct _kernel *k, float *result0, float *result1, int dst_stride, int *rw, int *rh, void *scratch);
+
+/**
+ * Returns the number of bytes of scratch space that _iqa_decimate_pair()
+ * needs for images 'w' pixels wide.
+ */
+size_t _iqa_decimate_pair_scratch(int w, int factor, const struct _kernel *k);
+
+/**
+ * Calculates one output row of a box filter decimation (uniform kernel) from
+ * its source rows. This lets images be decimated as their rows arrive.
+ * @param rows The k->h source rows for output row y (rows y*factor-k->h/2
+ *             onwards). Rows outside the image must already be resolved
+ *             through 'bnd_opt'. Columns outside the image are resolved
+ *             through 'bnd_opt' on each row.
+ * @param dst Receives the 'sw' output values
+ * @param col Scratch space for 2*(w+2*(k->w/2)+1)+1 doubles
+ */
+void _iqa_decimate_box_row(const float *const *rows, int w, int factor, const struct _kernel *k,
+    float *dst, int sw, double *col);
+
 #endif /*_DECIMATE_H_*/
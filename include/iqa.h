@@ -61,6 +61,23 @@ struct iqa_ms_ssim_args {
     const float *gammas;  /**< Pointer to array of gamma values for each scale. Required if 'scales' isn't 5. */
 };
 
+/**
+ * Sample format of the high-bit-depth (_16) functions: the bit depth (1 to
+ * 16), optionally OR'd with IQA_MSB_ALIGNED. Without it, each sample is in the
+ * low bits of its 16-bit word (e.g. yuv420p10le). With it, the sample is in
+ * the high bits and the low bits are ignored (e.g. P010, which is
+ * 10 | IQA_MSB_ALIGNED).
+ */
+#define IQA_MSB_ALIGNED 0x100
+
+/**
+ * A rectangular region of interest, in pixels. It must lie inside the image.
+ */
+struct iqa_rect {
+    int x, y;       /**< Top-left corner */
+    int w, h;       /**< Width and height (at least 1) */
+};
+
 /**
  * Calculates the Mean Squared Error between 2 equal-sized 8-bit images.
  * @note The images must have the same width, height, and stride.
@@ -74,6 +91,27 @@ struct iqa_ms_ssim_args {
  */
 float iqa_mse(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride);
 
+/**
+ * The same as iqa_mse() over the pixels of a list of rectangles. Only those
+ * pixels are read. Rectangles that overlap count their shared pixels once per
+ * rectangle.
+ * @param rects The regions of interest
+ * @param count The number of rectangles (at least 1)
+ * @return The MSE, or INFINITY if a rectangle is empty or outside the image.
+ */
+float iqa_mse_roi(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    const struct iqa_rect *rects, int count);
+
+/**
+ * The same as iqa_mse() for images with 16-bit samples. MSB-aligned samples
+ * are shifted down to their bit depth first.
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @param depth The sample format (see IQA_MSB_ALIGNED)
+ * @return The MSE, or INFINITY if the depth is invalid.
+ */
+float iqa_mse_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth);
+
 /**
  * Calculates the Peak Signal-to-Noise-Ratio between 2 equal-sized 8-bit
  * images.
@@ -88,6 +126,16 @@ float iqa_mse(const unsigned char *ref, const unsigned char *cmp, int w, int h,
  */
 float iqa_psnr(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride);
 
+/**
+ * The same as iqa_psnr() for images with 16-bit samples. The peak is the
+ * largest value of the bit depth (2^bits - 1).
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @param depth The sample format (see IQA_MSB_ALIGNED)
+ * @return The PSNR, or NAN if the depth is invalid.
+ */
+float iqa_psnr_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth);
+
 /**
  * Calculates the Structural SIMilarity between 2 equal-sized 8-bit images.
  *
@@ -108,6 +156,229 @@ float iqa_psnr(const unsigned char *ref, const unsigned char *cmp, int w, int h,
 float iqa_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride, 
     int gaussian, const struct iqa_ssim_args *args);
 
+/**
+ * The same as iqa_ssim() for images with 16-bit samples. The samples are
+ * converted to float in place of the 8-bit values, without reducing them.
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @param depth The sample format (see IQA_MSB_ALIGNED)
+ * @param args Optional SSIM arguments. 0 for defaults, which use
+ * L = 2^bits - 1. 'L' should be set to match the bit depth.
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth, int gaussian, const struct iqa_ssim_args *args);
+
+/**
+ * The same as iqa_ssim() for single precision float images, such as the
+ * output of a decoder or another filter. The images are read where they are,
+ * without conversion or a full size copy, and are not modified.
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ *               Must be a multiple of sizeof(float).
+ * @param args Optional SSIM arguments. The samples are compared against 'L'
+ *             like 8-bit values, so the default expects a range of 0 to 255.
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_f32(const float *ref, const float *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args);
+
+/**
+ * The same as iqa_ssim() over a list of regions of interest. The result is
+ * the mean over the SSIM windows centred on the pixels of each rectangle
+ * (after any downsampling). The windows read the real pixels around a
+ * rectangle; only the edges of the image are mirrored, as in iqa_ssim(). If
+ * no window centred on a rectangle fits inside the image, the nearest one is
+ * used. The rectangles are weighted by their number of windows, so the
+ * result is the mean of all those windows. Only the rectangles and their
+ * surroundings are processed, so the cost follows their area rather than the
+ * image size. A single rectangle covering the whole image gives the same
+ * result as iqa_ssim().
+ * @param rects The regions of interest
+ * @param count The number of rectangles (at least 1)
+ * @return The mean SSIM over the regions, or INFINITY if error.
+ */
+float iqa_ssim_roi(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args, const struct iqa_rect *rects, int count);
+
+/**
+ * Options for an SSIM plan.
+ */
+struct iqa_ssim_plan_options {
+    int gaussian;                       /**< 0 = 8x8 square window, 1 = 11x11 circular-symmetric Gaussian weighting. */
+    const struct iqa_ssim_args *args;   /**< Optional SSIM arguments (copied by iqa_ssim_plan_create()). 0 for defaults. */
+};
+
+/**
+ * Preallocated state for repeatedly calculating SSIM on images of one size
+ * (e.g. the frames of a video). Opaque to the caller.
+ */
+struct iqa_ssim_plan;
+
+/**
+ * Creates an SSIM plan. All the buffers are allocated (and aligned) up front
+ * and the window, scaling and kernel variants are chosen once, so executing
+ * the plan doesn't allocate memory.
+ * @param w Width of the images
+ * @param h Height of the images
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ *               This may be different from the image width.
+ * @param opts Optional. 0 for the defaults (Gaussian window, default args).
+ * @return The plan, or 0 on error. Release it with iqa_ssim_plan_destroy().
+ */
+struct iqa_ssim_plan *iqa_ssim_plan_create(int w, int h, int stride,
+    const struct iqa_ssim_plan_options *opts);
+
+/**
+ * Calculates the SSIM between 2 images with the size and options of 'plan'.
+ * The result is identical to iqa_ssim() with the same parameters.
+ * @note A plan must not be executed by multiple threads at the same time.
+ * @param plan A plan from iqa_ssim_plan_create()
+ * @param ref Original reference image
+ * @param cmp Distorted image
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_plan_execute(struct iqa_ssim_plan *plan, const unsigned char *ref,
+    const unsigned char *cmp);
+
+/* Pixel formats of an SSIM map */
+#define IQA_MAP_FLOAT 0     /**< One float per pixel holding the value as is */
+#define IQA_MAP_U8    1     /**< One byte per pixel: the value clamped to [0,1] and scaled to 0..255 */
+
+/**
+ * A caller-owned buffer that receives one value per SSIM window.
+ */
+struct iqa_map {
+    void *data;     /**< First row. 0 to skip this map. */
+    int stride;     /**< Bytes from the start of one row to the next */
+    int format;     /**< IQA_MAP_FLOAT or IQA_MAP_U8 */
+};
+
+/**
+ * The maps written by iqa_ssim_plan_execute_maps(). Each is
+ * iqa_ssim_plan_map_size() pixels, and any of them may be skipped.
+ */
+struct iqa_ssim_maps {
+    struct iqa_map ssim;    /**< Local SSIM */
+    struct iqa_map l;       /**< Luminance comparison */
+    struct iqa_map c;       /**< Contrast comparison */
+    struct iqa_map s;       /**< Structure comparison */
+};
+
+/**
+ * Returns the size of the SSIM maps of a plan. This is the size of the scaled
+ * image less the window size plus one.
+ * @return 0 on success.
+ */
+int iqa_ssim_plan_map_size(const struct iqa_ssim_plan *plan, int *mw, int *mh);
+
+/**
+ * The same as iqa_ssim_plan_execute(), except that the local values are also
+ * written to the caller's maps. The mean is identical to
+ * iqa_ssim_plan_execute(), and the SSIM map holds the values it averages.
+ * The l, c and s maps use the plan's alpha, beta and gamma (1 by default).
+ * Only the requested maps are calculated.
+ * @param maps Destination maps (see iqa_ssim_plan_map_size())
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_plan_execute_maps(struct iqa_ssim_plan *plan, const unsigned char *ref,
+    const unsigned char *cmp, const struct iqa_ssim_maps *maps);
+
+/**
+ * Releases a plan and all of its buffers. 'plan' may be 0.
+ */
+void iqa_ssim_plan_destroy(struct iqa_ssim_plan *plan);
+
+/**
+ * How iqa_ssim_sampled() picks the windows it evaluates.
+ */
+struct iqa_ssim_sampling {
+    int step;           /**< Grid: every 'step'th window of every 'step'th row (1 = all of them). */
+    int count;          /**< If > 0, 'count' pseudo-random windows instead of the grid. */
+    unsigned int seed;  /**< Seed of the random windows. The same seed gives the same windows. */
+};
+
+/**
+ * An SSIM estimate from a sample of the windows.
+ */
+struct iqa_ssim_estimate {
+    float mean;         /**< Mean SSIM of the sampled windows */
+    float error;        /**< Half-width of the 95% confidence interval of 'mean': 0 if every
+                             window was sampled, INFINITY with a single sample. */
+    int samples;        /**< Number of windows evaluated */
+};
+
+/**
+ * Estimates SSIM from a sample of the windows instead of all of them. The
+ * images are still converted (and downsampled) whole, but only the sampled
+ * windows are filtered and pooled, each on its own. The window work is about
+ * the number of sampled windows times that of one window: a step of s samples
+ * about 1/s^2 of them, and 'count' random windows cost about 'count' windows.
+ * A step of 1 is the full calculation. The interval treats the local values as a simple
+ * random sample; neighbouring windows are correlated, so it is an estimate.
+ * @param ref Original reference image
+ * @param cmp Distorted image
+ * @param w Width of the images
+ * @param h Height of the images
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @param gaussian 0 = 8x8 square window, 1 = 11x11 circular-symmetric Gaussian
+ * weighting.
+ * @param args Optional SSIM arguments (see iqa_ssim()). 0 for defaults.
+ * @param sampling Which windows to evaluate
+ * @param est Optional. Receives the mean, its confidence interval and the
+ *            number of windows.
+ * @return The mean SSIM of the sampled windows, or INFINITY if error. With a
+ *         step of 1 this is iqa_ssim() to within rounding.
+ */
+float iqa_ssim_sampled(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args, const struct iqa_ssim_sampling *sampling,
+    struct iqa_ssim_estimate *est);
+
+/**
+ * iqa_ssim_sampled() with the size and options of 'plan'.
+ * @note A plan must not be executed by multiple threads at the same time.
+ */
+float iqa_ssim_plan_sample(struct iqa_ssim_plan *plan, const unsigned char *ref, const unsigned char *cmp,
+    const struct iqa_ssim_sampling *sampling, struct iqa_ssim_estimate *est);
+
+/**
+ * A reference image prepared for repeated SSIM comparisons. Opaque to the
+ * caller.
+ */
+struct iqa_ssim_ref;
+
+/**
+ * Prepares a reference image for comparison with many distorted images (e.g.
+ * encoder candidates). The converted (and scaled) reference and its local
+ * means and variances are calculated once and cached.
+ * @param ref Original reference image
+ * @param w Width of the image
+ * @param h Height of the image
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ *               This may be different from the image width.
+ * @param opts Optional. 0 for the defaults (Gaussian window, default args).
+ * @return The prepared reference, or 0 on error (including images smaller
+ * than the window). Release it with iqa_ssim_ref_destroy().
+ */
+struct iqa_ssim_ref *iqa_ssim_ref_prepare(const unsigned char *ref, int w, int h, int stride,
+    const struct iqa_ssim_plan_options *opts);
+
+/**
+ * Calculates the SSIM between a prepared reference and a distorted image with
+ * the same width, height, and stride. Only the distorted image's statistics
+ * and the cross term are calculated, and the result is identical to
+ * iqa_ssim() with the same parameters. No memory is allocated.
+ * @note A prepared reference must not be used by multiple threads at the same
+ * time.
+ * @param prepared A reference from iqa_ssim_ref_prepare()
+ * @param cmp Distorted image
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_compare(struct iqa_ssim_ref *prepared, const unsigned char *cmp);
+
+/**
+ * Releases a prepared reference. 'prepared' may be 0.
+ */
+void iqa_ssim_ref_destroy(struct iqa_ssim_ref *prepared);
+
 /**
  * Calculates the Multi-Scale Structural SIMilarity between 2 equal-sized 8-bit
  * images. The default algorithm is MS-SSIM* proposed by Rouse/Hemami 2008.
@@ -131,4 +402,211 @@ float iqa_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h,
 float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride, 
     const struct iqa_ms_ssim_args *args);
 
+/**
+ * The same as iqa_ms_ssim() for images with 16-bit samples. The dynamic range
+ * is L = 2^bits - 1.
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ * @param depth The sample format (see IQA_MSB_ALIGNED)
+ * @return The mean MS-SSIM over the entire image, or INFINITY if error.
+ */
+float iqa_ms_ssim_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth, const struct iqa_ms_ssim_args *args);
+
+/**
+ * The same as iqa_ms_ssim() for single precision float images on the 8-bit
+ * scale (L = 255). The full size images are read where they are and are not
+ * modified. Only the smaller scales are allocated.
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ *               Must be a multiple of sizeof(float).
+ * @return The mean MS-SSIM over the entire image, or INFINITY if error.
+ */
+float iqa_ms_ssim_f32(const float *ref, const float *cmp, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args);
+
+/**
+ * The same as iqa_ms_ssim() over a list of regions of interest. Each scale
+ * pools only the windows centred on a rectangle (see iqa_ssim_roi()), using
+ * the real pixels around it. Only the rectangles and a margin around them are
+ * processed. The results of the rectangles are averaged, weighted by their
+ * number of windows at the first (full size) scale, as in iqa_ssim_roi(). The
+ * number of scales is limited by the size of the whole image, as in
+ * iqa_ms_ssim(). A single rectangle covering the whole image gives the same
+ * result as iqa_ms_ssim().
+ * @param rects The regions of interest
+ * @param count The number of rectangles (at least 1)
+ * @return The mean MS-SSIM over the regions, or INFINITY if error.
+ */
+float iqa_ms_ssim_roi(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args, const struct iqa_rect *rects, int count);
+
+/**
+ * A reference image prepared for repeated MS-SSIM comparisons. Opaque to the
+ * caller.
+ */
+struct iqa_ms_ssim_ref;
+
+/**
+ * Prepares a reference image for MS-SSIM comparison with many distorted
+ * images (e.g. the renditions of a bitrate ladder). The scaled reference
+ * images and their local means and variances are calculated once and cached.
+ * @param ref Original reference image
+ * @param w Width of the image
+ * @param h Height of the image
+ * @param stride The length (in bytes) of each horizontal line in the image.
+ *               This may be different from the image width.
+ * @param args Optional MS-SSIM arguments (copied). 0 for defaults.
+ * @return The prepared reference, or 0 on error (including images that are
+ * too small). Release it with iqa_ms_ssim_ref_destroy().
+ */
+struct iqa_ms_ssim_ref *iqa_ms_ssim_ref_prepare(const unsigned char *ref, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args);
+
+/**
+ * Calculates the MS-SSIM between a prepared reference and a distorted image
+ * with the same width, height, and stride. Only the distorted image is
+ * scaled and filtered, and at each scale only its window statistics and the
+ * cross term are calculated (the reference's are cached). The result is
+ * identical to iqa_ms_ssim() with the same parameters. No memory is
+ * allocated.
+ * @note A prepared reference must not be used by multiple threads at the same
+ * time.
+ * @param prepared A reference from iqa_ms_ssim_ref_prepare()
+ * @param cmp Distorted image
+ * @return The mean MS-SSIM over the entire image, or INFINITY if error.
+ */
+float iqa_ms_ssim_compare(struct iqa_ms_ssim_ref *prepared, const unsigned char *cmp);
+
+/**
+ * Releases a prepared MS-SSIM reference. 'prepared' may be 0.
+ */
+void iqa_ms_ssim_ref_destroy(struct iqa_ms_ssim_ref *prepared);
+
+struct iqa_ssim_stream;
+
+/**
+ * Creates a streaming SSIM calculation for very large images. The rows are
+ * pushed in order (in any number of calls) and only a few rows are kept at a
+ * time: about (2*scale) source rows plus 2*(window height+1) scaled rows of
+ * each image. Memory therefore grows with the width, not the height.
+ * Once all the rows have been pushed, the result is identical to iqa_ssim().
+ * @param w Width of the images
+ * @param h Height of the images
+ * @param opts Optional settings (see iqa_ssim_plan_create()). 0 for defaults.
+ * @return The stream, or 0 on error (including images that are too small).
+ *         Release it with iqa_ssim_stream_destroy().
+ */
+struct iqa_ssim_stream *iqa_ssim_stream_create(int w, int h, const struct iqa_ssim_plan_options *opts);
+
+/**
+ * Adds the next rows of both images to a stream.
+ * @param stream A stream from iqa_ssim_stream_create()
+ * @param ref The next 'rows' rows of the reference image
+ * @param cmp The next 'rows' rows of the distorted image
+ * @param stride The length (in bytes) of each horizontal line in both buffers
+ * @param rows Number of rows. The total must not exceed the image height.
+ * @return 0 on success.
+ */
+int iqa_ssim_stream_push(struct iqa_ssim_stream *stream, const unsigned char *ref,
+    const unsigned char *cmp, int stride, int rows);
+
+/**
+ * Returns the mean SSIM of the part of the image that has been pooled so far
+ * (the output rows whose windows have been received).
+ * @param stream A stream from iqa_ssim_stream_create()
+ * @param complete Optional. Set to 1 if every row has been pooled, in which
+ *                 case the result is the final MSSIM.
+ * @return The mean SSIM so far, or INFINITY if nothing has been pooled yet or
+ *         on error.
+ */
+float iqa_ssim_stream_result(const struct iqa_ssim_stream *stream, int *complete);
+
+/**
+ * Releases a stream. 'stream' may be 0.
+ */
+void iqa_ssim_stream_destroy(struct iqa_ssim_stream *stream);
+
+/**
+ * Supplies row 'y' of both images to iqa_ssim_streamed(). The rows must stay
+ * valid until the next call.
+ * @return 0 on success. Non-zero aborts the calculation.
+ */
+typedef int (*iqa_row_reader)(int y, const unsigned char **ref, const unsigned char **cmp, void *ctx);
+
+/**
+ * Calculates SSIM with a stream, reading the rows in order through 'read'.
+ * The result is identical to iqa_ssim() on the whole images.
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_streamed(int w, int h, const struct iqa_ssim_plan_options *opts,
+    iqa_row_reader read, void *ctx);
+
+struct iqa_ssim_tracker;
+
+/**
+ * Creates an SSIM tracker for a sequence of frames where only small parts of
+ * each frame change (e.g. screen capture). The SSIM windows are split into
+ * tiles that keep their own partial sums, and each update only scores the
+ * tiles that the changed rectangles reach (plus the window and filter halo).
+ * @param w Width of the frames
+ * @param h Height of the frames
+ * @param opts Optional settings (see iqa_ssim_plan_create()). 0 for defaults.
+ * @return The tracker, or 0 on error (including frames that are too small).
+ *         Release it with iqa_ssim_tracker_destroy().
+ */
+struct iqa_ssim_tracker *iqa_ssim_tracker_create(int w, int h, const struct iqa_ssim_plan_options *opts);
+
+/**
+ * Updates a tracker with the current frames and returns their SSIM. The first
+ * update (and any update after an error) scores the whole frames. The result
+ * only depends on the frames, not on the updates before, and matches
+ * iqa_ssim() to within rounding.
+ * @note A tracker must not be updated by multiple threads at the same time.
+ * @param tracker A tracker from iqa_ssim_tracker_create()
+ * @param ref The current reference frame
+ * @param cmp The current distorted frame
+ * @param stride The length (in bytes) of each horizontal line in both frames
+ * @param dirty The rectangles where either frame changed since the last
+ *              update, or 0 to score the whole frames
+ * @param count Number of rectangles. 0 if nothing changed.
+ * @return The mean SSIM over the entire frame (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_tracker_update(struct iqa_ssim_tracker *tracker, const unsigned char *ref,
+    const unsigned char *cmp, int stride, const struct iqa_rect *dirty, int count);
+
+/**
+ * Releases a tracker. 'tracker' may be 0.
+ */
+void iqa_ssim_tracker_destroy(struct iqa_ssim_tracker *tracker);
+
+/**
+ * Calculates SSIM with the fixed-point integer engine. The parameters are the
+ * same as iqa_ssim(). The 8-bit samples are filtered with integer arithmetic
+ * (the Gaussian window is quantized to 14-bit taps, and downsampled pixels
+ * are rounded to 8 bits), so the result differs slightly from iqa_ssim().
+ * With the default exponents (alpha = beta = gamma = 1) the result is
+ * identical on every machine and instruction set. Other exponents use the C
+ * library's pow(), whose last bit may differ between C libraries.
+ * @return The mean SSIM over the entire image (MSSIM), or INFINITY if error.
+ */
+float iqa_ssim_int(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args);
+
+/**
+ * Sets the number of threads used by SSIM and MS-SSIM. The images are split
+ * into fixed bands of rows whose partial results are combined in band order,
+ * so the result is bit-identical for any number of threads. The default is 1
+ * (no threads are created).
+ * @note The worker threads are shared. If a second application thread calls
+ * into the library while they are busy, it does its work on its own.
+ * @param threads Number of threads, including the calling thread. 0 or less
+ *                uses one per CPU.
+ * @return The number of threads that will be used.
+ */
+int iqa_set_num_threads(int threads);
+
+/**
+ * Returns the number of threads used by SSIM and MS-SSIM.
+ */
+int iqa_get_num_threads(void);
+
 #endif /*_IQA_H_*/
@@ -61,4 +61,21 @@ IQA_EXPORT IQA_INLINE int _cmp_float(float a, float b, int digits);
  */
 IQA_EXPORT IQA_INLINE int _matrix_cmp(const float *a, const float *b, int w, int h, int digits);
 
+/**
+ * Splits the sample format of a high-bit-depth image (see IQA_MSB_ALIGNED)
+ * into its bit depth and the right shift that moves each sample to the low
+ * bits.
+ * @return 0 on success, 1 if the bit depth isn't 1 to 16.
+ */
+int _iqa_depth(int depth, int *bits, int *shift);
+
+struct iqa_rect;
+
+/**
+ * Checks a list of regions of interest against a 'w' x 'h' image.
+ * @return 0 if there is at least 1 rectangle and all of them are non-empty
+ * and inside the image, 1 otherwise.
+ */
+int _iqa_rects_valid(const struct iqa_rect *rects, int count, int w, int h);
+
 #endif /*_MATH_UTILS_H_*/
@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include <stddef.h>
+
+/*
+ * Internal thread pool.
+ *
+ * Work is split into a fixed number of tasks (e.g. bands of image rows) that
+ * are handed out to the workers in task order. The number of tasks must not
+ * depend on the number of threads, and the task results must be combined in
+ * task order afterwards, so that the result doesn't depend on the thread
+ * count or on the scheduling.
+ *
+ * Tasks are normally independent. A task may also wait for work done by
+ * lower-numbered tasks of the same job (see _iqa_parallel_wait()): those have
+ * already been handed out, so the wait always ends, even when the tasks run
+ * in order on a single thread.
+ *
+ * The calling thread takes part as worker 0. The pool threads are created on
+ * first use and live until _iqa_parallel_shutdown().
+ */
+
+/**
+ * Called for each task.
+ * @param task Task index in [0, count)
+ * @param worker Index of the thread running the task, in [0, threads)
+ * @param ctx The context given to _iqa_parallel_for()
+ */
+typedef void (*_iqa_task)(int task, int worker, void *ctx);
+
+/**
+ * Runs 'fn' for every task in [0, count) and waits until all have finished.
+ * If the pool is being used by another thread, or only one thread is
+ * configured, the tasks are run in order on the calling thread.
+ * @return The number of workers that were used (at least 1).
+ */
+int _iqa_parallel_for(int count, _iqa_task fn, void *ctx);
+
+/**
+ * Returns a scratch buffer of at least 'size' bytes (IQA_ALIGN aligned) that
+ * belongs to a pool worker. The buffer is reused between calls and only
+ * grows, so it is normally not allocated. Only valid inside a task running on
+ * 'worker' (which must not be 0; worker 0 is the caller and uses its own
+ * buffers).
+ * @return The buffer, or 0 if it could not be allocated.
+ */
+void *_iqa_parallel_scratch(int worker, size_t size);
+
+/**
+ * Adds 1 to a progress counter shared by the tasks of a job, and wakes the
+ * tasks waiting on it. Everything the task wrote before is visible to them.
+ */
+void _iqa_parallel_post(int *counter);
+
+/**
+ * Waits until a progress counter reaches 'value'. Only counters posted by
+ * lower-numbered tasks may be waited on.
+ */
+void _iqa_parallel_wait(const int *counter, int value);
+
+/**
+ * Returns the number of threads that _iqa_parallel_for() will use.
+ */
+int _iqa_parallel_threads(void);
+
+/**
+ * Stops the pool threads and frees their buffers.
+ */
+void _iqa_parallel_shutdown(void);
+
+#endif /*_PARALLEL_H_*/
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#include <stddef.h>
+
+/*
+ * Run-time selected SIMD kernels.
+ *
+ * The instruction set is detected once (on first use). The choice can be
+ * overridden with the IQA_SIMD environment variable, set to one of "scalar",
+ * "sse2", "avx2" or "avx512". Requests for an instruction set the CPU doesn't
+ * support fall back to the best one that it does.
+ *
+ * The scalar level keeps the original (double precision) code paths. The
+ * vector levels must match the scalar results to the precision checked by the
+ * unit tests. Filtering works in single precision, but window sums that feed
+ * a variance or covariance are accumulated in double, since the difference
+ * of two nearly equal moments loses the leading digits.
+ */
+
+#define IQA_SIMD_SCALAR 0
+#define IQA_SIMD_SSE2   1
+#define IQA_SIMD_AVX2   2
+#define IQA_SIMD_AVX512 3
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define IQA_SIMD_X86 1
+#endif
+
+/* Compiles a function for a specific instruction set (GCC/Clang) without
+ * enabling it for the whole file. MSVC doesn't need this. */
+#if defined(__GNUC__)
+#define IQA_TARGET(isa) __attribute__((target(isa)))
+#else
+#define IQA_TARGET(isa)
+#endif
+
+/* Keeps a*b+c as two roundings in kernels that must match the scalar code
+ * exactly (GCC would otherwise fuse them when FMA is enabled). */
+#if defined(__GNUC__) && !defined(__clang__)
+#define IQA_NO_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define IQA_NO_CONTRACT
+#endif
+
+/**
+ * Table of dispatched kernels. Members other than 'u8_to_float',
+ * 'u16_to_float', 'ssim_terms_row' and 'int_moments_row' are 0 at the scalar level, in which
+ * case callers use their own scalar code.
+ */
+struct _iqa_simd {
+    int level;          /**< One of the IQA_SIMD_* values */
+    const char *name;   /**< Name used by the IQA_SIMD environment variable */
+
+    /** dst[x] = (float)src[x], for x in [0,len) */
+    void (*u8_to_float)(const unsigned char *src, float *dst, int len);
+
+    /** dst[x] = (float)(src[x] >> shift), for x in [0,len) */
+    void (*u16_to_float)(const unsigned short *src, float *dst, int len, int shift);
+
+    /** dst[x] = SUM(taps[u] * src[x+u]), for x in [0,len) and u in [0,ntaps) */
+    void (*filter_row)(const float *src, float *dst, int len, const float *taps, int ntaps);
+
+    /** dst[x] += wt * src[x*step], for x in [0,len) */
+    void (*accum_row)(const float *src, int step, float wt, float *dst, int len);
+
+    /**
+     * dst[x] += (double)(wt * src[x*step]), for x in [0,len). The products
+     * are single precision and the sums double, as in _iqa_filter_pixel(), so
+     * the results are identical at every level.
+     */
+    void (*accum_row_d)(const float *src, int step, float wt, double *dst, int len);
+
+    /**
+     * Calculates the 5 SSIM window statistics for one row of output pixels
+     * using a separable window. 'ref' and 'cmp' point to the first window row.
+     * 'col' is scratch space for 5*w doubles. 'stats' receives 5 consecutive
+     * rows of (w-kw+1) values: mean ref, mean cmp, variance of ref, variance
+     * of cmp and the covariance. The sums are double precision, and the
+     * results are identical at every level.
+     */
+    void (*ssim_stats_row)(const float *ref, const float *cmp, int stride, int w,
+        const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+        double *col, float *stats);
+
+    /**
+     * The same as 'ssim_stats_row' for a reference whose statistics are
+     * cached: only the mean and variance of cmp and the covariance are
+     * calculated (rows 1, 3 and 4). Row 0 must already hold the reference
+     * means, and row 2 is left untouched. 'col' needs 3*w doubles.
+     */
+    void (*ssim_cmp_stats_row)(const float *ref, const float *cmp, int stride, int w,
+        const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+        double *col, float *stats);
+
+    /**
+     * Returns the sum of the default SSIM term over 'len' pixels, given the 5
+     * statistic rows produced by 'ssim_stats_row'.
+     */
+    double (*ssim_pool_row)(const float *stats, int len, float C1, float C2);
+
+    /**
+     * Calculates the luminance, contrast and structure terms (with exponents
+     * of 1) of 'len' pixels from the 5 statistic rows. Negative variances are
+     * treated as 0, and the MS-SSIM* special cases apply when a constant is 0.
+     * The results are identical at every level.
+     */
+    void (*ssim_terms_row)(const float *stats, int len, float C1, float C2, float C3,
+        double *l, double *c, double *s);
+
+    /**
+     * Horizontal pass of the fixed-point SSIM engine. Fills 5 consecutive
+     * rows of 'len' values: SUM(taps[u] * p[x+u]), for x in [0,len) and u in
+     * [0,ntaps), where p is a, b, a*a, b*b and a*b. The taps must be
+     * non-negative and sum to at most 2^14, so every sum fits in 31 bits.
+     * The results are exact at every level.
+     */
+    void (*int_moments_row)(const unsigned char *a, const unsigned char *b, int len,
+        const int *taps, int ntaps, int *out);
+
+    /**
+     * v[x] = sign(v[x]) * pow(|v[x]|, e), for x in [0,len). Computed as
+     * exp(y), y = e*log|v|, with polynomials good to a unit in the last
+     * place. Rounding y costs about |y| more, so the results are close to,
+     * but not always identical to, pow(): within 1e-15 for SSIM terms and
+     * the usual exponents. Elements that are 0, subnormal, infinite or NaN,
+     * or whose result would leave the normal range, use pow() itself.
+     */
+    void (*pow_row)(double *v, int len, double e);
+
+    /** Returns SUM(v[x]), for x in [0,len) */
+    double (*sum_row)(const double *v, int len);
+
+    /**
+     * Returns SUM(l[x] * c[x] * s[x]), for x in [0,len). If 'prod' isn't 0,
+     * |l[x] * c[x] * s[x]| is also stored in it.
+     */
+    double (*lcs_sum_row)(const double *l, const double *c, const double *s, int len, double *prod);
+};
+
+/*
+ * Scalar 'ssim_terms_row' for pixel 'x' (also used for the vector kernels'
+ * remainders). Needs mu1, mu2, v11, v22, v12 (the statistic rows), float m1,
+ * m2, s11, s22 and double root. GUARDED adds the MS-SSIM* cases for constants
+ * of 0 (a flat window compares as equal instead of dividing by 0). They can't
+ * apply when all the constants are non-zero, so loops can leave them out.
+ */
+#define SSIM_TERMS(GUARDED) \
+    m1 = mu1[x]; \
+    m2 = mu2[x]; \
+    s11 = v11[x] < 0.0f ? 0.0f : v11[x]; \
+    s22 = v22[x] < 0.0f ? 0.0f : v22[x]; \
+    root = sqrt(s11 * s22); \
+    l[x] = (2.0 * m1 * m2 + C1) / (m1*m1 + m2*m2 + C1); \
+    c[x] = (2.0 * root + C2) / (s11 + s22 + C2); \
+    s[x] = (v12[x] + C3) / (root + C3); \
+    if (GUARDED) { \
+        if (C1 == 0 && m1*m1 == 0 && m2*m2 == 0) \
+            l[x] = 1.0; \
+        if (C2 == 0 && s11 + s22 == 0) \
+            c[x] = 1.0; \
+        if (C3 == 0 && root == 0) { \
+            if (s11 == 0 && s22 == 0) \
+                s[x] = 1.0; \
+            else if (s11 == 0 || s22 == 0) \
+                s[x] = 0.0; \
+        } \
+    }
+
+/*
+ * Constants of the 'pow_row' kernels. n*POW_LN2_HI is exact for |n| < 2^11,
+ * adding POW_ROUND rounds a double to an integer (which ends up in the low
+ * mantissa bits), and exp(y) stays in the normal range for |y| <= POW_Y_MAX.
+ */
+#define POW_LN2_HI 6.93147180369123816490e-01
+#define POW_LN2_LO 1.90821492927058770002e-10
+#define POW_LOG2E  1.44269504088896338700e+00
+#define POW_SQRT2  1.41421356237309514547e+00
+#define POW_ROUND  6755399441055744.0
+#define POW_Y_MAX  708.0
+
+/*
+ * Scalar 'pow_row' for element 'i' (also used for the vector kernels'
+ * remainders and for the lanes they leave to pow()).
+ */
+#define POW_SIGNED(i) \
+    v[i] = (v[i] < 0.0 ? -1.0 : 1.0) * pow(fabs(v[i]), e);
+
+/*
+ * Scalar 'int_moments_row' for pixel 'x' (also used for the vector kernels'
+ * remainders). Needs u, unsigned int t, pa, pb, sa, sb, saa, sbb and sab.
+ */
+#define INT_MOMENTS \
+    sa = sb = saa = sbb = sab = 0; \
+    for (u=0; u<ntaps; ++u) { \
+        t = (unsigned int)taps[u]; \
+        pa = a[x+u]; \
+        pb = b[x+u]; \
+        sa += t*pa; \
+        sb += t*pb; \
+        saa += t*pa*pa; \
+        sbb += t*pb*pb; \
+        sab += t*pa*pb; \
+    } \
+    out[x] = (int)sa; \
+    out[len+x] = (int)sb; \
+    out[2*len+x] = (int)saa; \
+    out[3*len+x] = (int)sbb; \
+    out[4*len+x] = (int)sab;
+
+/**
+ * Returns the kernel table for the selected instruction set. The selection is
+ * made on the first call.
+ */
+const struct _iqa_simd *_iqa_simd_get(void);
+
+/**
+ * Forces a specific instruction set (clamped to what the CPU supports).
+ * Intended for testing.
+ * @return The level that was actually selected.
+ */
+int _iqa_simd_set(int level);
+
+/**
+ * Returns the highest instruction set supported by the CPU.
+ */
+int _iqa_simd_detect(void);
+
+/* Alignment (bytes) of the buffers handed to the kernels. Enough for AVX-512. */
+#define IQA_ALIGN 64
+
+/* Rounds a byte count up to a multiple of IQA_ALIGN */
+#define IQA_ALIGN_SIZE(n) (((n) + (IQA_ALIGN-1)) & ~(size_t)(IQA_ALIGN-1))
+
+/**
+ * Returns the number of floats between rows of an internal 'w' wide image.
+ * Rows are padded to a multiple of IQA_ALIGN bytes, plus one more block when
+ * that would be a multiple of 4 KB, so the rows of power-of-two wide images
+ * don't all map to the same cache sets.
+ */
+int _iqa_row_stride(int w);
+
+/**
+ * Allocates 'size' bytes aligned to IQA_ALIGN.
+ * @return The buffer (release with _iqa_free_aligned()), or 0 on failure.
+ */
+void *_iqa_malloc_aligned(size_t size);
+
+/**
+ * Releases a buffer from _iqa_malloc_aligned(). 'p' may be 0.
+ */
+void _iqa_free_aligned(void *p);
+
+/* Size (bytes) from which large buffers ask to be backed by huge pages */
+#define IQA_HUGE_PAGE (2*1024*1024)
+
+/**
+ * Asks the system to back the 'size' bytes at 'p' with huge pages, when it
+ * supports them (Linux transparent huge pages) and the buffer is at least
+ * IQA_HUGE_PAGE bytes. It is only a hint; nothing changes where it isn't
+ * supported.
+ */
+void _iqa_advise_huge_pages(void *p, size_t size);
+
+/* Per instruction set tables. Only available on x86. */
+#ifdef IQA_SIMD_X86
+extern const struct _iqa_simd _iqa_simd_sse2;
+extern const struct _iqa_simd _iqa_simd_avx2;
+extern const struct _iqa_simd _iqa_simd_avx512;
+#endif
+
+#endif /*_SIMD_H_*/
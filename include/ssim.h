@@ -35,25 +35,36 @@
 #define _SSIM_H_
 
 #include "convolve.h"
+#include <stddef.h>
+
+/*
+ * 1-D Gaussian taps, g(x) = e^(-0.5*x^2/sigma^2) normalized to 1.0, with
+ * sigma=1.5.
+ */
+#define GAUSSIAN_LEN 11
+static const float g_gaussian_window_1d[GAUSSIAN_LEN] = {
+    0.00102838f, 0.00759876f, 0.03600077f, 0.10936069f, 0.21300554f, 0.26601172f, 0.21300554f, 0.10936069f, 0.03600077f, 0.00759876f, 0.00102838f
+};
 
 /*
  * Circular-symmetric Gaussian weighting.
  * h(x,y) = hg(x,y)/SUM(SUM(hg)) , for normalization to 1.0
  * hg(x,y) = e^( -0.5*( (x^2+y^2)/sigma^2 ) ) , where sigma was 1.5
+ * Each value is the product of two of the 1-D taps above (rounded to float),
+ * so the window can be applied as a horizontal and a vertical pass.
  */
-#define GAUSSIAN_LEN 11
 static const float g_gaussian_window[GAUSSIAN_LEN][GAUSSIAN_LEN] = {
-    {0.000001f, 0.000008f, 0.000037f, 0.000112f, 0.000219f, 0.000274f, 0.000219f, 0.000112f, 0.000037f, 0.000008f, 0.000001f},
-    {0.000008f, 0.000058f, 0.000274f, 0.000831f, 0.001619f, 0.002021f, 0.001619f, 0.000831f, 0.000274f, 0.000058f, 0.000008f},
-    {0.000037f, 0.000274f, 0.001296f, 0.003937f, 0.007668f, 0.009577f, 0.007668f, 0.003937f, 0.001296f, 0.000274f, 0.000037f},
-    {0.000112f, 0.000831f, 0.003937f, 0.011960f, 0.023294f, 0.029091f, 0.023294f, 0.011960f, 0.003937f, 0.000831f, 0.000112f},
-    {0.000219f, 0.001619f, 0.007668f, 0.023294f, 0.045371f, 0.056662f, 0.045371f, 0.023294f, 0.007668f, 0.001619f, 0.000219f},
-    {0.000274f, 0.002021f, 0.009577f, 0.029091f, 0.056662f, 0.070762f, 0.056662f, 0.029091f, 0.009577f, 0.002021f, 0.000274f},
-    {0.000219f, 0.001619f, 0.007668f, 0.023294f, 0.045371f, 0.056662f, 0.045371f, 0.023294f, 0.007668f, 0.001619f, 0.000219f},
-    {0.000112f, 0.000831f, 0.003937f, 0.011960f, 0.023294f, 0.029091f, 0.023294f, 0.011960f, 0.003937f, 0.000831f, 0.000112f},
-    {0.000037f, 0.000274f, 0.001296f, 0.003937f, 0.007668f, 0.009577f, 0.007668f, 0.003937f, 0.001296f, 0.000274f, 0.000037f},
-    {0.000008f, 0.000058f, 0.000274f, 0.000831f, 0.001619f, 0.002021f, 0.001619f, 0.000831f, 0.000274f, 0.000058f, 0.000008f},
-    {0.000001f, 0.000008f, 0.000037f, 0.000112f, 0.000219f, 0.000274f, 0.000219f, 0.000112f, 0.000037f, 0.000008f, 0.000001f},
+    {1.05756544e-06f, 7.81441304e-06f, 3.70224734e-05f, 1.12464346e-04f, 2.19050635e-04f, 2.73561134e-04f, 2.19050635e-04f, 1.12464346e-04f, 3.70224734e-05f, 7.81441304e-06f, 1.05756544e-06f},
+    {7.81441304e-06f, 5.77411556e-05f, 2.73561222e-04f, 8.31005629e-04f, 1.61857798e-03f, 2.02135928e-03f, 1.61857798e-03f, 8.31005629e-04f, 2.73561222e-04f, 5.77411556e-05f, 7.81441304e-06f},
+    {3.70224734e-05f, 2.73561222e-04f, 1.29605539e-03f, 3.93706886e-03f, 7.66836340e-03f, 9.57662612e-03f, 7.66836340e-03f, 3.93706886e-03f, 1.29605539e-03f, 2.73561222e-04f, 3.70224734e-05f},
+    {1.12464346e-04f, 8.31005629e-04f, 3.93706886e-03f, 1.19597595e-02f, 2.32944321e-02f, 2.90912241e-02f, 2.32944321e-02f, 1.19597595e-02f, 3.93706886e-03f, 8.31005629e-04f, 1.12464346e-04f},
+    {2.19050635e-04f, 1.61857798e-03f, 7.66836340e-03f, 2.32944321e-02f, 4.53713611e-02f, 5.66619709e-02f, 4.53713611e-02f, 2.32944321e-02f, 7.66836340e-03f, 1.61857798e-03f, 2.19050635e-04f},
+    {2.73561134e-04f, 2.02135928e-03f, 9.57662612e-03f, 2.90912241e-02f, 5.66619709e-02f, 7.07622319e-02f, 5.66619709e-02f, 2.90912241e-02f, 9.57662612e-03f, 2.02135928e-03f, 2.73561134e-04f},
+    {2.19050635e-04f, 1.61857798e-03f, 7.66836340e-03f, 2.32944321e-02f, 4.53713611e-02f, 5.66619709e-02f, 4.53713611e-02f, 2.32944321e-02f, 7.66836340e-03f, 1.61857798e-03f, 2.19050635e-04f},
+    {1.12464346e-04f, 8.31005629e-04f, 3.93706886e-03f, 1.19597595e-02f, 2.32944321e-02f, 2.90912241e-02f, 2.32944321e-02f, 1.19597595e-02f, 3.93706886e-03f, 8.31005629e-04f, 1.12464346e-04f},
+    {3.70224734e-05f, 2.73561222e-04f, 1.29605539e-03f, 3.93706886e-03f, 7.66836340e-03f, 9.57662612e-03f, 7.66836340e-03f, 3.93706886e-03f, 1.29605539e-03f, 2.73561222e-04f, 3.70224734e-05f},
+    {7.81441304e-06f, 5.77411556e-05f, 2.73561222e-04f, 8.31005629e-04f, 1.61857798e-03f, 2.02135928e-03f, 1.61857798e-03f, 8.31005629e-04f, 2.73561222e-04f, 5.77411556e-05f, 7.81441304e-06f},
+    {1.05756544e-06f, 7.81441304e-06f, 3.70224734e-05f, 1.12464346e-04f, 2.19050635e-04f, 2.73561134e-04f, 2.19050635e-04f, 1.12464346e-04f, 3.70224734e-05f, 7.81441304e-06f, 1.05756544e-06f},
 };
 
 /*
@@ -72,35 +83,95 @@ static const float g_square_window[SQUARE_LEN][SQUARE_LEN] = {
     {0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f, 0.015625f},
 };
 
-/* Holds intermediate SSIM values for map-reduce operation. */
-struct _ssim_int {
-    double l;
-    double c;
-    double s;
+/* 1-D taps of the square window (1/8), so that the outer product is 1/64 */
+static const float g_square_window_1d[SQUARE_LEN] = {
+    0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f, 0.125f
 };
 
-/* Defines the pointers to the map-reduce functions. */
-typedef int (*_map)(const struct _ssim_int *, void *);
+/*
+ * Integer taps of the windows for the fixed-point engine (iqa_ssim_int()).
+ * The Gaussian taps are 'g_gaussian_window_1d' scaled to a sum of 2^14. The
+ * square window taps are unscaled (a sum of 8).
+ */
+#define GAUSSIAN_Q_BITS 14
+static const int g_gaussian_window_1d_q[GAUSSIAN_LEN] = {
+    17, 124, 590, 1792, 3490, 4358, 3490, 1792, 590, 124, 17
+};
+static const int g_square_window_1d_q[SQUARE_LEN] = {
+    1, 1, 1, 1, 1, 1, 1, 1
+};
+
+/*
+ * Defines the pointers to the map-reduce functions. 'map' receives the
+ * luminance, contrast and structure terms of a span of 'n' pixels (one output
+ * row at a time, in order).
+ */
+typedef int (*_map)(const double *l, const double *c, const double *s, int n, void *);
 typedef float (*_reduce)(int, int, void *);
 
-/* Arguments for map-reduce. The 'context' is user-defined. */
+/*
+ * Splits and merges a map-reduce context. 'split' initializes a band context
+ * that the map function can accumulate into independently, and 'merge' adds a
+ * finished band context back into the main one.
+ */
+typedef void (*_split)(const void *context, void *band);
+typedef void (*_merge)(void *context, const void *band);
+
+/* Largest band context supported (bytes) */
+#define MR_CONTEXT_MAX 64
+
+/*
+ * Built-in pooling. These are evaluated inside the SSIM row loop (no function
+ * pointers), and their context is a struct _ssim_pool.
+ */
+#define MR_CUSTOM       0   /* Use the map-reduce functions */
+#define MR_MEAN         1   /* Mean of l*c*s (SSIM) */
+#define MR_MEAN_LCS     2   /* mean(l)^alpha * mean(c)^beta * |mean(s)|^gamma (one MS-SSIM scale) */
+#define MR_MINKOWSKI    3   /* mean(|l*c*s|^p)^(1/p) */
+
+/* Context of the built-in pooling */
+struct _ssim_pool {
+    double l, c, s;             /* Sums. MR_MEAN and MR_MINKOWSKI only use 'l'. */
+    float alpha, beta, gamma;   /* MR_MEAN_LCS exponents */
+    float p;                    /* MR_MINKOWSKI exponent */
+};
+
+/*
+ * Arguments for map-reduce. With 'pool' set to one of the built-in poolings,
+ * only 'context' is used. For MR_CUSTOM, the 'context' is user-defined. If
+ * 'split' and 'merge' are given (with 'context_size' no larger than
+ * MR_CONTEXT_MAX), the rows can be spread across threads. Otherwise the map
+ * function is called in order on a single thread.
+ */
 struct _map_reduce {
+    int pool;
     _map map;
     _reduce reduce;
     void *context;
+    _split split;
+    _merge merge;
+    size_t context_size;
 };
 
 /**
  * Private method that calculates the SSIM value on a pre-processed image.
  *
- * The input images must have stride==width. This method does not scale.
+ * The rows of the input images are packed ('w' floats apart). For views into
+ * larger or padded buffers, _iqa_ssim_strided() takes the distance between
+ * rows as its 'stride' parameter. This method does not scale.
  *
- * @note Image buffers are modified.
+ * All window statistics (both means, both variances and the covariance) are
+ * gathered in a single fused pass, one output row at a time, so no full-size
+ * temporary buffers are needed and the image buffers are not modified.
  *
  * Map-reduce is used for doing the final SSIM calculation. The map function is
- * called for every pixel, and the reduce is called at the end. The context is
+ * called for every output row, and the reduce is called at the end. The context is
  * caller-defined and *not* modified by this method.
  *
+ * The output rows are processed in fixed bands, in parallel when more than one
+ * thread is enabled (iqa_set_num_threads()). The band results are combined in
+ * band order, so the result is the same for any number of threads.
+ *
  * @param ref Original reference image
  * @param cmp Distorted image
  * @param w Width of the images
@@ -114,4 +185,121 @@ struct _map_reduce {
  */
 float _iqa_ssim(float *ref, float *cmp, int w, int h, const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args);
 
+/*
+ * Cached window statistics of a reference image, one value per output pixel
+ * ((w-kw+1)*(h-kh+1) of each).
+ */
+struct _ssim_ref_stats {
+    float *mu;          /* Local means */
+    float *sigma_sqd;   /* Local variances */
+};
+
+/**
+ * The same as _iqa_ssim(), except that the row buffers are taken from
+ * 'scratch' so nothing is allocated.
+ * @param rs Optional cached statistics of 'ref' (from _iqa_ssim_ref_stats()
+ *           with the same kernel). If given, only the cmp mean, cmp variance
+ *           and covariance are calculated. The result is identical.
+ * @param scratch At least _iqa_ssim_scratch() bytes, aligned to IQA_ALIGN.
+ *                If 0, the buffers are allocated internally.
+ */
+float _iqa_ssim_ws(float *ref, float *cmp, int w, int h, const struct _kernel *k,
+    const struct _map_reduce *mr, const struct iqa_ssim_args *args,
+    const struct _ssim_ref_stats *rs, void *scratch);
+
+/**
+ * The same as _iqa_ssim_ws() for images whose rows start 'stride' floats
+ * apart. The images are only read.
+ */
+float _iqa_ssim_strided(const float *ref, const float *cmp, int w, int h, int stride,
+    const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args,
+    const struct _ssim_ref_stats *rs, void *scratch);
+
+/**
+ * Calculates the local means and variances of 'ref' for use with
+ * _iqa_ssim_ws().
+ * @param stride The number of floats between rows of 'ref'
+ * @param rs Receives the statistics. Both buffers must be allocated by the
+ *           caller.
+ * @param scratch At least _iqa_ssim_scratch() bytes, or 0.
+ * @return 0 on success.
+ */
+int _iqa_ssim_ref_stats(const float *ref, int w, int h, int stride, const struct _kernel *k,
+    struct _ssim_ref_stats *rs, void *scratch);
+
+/**
+ * Finds the SSIM windows of a region of interest along one axis: the
+ * positions [*p0,*p1) of the 'kn' wide windows that are centred on [r0,r1)
+ * and fit inside [0,n). If none of them fits, the nearest window is used.
+ * 'n' must be at least 'kn'.
+ */
+void _iqa_roi_windows(int r0, int r1, int n, int kn, int *p0, int *p1);
+
+/**
+ * Returns the number of bytes of scratch space that _iqa_ssim_ws() needs for
+ * a 'w' x 'h' image. This is also enough for _iqa_ssim_ref_stats().
+ */
+size_t _iqa_ssim_scratch(int w, int h, const struct _kernel *k);
+
+/* Partial result of one band of output rows */
+struct _ssim_band {
+    double sum;                                 /* Default SSIM sum */
+    double context[MR_CONTEXT_MAX/sizeof(double)]; /* Map-reduce context */
+    int error;
+};
+
+/* Everything the band tasks of one SSIM calculation need */
+struct _ssim_job {
+    const float *ref, *cmp;
+    int w, stride, dst_w, dst_h;  /* 'stride' in floats */
+    const struct _kernel *k;
+    const struct _map_reduce *mr;
+    const struct iqa_ssim_args *args;
+    const struct _ssim_ref_stats *rs;
+    const struct _iqa_simd *simd;
+    float alpha, beta, gamma;
+    float C1, C2, C3;
+    double scale;
+    int box;
+    int direct;                 /* Map straight into mr->context, in order */
+    const struct iqa_ssim_maps *maps;   /* Optional output maps */
+    int components;             /* The l, c or s map is wanted */
+    struct _ssim_band *bands;
+    void *rows;                 /* Row buffers for worker 0 */
+    size_t row_size;
+};
+
+/**
+ * Sets up the same calculation as _iqa_ssim_strided() to be run one band of
+ * output rows at a time with _iqa_ssim_band(), so a caller can schedule the
+ * bands of several calculations in one _iqa_parallel_for(). The map-reduce
+ * context must be splittable (any built-in pooling is).
+ * @param bands Receives the partial result of each band
+ *              (_iqa_ssim_band_count() of them)
+ * @param rows Row buffers for worker 0: the _iqa_ssim_scratch() of an image
+ *             at least 'w' wide, minus its band results. Bands on other
+ *             workers use the pool's buffers.
+ * @return The number of bands, or 0 on error.
+ */
+int _iqa_ssim_job_init(struct _ssim_job *job, const float *ref, const float *cmp, int w, int h, int stride,
+    const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args,
+    const struct _ssim_ref_stats *rs, struct _ssim_band *bands, void *rows);
+
+/**
+ * Calculates band 'band' of a job on pool worker 'worker'. Bands can run in
+ * any order and at the same time.
+ */
+void _iqa_ssim_band(struct _ssim_job *job, int band, int worker);
+
+/**
+ * Combines the bands of a job (in band order) once they have all run.
+ * @return The pooled result, or INFINITY if error.
+ */
+float _iqa_ssim_job_result(const struct _ssim_job *job);
+
+/**
+ * Returns the number of bands of output rows of a 'h' high image.
+ */
+int _iqa_ssim_band_count(int h, const struct _kernel *k);
+
 #endif /* _SSIM_H_ */
@@ -32,36 +32,37 @@
  */
 
 #include "convolve.h"
+#include "simd.h"
 #include <stdlib.h>
 
-float KBND_SYMMETRIC(const float *img, int w, int h, int x, int y, float bnd_const)
+float KBND_SYMMETRIC(const float *img, int w, int h, int stride, int x, int y, float bnd_const)
 {
     if (x<0) x=-1-x;
     else if (x>=w) x=(w-(x-w))-1;
     if (y<0) y=-1-y;
     else if (y>=h) y=(h-(y-h))-1;
-    return img[y*w + x];
+    return img[y*stride + x];
 }
 
-float KBND_REPLICATE(const float *img, int w, int h, int x, int y, float bnd_const)
+float KBND_REPLICATE(const float *img, int w, int h, int stride, int x, int y, float bnd_const)
 {
     if (x<0) x=0;
     if (x>=w) x=w-1;
     if (y<0) y=0;
     if (y>=h) y=h-1;
-    return img[y*w + x];
+    return img[y*stride + x];
 }
 
-float KBND_CONSTANT(const float *img, int w, int h, int x, int y, float bnd_const)
+float KBND_CONSTANT(const float *img, int w, int h, int stride, int x, int y, float bnd_const)
 {
     if (x<0) x=0;
     if (y<0) y=0;
     if (x>=w || y>=h)
         return bnd_const;
-    return img[y*w + x];
+    return img[y*stride + x];
 }
 
-static float _calc_scale(const struct _kernel *k)
+float _iqa_kernel_scale(const struct _kernel *k)
 {
     int ii,k_len;
     double sum=0.0;
@@ -78,7 +79,123 @@ static float _calc_scale(const struct _kernel *k)
     }
 }
 
+int _iqa_kernel_is_uniform(const struct _kernel *k)
+{
+    int ii,k_len;
+
+    if (!k || !k->kernel)
+        return 0;
+    k_len = k->w * k->h;
+    for (ii=1; ii<k_len; ++ii) {
+        if (k->kernel[ii] != k->kernel[0])
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Applies a separable kernel as a horizontal pass followed by a vertical pass.
+ * The horizontal pass is kept for the last 'k->h' rows only, in a ring indexed
+ * by the row modulo 'k->h'. Returns non-zero if the ring couldn't be allocated.
+ */
+static int _iqa_convolve_separable(const float *img, int w, int h, int stride, const struct _kernel *k,
+    float scale, float *dst, int dst_stride)
+{
+    int x,y,u,v;
+    int dst_w = w - k->w + 1;
+    int img_offset;
+    double sum;
+    double *tmp, *row;
+
+    tmp = (double*)malloc(dst_w*k->h*sizeof(double));
+    if (!tmp)
+        return 1;
+
+    for (y=0; y < h; ++y) {
+        /* Output row y-h+1 is written after its last input row was read, and
+         * the rows below it are already in the ring, so in-place is safe */
+        img_offset = y*stride;
+        row = tmp + (y % k->h)*dst_w;
+        for (x=0; x < dst_w; ++x) {
+            sum = 0.0;
+            for (u=0; u < k->w; ++u)
+                sum += img[img_offset+x+u] * k->kernel_h[u];
+            row[x] = sum;
+        }
+        if (y < k->h - 1)
+            continue;
+
+        for (x=0; x < dst_w; ++x) {
+            sum = 0.0;
+            for (v=0; v < k->h; ++v)
+                sum += tmp[((y-k->h+1+v) % k->h)*dst_w + x] * k->kernel_v[v];
+            dst[(y-k->h+1)*dst_stride + x] = (float)(sum * scale);
+        }
+    }
+
+    free(tmp);
+    return 0;
+}
+
+/*
+ * Single precision version of the convolution using the dispatched SIMD
+ * kernels. Separable kernels are applied as two 1-D passes, through a ring of
+ * the last 'k->h' horizontally filtered rows. Returns non-zero if the scratch
+ * rows couldn't be allocated.
+ */
+static int _iqa_convolve_simd(const float *img, int w, int h, int stride, const struct _kernel *k,
+    float scale, float *dst, int dst_stride, const struct _iqa_simd *simd)
+{
+    int x,y,u,v;
+    int dst_w = w - k->w + 1;
+    int dst_h = h - k->h + 1;
+    float *tmp, *row;
+
+    if (k->kernel_h && k->kernel_v) {
+        tmp = (float*)malloc(dst_w*k->h*sizeof(float));
+        if (!tmp)
+            return 1;
+        for (y=0; y < h; ++y) {
+            simd->filter_row(img + y*stride, tmp + (y % k->h)*dst_w, dst_w, k->kernel_h, k->w);
+            if (y < k->h - 1)
+                continue;
+            row = dst + (y-k->h+1)*dst_stride;
+            for (x=0; x < dst_w; ++x)
+                row[x] = 0.0f;
+            for (v=0; v < k->h; ++v)
+                simd->accum_row(tmp + ((y-k->h+1+v) % k->h)*dst_w, 1, k->kernel_v[v] * scale, row, dst_w);
+        }
+        free(tmp);
+        return 0;
+    }
+
+    /* Each output row is accumulated one kernel value at a time. The output
+     * row is written after all its input rows were read, so in-place is safe. */
+    tmp = (float*)malloc(dst_w*sizeof(float));
+    if (!tmp)
+        return 1;
+    for (y=0; y < dst_h; ++y) {
+        for (x=0; x < dst_w; ++x)
+            tmp[x] = 0.0f;
+        for (v=0; v < k->h; ++v) {
+            for (u=0; u < k->w; ++u)
+                simd->accum_row(img + (y+v)*stride + u, 1, k->kernel[v*k->w + u] * scale, tmp, dst_w);
+        }
+        for (x=0; x < dst_w; ++x)
+            dst[y*dst_stride + x] = tmp[x];
+    }
+    free(tmp);
+    return 0;
+}
+
 void _iqa_convolve(float *img, int w, int h, const struct _kernel *k, float *result, int *rw, int *rh)
+{
+    /* In-place results are packed, as before */
+    _iqa_convolve_strided(img, w, h, w, k, result ? result : img, w - k->w + 1, rw, rh);
+}
+
+void _iqa_convolve_strided(const float *img, int w, int h, int stride, const struct _kernel *k,
+    float *dst, int dst_stride, int *rw, int *rh)
 {
     int x,y,kx,ky,u,v;
     int uc = k->w/2;
@@ -89,14 +206,26 @@ void _iqa_convolve(float *img, int w, int h, const struct _kernel *k, float *res
     int dst_h = h - k->h + 1;
     int img_offset,k_offset;
     double sum;
-    float scale, *dst=result;
-
-    if (!dst)
-        dst = img; /* Convolve in-place */
+    float scale;
+    const struct _iqa_simd *simd;
 
     /* Kernel is applied to all positions where the kernel is fully contained
      * in the image */
-    scale = _calc_scale(k);
+    scale = _iqa_kernel_scale(k);
+    simd = _iqa_simd_get();
+    if (simd->filter_row && _iqa_convolve_simd(img, w, h, stride, k, scale, dst, dst_stride, simd) == 0) {
+        if (rw) *rw = dst_w;
+        if (rh) *rh = dst_h;
+        return;
+    }
+    if (k->kernel_h && k->kernel_v &&
+        _iqa_convolve_separable(img, w, h, stride, k, scale, dst, dst_stride) == 0)
+    {
+        if (rw) *rw = dst_w;
+        if (rh) *rh = dst_h;
+        return;
+    }
+
     for (y=0; y < dst_h; ++y) {
         for (x=0; x < dst_w; ++x) {
             sum = 0.0;
@@ -104,12 +233,12 @@ void _iqa_convolve(float *img, int w, int h, const struct _kernel *k, float *res
             ky = y+vc;
             kx = x+uc;
             for (v=-vc; v <= vc-kh_even; ++v) {
-                img_offset = (ky+v)*w + kx;
+                img_offset = (ky+v)*stride + kx;
                 for (u=-uc; u <= uc-kw_even; ++u, ++k_offset) {
                     sum += img[img_offset+u] * k->kernel[k_offset];
                 }
             }
-            dst[y*dst_w + x] = (float)(sum * scale);
+            dst[y*dst_stride + x] = (float)(sum * scale);
         }
     }
 
@@ -132,12 +261,12 @@ int _iqa_img_filter(float *img, int w, int h, const struct _kernel *k, float *re
             return 2;
     }
 
-    scale = _calc_scale(k);
+    scale = _iqa_kernel_scale(k);
 
     /* Kernel is applied to all positions where top-left corner is in the image */
     for (y=0; y < h; ++y) {
         for (x=0; x < w; ++x) {
-            dst[y*w + x] = _iqa_filter_pixel(img, w, h, x, y, k, scale);
+            dst[y*w + x] = _iqa_filter_pixel(img, w, h, w, x, y, k, scale);
         }
     }
 
@@ -154,7 +283,7 @@ int _iqa_img_filter(float *img, int w, int h, const struct _kernel *k, float *re
     return 0;
 }
 
-float _iqa_filter_pixel(const float *img, int w, int h, int x, int y, const struct _kernel *k, const float kscale)
+float _iqa_filter_pixel(const float *img, int w, int h, int stride, int x, int y, const struct _kernel *k, const float kscale)
 {
     int u,v,uc,vc;
     int kw_even,kh_even;
@@ -163,7 +292,7 @@ float _iqa_filter_pixel(const float *img, int w, int h, int x, int y, const stru
     double sum;
 
     if (!k)
-        return img[y*w + x];
+        return img[y*stride + x];
 
     uc = k->w/2;
     vc = k->h/2;
@@ -181,12 +310,12 @@ float _iqa_filter_pixel(const float *img, int w, int h, int x, int y, const stru
     sum = 0.0;
     k_offset = 0;
     for (v=-vc; v <= vc-kh_even; ++v) {
-        img_offset = (y+v)*w + x;
+        img_offset = (y+v)*stride + x;
         for (u=-uc; u <= uc-kw_even; ++u, ++k_offset) {
             if (!edge)
                 sum += img[img_offset+u] * k->kernel[k_offset];
             else
-                sum += k->bnd_opt(img, w, h, x+u, y+v, k->bnd_const) * k->kernel[k_offset];
+                sum += k->bnd_opt(img, w, h, stride, x+u, y+v, k->bnd_const) * k->kernel[k_offset];
         }
     }
     return (float)(sum * kscale);
@@ -32,24 +32,349 @@
  */
 
 #include "decimate.h"
+#include "simd.h"
 #include <stdlib.h>
 
+/* _iqa_decimate_box_row */
+void _iqa_decimate_box_row(const float *const *rows, int w, int factor, const struct _kernel *k,
+    float *dst, int sw, double *col)
+{
+    int x,u,v;
+    int uc = k->w/2;
+    int kw_even = (k->w&1)?0:1;
+    int ext_w = w + 2*uc + 1; /* Columns from -uc to w+uc */
+    const float *row;
+    double *prefix;
+    double sum;
+
+    prefix = col + ext_w;
+
+    for (x=0; x<ext_w; ++x)
+        col[x] = 0.0;
+    for (v=0; v<k->h; ++v) {
+        row = rows[v];
+        for (u=-uc; u<0; ++u)
+            col[u+uc] += k->bnd_opt(row, w, 1, w, u, 0, k->bnd_const);
+        for (u=w; u<w+uc+1; ++u)
+            col[u+uc] += k->bnd_opt(row, w, 1, w, u, 0, k->bnd_const);
+        for (x=0; x<w; ++x)
+            col[x+uc] += row[x];
+    }
+
+    prefix[0] = 0.0;
+    for (x=0; x<ext_w; ++x)
+        prefix[x+1] = prefix[x] + col[x];
+
+    /* Window for output x spans columns x*factor-uc to x*factor+uc-kw_even */
+    for (x=0; x<sw; ++x) {
+        sum = prefix[x*factor + 2*uc - kw_even + 1] - prefix[x*factor];
+        dst[x] = (float)(sum * k->kernel[0]);
+    }
+}
+
+/*
+ * Box filter version of the decimation. Rows outside the image are resolved
+ * once through 'bnd_opt' into a boundary row, and each output row is then
+ * built by _iqa_decimate_box_row().
+ */
+static void _iqa_decimate_box(const float *img, int w, int h, int stride, int factor, const struct _kernel *k,
+    float *dst, int dst_stride, int sw, int sh, double *col)
+{
+    int x,y,v,r;
+    int vc = k->h/2;
+    int ext_w = w + 2*(k->w/2) + 1;
+    const float **rows;
+    float *bnd;
+
+    rows = (const float**)(col + 2*ext_w + 1);
+    bnd = (float*)(rows + k->h);
+
+    for (y=0; y<sh; ++y) {
+        for (v=0; v<k->h; ++v) {
+            r = y*factor + v - vc;
+            if (r >= 0 && r < h) {
+                rows[v] = img + r*stride;
+                continue;
+            }
+            for (x=0; x<w; ++x)
+                bnd[v*w + x] = k->bnd_opt(img, w, h, stride, x, r, k->bnd_const);
+            rows[v] = bnd + v*w;
+        }
+        _iqa_decimate_box_row(rows, w, factor, k, dst + y*dst_stride, sw, col);
+    }
+}
+
+/*
+ * Version of the decimation using the dispatched SIMD kernels. Kept samples
+ * whose kernel fits inside the image are accumulated a row at a time, one
+ * kernel value per pass, in the same order and precision as
+ * _iqa_filter_pixel(), which handles the samples near the edges.
+ *
+ * 'count' (1 or 2) images of the same size are decimated in one sweep, each
+ * kernel value applied to the rows of all of them. 'row' holds 'sw' doubles
+ * per image.
+ */
+static void _iqa_decimate_simd(const float *const *imgs, int count, int w, int h, int stride, int factor,
+    const struct _kernel *k, float *const *dsts, int dst_stride, int sw, int sh, const struct _iqa_simd *simd,
+    double *row)
+{
+    int i,x,y,u,v;
+    float wt;
+    double *r;
+    int uc = k->w/2;
+    int vc = k->h/2;
+    int kw_even = (k->w&1)?0:1;
+    int kh_even = (k->h&1)?0:1;
+    int x0, x1;
+
+    /* Interior columns: x*factor-uc >= 0 and x*factor+uc-kw_even <= w-1 */
+    x0 = (uc + factor - 1) / factor;
+    x1 = (w - 1 - uc + kw_even) / factor;
+    if (x1 >= sw)
+        x1 = sw - 1;
+
+    for (y=0; y<sh; ++y) {
+        if (x0 > x1 || y*factor-vc < 0 || y*factor+vc-kh_even > h-1) {
+            for (i=0, r=row; i<count; ++i, r+=sw) {
+                for (x=0; x<sw; ++x)
+                    r[x] = _iqa_filter_pixel(imgs[i], w, h, stride, x*factor, y*factor, k, 1.0f);
+            }
+        }
+        else {
+            for (i=0, r=row; i<count; ++i, r+=sw) {
+                for (x=0; x<x0; ++x)
+                    r[x] = _iqa_filter_pixel(imgs[i], w, h, stride, x*factor, y*factor, k, 1.0f);
+                for (x=x1+1; x<sw; ++x)
+                    r[x] = _iqa_filter_pixel(imgs[i], w, h, stride, x*factor, y*factor, k, 1.0f);
+                for (x=x0; x<=x1; ++x)
+                    r[x] = 0.0;
+            }
+            for (v=-vc; v <= vc-kh_even; ++v) {
+                for (u=-uc; u <= uc-kw_even; ++u) {
+                    wt = k->kernel[(v+vc)*k->w + u+uc];
+                    for (i=0, r=row; i<count; ++i, r+=sw)
+                        simd->accum_row_d(imgs[i] + (y*factor+v)*stride + x0*factor + u, factor,
+                            wt, r + x0, x1-x0+1);
+                }
+            }
+        }
+        /* Written after the row was read, so decimating in-place is safe */
+        for (i=0, r=row; i<count; ++i, r+=sw) {
+            for (x=0; x<sw; ++x)
+                dsts[i][y*dst_stride + x] = (float)r[x];
+        }
+    }
+}
+
+/* Padded row width of the separable decimation: columns -k->w/2 to the last
+ * one read by the right-most kept sample (or the image edge) */
+static int _separable_pad(int w, int factor, const struct _kernel *k)
+{
+    int sw = w/factor + (w&1);
+    int right = (sw-1)*factor + k->w/2 - ((k->w&1)?0:1);
+    return (right > w-1 ? right : w-1) + k->w/2 + 1;
+}
+
+/* Scratch space of one image in the separable decimation */
+static size_t _separable_scratch(int w, int factor, const struct _kernel *k)
+{
+    return IQA_ALIGN_SIZE(_separable_pad(w, factor, k)*sizeof(double) + k->h*sizeof(float*) +
+        (k->h*w + w/factor + (w&1))*sizeof(float));
+}
+
+/*
+ * Separable version of the decimation, for kernels that carry 'kernel_h' and
+ * 'kernel_v'. Each kept row is filtered vertically across the whole width
+ * into a row padded on both sides with the columns 'bnd_opt' gives outside
+ * the image. Only the kept columns of that row are then filtered
+ * horizontally, so no sample is calculated that decimation throws away. The
+ * vector levels run both passes through 'accum_row' in single precision.
+ *
+ * 'count' (1 or 2) images of the same size are decimated in one sweep: each
+ * tap is applied to the rows of all of them before moving to the next.
+ * 'buf' holds _separable_scratch() bytes per image.
+ */
+static void _iqa_decimate_separable(const float *const *imgs, int count, int w, int h, int stride,
+    int factor, const struct _kernel *k, float *const *dsts, int dst_stride, int sw, int sh,
+    const struct _iqa_simd *simd, void *buf)
+{
+    int i,x,y,u,v,r;
+    int uc = k->w/2;
+    int vc = k->h/2;
+    int pad_w = _separable_pad(w, factor, k);
+    size_t size = _separable_scratch(w, factor, k);
+    double *pad[2];
+    const float **rows[2];
+    float *bnd[2], *out[2];
+    float *padf;
+    float tap;
+    double sum;
+
+    for (i=0; i<count; ++i) {
+        pad[i] = (double*)((unsigned char*)buf + i*size);
+        rows[i] = (const float**)(pad[i] + pad_w);
+        bnd[i] = (float*)(rows[i] + k->h);
+        out[i] = bnd[i] + k->h*w;
+    }
+
+    for (y=0; y<sh; ++y) {
+        for (v=0; v<k->h; ++v) {
+            r = y*factor + v - vc;
+            for (i=0; i<count; ++i) {
+                if (r >= 0 && r < h) {
+                    rows[i][v] = imgs[i] + r*stride;
+                    continue;
+                }
+                for (x=0; x<w; ++x)
+                    bnd[i][v*w + x] = k->bnd_opt(imgs[i], w, h, stride, x, r, k->bnd_const);
+                rows[i][v] = bnd[i] + v*w;
+            }
+        }
+
+        if (simd->accum_row) {
+            for (i=0; i<count; ++i) {
+                padf = (float*)pad[i];
+                for (x=0; x<pad_w; ++x)
+                    padf[x] = 0.0f;
+                for (x=0; x<sw; ++x)
+                    out[i][x] = 0.0f;
+            }
+            for (v=0; v<k->h; ++v) {
+                tap = k->kernel_v[v];
+                for (i=0; i<count; ++i) {
+                    padf = (float*)pad[i];
+                    simd->accum_row(rows[i][v], 1, tap, padf + uc, w);
+                    for (u=-uc; u<0; ++u)
+                        padf[u+uc] += tap * k->bnd_opt(rows[i][v], w, 1, w, u, 0, k->bnd_const);
+                    for (u=w; u<pad_w-uc; ++u)
+                        padf[u+uc] += tap * k->bnd_opt(rows[i][v], w, 1, w, u, 0, k->bnd_const);
+                }
+            }
+            for (u=0; u<k->w; ++u) {
+                for (i=0; i<count; ++i)
+                    simd->accum_row((float*)pad[i] + u, factor, k->kernel_h[u], out[i], sw);
+            }
+        }
+        else {
+            for (i=0; i<count; ++i) {
+                for (x=0; x<pad_w; ++x)
+                    pad[i][x] = 0.0;
+            }
+            for (v=0; v<k->h; ++v) {
+                tap = k->kernel_v[v];
+                for (i=0; i<count; ++i) {
+                    for (u=-uc; u<0; ++u)
+                        pad[i][u+uc] += tap * k->bnd_opt(rows[i][v], w, 1, w, u, 0, k->bnd_const);
+                    for (x=0; x<w; ++x)
+                        pad[i][x+uc] += tap * rows[i][v][x];
+                    for (u=w; u<pad_w-uc; ++u)
+                        pad[i][u+uc] += tap * k->bnd_opt(rows[i][v], w, 1, w, u, 0, k->bnd_const);
+                }
+            }
+            for (i=0; i<count; ++i) {
+                for (x=0; x<sw; ++x) {
+                    sum = 0.0;
+                    for (u=0; u<k->w; ++u)
+                        sum += pad[i][x*factor + u] * k->kernel_h[u];
+                    out[i][x] = (float)sum;
+                }
+            }
+        }
+        /* Written after the row was read, so decimating in-place is safe */
+        for (i=0; i<count; ++i) {
+            for (x=0; x<sw; ++x)
+                dsts[i][y*dst_stride + x] = out[i][x];
+        }
+    }
+}
+
+/* Scratch space used by each of the decimation paths */
+static size_t _box_scratch(int w, const struct _kernel *k)
+{
+    return (2*(w + 2*(k->w/2) + 1) + 1)*sizeof(double) + k->h*(sizeof(float*) + w*sizeof(float));
+}
+static size_t _simd_scratch(int w, int factor)
+{
+    return (w/factor + (w&1))*sizeof(double);
+}
+
+size_t _iqa_decimate_scratch(int w, int factor, const struct _kernel *k)
+{
+    size_t box, simd, separable;
+    if (!k || !k->bnd_opt)
+        return 0;
+    box = _box_scratch(w, k);
+    simd = _simd_scratch(w, factor);
+    separable = k->kernel_h && k->kernel_v ? _separable_scratch(w, factor, k) : 0;
+    if (separable > simd)
+        simd = separable;
+    return box > simd ? box : simd;
+}
+
 int _iqa_decimate(float *img, int w, int h, int factor, const struct _kernel *k, float *result, int *rw, int *rh)
+{
+    return _iqa_decimate_ws(img, w, h, factor, k, result, rw, rh, 0);
+}
+
+int _iqa_decimate_ws(float *img, int w, int h, int factor, const struct _kernel *k, float *result,
+    int *rw, int *rh, void *scratch)
+{
+    int sw = w/factor + (w&1);
+
+    /* The result is packed */
+    return _iqa_decimate_strided(img, w, h, w, factor, k, result ? result : img, sw, rw, rh, scratch);
+}
+
+int _iqa_decimate_strided(const float *img, int w, int h, int stride, int factor, const struct _kernel *k,
+    float *result, int dst_stride, int *rw, int *rh, void *scratch)
 {
     int x,y;
     int sw = w/factor + (w&1);
     int sh = h/factor + (h&1);
     int dst_offset;
-    float *dst=img;
+    float *dst=result;
+    void *buf=scratch;
+    const struct _iqa_simd *simd;
+
+    if (k && k->bnd_opt && _iqa_kernel_is_uniform(k)) {
+        if (!scratch && !(buf = malloc(_box_scratch(w, k))))
+            return 1;
+        _iqa_decimate_box(img, w, h, stride, factor, k, dst, dst_stride, sw, sh, (double*)buf);
+        if (!scratch)
+            free(buf);
+        if (rw) *rw = sw;
+        if (rh) *rh = sh;
+        return 0;
+    }
+
+    simd = _iqa_simd_get();
+    if (k && k->bnd_opt && k->kernel_h && k->kernel_v) {
+        if (!scratch && !(buf = malloc(_separable_scratch(w, factor, k))))
+            return 1;
+        _iqa_decimate_separable(&img, 1, w, h, stride, factor, k, &dst, dst_stride, sw, sh, simd, buf);
+        if (!scratch)
+            free(buf);
+        if (rw) *rw = sw;
+        if (rh) *rh = sh;
+        return 0;
+    }
 
-    if (result)
-        dst = result;
+    if (k && k->bnd_opt && simd->accum_row_d) {
+        if (!scratch && !(buf = malloc(_simd_scratch(w, factor))))
+            return 1;
+        _iqa_decimate_simd(&img, 1, w, h, stride, factor, k, &dst, dst_stride, sw, sh, simd, (double*)buf);
+        if (!scratch)
+            free(buf);
+        if (rw) *rw = sw;
+        if (rh) *rh = sh;
+        return 0;
+    }
 
     /* Downsample */
     for (y=0; y<sh; ++y) {
-        dst_offset = y*sw;
+        dst_offset = y*dst_stride;
         for (x=0; x<sw; ++x,++dst_offset) {
-            dst[dst_offset] = _iqa_filter_pixel(img, w, h, x*factor, y*factor, k, 1.0f);
+            dst[dst_offset] = _iqa_filter_pixel(img, w, h, stride, x*factor, y*factor, k, 1.0f);
         }
     }
     
@@ -57,3 +382,61 @@ int _iqa_decimate(float *img, int w, int h, int factor, const struct _kernel *k,
     if (rh) *rh = sh;
     return 0;
 }
+
+/* Whether the kernel is separable, for the fused paths of two images */
+static int _pair_separable(const struct _kernel *k)
+{
+    return k && k->bnd_opt && k->kernel_h && k->kernel_v && !_iqa_kernel_is_uniform(k);
+}
+
+/* Whether the 2-D SIMD path decimates the pair */
+static int _pair_simd(const struct _kernel *k)
+{
+    return k && k->bnd_opt && !_iqa_kernel_is_uniform(k) && !_pair_separable(k) &&
+        _iqa_simd_get()->accum_row_d;
+}
+
+size_t _iqa_decimate_pair_scratch(int w, int factor, const struct _kernel *k)
+{
+    size_t simd = 2*_simd_scratch(w, factor);
+    size_t other = _iqa_decimate_scratch(w, factor, k);
+    if (_pair_separable(k))
+        return 2*_separable_scratch(w, factor, k);
+    /* The SIMD level may change before the pair is decimated */
+    if (k && k->bnd_opt && !_iqa_kernel_is_uniform(k))
+        return simd > other ? simd : other;
+    return other;
+}
+
+int _iqa_decimate_pair(const float *img0, const float *img1, int w, int h, int stride, int factor,
+    const struct _kernel *k, float *result0, float *result1, int dst_stride, int *rw, int *rh, void *scratch)
+{
+    int sw = w/factor + (w&1);
+    int sh = h/factor + (h&1);
+    const float *imgs[2];
+    float *dsts[2];
+    void *buf = scratch;
+    const struct _iqa_simd *simd = _iqa_simd_get();
+    int separable = _pair_separable(k);
+
+    if (!separable && !_pair_simd(k)) {
+        return _iqa_decimate_strided(img0, w, h, stride, factor, k, result0, dst_stride, rw, rh, scratch) ||
+            _iqa_decimate_strided(img1, w, h, stride, factor, k, result1, dst_stride, rw, rh, scratch);
+    }
+
+    if (!scratch && !(buf = malloc(separable ? 2*_separable_scratch(w, factor, k) : 2*_simd_scratch(w, factor))))
+        return 1;
+    imgs[0] = img0;
+    imgs[1] = img1;
+    dsts[0] = result0;
+    dsts[1] = result1;
+    if (separable)
+        _iqa_decimate_separable(imgs, 2, w, h, stride, factor, k, dsts, dst_stride, sw, sh, simd, buf);
+    else
+        _iqa_decimate_simd(imgs, 2, w, h, stride, factor, k, dsts, dst_stride, sw, sh, simd, (double*)buf);
+    if (!scratch)
+        free(buf);
+    if (rw) *rw = sw;
+    if (rh) *rh = sh;
+    return 0;
+}
@@ -31,6 +31,7 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "iqa.h"
 #include "math_utils.h"
 #include <math.h>
 
@@ -80,3 +81,25 @@ int _matrix_cmp(const float *a, const float *b, int w, int h, int digits)
     return result;
 }
 
+int _iqa_depth(int depth, int *bits, int *shift)
+{
+    int b = depth & ~IQA_MSB_ALIGNED;
+    if (b < 1 || b > 16)
+        return 1;
+    *bits = b;
+    *shift = (depth & IQA_MSB_ALIGNED) ? 16 - b : 0;
+    return 0;
+}
+
+int _iqa_rects_valid(const struct iqa_rect *rects, int count, int w, int h)
+{
+    int i;
+    if (!rects || count < 1)
+        return 1;
+    for (i=0; i<count; ++i) {
+        if (rects[i].w < 1 || rects[i].h < 1 || rects[i].x < 0 || rects[i].y < 0 ||
+            rects[i].x > w - rects[i].w || rects[i].y > h - rects[i].h)
+            return 1;
+    }
+    return 0;
+}
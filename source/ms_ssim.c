@@ -34,6 +34,9 @@
 #include "iqa.h"
 #include "ssim.h"
 #include "decimate.h"
+#include "simd.h"
+#include "math_utils.h"
+#include "parallel.h"
 #include <math.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,18 +44,29 @@
 /* Default number of scales */
 #define SCALES  5
 
+/* _ms_ssim_init() depth for float images that are read in place */
+#define DEPTH_F32   (-1)
+
+/* Rows of the full size images converted by one task */
+#define CONVERT_ROWS 64
+
 /* Low-pass filter for down-sampling (9/7 biorthogonal wavelet filter) */
 #define LPF_LEN 9
+static const float g_lpf_1d[LPF_LEN] = {
+    0.026727f, -0.016828f, -0.078202f, 0.266847f, 0.602914f, 0.266847f, -0.078202f, -0.016828f, 0.026727f
+};
+/* Its 2-D form. Each value is the product of two of the 1-D taps (rounded to
+ * float), so decimation can run the filter as two passes. */
 static const float g_lpf[LPF_LEN][LPF_LEN] = {
-   { 0.000714f,-0.000450f,-0.002090f, 0.007132f, 0.016114f, 0.007132f,-0.002090f,-0.000450f, 0.000714f},
-   {-0.000450f, 0.000283f, 0.001316f,-0.004490f,-0.010146f,-0.004490f, 0.001316f, 0.000283f,-0.000450f},
-   {-0.002090f, 0.001316f, 0.006115f,-0.020867f,-0.047149f,-0.020867f, 0.006115f, 0.001316f,-0.002090f},
-   { 0.007132f,-0.004490f,-0.020867f, 0.071207f, 0.160885f, 0.071207f,-0.020867f,-0.004490f, 0.007132f},
-   { 0.016114f,-0.010146f,-0.047149f, 0.160885f, 0.363505f, 0.160885f,-0.047149f,-0.010146f, 0.016114f},
-   { 0.007132f,-0.004490f,-0.020867f, 0.071207f, 0.160885f, 0.071207f,-0.020867f,-0.004490f, 0.007132f},
-   {-0.002090f, 0.001316f, 0.006115f,-0.020867f,-0.047149f,-0.020867f, 0.006115f, 0.001316f,-0.002090f},
-   {-0.000450f, 0.000283f, 0.001316f,-0.004490f,-0.010146f,-0.004490f, 0.001316f, 0.000283f,-0.000450f},
-   { 0.000714f,-0.000450f,-0.002090f, 0.007132f, 0.016114f, 0.007132f,-0.002090f,-0.000450f, 0.000714f},
+    { 7.14332564e-04f,-4.49761981e-04f,-2.09010486e-03f, 7.13202031e-03f, 1.61140822e-02f, 7.13202031e-03f,-2.09010486e-03f,-4.49761981e-04f, 7.14332564e-04f},
+    {-4.49761981e-04f, 2.83181609e-04f, 1.31598336e-03f,-4.49050171e-03f,-1.01458365e-02f,-4.49050171e-03f, 1.31598336e-03f, 2.83181609e-04f,-4.49761981e-04f},
+    {-2.09010486e-03f, 1.31598336e-03f, 6.11555297e-03f,-2.08679698e-02f,-4.71490808e-02f,-2.08679698e-02f, 6.11555297e-03f, 1.31598336e-03f,-2.09010486e-03f},
+    { 7.13202031e-03f,-4.49050171e-03f,-2.08679698e-02f, 7.12073296e-02f, 1.60885796e-01f, 7.12073296e-02f,-2.08679698e-02f,-4.49050171e-03f, 7.13202031e-03f},
+    { 1.61140822e-02f,-1.01458365e-02f,-4.71490808e-02f, 1.60885796e-01f, 3.63505274e-01f, 1.60885796e-01f,-4.71490808e-02f,-1.01458365e-02f, 1.61140822e-02f},
+    { 7.13202031e-03f,-4.49050171e-03f,-2.08679698e-02f, 7.12073296e-02f, 1.60885796e-01f, 7.12073296e-02f,-2.08679698e-02f,-4.49050171e-03f, 7.13202031e-03f},
+    {-2.09010486e-03f, 1.31598336e-03f, 6.11555297e-03f,-2.08679698e-02f,-4.71490808e-02f,-2.08679698e-02f, 6.11555297e-03f, 1.31598336e-03f,-2.09010486e-03f},
+    {-4.49761981e-04f, 2.83181609e-04f, 1.31598336e-03f,-4.49050171e-03f,-1.01458365e-02f,-4.49050171e-03f, 1.31598336e-03f, 2.83181609e-04f,-4.49761981e-04f},
+    { 7.14332564e-04f,-4.49761981e-04f,-2.09010486e-03f, 7.13202031e-03f, 1.61140822e-02f, 7.13202031e-03f,-2.09010486e-03f,-4.49761981e-04f, 7.14332564e-04f},
 };
 
 /* Alpha, beta, and gamma values for each scale */
@@ -60,92 +74,121 @@ static float g_alphas[] = { 0.0000f, 0.0000f, 0.0000f, 0.0000f, 0.1333f };
 static float g_betas[]  = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
 static float g_gammas[] = { 0.0448f, 0.2856f, 0.3001f, 0.2363f, 0.1333f };
 
+/* One scale of the MS-SSIM task graph (see _ms_ssim_run()) */
+struct _ms_scale {
+    struct _ssim_job job;
+    struct _map_reduce mr;
+    struct _ssim_pool pool;
+    int first;                          /* Task of its first band, after the conversions */
+    int bands;
+    int done;                           /* Progress: bands finished */
+};
 
-struct _context {
-    double l;  /* Luminance */
-    double c;  /* Contrast */
-    double s;  /* Structure */
-    float alpha;
-    float beta;
-    float gamma;
+/*
+ * Settings and buffers for MS-SSIM on images of one size. The pyramids, the
+ * scratch space and the task graph share one aligned block, with the scales
+ * one after the other and the ref and cmp rows of each interleaved (see
+ * _ms_pair_stride()).
+ */
+struct _ms_ssim {
+    int w, h, stride;
+    int wide, bits, shift;              /* 16-bit samples, their bit depth and shift (see _iqa_depth()) */
+    int wang;
+    int scales;
+    float *alphas, *betas, *gammas;     /* Copies of the caller's exponents */
+    struct _kernel lpf, window;
+    float **ref_imgs, **cmp_imgs;       /* Array of pointers to scaled images */
+    const float *ref0, *cmp0;           /* The full size images */
+    int stride0;                        /* Floats between rows of the full size images */
+    int recycle;                        /* Scales from the third reuse the storage of the one two above */
+    void *scratch;                      /* SSIM band results and rows of the first scale */
+    void *lp_scratch;                   /* Downsampling buffers of both pyramids */
+    struct _ms_scale *levels;           /* Task graph, one per scale */
+    struct _ssim_band *bands;           /* Band results of every scale */
+    void *block;
 };
 
-/* Called for each pixel */
-int _ms_ssim_map(const struct _ssim_int *si, void *ctx)
+/*
+ * Floats between rows of a scale 'w' wide. The ref and cmp images of a scale
+ * are interleaved a row at a time, cmp starting _iqa_row_stride(w) floats
+ * after ref, so the windows of both images are read from one stream. Like
+ * _iqa_row_stride(), the pair avoids being a multiple of 4 KB.
+ */
+static int _ms_pair_stride(int w)
 {
-    struct _context *ms_ctx = (struct _context*)ctx;
-    ms_ctx->l += si->l;
-    ms_ctx->c += si->c;
-    ms_ctx->s += si->s;
-    return 0;
+    int stride = 2*_iqa_row_stride(w);
+    if ((stride*sizeof(float) & 4095) == 0)
+        stride += IQA_ALIGN/sizeof(float);
+    return stride;
 }
 
-/* Called to calculate the final result */
-float _ms_ssim_reduce(int w, int h, void *ctx)
+/* Whether scale 'idx' reuses the storage of scale idx-2 (see _ms_ssim_init()) */
+static int _ms_recycled(const struct _ms_ssim *ms, int idx, int depth)
 {
-    double size = (double)(w*h);
-    struct _context *ms_ctx = (struct _context*)ctx;
-    ms_ctx->l = pow(ms_ctx->l / size, (double)ms_ctx->alpha);
-    ms_ctx->c = pow(ms_ctx->c / size, (double)ms_ctx->beta);
-    ms_ctx->s = pow(fabs(ms_ctx->s / size), (double)ms_ctx->gamma);
-    return (float)(ms_ctx->l * ms_ctx->c * ms_ctx->s);
+    return ms->recycle && idx >= 2 && (idx > 2 || depth != DEPTH_F32);
 }
 
-/* Releases the scaled buffers */
-void _free_buffers(float **buf, int scales)
+/* Releases the buffers of an MS-SSIM state */
+static void _ms_ssim_free(struct _ms_ssim *ms)
 {
-    int idx;
-    for (idx=0; idx<scales; ++idx)
-        free(buf[idx]);
+    _iqa_free_aligned(ms->block);
+    free(ms->alphas);
+    free(ms->ref_imgs);
 }
 
-/* Allocates the scaled buffers. If error, all buffers are free'd */
-int _alloc_buffers(float **buf, int w, int h, int scales)
+/*
+ * Whether 'scales' scales of a 'w' x 'h' image are all at least as large as
+ * the window (and the low-pass filter). Returns 0 if they are.
+ */
+static int _ms_ssim_fits(int w, int h, int scales, int gauss)
 {
     int idx;
-    int cur_w = w;
-    int cur_h = h;
+    int len = gauss ? GAUSSIAN_LEN : LPF_LEN;
+
+    if (scales < 1)
+        return 1;
     for (idx=0; idx<scales; ++idx) {
-        buf[idx] = (float*)malloc(cur_w*cur_h*sizeof(float));
-        if (!buf[idx]) {
-            _free_buffers(buf, idx);
+        if (w < len || h < len)
             return 1;
-        }
-        cur_w = cur_w/2 + (cur_w&1);
-        cur_h = cur_h/2 + (cur_h&1);
+        w /= 2;
+        h /= 2;
     }
     return 0;
 }
 
 /*
- * MS_SSIM(X,Y) = Lm(x,y)^aM * MULT[j=1->M]( Cj(x,y)^bj  *  Sj(x,y)^gj )
- * where,
- *  L = mean
- *  C = variance
- *  S = cross-correlation
- *
- *  b1=g1=0.0448, b2=g2=0.2856, b3=g3=0.3001, b4=g4=0.2363, a5=b5=g5=0.1333
+ * Validates the arguments and allocates the pyramids for 'w' x 'h' images
+ * with 8-bit samples (depth 0) or 16-bit samples in the format 'depth' (see
+ * IQA_MSB_ALIGNED). With DEPTH_F32, the full size images are the caller's and
+ * only the smaller scales are allocated. With 'recycle', a scale is built
+ * into the storage of the scale two above it (when that storage isn't the
+ * caller's), so only two scales of each pyramid are allocated. Such pyramids
+ * can only be built and scored by _ms_ssim_run(). Returns 0 on success.
  */
-float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, 
-    int stride, const struct iqa_ms_ssim_args *args)
+static int _ms_ssim_init(struct _ms_ssim *ms, int w, int h, int stride, int depth, int recycle,
+    const struct iqa_ms_ssim_args *args)
 {
-    int wang=0;
-    int scales=SCALES;
     int gauss=1;
     const float *alphas=g_alphas, *betas=g_betas, *gammas=g_gammas;
-    int idx,x,y,cur_w,cur_h;
-    int offset,src_offset;
-    float **ref_imgs, **cmp_imgs; /* Array of pointers to scaled images */
-    float msssim;
-    struct _kernel lpf, window;
-    struct iqa_ssim_args s_args;
-    struct _map_reduce mr;
-    struct _context ms_ctx;
+    int idx,cur_w,cur_h,bands;
+    size_t size, scratch, dec, levels;
+    unsigned char *mem;
 
+    memset(ms, 0, sizeof(struct _ms_ssim));
+    ms->w = w;
+    ms->h = h;
+    ms->stride = stride;
+    ms->bits = 8;
+    ms->scales = SCALES;
+    ms->wide = depth > 0;
+    ms->stride0 = _ms_pair_stride(w);
+    ms->recycle = recycle;
+    if (ms->wide && _iqa_depth(depth, &ms->bits, &ms->shift))
+        return 1;
     if (args) {
-        wang   = args->wang;
-        gauss  = args->gaussian;
-        scales = args->scales;
+        ms->wang   = args->wang;
+        gauss      = args->gaussian;
+        ms->scales = args->scales;
         if (args->alphas)
             alphas = args->alphas;
         if (args->betas)
@@ -153,114 +196,381 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
         if (args->gammas)
             gammas = args->gammas;
     }
-
     /* Make sure we won't scale below 1x1 */
+    if (_ms_ssim_fits(w, h, ms->scales, gauss))
+        return 1;
+
+    ms->window.kernel = (float*)g_square_window;
+    ms->window.w = ms->window.h = SQUARE_LEN;
+    ms->window.normalized = 1;
+    ms->window.bnd_opt = KBND_SYMMETRIC;
+    ms->window.kernel_h = (float*)g_square_window_1d;
+    ms->window.kernel_v = (float*)g_square_window_1d;
+    if (gauss) {
+        ms->window.kernel = (float*)g_gaussian_window;
+        ms->window.w = ms->window.h = GAUSSIAN_LEN;
+        ms->window.kernel_h = (float*)g_gaussian_window_1d;
+        ms->window.kernel_v = (float*)g_gaussian_window_1d;
+    }
+
+    ms->lpf.kernel = (float*)g_lpf;
+    ms->lpf.w = ms->lpf.h = LPF_LEN;
+    ms->lpf.normalized = 1;
+    ms->lpf.bnd_opt = KBND_SYMMETRIC;
+    ms->lpf.kernel_h = (float*)g_lpf_1d;
+    ms->lpf.kernel_v = (float*)g_lpf_1d;
+
+    /* Exponents, and the pointers to the scaled images */
+    ms->alphas = (float*)malloc(3*ms->scales*sizeof(float));
+    ms->ref_imgs = (float**)malloc(2*ms->scales*sizeof(float*));
+    if (!ms->alphas || !ms->ref_imgs) {
+        _ms_ssim_free(ms);
+        return 1;
+    }
+    ms->betas = ms->alphas + ms->scales;
+    ms->gammas = ms->betas + ms->scales;
+    ms->cmp_imgs = ms->ref_imgs + ms->scales;
+    memcpy(ms->alphas, alphas, ms->scales*sizeof(float));
+    memcpy(ms->betas, betas, ms->scales*sizeof(float));
+    memcpy(ms->gammas, gammas, ms->scales*sizeof(float));
+
+    /* Pyramid sizes. The first level is the largest, so it sets the scratch. */
+    size = 0;
+    bands = 0;
     cur_w = w;
     cur_h = h;
-    for (idx=0; idx<scales; ++idx) {
-        if ( gauss ? cur_w<GAUSSIAN_LEN || cur_h<GAUSSIAN_LEN : cur_w<LPF_LEN || cur_h<LPF_LEN )
-            return INFINITY;
-        cur_w /= 2;
-        cur_h /= 2;
+    for (idx=0; idx<ms->scales; ++idx) {
+        if (_ms_recycled(ms, idx, depth))
+            ;
+        else if (idx || depth != DEPTH_F32)
+            size += IQA_ALIGN_SIZE(_ms_pair_stride(cur_w)*cur_h*sizeof(float));
+        bands += _iqa_ssim_band_count(cur_h, &ms->window);
+        cur_w = cur_w/2 + (cur_w&1);
+        cur_h = cur_h/2 + (cur_h&1);
     }
+    scratch = IQA_ALIGN_SIZE(_iqa_ssim_scratch(w, h, &ms->window));
+    dec = IQA_ALIGN_SIZE(_iqa_decimate_pair_scratch(w, 2, &ms->lpf));
+    levels = IQA_ALIGN_SIZE(ms->scales*sizeof(struct _ms_scale));
 
-    window.kernel = (float*)g_square_window;
-    window.w = window.h = SQUARE_LEN;
-    window.normalized = 1;
-    window.bnd_opt = KBND_SYMMETRIC;
-    if (gauss) {
-        window.kernel = (float*)g_gaussian_window;
-        window.w = window.h = GAUSSIAN_LEN;
+    size += scratch + dec + levels + bands*sizeof(struct _ssim_band);
+    ms->block = _iqa_malloc_aligned(size);
+    if (!ms->block) {
+        _ms_ssim_free(ms);
+        return 1;
+    }
+    _iqa_advise_huge_pages(ms->block, size);
+    mem = (unsigned char*)ms->block;
+    cur_w = w;
+    cur_h = h;
+    for (idx=0; idx<ms->scales; ++idx) {
+        size = IQA_ALIGN_SIZE(_ms_pair_stride(cur_w)*cur_h*sizeof(float));
+        if (_ms_recycled(ms, idx, depth)) {
+            ms->ref_imgs[idx] = ms->ref_imgs[idx-2];
+            ms->cmp_imgs[idx] = ms->ref_imgs[idx] + _iqa_row_stride(cur_w);
+        }
+        else if (idx || depth != DEPTH_F32) {
+            ms->ref_imgs[idx] = (float*)mem;
+            ms->cmp_imgs[idx] = (float*)mem + _iqa_row_stride(cur_w);
+            mem += size;
+        }
+        else
+            ms->ref_imgs[idx] = ms->cmp_imgs[idx] = 0;
+        cur_w = cur_w/2 + (cur_w&1);
+        cur_h = cur_h/2 + (cur_h&1);
+    }
+    ms->ref0 = ms->ref_imgs[0];
+    ms->cmp0 = ms->cmp_imgs[0];
+    ms->scratch = mem;
+    ms->lp_scratch = mem + scratch;
+    ms->levels = (struct _ms_scale*)(mem + scratch + dec);
+    ms->bands = (struct _ssim_band*)(mem + scratch + dec + levels);
+    return 0;
+}
+
+/*
+ * Builds scale 'idx' (1 onwards) of the pyramids from scale idx-1. 'build' has
+ * bit 0 set to build the ref pyramid and bit 1 for cmp. When both are built,
+ * the two are decimated in one sweep. The rows of the scaled versions are
+ * padded and interleaved (see _ms_pair_stride()).
+ */
+static int _ms_ssim_level(struct _ms_ssim *ms, int idx, int build)
+{
+    int i,cur_w,cur_h,stride,dst_stride;
+    const float *src[2];
+
+    cur_w = ms->w;
+    cur_h = ms->h;
+    for (i=1; i<idx; ++i) {
+        cur_w = cur_w/2 + (cur_w&1);
+        cur_h = cur_h/2 + (cur_h&1);
+    }
+    src[0] = idx==1 ? ms->ref0 : ms->ref_imgs[idx-1];
+    src[1] = idx==1 ? ms->cmp0 : ms->cmp_imgs[idx-1];
+    stride = idx==1 ? ms->stride0 : _ms_pair_stride(cur_w);
+    dst_stride = _ms_pair_stride(cur_w/2 + (cur_w&1));
+    if (build == 3) {
+        return _iqa_decimate_pair(src[0], src[1], cur_w, cur_h, stride, 2, &ms->lpf,
+            ms->ref_imgs[idx], ms->cmp_imgs[idx], dst_stride, 0, 0, ms->lp_scratch);
     }
+    i = build & 1 ? 0 : 1;
+    return _iqa_decimate_strided(src[i], cur_w, cur_h, stride, 2, &ms->lpf,
+        i ? ms->cmp_imgs[idx] : ms->ref_imgs[idx], dst_stride, 0, 0, ms->lp_scratch);
+}
 
-    mr.map     = _ms_ssim_map;
-    mr.reduce  = _ms_ssim_reduce;
+/* Converts rows [y0,y1) of an image into the full size image 'dst', with padded rows */
+static void _ms_ssim_convert(const struct _ms_ssim *ms, const void *src, float *dst, int y0, int y1)
+{
+    int y;
+    const unsigned char *row;
+    const struct _iqa_simd *simd = _iqa_simd_get();
 
-    /* Allocate the scaled image buffers */
-    ref_imgs = (float**)malloc(scales*sizeof(float*));
-    cmp_imgs = (float**)malloc(scales*sizeof(float*));
-    if (!ref_imgs || !cmp_imgs) {
-        if (ref_imgs) free(ref_imgs);
-        if (cmp_imgs) free(cmp_imgs);
-        return INFINITY;
+    for (y=y0; y<y1; ++y) {
+        row = (const unsigned char*)src + y*ms->stride;
+        if (!ms->wide)
+            simd->u8_to_float(row, dst + y*ms->stride0, ms->w);
+        else
+            simd->u16_to_float((const unsigned short*)row, dst + y*ms->stride0, ms->w, ms->shift);
     }
-    if (_alloc_buffers(ref_imgs, w, h, scales)) {
-        free(ref_imgs);
-        free(cmp_imgs);
-        return INFINITY;
+}
+
+/*
+ * Converts the ref and (if given) the cmp image into their full size images
+ * and builds the scaled versions
+ */
+static int _ms_ssim_load(struct _ms_ssim *ms, const void *ref, const void *cmp)
+{
+    int idx;
+
+    _ms_ssim_convert(ms, ref, ms->ref_imgs[0], 0, ms->h);
+    if (cmp)
+        _ms_ssim_convert(ms, cmp, ms->cmp_imgs[0], 0, ms->h);
+    for (idx=1; idx<ms->scales; ++idx) {
+        if (_ms_ssim_level(ms, idx, cmp ? 3 : 1))
+            return 1;
     }
-    if (_alloc_buffers(cmp_imgs, w, h, scales)) {
-        _free_buffers(ref_imgs, scales);
-        free(ref_imgs);
-        free(cmp_imgs);
-        return INFINITY;
+    return 0;
+}
+
+/* The SSIM arguments of every scale */
+static void _ms_ssim_args(const struct _ms_ssim *ms, struct iqa_ssim_args *s_args)
+{
+    s_args->alpha = 1.0f;
+    s_args->beta  = 1.0f;
+    s_args->gamma = 1.0f;
+    s_args->L  = (1 << ms->bits) - 1;
+    s_args->f  = 1; /* Don't resize */
+    if (!ms->wang) {
+        /* MS-SSIM* (Rouse/Hemami) */
+        s_args->K1 = 0.0f; /* Force stabilization constants to 0 */
+        s_args->K2 = 0.0f;
+    }
+    else {
+        /* MS-SSIM (Wang) */
+        s_args->K1 = 0.01f;
+        s_args->K2 = 0.03f;
     }
+}
+
+/*
+ * The tasks of _ms_ssim_run(), in this order:
+ *  1. 'converts' tasks that convert bands of rows of the caller's images
+ *  2. The task that builds scale 1, if the pyramids are built
+ *  3. For each scale, its SSIM bands (waiting for the scale they read), then
+ *     the task that builds the scale after next. Scales are built one after
+ *     the other. A scale that reuses the storage of the one two above it
+ *     also waits for that scale's bands to finish.
+ * Tasks only wait for lower-numbered ones (see _iqa_parallel_wait()).
+ */
+struct _ms_graph {
+    struct _ms_ssim *ms;
+    const void *src[2];         /* Caller's ref and cmp images to convert, or 0 */
+    int converts;               /* Number of conversion tasks */
+    int build;                  /* Pyramids to build (see _ms_ssim_level()) */
+    int pyramids;               /* 1 if there are scales to build, 0 otherwise */
+    int converted;              /* Progress: conversion tasks done */
+    int built;                  /* Progress: scales built after the first */
+    int error;
+};
+
+/* Task that builds scale 'idx' of an MS-SSIM graph */
+static void _ms_build(struct _ms_graph *g, int idx)
+{
+    struct _ms_ssim *ms = g->ms;
+
+    if (idx == 1)
+        _iqa_parallel_wait(&g->converted, g->converts);
+    else
+        _iqa_parallel_wait(&g->built, idx-1);
+    if (idx >= 2 && ms->ref_imgs[idx] == ms->ref_imgs[idx-2])
+        _iqa_parallel_wait(&ms->levels[idx-2].done, ms->levels[idx-2].bands);
+    /* On errors the waiting bands still run. The result is discarded. */
+    if (!g->error && _ms_ssim_level(ms, idx, g->build))
+        g->error = 1;
+    _iqa_parallel_post(&g->built);
+}
+
+/* Runs one task of an MS-SSIM graph */
+static void _ms_task(int task, int worker, void *ctx)
+{
+    struct _ms_graph *g = (struct _ms_graph*)ctx;
+    struct _ms_ssim *ms = g->ms;
+    struct _ms_scale *sc;
+    int i, idx, y0;
 
-    /* Copy original images into first scale buffer, forcing stride = width. */
-    for (y=0; y<h; ++y) {
-        src_offset = y*stride;
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset, ++src_offset) {
-            ref_imgs[0][offset] = (float)ref[src_offset];
-            cmp_imgs[0][offset] = (float)cmp[src_offset];
+    if (task < g->converts) {
+        y0 = task*CONVERT_ROWS;
+        for (i=0; i<2; ++i) {
+            if (g->src[i])
+                _ms_ssim_convert(ms, g->src[i], i ? ms->cmp_imgs[0] : ms->ref_imgs[0], y0,
+                    _min(y0 + CONVERT_ROWS, ms->h));
         }
+        _iqa_parallel_post(&g->converted);
+        return;
     }
+    task -= g->converts;
 
-    /* Create scaled versions of the images */
-    cur_w=w;
-    cur_h=h;
-    lpf.kernel = (float*)g_lpf;
-    lpf.w = lpf.h = LPF_LEN;
-    lpf.normalized = 1;
-    lpf.bnd_opt = KBND_SYMMETRIC;
-    for (idx=1; idx<scales; ++idx) {
-        if (_iqa_decimate(ref_imgs[idx-1], cur_w, cur_h, 2, &lpf, ref_imgs[idx], 0, 0) ||
-            _iqa_decimate(cmp_imgs[idx-1], cur_w, cur_h, 2, &lpf, cmp_imgs[idx], &cur_w, &cur_h))
-        {
-            _free_buffers(ref_imgs, scales);
-            _free_buffers(cmp_imgs, scales);
-            free(ref_imgs);
-            free(cmp_imgs);
+    if (task < g->pyramids) {
+        _ms_build(g, 1);
+        return;
+    }
+    task -= g->pyramids;
+
+    for (idx=ms->scales-1; ms->levels[idx].first > task; --idx)
+        ;
+    sc = ms->levels + idx;
+    if (task - sc->first == sc->bands) {
+        _ms_build(g, idx+2);
+        return;
+    }
+    if (!idx)
+        _iqa_parallel_wait(&g->converted, g->converts);
+    if (idx && g->pyramids)
+        _iqa_parallel_wait(&g->built, idx);
+    _iqa_ssim_band(&sc->job, task - sc->first, worker);
+    _iqa_parallel_post(&sc->done);
+}
+
+/*
+ * MS_SSIM(X,Y) = Lm(x,y)^aM * MULT[j=1->M]( Cj(x,y)^bj  *  Sj(x,y)^gj )
+ * where,
+ *  L = mean
+ *  C = variance
+ *  S = cross-correlation
+ *
+ *  b1=g1=0.0448, b2=g2=0.2856, b3=g3=0.3001, b4=g4=0.2363, a5=b5=g5=0.1333
+ *
+ * Loads the pyramids and combines them as one graph of pool tasks, so the
+ * SSIM of a scale starts as soon as that scale is built, while the smaller
+ * ones are still being downsampled on other threads. 'ref' and 'cmp' are the
+ * caller's images to convert, or 0 if the full size images are already
+ * loaded. 'build' has bit 0 set to build the ref pyramid and bit 1 for cmp.
+ * 'rs' optionally holds the reference statistics for each scale. Each scale
+ * combines its bands in order, so the result is the same as scoring the
+ * scales one after the other, for any number of threads.
+ */
+static float _ms_ssim_run(struct _ms_ssim *ms, const void *ref, const void *cmp, int build,
+    const struct _ssim_ref_stats *rs)
+{
+    struct _ms_graph g;
+    struct _ms_scale *sc;
+    struct iqa_ssim_args s_args;
+    struct _ssim_band *bands = ms->bands;
+    int idx, cur_w, cur_h, tasks;
+    float msssim;
+    void *rows = (unsigned char*)ms->scratch +
+        IQA_ALIGN_SIZE(_iqa_ssim_band_count(ms->h, &ms->window)*sizeof(struct _ssim_band));
+
+    memset(&g, 0, sizeof(g));
+    g.ms = ms;
+    g.src[0] = ref;
+    g.src[1] = cmp;
+    if (ref || cmp)
+        g.converts = (ms->h + CONVERT_ROWS - 1)/CONVERT_ROWS;
+    g.build = build;
+    g.pyramids = ms->scales > 1 && build ? 1 : 0;
+    _ms_ssim_args(ms, &s_args);
+
+    /* The means of l, c and s are pooled without leaving the SSIM row loop */
+    tasks = 0;
+    cur_w = ms->w;
+    cur_h = ms->h;
+    for (idx=0; idx<ms->scales; ++idx) {
+        sc = ms->levels + idx;
+        memset(&sc->pool, 0, sizeof(sc->pool));
+        sc->pool.alpha = ms->alphas[idx];
+        sc->pool.beta  = ms->betas[idx];
+        sc->pool.gamma = ms->gammas[idx];
+        memset(&sc->mr, 0, sizeof(sc->mr));
+        sc->mr.pool    = MR_MEAN_LCS;
+        sc->mr.context = &sc->pool;
+        sc->bands = _iqa_ssim_job_init(&sc->job, idx ? ms->ref_imgs[idx] : ms->ref0,
+            idx ? ms->cmp_imgs[idx] : ms->cmp0, cur_w, cur_h, idx ? _ms_pair_stride(cur_w) : ms->stride0,
+            &ms->window, &sc->mr, &s_args, rs ? rs+idx : 0, bands, rows);
+        if (!sc->bands)
             return INFINITY;
-        }
+        sc->first = tasks;
+        sc->done = 0;
+        tasks += sc->bands + (g.pyramids && idx+2 < ms->scales ? 1 : 0);
+        bands += sc->bands;
+        cur_w = cur_w/2 + (cur_w&1);
+        cur_h = cur_h/2 + (cur_h&1);
     }
 
-    cur_w=w;
-    cur_h=h;
+    _iqa_parallel_for(g.converts + g.pyramids + tasks, _ms_task, &g);
+    if (g.error)
+        return INFINITY;
+
     msssim = 1.0;
-    for (idx=0; idx<scales; ++idx) {
+    for (idx=0; idx<ms->scales; ++idx) {
+        msssim *= _iqa_ssim_job_result(&ms->levels[idx].job);
+        if (msssim == INFINITY)
+            break;
+    }
+    return msssim;
+}
 
-        ms_ctx.l = 0;
-        ms_ctx.c = 0;
-        ms_ctx.s = 0;
-        ms_ctx.alpha = alphas[idx];
-        ms_ctx.beta  = betas[idx];
-        ms_ctx.gamma = gammas[idx];
-
-        if (!wang) {
-            /* MS-SSIM* (Rouse/Hemami) */
-            s_args.alpha = 1.0f;
-            s_args.beta  = 1.0f;
-            s_args.gamma = 1.0f;
-            s_args.K1 = 0.0f; /* Force stabilization constants to 0 */
-            s_args.K2 = 0.0f;
-            s_args.L  = 255;
-            s_args.f  = 1; /* Don't resize */
-            mr.context = &ms_ctx;
-            msssim *= _iqa_ssim(ref_imgs[idx], cmp_imgs[idx], cur_w, cur_h, &window, &mr, &s_args);
-        }
-        else {
-            /* MS-SSIM (Wang) */
-            s_args.alpha = 1.0f;
-            s_args.beta  = 1.0f;
-            s_args.gamma = 1.0f;
-            s_args.K1 = 0.01f;
-            s_args.K2 = 0.03f;
-            s_args.L  = 255;
-            s_args.f  = 1; /* Don't resize */
-            mr.context = &ms_ctx;
-            msssim *= _iqa_ssim(ref_imgs[idx], cmp_imgs[idx], cur_w, cur_h, &window, &mr, &s_args);
-        }
+/*
+ * Combines the loaded pyramids, pooling only the windows centred on 'roi' at
+ * each scale (see _iqa_roi_windows()).
+ */
+static float _ms_ssim_score(struct _ms_ssim *ms, const struct iqa_rect *roi)
+{
+    int idx,cur_w,cur_h,stride,vw,vh,p0,p1,q0,q1,f;
+    float msssim;
+    const float *r, *c;
+    struct iqa_ssim_args s_args;
+    struct _map_reduce mr;
+    struct _ssim_pool pool;
+
+    /* The means of l, c and s are pooled without leaving the SSIM row loop */
+    memset(&mr, 0, sizeof(mr));
+    mr.pool    = MR_MEAN_LCS;
+    mr.context = &pool;
+    _ms_ssim_args(ms, &s_args);
+
+    cur_w = ms->w;
+    cur_h = ms->h;
+    msssim = 1.0;
+    for (idx=0; idx<ms->scales; ++idx) {
+
+        memset(&pool, 0, sizeof(pool));
+        pool.alpha = ms->alphas[idx];
+        pool.beta  = ms->betas[idx];
+        pool.gamma = ms->gammas[idx];
+
+        r = idx ? ms->ref_imgs[idx] : ms->ref0;
+        c = idx ? ms->cmp_imgs[idx] : ms->cmp0;
+        stride = idx ? _ms_pair_stride(cur_w) : ms->stride0;
+
+        /* Pixel X of this scale sits at pixel X*f of the first */
+        f = 1 << idx;
+        _iqa_roi_windows((roi->x + f-1)/f, (roi->x + roi->w + f-1)/f, cur_w, ms->window.w, &p0, &p1);
+        _iqa_roi_windows((roi->y + f-1)/f, (roi->y + roi->h + f-1)/f, cur_h, ms->window.h, &q0, &q1);
+        r += q0*stride + p0;
+        c += q0*stride + p0;
+        vw = p1 - p0 + ms->window.w - 1;
+        vh = q1 - q0 + ms->window.h - 1;
+        msssim *= _iqa_ssim_strided(r, c, vw, vh, stride, &ms->window, &mr, &s_args, 0, ms->scratch);
 
         if (msssim == INFINITY)
             break;
@@ -268,10 +578,205 @@ float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int
         cur_h = cur_h/2 + (cur_h&1);
     }
 
-    _free_buffers(ref_imgs, scales);
-    _free_buffers(cmp_imgs, scales);
-    free(ref_imgs);
-    free(cmp_imgs);
+    return msssim;
+}
+
+/* iqa_ms_ssim */
+float iqa_ms_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, 
+    int stride, const struct iqa_ms_ssim_args *args)
+{
+    struct _ms_ssim ms;
+    float msssim;
+
+    if (_ms_ssim_init(&ms, w, h, stride, 0, 1, args))
+        return INFINITY;
+    msssim = _ms_ssim_run(&ms, ref, cmp, 3, 0);
+    _ms_ssim_free(&ms);
+    return msssim;
+}
+
+/* iqa_ms_ssim_16 */
+float iqa_ms_ssim_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth, const struct iqa_ms_ssim_args *args)
+{
+    struct _ms_ssim ms;
+    float msssim;
 
+    if (!depth || stride < 2*w)
+        return INFINITY;
+    if (_ms_ssim_init(&ms, w, h, stride, depth, 1, args))
+        return INFINITY;
+    msssim = _ms_ssim_run(&ms, ref, cmp, 3, 0);
+    _ms_ssim_free(&ms);
     return msssim;
 }
+
+/* iqa_ms_ssim_f32 */
+float iqa_ms_ssim_f32(const float *ref, const float *cmp, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args)
+{
+    struct _ms_ssim ms;
+    float msssim;
+    int fstride;
+
+    if (!ref || !cmp || stride % (int)sizeof(float))
+        return INFINITY;
+    fstride = stride / (int)sizeof(float);
+    if (fstride < w)
+        return INFINITY;
+    if (_ms_ssim_init(&ms, w, h, stride, DEPTH_F32, 1, args))
+        return INFINITY;
+    ms.ref0 = ref;
+    ms.cmp0 = cmp;
+    ms.stride0 = fstride;
+    msssim = _ms_ssim_run(&ms, 0, 0, 3, 0);
+    _ms_ssim_free(&ms);
+    return msssim;
+}
+
+
+/*
+ * iqa_ms_ssim_roi. Each rectangle is scored on a view of the images that adds
+ * enough real pixels around it for the low-pass filters and windows of every
+ * scale, clipped to the image. The views start on a multiple of the largest
+ * downsampling factor, so the scales line up with those of the whole image.
+ * The rectangles are pooled by their number of windows at the first scale,
+ * as iqa_ssim_roi() pools them.
+ */
+float iqa_ms_ssim_roi(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args, const struct iqa_rect *rects, int count)
+{
+    struct _ms_ssim ms;
+    struct iqa_rect roi;
+    int i, align, margin, ox, oy, ex, ey, offset, scales, gauss, kn, p0, p1, q0, q1;
+    double sum=0.0, n=0.0, windows;
+    float msssim;
+
+    if (!ref || !cmp || w < 1 || h < 1 || stride < w || _iqa_rects_valid(rects, count, w, h))
+        return INFINITY;
+    scales = args ? args->scales : SCALES;
+    gauss = args ? args->gaussian : 1;
+    /* The same limit as iqa_ms_ssim() on the whole image */
+    if (_ms_ssim_fits(w, h, scales, gauss))
+        return INFINITY;
+    kn = gauss ? GAUSSIAN_LEN : SQUARE_LEN;
+    align = 1 << (scales-1);
+    margin = align*(GAUSSIAN_LEN + 5);
+
+    for (i=0; i<count; ++i) {
+        ox = rects[i].x - margin < 0 ? 0 : ((rects[i].x - margin)/align)*align;
+        oy = rects[i].y - margin < 0 ? 0 : ((rects[i].y - margin)/align)*align;
+        ex = _min(rects[i].x + rects[i].w + margin, w);
+        ey = _min(rects[i].y + rects[i].h + margin, h);
+        roi = rects[i];
+        roi.x -= ox;
+        roi.y -= oy;
+
+        offset = oy*stride + ox;
+        if (_ms_ssim_init(&ms, ex - ox, ey - oy, stride, 0, 0, args))
+            return INFINITY;
+        msssim = INFINITY;
+        if (!_ms_ssim_load(&ms, ref + offset, cmp + offset))
+            msssim = _ms_ssim_score(&ms, &roi);
+        _ms_ssim_free(&ms);
+        if (msssim == INFINITY)
+            return INFINITY;
+        _iqa_roi_windows(rects[i].x, rects[i].x + rects[i].w, w, kn, &p0, &p1);
+        _iqa_roi_windows(rects[i].y, rects[i].y + rects[i].h, h, kn, &q0, &q1);
+        windows = (double)(p1 - p0) * (q1 - q0);
+        sum += (double)msssim * windows;
+        n += windows;
+    }
+    return (float)(sum / n);
+}
+
+/*
+ * A reference image with its pyramid and the window statistics of every scale
+ * already calculated.
+ */
+struct iqa_ms_ssim_ref {
+    struct _ms_ssim ms;
+    struct _ssim_ref_stats *rs;     /* One per scale */
+    void *block;
+};
+
+/* iqa_ms_ssim_ref_prepare */
+struct iqa_ms_ssim_ref *iqa_ms_ssim_ref_prepare(const unsigned char *ref, int w, int h, int stride,
+    const struct iqa_ms_ssim_args *args)
+{
+    struct iqa_ms_ssim_ref *prep;
+    int idx,cur_w,cur_h,dst_w,dst_h;
+    size_t size, total;
+    unsigned char *mem;
+
+    if (!ref)
+        return 0;
+    prep = (struct iqa_ms_ssim_ref*)calloc(1, sizeof(struct iqa_ms_ssim_ref));
+    if (!prep)
+        return 0;
+    if (_ms_ssim_init(&prep->ms, w, h, stride, 0, 0, args)) {
+        free(prep);
+        return 0;
+    }
+    prep->rs = (struct _ssim_ref_stats*)malloc(prep->ms.scales*sizeof(struct _ssim_ref_stats));
+    if (!prep->rs || _ms_ssim_load(&prep->ms, ref, 0)) {
+        iqa_ms_ssim_ref_destroy(prep);
+        return 0;
+    }
+
+    /* Mean and variance of each scale (init ensured they fit the window) */
+    total = 0;
+    cur_w = w;
+    cur_h = h;
+    for (idx=0; idx<prep->ms.scales; ++idx) {
+        dst_w = cur_w - prep->ms.window.w + 1;
+        dst_h = cur_h - prep->ms.window.h + 1;
+        total += 2*IQA_ALIGN_SIZE(dst_w*dst_h*sizeof(float));
+        cur_w = cur_w/2 + (cur_w&1);
+        cur_h = cur_h/2 + (cur_h&1);
+    }
+    prep->block = _iqa_malloc_aligned(total);
+    if (!prep->block) {
+        iqa_ms_ssim_ref_destroy(prep);
+        return 0;
+    }
+    mem = (unsigned char*)prep->block;
+    cur_w = w;
+    cur_h = h;
+    for (idx=0; idx<prep->ms.scales; ++idx) {
+        dst_w = cur_w - prep->ms.window.w + 1;
+        dst_h = cur_h - prep->ms.window.h + 1;
+        size = IQA_ALIGN_SIZE(dst_w*dst_h*sizeof(float));
+        prep->rs[idx].mu = (float*)mem;
+        prep->rs[idx].sigma_sqd = (float*)(mem + size);
+        mem += 2*size;
+        if (_iqa_ssim_ref_stats(prep->ms.ref_imgs[idx], cur_w, cur_h,
+            idx ? _ms_pair_stride(cur_w) : prep->ms.stride0, &prep->ms.window,
+            prep->rs+idx, prep->ms.scratch)) {
+            iqa_ms_ssim_ref_destroy(prep);
+            return 0;
+        }
+        cur_w = cur_w/2 + (cur_w&1);
+        cur_h = cur_h/2 + (cur_h&1);
+    }
+    return prep;
+}
+
+/* iqa_ms_ssim_compare */
+float iqa_ms_ssim_compare(struct iqa_ms_ssim_ref *prepared, const unsigned char *cmp)
+{
+    if (!prepared || !cmp)
+        return INFINITY;
+    return _ms_ssim_run(&prepared->ms, 0, cmp, 2, prepared->rs);
+}
+
+/* iqa_ms_ssim_ref_destroy */
+void iqa_ms_ssim_ref_destroy(struct iqa_ms_ssim_ref *prepared)
+{
+    if (!prepared)
+        return;
+    _ms_ssim_free(&prepared->ms);
+    _iqa_free_aligned(prepared->block);
+    free(prepared->rs);
+    free(prepared);
+}
@@ -32,6 +32,7 @@
  */
 
 #include "iqa.h"
+#include "math_utils.h"
 
 /* MSE(a,b) = 1/N * SUM((a-b)^2) */
 float iqa_mse(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride)
@@ -48,3 +49,48 @@ float iqa_mse(const unsigned char *ref, const unsigned char *cmp, int w, int h,
     }
     return (float)( (double)sum / (double)(w*h) );
 }
+
+/* iqa_mse_roi */
+float iqa_mse_roi(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    const struct iqa_rect *rects, int count)
+{
+    int i, error, offset, x, y;
+    unsigned long long sum=0, n=0;
+    const struct iqa_rect *r;
+
+    if (_iqa_rects_valid(rects, count, w, h))
+        return INFINITY;
+    for (i=0; i<count; ++i) {
+        r = rects + i;
+        for (y=r->y; y<r->y+r->h; ++y) {
+            offset = y*stride + r->x;
+            for (x=0; x<r->w; ++x, ++offset) {
+                error = ref[offset] - cmp[offset];
+                sum += error * error;
+            }
+        }
+        n += (unsigned long long)r->w * r->h;
+    }
+    return (float)( (double)sum / (double)n );
+}
+
+/* iqa_mse_16 */
+float iqa_mse_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth)
+{
+    int bits, shift, error, x, y;
+    unsigned long long sum=0;
+    const unsigned short *r, *c;
+
+    if (_iqa_depth(depth, &bits, &shift))
+        return INFINITY;
+    for (y=0; y<h; ++y) {
+        r = (const unsigned short*)((const unsigned char*)ref + y*stride);
+        c = (const unsigned short*)((const unsigned char*)cmp + y*stride);
+        for (x=0; x<w; ++x) {
+            error = (r[x] >> shift) - (c[x] >> shift);
+            sum += (unsigned long long)((long long)error * error);
+        }
+    }
+    return (float)( (double)sum / (double)(w*h) );
+}
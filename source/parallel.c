@@ -0,0 +1,302 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "iqa.h"
+#include "parallel.h"
+#include "simd.h"
+#include <stdlib.h>
+
+#ifdef WIN32
+/* Slim reader/writer locks and condition variables (Vista and later) */
+typedef SRWLOCK _mutex;
+typedef CONDITION_VARIABLE _cond;
+#define MUTEX_INIT SRWLOCK_INIT
+#define COND_INIT CONDITION_VARIABLE_INIT
+#define _lock(m) AcquireSRWLockExclusive(m)
+#define _unlock(m) ReleaseSRWLockExclusive(m)
+#define _trylock(m) (TryAcquireSRWLockExclusive(m) ? 0 : 1)
+#define _wait(c,m) SleepConditionVariableSRW(c, m, INFINITE, 0)
+#define _signal(c) WakeConditionVariable(c)
+#define _broadcast(c) WakeAllConditionVariable(c)
+typedef HANDLE _thread;
+#else
+#include <pthread.h>
+#include <unistd.h>
+typedef pthread_mutex_t _mutex;
+typedef pthread_cond_t _cond;
+#define MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+#define COND_INIT PTHREAD_COND_INITIALIZER
+#define _lock(m) pthread_mutex_lock(m)
+#define _unlock(m) pthread_mutex_unlock(m)
+#define _trylock(m) pthread_mutex_trylock(m)
+#define _wait(c,m) pthread_cond_wait(c, m)
+#define _signal(c) pthread_cond_signal(c)
+#define _broadcast(c) pthread_cond_broadcast(c)
+typedef pthread_t _thread;
+#endif
+
+/* Upper limit on the number of threads (including the caller) */
+#define MAX_THREADS 64
+
+static int g_threads = 1;           /* Configured thread count */
+
+/* Serializes callers of _iqa_parallel_for() */
+static _mutex g_busy = MUTEX_INIT;
+
+/* Pool state. Everything below 'lock' is protected by it. */
+static struct {
+    int started;                    /* Pool threads running (ids 1..started) */
+    _thread threads[MAX_THREADS];
+    void *scratch[MAX_THREADS];     /* Per worker buffers (index 0 unused) */
+    size_t scratch_size[MAX_THREADS];
+    unsigned initial_gen[MAX_THREADS];
+
+    _mutex lock;
+    _cond work;                     /* A job was posted, or the pool is quitting */
+    _cond done;                     /* The last worker finished the job */
+    unsigned generation;            /* Incremented for each job */
+    int quit;
+    _iqa_task fn;
+    void *ctx;
+    int count;                      /* Number of tasks */
+    int next;                       /* Next task to hand out */
+    int workers;                    /* Threads taking part (including the caller) */
+    int active;                     /* Pool threads still working on the job */
+} g_pool = { 0, {0}, {0}, {0}, {0}, MUTEX_INIT, COND_INIT, COND_INIT, 0, 0, 0, 0, 0, 0, 0, 0 };
+
+/* Progress counters of the running job (see _iqa_parallel_post()) */
+static _mutex g_progress = MUTEX_INIT;
+static _cond g_progress_cond = COND_INIT;
+
+/* Runs tasks until there are none left. Called with the lock held. */
+static void _run_tasks(int worker)
+{
+    int task;
+    while (g_pool.next < g_pool.count) {
+        task = g_pool.next++;
+        _unlock(&g_pool.lock);
+        g_pool.fn(task, worker, g_pool.ctx);
+        _lock(&g_pool.lock);
+    }
+}
+
+/* Pool thread */
+static void _worker(int id)
+{
+    unsigned seen;
+
+    _lock(&g_pool.lock);
+    seen = g_pool.initial_gen[id];
+    for (;;) {
+        while (!g_pool.quit && g_pool.generation == seen)
+            _wait(&g_pool.work, &g_pool.lock);
+        if (g_pool.quit)
+            break;
+        seen = g_pool.generation;
+        if (id >= g_pool.workers)
+            continue; /* Not needed for this job */
+        _run_tasks(id);
+        if (--g_pool.active == 0)
+            _signal(&g_pool.done);
+    }
+    _unlock(&g_pool.lock);
+}
+
+#ifdef WIN32
+static DWORD WINAPI _thread_main(LPVOID arg)
+{
+    _worker((int)(size_t)arg);
+    return 0;
+}
+#else
+static void *_thread_main(void *arg)
+{
+    _worker((int)(size_t)arg);
+    return 0;
+}
+#endif
+
+/* Starts pool threads until there are 'n' (plus the caller). Returns the number running. */
+static int _start_threads(int n)
+{
+    int id;
+    while (g_pool.started < n) {
+        id = g_pool.started + 1;
+        _lock(&g_pool.lock);
+        g_pool.initial_gen[id] = g_pool.generation;
+        _unlock(&g_pool.lock);
+#ifdef WIN32
+        g_pool.threads[id] = CreateThread(0, 0, _thread_main, (LPVOID)(size_t)id, 0, 0);
+        if (!g_pool.threads[id])
+            break;
+#else
+        if (pthread_create(&g_pool.threads[id], 0, _thread_main, (void*)(size_t)id))
+            break;
+#endif
+        g_pool.started = id;
+    }
+    return g_pool.started;
+}
+
+/* Number of CPUs, or 1 if unknown */
+static int _cpu_count(void)
+{
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#else
+    return 1;
+#endif
+}
+
+int _iqa_parallel_for(int count, _iqa_task fn, void *ctx)
+{
+    int task, workers;
+
+    workers = g_threads < count ? g_threads : count;
+    if (workers <= 1 || _trylock(&g_busy)) {
+        /* Run in order on the calling thread */
+        for (task=0; task<count; ++task)
+            fn(task, 0, ctx);
+        return 1;
+    }
+
+    workers = _start_threads(workers - 1) + 1;
+    if (workers > g_threads)
+        workers = g_threads;
+
+    _lock(&g_pool.lock);
+    g_pool.fn = fn;
+    g_pool.ctx = ctx;
+    g_pool.count = count;
+    g_pool.next = 0;
+    g_pool.workers = workers;
+    g_pool.active = workers - 1;
+    ++g_pool.generation;
+    _broadcast(&g_pool.work);
+
+    _run_tasks(0);
+    while (g_pool.active > 0)
+        _wait(&g_pool.done, &g_pool.lock);
+    g_pool.fn = 0;
+    g_pool.ctx = 0;
+    _unlock(&g_pool.lock);
+
+    _unlock(&g_busy);
+    return workers;
+}
+
+void _iqa_parallel_post(int *counter)
+{
+    _lock(&g_progress);
+    ++*counter;
+    _broadcast(&g_progress_cond);
+    _unlock(&g_progress);
+}
+
+void _iqa_parallel_wait(const int *counter, int value)
+{
+    _lock(&g_progress);
+    while (*counter < value)
+        _wait(&g_progress_cond, &g_progress);
+    _unlock(&g_progress);
+}
+
+void *_iqa_parallel_scratch(int worker, size_t size)
+{
+    if (worker < 1 || worker >= MAX_THREADS)
+        return 0;
+    if (g_pool.scratch_size[worker] < size) {
+        _iqa_free_aligned(g_pool.scratch[worker]);
+        g_pool.scratch[worker] = _iqa_malloc_aligned(size);
+        g_pool.scratch_size[worker] = g_pool.scratch[worker] ? size : 0;
+    }
+    return g_pool.scratch[worker];
+}
+
+int _iqa_parallel_threads(void)
+{
+    return g_threads;
+}
+
+void _iqa_parallel_shutdown(void)
+{
+    int id;
+
+    _lock(&g_busy);
+    _lock(&g_pool.lock);
+    g_pool.quit = 1;
+    _broadcast(&g_pool.work);
+    _unlock(&g_pool.lock);
+    for (id=1; id<=g_pool.started; ++id) {
+#ifdef WIN32
+        WaitForSingleObject(g_pool.threads[id], INFINITE);
+        CloseHandle(g_pool.threads[id]);
+#else
+        pthread_join(g_pool.threads[id], 0);
+#endif
+    }
+    for (id=1; id<MAX_THREADS; ++id) {
+        _iqa_free_aligned(g_pool.scratch[id]);
+        g_pool.scratch[id] = 0;
+        g_pool.scratch_size[id] = 0;
+    }
+    g_pool.started = 0;
+    g_pool.quit = 0;
+    _unlock(&g_busy);
+}
+
+/* iqa_set_num_threads */
+int iqa_set_num_threads(int threads)
+{
+    if (threads < 1)
+        threads = _cpu_count();
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+
+    /* Going back to a single thread releases the pool */
+    if (threads == 1 && g_pool.started)
+        _iqa_parallel_shutdown();
+    g_threads = threads;
+    return g_threads;
+}
+
+/* iqa_get_num_threads */
+int iqa_get_num_threads(void)
+{
+    return g_threads;
+}
@@ -32,6 +32,7 @@
  */
 
 #include "iqa.h"
+#include "math_utils.h"
 #include <math.h>
 
 /* PSNR(a,b) = 10*log10(L^2 / MSE(a,b)), where L=2^b - 1 (8bit = 255) */
@@ -40,3 +41,16 @@ float iqa_psnr(const unsigned char *ref, const unsigned char *cmp, int w, int h,
     const int L_sqd = 255 * 255;
     return (float)( 10.0 * log10( L_sqd / iqa_mse(ref,cmp,w,h,stride) ) );
 }
+
+/* PSNR(a,b) = 10*log10(L^2 / MSE(a,b)), where L = 2^bits - 1 */
+float iqa_psnr_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth)
+{
+    int bits, shift;
+    double L;
+
+    if (_iqa_depth(depth, &bits, &shift))
+        return NAN;
+    L = (double)((1 << bits) - 1);
+    return (float)( 10.0 * log10( L*L / iqa_mse_16(ref,cmp,w,h,stride,depth) ) );
+}
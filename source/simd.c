@@ -0,0 +1,242 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(IQA_SIMD_X86) && defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/* Scalar conversion. Everything else falls back to the callers' code. */
+static void _u8_to_float_scalar(const unsigned char *src, float *dst, int len)
+{
+    int x;
+    for (x=0; x<len; ++x)
+        dst[x] = (float)src[x];
+}
+
+static void _u16_to_float_scalar(const unsigned short *src, float *dst, int len, int shift)
+{
+    int x;
+    for (x=0; x<len; ++x)
+        dst[x] = (float)(src[x] >> shift);
+}
+
+static void _ssim_terms_row_scalar(const float *stats, int len, float C1, float C2, float C3,
+    double *l, double *c, double *s)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22;
+    double root;
+
+    if (C1 == 0 || C2 == 0 || C3 == 0) {
+        for (x=0; x<len; ++x) {
+            SSIM_TERMS(1)
+        }
+    }
+    else {
+        for (x=0; x<len; ++x) {
+            SSIM_TERMS(0)
+        }
+    }
+}
+
+static void _int_moments_row_scalar(const unsigned char *a, const unsigned char *b, int len,
+    const int *taps, int ntaps, int *out)
+{
+    int x, u;
+    unsigned int t, pa, pb, sa, sb, saa, sbb, sab;
+    for (x=0; x<len; ++x) {
+        INT_MOMENTS
+    }
+}
+
+static const struct _iqa_simd _iqa_simd_scalar = {
+    IQA_SIMD_SCALAR,
+    "scalar",
+    _u8_to_float_scalar,
+    _u16_to_float_scalar,
+    0,
+    0,
+    0,
+    0,
+    0,
+    0,
+    _ssim_terms_row_scalar,
+    _int_moments_row_scalar,
+    0,
+    0,
+    0
+};
+
+static const struct _iqa_simd *g_simd = 0;
+
+int _iqa_simd_detect(void)
+{
+#if defined(IQA_SIMD_X86) && defined(_MSC_VER)
+    int info[4];
+    int level = IQA_SIMD_SCALAR;
+    unsigned long long xcr0 = 0;
+
+    __cpuid(info, 0);
+    if (info[0] < 1)
+        return level;
+    __cpuid(info, 1);
+    if (info[3] & (1<<26))
+        level = IQA_SIMD_SSE2;
+    if (!(info[2] & (1<<27)) || !(info[2] & (1<<28)) || !(info[2] & (1<<12)))
+        return level; /* No OSXSAVE, AVX or FMA */
+    xcr0 = _xgetbv(0);
+    if ((xcr0 & 0x6) != 0x6)
+        return level; /* OS doesn't save YMM state */
+    __cpuidex(info, 7, 0);
+    if (info[1] & (1<<5))
+        level = IQA_SIMD_AVX2;
+    if ((info[1] & (1<<16)) && (xcr0 & 0xe6) == 0xe6)
+        level = IQA_SIMD_AVX512;
+    return level;
+#elif defined(IQA_SIMD_X86) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return IQA_SIMD_AVX512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return IQA_SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2"))
+        return IQA_SIMD_SSE2;
+    return IQA_SIMD_SCALAR;
+#else
+    return IQA_SIMD_SCALAR;
+#endif
+}
+
+/* Returns the table for the level, or the closest lower level available */
+static const struct _iqa_simd *_simd_table(int level)
+{
+#ifdef IQA_SIMD_X86
+    if (level >= IQA_SIMD_AVX512)
+        return &_iqa_simd_avx512;
+    if (level == IQA_SIMD_AVX2)
+        return &_iqa_simd_avx2;
+    if (level == IQA_SIMD_SSE2)
+        return &_iqa_simd_sse2;
+#endif
+    return &_iqa_simd_scalar;
+}
+
+int _iqa_simd_set(int level)
+{
+    int max = _iqa_simd_detect();
+    if (level > max)
+        level = max;
+    if (level < IQA_SIMD_SCALAR)
+        level = IQA_SIMD_SCALAR;
+    g_simd = _simd_table(level);
+    return g_simd->level;
+}
+
+const struct _iqa_simd *_iqa_simd_get(void)
+{
+    const char *env;
+    int level;
+
+    if (g_simd)
+        return g_simd;
+
+    level = _iqa_simd_detect();
+    env = getenv("IQA_SIMD");
+    if (env) {
+        if (strcmp(env, "scalar") == 0)
+            level = IQA_SIMD_SCALAR;
+        else if (strcmp(env, "sse2") == 0)
+            level = IQA_SIMD_SSE2;
+        else if (strcmp(env, "avx2") == 0)
+            level = IQA_SIMD_AVX2;
+        else if (strcmp(env, "avx512") == 0)
+            level = IQA_SIMD_AVX512;
+    }
+    _iqa_simd_set(level);
+    return g_simd;
+}
+
+void *_iqa_malloc_aligned(size_t size)
+{
+    unsigned char *raw, *p;
+
+    /* The original pointer is kept just below the aligned block */
+    raw = (unsigned char*)malloc(size + IQA_ALIGN + sizeof(void*));
+    if (!raw)
+        return 0;
+    p = raw + sizeof(void*);
+    p += (IQA_ALIGN - ((size_t)p & (IQA_ALIGN-1))) & (IQA_ALIGN-1);
+    ((void**)p)[-1] = raw;
+    return p;
+}
+
+void _iqa_advise_huge_pages(void *p, size_t size)
+{
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = ((size_t)p + page - 1) & ~(page - 1);
+    size_t end = ((size_t)p + size) & ~(page - 1);
+
+    /* Only a hint. Small blocks would not fill a huge page anyway. */
+    if (size >= IQA_HUGE_PAGE && end > start)
+        madvise((void*)start, end - start, MADV_HUGEPAGE);
+#else
+    (void)p;
+    (void)size;
+#endif
+}
+
+void _iqa_free_aligned(void *p)
+{
+    if (p)
+        free(((void**)p)[-1]);
+}
+
+int _iqa_row_stride(int w)
+{
+    size_t bytes = IQA_ALIGN_SIZE(w*sizeof(float));
+    if ((bytes & 4095) == 0)
+        bytes += IQA_ALIGN;
+    return (int)(bytes / sizeof(float));
+}
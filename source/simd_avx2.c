@@ -0,0 +1,579 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+#include <float.h>
+#include <math.h>
+
+#ifdef IQA_SIMD_X86
+
+#include <immintrin.h>
+
+#define AVX2 IQA_TARGET("avx2,fma")
+
+AVX2 static void _u8_to_float_avx2(const unsigned char *src, float *dst, int len)
+{
+    int x;
+    __m128i p;
+    for (x=0; x+8<=len; x+=8) {
+        p = _mm_loadl_epi64((const __m128i*)(src+x));
+        _mm256_storeu_ps(dst+x, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(p)));
+    }
+    for (; x<len; ++x)
+        dst[x] = (float)src[x];
+}
+
+AVX2 static void _u16_to_float_avx2(const unsigned short *src, float *dst, int len, int shift)
+{
+    int x;
+    __m256i p;
+    __m128i n = _mm_cvtsi32_si128(shift);
+    for (x=0; x+8<=len; x+=8) {
+        p = _mm256_srl_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(src+x))), n);
+        _mm256_storeu_ps(dst+x, _mm256_cvtepi32_ps(p));
+    }
+    for (; x<len; ++x)
+        dst[x] = (float)(src[x] >> shift);
+}
+
+AVX2 static void _filter_row_avx2(const float *src, float *dst, int len, const float *taps, int ntaps)
+{
+    int x,u;
+    float sum;
+    __m256 acc;
+    for (x=0; x+8<=len; x+=8) {
+        acc = _mm256_setzero_ps();
+        for (u=0; u<ntaps; ++u)
+            acc = _mm256_fmadd_ps(_mm256_set1_ps(taps[u]), _mm256_loadu_ps(src+x+u), acc);
+        _mm256_storeu_ps(dst+x, acc);
+    }
+    for (; x<len; ++x) {
+        sum = 0.0f;
+        for (u=0; u<ntaps; ++u)
+            sum += taps[u] * src[x+u];
+        dst[x] = sum;
+    }
+}
+
+AVX2 static void _accum_row_avx2(const float *src, int step, float wt, float *dst, int len)
+{
+    int x;
+    __m256 w = _mm256_set1_ps(wt);
+    __m256i idx;
+    if (step == 1) {
+        for (x=0; x+8<=len; x+=8)
+            _mm256_storeu_ps(dst+x, _mm256_fmadd_ps(w, _mm256_loadu_ps(src+x), _mm256_loadu_ps(dst+x)));
+    }
+    else {
+        idx = _mm256_mullo_epi32(_mm256_set_epi32(7,6,5,4,3,2,1,0), _mm256_set1_epi32(step));
+        for (x=0; x+8<=len; x+=8) {
+            _mm256_storeu_ps(dst+x, _mm256_fmadd_ps(w, _mm256_i32gather_ps(src+x*step, idx, 4),
+                _mm256_loadu_ps(dst+x)));
+        }
+    }
+    for (; x<len; ++x)
+        dst[x] += wt * src[x*step];
+}
+
+AVX2 static void _accum_row_d_avx2(const float *src, int step, float wt, double *dst, int len)
+{
+    int x;
+    __m256 w = _mm256_set1_ps(wt);
+    __m256 v;
+    __m256i idx = _mm256_mullo_epi32(_mm256_set_epi32(7,6,5,4,3,2,1,0), _mm256_set1_epi32(step));
+    for (x=0; x+8<=len; x+=8) {
+        if (step == 1)
+            v = _mm256_mul_ps(w, _mm256_loadu_ps(src+x));
+        else
+            v = _mm256_mul_ps(w, _mm256_i32gather_ps(src+x*step, idx, 4));
+        _mm256_storeu_pd(dst+x, _mm256_add_pd(_mm256_loadu_pd(dst+x),
+            _mm256_cvtps_pd(_mm256_castps256_ps128(v))));
+        _mm256_storeu_pd(dst+x+4, _mm256_add_pd(_mm256_loadu_pd(dst+x+4),
+            _mm256_cvtps_pd(_mm256_extractf128_ps(v, 1))));
+    }
+    for (; x<len; ++x)
+        dst[x] += wt * src[x*step];
+}
+
+/*
+ * Both passes are double precision and add the same products in the same
+ * order as the scalar code, so the results are identical.
+ */
+AVX2 IQA_NO_CONTRACT static void _ssim_stats_row_avx2(const float *ref, const float *cmp, int stride, int w,
+    const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+    double *col, float *stats)
+{
+    int x,u,v,i;
+    int dst_w = w - kw + 1;
+    double *c[5], sum[5];
+    float *s[5];
+    double wt, da, db;
+    float m1, m2;
+    const float *r, *q;
+    __m256d t, a, b, wa, wb, s0, s1, s2, s3, s4, sc;
+    __m128 f0, f1;
+
+    for (i=0; i<5; ++i) {
+        c[i] = col + i*w;
+        s[i] = stats + i*dst_w;
+    }
+    for (x=0; x<5*w; ++x)
+        col[x] = 0.0;
+
+    /* Vertical pass */
+    for (v=0; v<kh; ++v) {
+        r = ref + v*stride;
+        q = cmp + v*stride;
+        wt = taps_v[v];
+        t = _mm256_set1_pd(wt);
+        for (x=0; x+4<=w; x+=4) {
+            a = _mm256_cvtps_pd(_mm_loadu_ps(r+x));
+            b = _mm256_cvtps_pd(_mm_loadu_ps(q+x));
+            wa = _mm256_mul_pd(t, a);
+            wb = _mm256_mul_pd(t, b);
+            _mm256_storeu_pd(c[0]+x, _mm256_add_pd(_mm256_loadu_pd(c[0]+x), wa));
+            _mm256_storeu_pd(c[1]+x, _mm256_add_pd(_mm256_loadu_pd(c[1]+x), wb));
+            _mm256_storeu_pd(c[2]+x, _mm256_add_pd(_mm256_loadu_pd(c[2]+x), _mm256_mul_pd(wa, a)));
+            _mm256_storeu_pd(c[3]+x, _mm256_add_pd(_mm256_loadu_pd(c[3]+x), _mm256_mul_pd(wb, b)));
+            _mm256_storeu_pd(c[4]+x, _mm256_add_pd(_mm256_loadu_pd(c[4]+x), _mm256_mul_pd(wa, b)));
+        }
+        for (; x<w; ++x) {
+            da = r[x];
+            db = q[x];
+            c[0][x] += wt * da;
+            c[1][x] += wt * db;
+            c[2][x] += wt * da * da;
+            c[3][x] += wt * db * db;
+            c[4][x] += wt * da * db;
+        }
+    }
+
+    /* Horizontal pass. The variances are formed in single precision. */
+    sc = _mm256_set1_pd(scale);
+    for (x=0; x+4<=dst_w; x+=4) {
+        s0 = s1 = s2 = s3 = s4 = _mm256_setzero_pd();
+        for (u=0; u<kw; ++u) {
+            t = _mm256_set1_pd(taps_h[u]);
+            s0 = _mm256_add_pd(s0, _mm256_mul_pd(t, _mm256_loadu_pd(c[0]+x+u)));
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(t, _mm256_loadu_pd(c[1]+x+u)));
+            s2 = _mm256_add_pd(s2, _mm256_mul_pd(t, _mm256_loadu_pd(c[2]+x+u)));
+            s3 = _mm256_add_pd(s3, _mm256_mul_pd(t, _mm256_loadu_pd(c[3]+x+u)));
+            s4 = _mm256_add_pd(s4, _mm256_mul_pd(t, _mm256_loadu_pd(c[4]+x+u)));
+        }
+        f0 = _mm256_cvtpd_ps(_mm256_mul_pd(s0, sc));
+        f1 = _mm256_cvtpd_ps(_mm256_mul_pd(s1, sc));
+        _mm_storeu_ps(s[0]+x, f0);
+        _mm_storeu_ps(s[1]+x, f1);
+        _mm_storeu_ps(s[2]+x, _mm_sub_ps(_mm256_cvtpd_ps(_mm256_mul_pd(s2, sc)), _mm_mul_ps(f0, f0)));
+        _mm_storeu_ps(s[3]+x, _mm_sub_ps(_mm256_cvtpd_ps(_mm256_mul_pd(s3, sc)), _mm_mul_ps(f1, f1)));
+        _mm_storeu_ps(s[4]+x, _mm_sub_ps(_mm256_cvtpd_ps(_mm256_mul_pd(s4, sc)), _mm_mul_ps(f0, f1)));
+    }
+    for (; x<dst_w; ++x) {
+        for (i=0; i<5; ++i)
+            sum[i] = 0.0;
+        for (u=0; u<kw; ++u) {
+            wt = taps_h[u];
+            for (i=0; i<5; ++i)
+                sum[i] += wt * c[i][x+u];
+        }
+        m1 = (float)(sum[0] * scale);
+        m2 = (float)(sum[1] * scale);
+        s[0][x] = m1;
+        s[1][x] = m2;
+        s[2][x] = (float)(sum[2] * scale) - m1*m1;
+        s[3][x] = (float)(sum[3] * scale) - m2*m2;
+        s[4][x] = (float)(sum[4] * scale) - m1*m2;
+    }
+}
+
+AVX2 IQA_NO_CONTRACT static void _ssim_cmp_stats_row_avx2(const float *ref, const float *cmp, int stride, int w,
+    const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+    double *col, float *stats)
+{
+    int x,u,v,i;
+    int dst_w = w - kw + 1;
+    double *c[3], sum[3];
+    float *s[5];
+    double wt, da, db;
+    float m1, m2;
+    const float *r, *q;
+    __m256d t, a, b, wa, wb, s1, s3, s4, sc;
+    __m128 f0, f1;
+
+    for (i=0; i<3; ++i)
+        c[i] = col + i*w;
+    for (i=0; i<5; ++i)
+        s[i] = stats + i*dst_w;
+    for (x=0; x<3*w; ++x)
+        col[x] = 0.0;
+
+    /* Vertical pass (mean cmp, E[cmp^2], E[ref*cmp]) */
+    for (v=0; v<kh; ++v) {
+        r = ref + v*stride;
+        q = cmp + v*stride;
+        wt = taps_v[v];
+        t = _mm256_set1_pd(wt);
+        for (x=0; x+4<=w; x+=4) {
+            a = _mm256_cvtps_pd(_mm_loadu_ps(r+x));
+            b = _mm256_cvtps_pd(_mm_loadu_ps(q+x));
+            wa = _mm256_mul_pd(t, a);
+            wb = _mm256_mul_pd(t, b);
+            _mm256_storeu_pd(c[0]+x, _mm256_add_pd(_mm256_loadu_pd(c[0]+x), wb));
+            _mm256_storeu_pd(c[1]+x, _mm256_add_pd(_mm256_loadu_pd(c[1]+x), _mm256_mul_pd(wb, b)));
+            _mm256_storeu_pd(c[2]+x, _mm256_add_pd(_mm256_loadu_pd(c[2]+x), _mm256_mul_pd(wa, b)));
+        }
+        for (; x<w; ++x) {
+            da = r[x];
+            db = q[x];
+            c[0][x] += wt * db;
+            c[1][x] += wt * db * db;
+            c[2][x] += wt * da * db;
+        }
+    }
+
+    /* Horizontal pass. The reference means are already in the first row. */
+    sc = _mm256_set1_pd(scale);
+    for (x=0; x+4<=dst_w; x+=4) {
+        s1 = s3 = s4 = _mm256_setzero_pd();
+        for (u=0; u<kw; ++u) {
+            t = _mm256_set1_pd(taps_h[u]);
+            s1 = _mm256_add_pd(s1, _mm256_mul_pd(t, _mm256_loadu_pd(c[0]+x+u)));
+            s3 = _mm256_add_pd(s3, _mm256_mul_pd(t, _mm256_loadu_pd(c[1]+x+u)));
+            s4 = _mm256_add_pd(s4, _mm256_mul_pd(t, _mm256_loadu_pd(c[2]+x+u)));
+        }
+        f0 = _mm_loadu_ps(s[0]+x);
+        f1 = _mm256_cvtpd_ps(_mm256_mul_pd(s1, sc));
+        _mm_storeu_ps(s[1]+x, f1);
+        _mm_storeu_ps(s[3]+x, _mm_sub_ps(_mm256_cvtpd_ps(_mm256_mul_pd(s3, sc)), _mm_mul_ps(f1, f1)));
+        _mm_storeu_ps(s[4]+x, _mm_sub_ps(_mm256_cvtpd_ps(_mm256_mul_pd(s4, sc)), _mm_mul_ps(f0, f1)));
+    }
+    for (; x<dst_w; ++x) {
+        for (i=0; i<3; ++i)
+            sum[i] = 0.0;
+        for (u=0; u<kw; ++u) {
+            wt = taps_h[u];
+            for (i=0; i<3; ++i)
+                sum[i] += wt * c[i][x+u];
+        }
+        m1 = s[0][x];
+        m2 = (float)(sum[0] * scale);
+        s[1][x] = m2;
+        s[3][x] = (float)(sum[1] * scale) - m2*m2;
+        s[4][x] = (float)(sum[2] * scale) - m1*m2;
+    }
+}
+
+AVX2 static double _ssim_pool_row_avx2(const float *stats, int len, float C1, float C2)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22, s12;
+    double sum;
+    double part[4];
+    __m256 vm1, vm2, vs11, vs22, vs12, num, den, r;
+    __m256 c1 = _mm256_set1_ps(C1);
+    __m256 c2 = _mm256_set1_ps(C2);
+    __m256 two = _mm256_set1_ps(2.0f);
+    __m256d acc = _mm256_setzero_pd();
+
+    for (x=0; x+8<=len; x+=8) {
+        vm1 = _mm256_loadu_ps(mu1+x);
+        vm2 = _mm256_loadu_ps(mu2+x);
+        vs11 = _mm256_loadu_ps(v11+x);
+        vs22 = _mm256_loadu_ps(v22+x);
+        vs12 = _mm256_loadu_ps(v12+x);
+        num = _mm256_mul_ps(_mm256_fmadd_ps(_mm256_mul_ps(two, vm1), vm2, c1),
+            _mm256_fmadd_ps(two, vs12, c2));
+        den = _mm256_mul_ps(_mm256_add_ps(_mm256_fmadd_ps(vm1, vm1, _mm256_mul_ps(vm2, vm2)), c1),
+            _mm256_add_ps(_mm256_add_ps(vs11, vs22), c2));
+        r = _mm256_div_ps(num, den);
+        acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_castps256_ps128(r)));
+        acc = _mm256_add_pd(acc, _mm256_cvtps_pd(_mm256_extractf128_ps(r, 1)));
+    }
+    _mm256_storeu_pd(part, acc);
+    sum = (part[0] + part[1]) + (part[2] + part[3]);
+    for (; x<len; ++x) {
+        m1 = mu1[x];
+        m2 = mu2[x];
+        s11 = v11[x];
+        s22 = v22[x];
+        s12 = v12[x];
+        sum += ((2.0 * m1 * m2 + C1) * (2.0 * s12 + C2)) /
+            ((m1*m1 + m2*m2 + C1) * (s11 + s22 + C2));
+    }
+    return sum;
+}
+
+/* The vector version of SSIM_TERMS(), 4 pixels at a time */
+AVX2 IQA_NO_CONTRACT static void _ssim_terms_row_avx2(const float *stats, int len, float C1, float C2, float C3,
+    double *l, double *c, double *s)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22;
+    double root;
+    int guarded = C1 == 0 || C2 == 0 || C3 == 0;
+    __m128 vm1, vm2, vs11, vs22, zero = _mm_setzero_ps();
+    __m128 c1 = _mm_set1_ps(C1), c2 = _mm_set1_ps(C2), c3 = _mm_set1_ps(C3);
+    __m256d c1d = _mm256_set1_pd(C1), c2d = _mm256_set1_pd(C2), c3d = _mm256_set1_pd(C3);
+    __m256d two = _mm256_set1_pd(2.0), one = _mm256_set1_pd(1.0), dzero = _mm256_setzero_pd();
+    __m256d vroot, lv, cv, sv, d11, d22, flat, mask;
+
+    for (x=0; x+4<=len; x+=4) {
+        vm1 = _mm_loadu_ps(mu1+x);
+        vm2 = _mm_loadu_ps(mu2+x);
+        vs11 = _mm_max_ps(zero, _mm_loadu_ps(v11+x));
+        vs22 = _mm_max_ps(zero, _mm_loadu_ps(v22+x));
+        vroot = _mm256_sqrt_pd(_mm256_cvtps_pd(_mm_mul_ps(vs11, vs22)));
+        lv = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_mul_pd(two, _mm256_cvtps_pd(vm1)), _mm256_cvtps_pd(vm2)), c1d),
+            _mm256_cvtps_pd(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vm1, vm1), _mm_mul_ps(vm2, vm2)), c1)));
+        cv = _mm256_div_pd(_mm256_add_pd(_mm256_mul_pd(two, vroot), c2d),
+            _mm256_cvtps_pd(_mm_add_ps(_mm_add_ps(vs11, vs22), c2)));
+        sv = _mm256_div_pd(_mm256_cvtps_pd(_mm_add_ps(_mm_loadu_ps(v12+x), c3)),
+            _mm256_add_pd(vroot, c3d));
+        if (guarded) {
+            if (C1 == 0) {
+                mask = _mm256_and_pd(_mm256_cmp_pd(_mm256_cvtps_pd(_mm_mul_ps(vm1, vm1)), dzero, _CMP_EQ_OQ),
+                    _mm256_cmp_pd(_mm256_cvtps_pd(_mm_mul_ps(vm2, vm2)), dzero, _CMP_EQ_OQ));
+                lv = _mm256_blendv_pd(lv, one, mask);
+            }
+            if (C2 == 0) {
+                mask = _mm256_cmp_pd(_mm256_cvtps_pd(_mm_add_ps(vs11, vs22)), dzero, _CMP_EQ_OQ);
+                cv = _mm256_blendv_pd(cv, one, mask);
+            }
+            if (C3 == 0) {
+                d11 = _mm256_cmp_pd(_mm256_cvtps_pd(vs11), dzero, _CMP_EQ_OQ);
+                d22 = _mm256_cmp_pd(_mm256_cvtps_pd(vs22), dzero, _CMP_EQ_OQ);
+                flat = _mm256_cmp_pd(vroot, dzero, _CMP_EQ_OQ);
+                sv = _mm256_blendv_pd(sv, dzero, _mm256_and_pd(flat, _mm256_or_pd(d11, d22)));
+                sv = _mm256_blendv_pd(sv, one, _mm256_and_pd(flat, _mm256_and_pd(d11, d22)));
+            }
+        }
+        _mm256_storeu_pd(l+x, lv);
+        _mm256_storeu_pd(c+x, cv);
+        _mm256_storeu_pd(s+x, sv);
+    }
+    for (; x<len; ++x) {
+        SSIM_TERMS(1)
+    }
+}
+
+/* Adds the 32-bit products of the unsigned 16-bit lanes of v and t to lo/hi.
+ * Within each 128-bit half, lo gets the first 4 lanes and hi the last 4. */
+#define MUL_ADD_U16(v, t, lo, hi) \
+    pl = _mm256_mullo_epi16(v, t); \
+    ph = _mm256_mulhi_epu16(v, t); \
+    lo = _mm256_add_epi32(lo, _mm256_unpacklo_epi16(pl, ph)); \
+    hi = _mm256_add_epi32(hi, _mm256_unpackhi_epi16(pl, ph));
+
+/* Stores the 16 sums held in lo/hi in order */
+#define STORE_U16_SUMS(dst, lo, hi) \
+    _mm256_storeu_si256((__m256i*)(dst), _mm256_permute2x128_si256(lo, hi, 0x20)); \
+    _mm256_storeu_si256((__m256i*)(dst)+1, _mm256_permute2x128_si256(lo, hi, 0x31));
+
+/* 16 pixels at a time in unsigned 16-bit lanes (a*a fits, but not in pmaddwd's signed lanes) */
+AVX2 static void _int_moments_row_avx2(const unsigned char *a, const unsigned char *b, int len,
+    const int *taps, int ntaps, int *out)
+{
+    int x, u;
+    unsigned int t, pa, pb, sa, sb, saa, sbb, sab;
+    __m256i va, vb, vt, pl, ph, zero = _mm256_setzero_si256();
+    __m256i a0, a1, b0, b1, aa0, aa1, bb0, bb1, ab0, ab1;
+
+    for (x=0; x+16<=len; x+=16) {
+        a0 = a1 = b0 = b1 = aa0 = aa1 = bb0 = bb1 = ab0 = ab1 = zero;
+        for (u=0; u<ntaps; ++u) {
+            vt = _mm256_set1_epi16((short)taps[u]);
+            va = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(a+x+u)));
+            vb = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(b+x+u)));
+            MUL_ADD_U16(va, vt, a0, a1)
+            MUL_ADD_U16(vb, vt, b0, b1)
+            MUL_ADD_U16(_mm256_mullo_epi16(va, va), vt, aa0, aa1)
+            MUL_ADD_U16(_mm256_mullo_epi16(vb, vb), vt, bb0, bb1)
+            MUL_ADD_U16(_mm256_mullo_epi16(va, vb), vt, ab0, ab1)
+        }
+        STORE_U16_SUMS(out+x, a0, a1)
+        STORE_U16_SUMS(out+len+x, b0, b1)
+        STORE_U16_SUMS(out+2*len+x, aa0, aa1)
+        STORE_U16_SUMS(out+3*len+x, bb0, bb1)
+        STORE_U16_SUMS(out+4*len+x, ab0, ab1)
+    }
+    for (; x<len; ++x) {
+        INT_MOMENTS
+    }
+}
+
+#undef MUL_ADD_U16
+#undef STORE_U16_SUMS
+
+
+/* exp(e*log|v|): log from the atanh series of the mantissa, exp from its Taylor polynomial */
+AVX2 IQA_NO_CONTRACT static void _pow_row_avx2(double *v, int len, double e)
+{
+    int x, i;
+    __m256i bits, sign, n_bits;
+    __m256d a, m, k, t, w, p, y, n, r;
+    __m256d big, ok;
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256i abs_mask = _mm256_set1_epi64x(0x7fffffffffffffffLL);
+    for (x=0; x+4<=len; x+=4) {
+        a = _mm256_loadu_pd(v+x);
+        /* |v| = 2^k * m, with m in [sqrt(1/2), sqrt(2)) */
+        bits = _mm256_and_si256(_mm256_castpd_si256(a), abs_mask);
+        sign = _mm256_and_si256(_mm256_castpd_si256(a), _mm256_set1_epi64x(0x8000000000000000LL));
+        a = _mm256_castsi256_pd(bits);
+        m = _mm256_castsi256_pd(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi64x(0x000fffffffffffffLL)),
+            _mm256_set1_epi64x(0x3ff0000000000000LL)));
+        /* The exponent field as the low bits of 2^52, minus 2^52 and the bias */
+        k = _mm256_sub_pd(_mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), _mm256_set1_epi64x(0x4330000000000000LL))),
+            _mm256_set1_pd(4503599627371519.0));
+        big = _mm256_cmp_pd(m, _mm256_set1_pd(POW_SQRT2), _CMP_GT_OQ);
+        m = _mm256_blendv_pd(m, _mm256_mul_pd(m, _mm256_set1_pd(0.5)), big);
+        k = _mm256_add_pd(k, _mm256_and_pd(big, one));
+
+        /* log(m) = 2*atanh(t), with |t| <= 0.1716 */
+        t = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+        w = _mm256_mul_pd(t, t);
+        p = _mm256_set1_pd(1.0/21);
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/19));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/17));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/15));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/13));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/11));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/9));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/7));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/5));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), _mm256_set1_pd(1.0/3));
+        p = _mm256_add_pd(_mm256_mul_pd(p, w), one);
+        y = _mm256_mul_pd(_mm256_set1_pd(e), _mm256_add_pd(_mm256_mul_pd(k, _mm256_set1_pd(POW_LN2_HI)),
+            _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(t, t), p), _mm256_mul_pd(k, _mm256_set1_pd(POW_LN2_LO)))));
+
+        /* exp(y) = 2^n * exp(r), with |r| <= log(2)/2 */
+        n = _mm256_add_pd(_mm256_mul_pd(y, _mm256_set1_pd(POW_LOG2E)), _mm256_set1_pd(POW_ROUND));
+        n_bits = _mm256_castpd_si256(n);
+        n = _mm256_sub_pd(n, _mm256_set1_pd(POW_ROUND));
+        r = _mm256_sub_pd(_mm256_sub_pd(y, _mm256_mul_pd(n, _mm256_set1_pd(POW_LN2_HI))),
+            _mm256_mul_pd(n, _mm256_set1_pd(POW_LN2_LO)));
+        p = _mm256_set1_pd(1.0/6227020800.0);
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/479001600.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/39916800.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/3628800.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/362880.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/40320.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/5040.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/720.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/120.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/24.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/6.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), _mm256_set1_pd(1.0/2.0));
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), one);
+        p = _mm256_add_pd(_mm256_mul_pd(p, r), one);
+        p = _mm256_mul_pd(p, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_add_epi64(n_bits, _mm256_set1_epi64x(1023)), 52)));   /* 2^n */
+
+        ok = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(a, _mm256_set1_pd(DBL_MIN), _CMP_GE_OQ), _mm256_cmp_pd(a, _mm256_set1_pd(DBL_MAX), _CMP_LE_OQ)),
+            _mm256_cmp_pd(_mm256_castsi256_pd(_mm256_and_si256(_mm256_castpd_si256(y), abs_mask)), _mm256_set1_pd(POW_Y_MAX), _CMP_LE_OQ));
+        if (_mm256_movemask_pd(ok) == 0xF)
+            _mm256_storeu_pd(v+x, _mm256_castsi256_pd(_mm256_or_si256(_mm256_castpd_si256(p), sign)));
+        else {
+            for (i=x; i<x+4; ++i) {
+                POW_SIGNED(i)
+            }
+        }
+    }
+    for (; x<len; ++x) {
+        POW_SIGNED(x)
+    }
+}
+
+AVX2 static double _sum_row_avx2(const double *v, int len)
+{
+    int x;
+    double sum;
+    double part[4];
+    __m256d acc = _mm256_setzero_pd();
+
+    for (x=0; x+4<=len; x+=4)
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(v+x));
+    _mm256_storeu_pd(part, acc);
+    sum = (part[0] + part[1]) + (part[2] + part[3]);
+    for (; x<len; ++x)
+        sum += v[x];
+    return sum;
+}
+
+AVX2 IQA_NO_CONTRACT static double _lcs_sum_row_avx2(const double *l, const double *c, const double *s,
+    int len, double *prod)
+{
+    int x;
+    double sum, p;
+    double part[4];
+    __m256d vp;
+    __m256d acc = _mm256_setzero_pd();
+    const __m256d sign = _mm256_set1_pd(-0.0);
+
+    for (x=0; x+4<=len; x+=4) {
+        vp = _mm256_mul_pd(_mm256_mul_pd(_mm256_loadu_pd(l+x), _mm256_loadu_pd(c+x)), _mm256_loadu_pd(s+x));
+        if (prod)
+            _mm256_storeu_pd(prod+x, _mm256_andnot_pd(sign, vp));
+        acc = _mm256_add_pd(acc, vp);
+    }
+    _mm256_storeu_pd(part, acc);
+    sum = (part[0] + part[1]) + (part[2] + part[3]);
+    for (; x<len; ++x) {
+        p = l[x] * c[x] * s[x];
+        if (prod)
+            prod[x] = fabs(p);
+        sum += p;
+    }
+    return sum;
+}
+
+const struct _iqa_simd _iqa_simd_avx2 = {
+    IQA_SIMD_AVX2,
+    "avx2",
+    _u8_to_float_avx2,
+    _u16_to_float_avx2,
+    _filter_row_avx2,
+    _accum_row_avx2,
+    _accum_row_d_avx2,
+    _ssim_stats_row_avx2,
+    _ssim_cmp_stats_row_avx2,
+    _ssim_pool_row_avx2,
+    _ssim_terms_row_avx2,
+    _int_moments_row_avx2,
+    _pow_row_avx2,
+    _sum_row_avx2,
+    _lcs_sum_row_avx2
+};
+
+#endif /*IQA_SIMD_X86*/
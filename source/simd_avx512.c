@@ -0,0 +1,562 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+#include <float.h>
+#include <math.h>
+
+#ifdef IQA_SIMD_X86
+
+#include <immintrin.h>
+
+#define AVX512 IQA_TARGET("avx512f")
+
+AVX512 static void _u8_to_float_avx512(const unsigned char *src, float *dst, int len)
+{
+    int x;
+    __m128i p;
+    for (x=0; x+16<=len; x+=16) {
+        p = _mm_loadu_si128((const __m128i*)(src+x));
+        _mm512_storeu_ps(dst+x, _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(p)));
+    }
+    for (; x<len; ++x)
+        dst[x] = (float)src[x];
+}
+
+AVX512 static void _u16_to_float_avx512(const unsigned short *src, float *dst, int len, int shift)
+{
+    int x;
+    __m512i p;
+    __m128i n = _mm_cvtsi32_si128(shift);
+    for (x=0; x+16<=len; x+=16) {
+        p = _mm512_srl_epi32(_mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(src+x))), n);
+        _mm512_storeu_ps(dst+x, _mm512_cvtepi32_ps(p));
+    }
+    for (; x<len; ++x)
+        dst[x] = (float)(src[x] >> shift);
+}
+
+AVX512 static void _filter_row_avx512(const float *src, float *dst, int len, const float *taps, int ntaps)
+{
+    int x,u;
+    float sum;
+    __m512 acc;
+    for (x=0; x+16<=len; x+=16) {
+        acc = _mm512_setzero_ps();
+        for (u=0; u<ntaps; ++u)
+            acc = _mm512_fmadd_ps(_mm512_set1_ps(taps[u]), _mm512_loadu_ps(src+x+u), acc);
+        _mm512_storeu_ps(dst+x, acc);
+    }
+    for (; x<len; ++x) {
+        sum = 0.0f;
+        for (u=0; u<ntaps; ++u)
+            sum += taps[u] * src[x+u];
+        dst[x] = sum;
+    }
+}
+
+AVX512 static void _accum_row_avx512(const float *src, int step, float wt, float *dst, int len)
+{
+    int x;
+    __m512 w = _mm512_set1_ps(wt);
+    __m512i idx;
+    if (step == 1) {
+        for (x=0; x+16<=len; x+=16)
+            _mm512_storeu_ps(dst+x, _mm512_fmadd_ps(w, _mm512_loadu_ps(src+x), _mm512_loadu_ps(dst+x)));
+    }
+    else {
+        idx = _mm512_mullo_epi32(_mm512_set_epi32(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0),
+            _mm512_set1_epi32(step));
+        for (x=0; x+16<=len; x+=16) {
+            _mm512_storeu_ps(dst+x, _mm512_fmadd_ps(w, _mm512_i32gather_ps(idx, src+x*step, 4),
+                _mm512_loadu_ps(dst+x)));
+        }
+    }
+    for (; x<len; ++x)
+        dst[x] += wt * src[x*step];
+}
+
+AVX512 static void _accum_row_d_avx512(const float *src, int step, float wt, double *dst, int len)
+{
+    int x;
+    __m512 w = _mm512_set1_ps(wt);
+    __m512 v;
+    __m512i idx = _mm512_mullo_epi32(_mm512_set_epi32(15,14,13,12,11,10,9,8,7,6,5,4,3,2,1,0),
+        _mm512_set1_epi32(step));
+    for (x=0; x+16<=len; x+=16) {
+        if (step == 1)
+            v = _mm512_mul_ps(w, _mm512_loadu_ps(src+x));
+        else
+            v = _mm512_mul_ps(w, _mm512_i32gather_ps(idx, src+x*step, 4));
+        _mm512_storeu_pd(dst+x, _mm512_add_pd(_mm512_loadu_pd(dst+x),
+            _mm512_cvtps_pd(_mm512_castps512_ps256(v))));
+        _mm512_storeu_pd(dst+x+8, _mm512_add_pd(_mm512_loadu_pd(dst+x+8),
+            _mm512_cvtps_pd(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(v), 1)))));
+    }
+    for (; x<len; ++x)
+        dst[x] += wt * src[x*step];
+}
+
+/*
+ * Both passes are double precision and add the same products in the same
+ * order as the scalar code, so the results are identical.
+ */
+AVX512 IQA_NO_CONTRACT static void _ssim_stats_row_avx512(const float *ref, const float *cmp, int stride, int w,
+    const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+    double *col, float *stats)
+{
+    int x,u,v,i;
+    int dst_w = w - kw + 1;
+    double *c[5], sum[5];
+    float *s[5];
+    double wt, da, db;
+    float m1, m2;
+    const float *r, *q;
+    __m512d t, a, b, wa, wb, s0, s1, s2, s3, s4, sc;
+    __m256 f0, f1;
+
+    for (i=0; i<5; ++i) {
+        c[i] = col + i*w;
+        s[i] = stats + i*dst_w;
+    }
+    for (x=0; x<5*w; ++x)
+        col[x] = 0.0;
+
+    /* Vertical pass */
+    for (v=0; v<kh; ++v) {
+        r = ref + v*stride;
+        q = cmp + v*stride;
+        wt = taps_v[v];
+        t = _mm512_set1_pd(wt);
+        for (x=0; x+8<=w; x+=8) {
+            a = _mm512_cvtps_pd(_mm256_loadu_ps(r+x));
+            b = _mm512_cvtps_pd(_mm256_loadu_ps(q+x));
+            wa = _mm512_mul_pd(t, a);
+            wb = _mm512_mul_pd(t, b);
+            _mm512_storeu_pd(c[0]+x, _mm512_add_pd(_mm512_loadu_pd(c[0]+x), wa));
+            _mm512_storeu_pd(c[1]+x, _mm512_add_pd(_mm512_loadu_pd(c[1]+x), wb));
+            _mm512_storeu_pd(c[2]+x, _mm512_add_pd(_mm512_loadu_pd(c[2]+x), _mm512_mul_pd(wa, a)));
+            _mm512_storeu_pd(c[3]+x, _mm512_add_pd(_mm512_loadu_pd(c[3]+x), _mm512_mul_pd(wb, b)));
+            _mm512_storeu_pd(c[4]+x, _mm512_add_pd(_mm512_loadu_pd(c[4]+x), _mm512_mul_pd(wa, b)));
+        }
+        for (; x<w; ++x) {
+            da = r[x];
+            db = q[x];
+            c[0][x] += wt * da;
+            c[1][x] += wt * db;
+            c[2][x] += wt * da * da;
+            c[3][x] += wt * db * db;
+            c[4][x] += wt * da * db;
+        }
+    }
+
+    /* Horizontal pass. The variances are formed in single precision. */
+    sc = _mm512_set1_pd(scale);
+    for (x=0; x+8<=dst_w; x+=8) {
+        s0 = s1 = s2 = s3 = s4 = _mm512_setzero_pd();
+        for (u=0; u<kw; ++u) {
+            t = _mm512_set1_pd(taps_h[u]);
+            s0 = _mm512_add_pd(s0, _mm512_mul_pd(t, _mm512_loadu_pd(c[0]+x+u)));
+            s1 = _mm512_add_pd(s1, _mm512_mul_pd(t, _mm512_loadu_pd(c[1]+x+u)));
+            s2 = _mm512_add_pd(s2, _mm512_mul_pd(t, _mm512_loadu_pd(c[2]+x+u)));
+            s3 = _mm512_add_pd(s3, _mm512_mul_pd(t, _mm512_loadu_pd(c[3]+x+u)));
+            s4 = _mm512_add_pd(s4, _mm512_mul_pd(t, _mm512_loadu_pd(c[4]+x+u)));
+        }
+        f0 = _mm512_cvtpd_ps(_mm512_mul_pd(s0, sc));
+        f1 = _mm512_cvtpd_ps(_mm512_mul_pd(s1, sc));
+        _mm256_storeu_ps(s[0]+x, f0);
+        _mm256_storeu_ps(s[1]+x, f1);
+        _mm256_storeu_ps(s[2]+x, _mm256_sub_ps(_mm512_cvtpd_ps(_mm512_mul_pd(s2, sc)), _mm256_mul_ps(f0, f0)));
+        _mm256_storeu_ps(s[3]+x, _mm256_sub_ps(_mm512_cvtpd_ps(_mm512_mul_pd(s3, sc)), _mm256_mul_ps(f1, f1)));
+        _mm256_storeu_ps(s[4]+x, _mm256_sub_ps(_mm512_cvtpd_ps(_mm512_mul_pd(s4, sc)), _mm256_mul_ps(f0, f1)));
+    }
+    for (; x<dst_w; ++x) {
+        for (i=0; i<5; ++i)
+            sum[i] = 0.0;
+        for (u=0; u<kw; ++u) {
+            wt = taps_h[u];
+            for (i=0; i<5; ++i)
+                sum[i] += wt * c[i][x+u];
+        }
+        m1 = (float)(sum[0] * scale);
+        m2 = (float)(sum[1] * scale);
+        s[0][x] = m1;
+        s[1][x] = m2;
+        s[2][x] = (float)(sum[2] * scale) - m1*m1;
+        s[3][x] = (float)(sum[3] * scale) - m2*m2;
+        s[4][x] = (float)(sum[4] * scale) - m1*m2;
+    }
+}
+
+AVX512 IQA_NO_CONTRACT static void _ssim_cmp_stats_row_avx512(const float *ref, const float *cmp, int stride, int w,
+    const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+    double *col, float *stats)
+{
+    int x,u,v,i;
+    int dst_w = w - kw + 1;
+    double *c[3], sum[3];
+    float *s[5];
+    double wt, da, db;
+    float m1, m2;
+    const float *r, *q;
+    __m512d t, a, b, wa, wb, s1, s3, s4, sc;
+    __m256 f0, f1;
+
+    for (i=0; i<3; ++i)
+        c[i] = col + i*w;
+    for (i=0; i<5; ++i)
+        s[i] = stats + i*dst_w;
+    for (x=0; x<3*w; ++x)
+        col[x] = 0.0;
+
+    /* Vertical pass (mean cmp, E[cmp^2], E[ref*cmp]) */
+    for (v=0; v<kh; ++v) {
+        r = ref + v*stride;
+        q = cmp + v*stride;
+        wt = taps_v[v];
+        t = _mm512_set1_pd(wt);
+        for (x=0; x+8<=w; x+=8) {
+            a = _mm512_cvtps_pd(_mm256_loadu_ps(r+x));
+            b = _mm512_cvtps_pd(_mm256_loadu_ps(q+x));
+            wa = _mm512_mul_pd(t, a);
+            wb = _mm512_mul_pd(t, b);
+            _mm512_storeu_pd(c[0]+x, _mm512_add_pd(_mm512_loadu_pd(c[0]+x), wb));
+            _mm512_storeu_pd(c[1]+x, _mm512_add_pd(_mm512_loadu_pd(c[1]+x), _mm512_mul_pd(wb, b)));
+            _mm512_storeu_pd(c[2]+x, _mm512_add_pd(_mm512_loadu_pd(c[2]+x), _mm512_mul_pd(wa, b)));
+        }
+        for (; x<w; ++x) {
+            da = r[x];
+            db = q[x];
+            c[0][x] += wt * db;
+            c[1][x] += wt * db * db;
+            c[2][x] += wt * da * db;
+        }
+    }
+
+    /* Horizontal pass. The reference means are already in the first row. */
+    sc = _mm512_set1_pd(scale);
+    for (x=0; x+8<=dst_w; x+=8) {
+        s1 = s3 = s4 = _mm512_setzero_pd();
+        for (u=0; u<kw; ++u) {
+            t = _mm512_set1_pd(taps_h[u]);
+            s1 = _mm512_add_pd(s1, _mm512_mul_pd(t, _mm512_loadu_pd(c[0]+x+u)));
+            s3 = _mm512_add_pd(s3, _mm512_mul_pd(t, _mm512_loadu_pd(c[1]+x+u)));
+            s4 = _mm512_add_pd(s4, _mm512_mul_pd(t, _mm512_loadu_pd(c[2]+x+u)));
+        }
+        f0 = _mm256_loadu_ps(s[0]+x);
+        f1 = _mm512_cvtpd_ps(_mm512_mul_pd(s1, sc));
+        _mm256_storeu_ps(s[1]+x, f1);
+        _mm256_storeu_ps(s[3]+x, _mm256_sub_ps(_mm512_cvtpd_ps(_mm512_mul_pd(s3, sc)), _mm256_mul_ps(f1, f1)));
+        _mm256_storeu_ps(s[4]+x, _mm256_sub_ps(_mm512_cvtpd_ps(_mm512_mul_pd(s4, sc)), _mm256_mul_ps(f0, f1)));
+    }
+    for (; x<dst_w; ++x) {
+        for (i=0; i<3; ++i)
+            sum[i] = 0.0;
+        for (u=0; u<kw; ++u) {
+            wt = taps_h[u];
+            for (i=0; i<3; ++i)
+                sum[i] += wt * c[i][x+u];
+        }
+        m1 = s[0][x];
+        m2 = (float)(sum[0] * scale);
+        s[1][x] = m2;
+        s[3][x] = (float)(sum[1] * scale) - m2*m2;
+        s[4][x] = (float)(sum[2] * scale) - m1*m2;
+    }
+}
+
+AVX512 static double _ssim_pool_row_avx512(const float *stats, int len, float C1, float C2)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22, s12;
+    double sum;
+    __m512 vm1, vm2, vs11, vs22, vs12, num, den, r;
+    __m512 c1 = _mm512_set1_ps(C1);
+    __m512 c2 = _mm512_set1_ps(C2);
+    __m512 two = _mm512_set1_ps(2.0f);
+    __m512d acc = _mm512_setzero_pd();
+
+    for (x=0; x+16<=len; x+=16) {
+        vm1 = _mm512_loadu_ps(mu1+x);
+        vm2 = _mm512_loadu_ps(mu2+x);
+        vs11 = _mm512_loadu_ps(v11+x);
+        vs22 = _mm512_loadu_ps(v22+x);
+        vs12 = _mm512_loadu_ps(v12+x);
+        num = _mm512_mul_ps(_mm512_fmadd_ps(_mm512_mul_ps(two, vm1), vm2, c1),
+            _mm512_fmadd_ps(two, vs12, c2));
+        den = _mm512_mul_ps(_mm512_add_ps(_mm512_fmadd_ps(vm1, vm1, _mm512_mul_ps(vm2, vm2)), c1),
+            _mm512_add_ps(_mm512_add_ps(vs11, vs22), c2));
+        r = _mm512_div_ps(num, den);
+        acc = _mm512_add_pd(acc, _mm512_cvtps_pd(_mm512_castps512_ps256(r)));
+        acc = _mm512_add_pd(acc, _mm512_cvtps_pd(
+            _mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(r), 1))));
+    }
+    sum = _mm512_reduce_add_pd(acc);
+    for (; x<len; ++x) {
+        m1 = mu1[x];
+        m2 = mu2[x];
+        s11 = v11[x];
+        s22 = v22[x];
+        s12 = v12[x];
+        sum += ((2.0 * m1 * m2 + C1) * (2.0 * s12 + C2)) /
+            ((m1*m1 + m2*m2 + C1) * (s11 + s22 + C2));
+    }
+    return sum;
+}
+
+/* The vector version of SSIM_TERMS(), 8 pixels at a time */
+AVX512 IQA_NO_CONTRACT static void _ssim_terms_row_avx512(const float *stats, int len, float C1, float C2, float C3,
+    double *l, double *c, double *s)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22;
+    double root;
+    int guarded = C1 == 0 || C2 == 0 || C3 == 0;
+    __m256 vm1, vm2, vs11, vs22, zero = _mm256_setzero_ps();
+    __m256 c1 = _mm256_set1_ps(C1), c2 = _mm256_set1_ps(C2), c3 = _mm256_set1_ps(C3);
+    __m512d c1d = _mm512_set1_pd(C1), c2d = _mm512_set1_pd(C2), c3d = _mm512_set1_pd(C3);
+    __m512d two = _mm512_set1_pd(2.0), one = _mm512_set1_pd(1.0), dzero = _mm512_setzero_pd();
+    __m512d vroot, lv, cv, sv;
+    __mmask8 d11, d22, flat;
+
+    for (x=0; x+8<=len; x+=8) {
+        vm1 = _mm256_loadu_ps(mu1+x);
+        vm2 = _mm256_loadu_ps(mu2+x);
+        vs11 = _mm256_max_ps(zero, _mm256_loadu_ps(v11+x));
+        vs22 = _mm256_max_ps(zero, _mm256_loadu_ps(v22+x));
+        vroot = _mm512_sqrt_pd(_mm512_cvtps_pd(_mm256_mul_ps(vs11, vs22)));
+        lv = _mm512_div_pd(_mm512_add_pd(_mm512_mul_pd(_mm512_mul_pd(two, _mm512_cvtps_pd(vm1)), _mm512_cvtps_pd(vm2)), c1d),
+            _mm512_cvtps_pd(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vm1, vm1), _mm256_mul_ps(vm2, vm2)), c1)));
+        cv = _mm512_div_pd(_mm512_add_pd(_mm512_mul_pd(two, vroot), c2d),
+            _mm512_cvtps_pd(_mm256_add_ps(_mm256_add_ps(vs11, vs22), c2)));
+        sv = _mm512_div_pd(_mm512_cvtps_pd(_mm256_add_ps(_mm256_loadu_ps(v12+x), c3)),
+            _mm512_add_pd(vroot, c3d));
+        if (guarded) {
+            if (C1 == 0) {
+                lv = _mm512_mask_blend_pd(
+                    _mm512_cmp_pd_mask(_mm512_cvtps_pd(_mm256_mul_ps(vm1, vm1)), dzero, _CMP_EQ_OQ) &
+                    _mm512_cmp_pd_mask(_mm512_cvtps_pd(_mm256_mul_ps(vm2, vm2)), dzero, _CMP_EQ_OQ),
+                    lv, one);
+            }
+            if (C2 == 0) {
+                cv = _mm512_mask_blend_pd(
+                    _mm512_cmp_pd_mask(_mm512_cvtps_pd(_mm256_add_ps(vs11, vs22)), dzero, _CMP_EQ_OQ),
+                    cv, one);
+            }
+            if (C3 == 0) {
+                d11 = _mm512_cmp_pd_mask(_mm512_cvtps_pd(vs11), dzero, _CMP_EQ_OQ);
+                d22 = _mm512_cmp_pd_mask(_mm512_cvtps_pd(vs22), dzero, _CMP_EQ_OQ);
+                flat = _mm512_cmp_pd_mask(vroot, dzero, _CMP_EQ_OQ);
+                sv = _mm512_mask_blend_pd(flat & (d11 | d22), sv, dzero);
+                sv = _mm512_mask_blend_pd(flat & d11 & d22, sv, one);
+            }
+        }
+        _mm512_storeu_pd(l+x, lv);
+        _mm512_storeu_pd(c+x, cv);
+        _mm512_storeu_pd(s+x, sv);
+    }
+    for (; x<len; ++x) {
+        SSIM_TERMS(1)
+    }
+}
+
+/* 16 pixels at a time in 32-bit lanes (16-bit multiplies need AVX-512BW) */
+AVX512 static void _int_moments_row_avx512(const unsigned char *a, const unsigned char *b, int len,
+    const int *taps, int ntaps, int *out)
+{
+    int x, u;
+    unsigned int t, pa, pb, sa, sb, saa, sbb, sab;
+    __m512i va, vb, vt, a0, b0, aa0, bb0, ab0;
+
+    for (x=0; x+16<=len; x+=16) {
+        a0 = b0 = aa0 = bb0 = ab0 = _mm512_setzero_si512();
+        for (u=0; u<ntaps; ++u) {
+            vt = _mm512_set1_epi32(taps[u]);
+            va = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(a+x+u)));
+            vb = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(b+x+u)));
+            a0 = _mm512_add_epi32(a0, _mm512_mullo_epi32(va, vt));
+            b0 = _mm512_add_epi32(b0, _mm512_mullo_epi32(vb, vt));
+            aa0 = _mm512_add_epi32(aa0, _mm512_mullo_epi32(_mm512_mullo_epi32(va, va), vt));
+            bb0 = _mm512_add_epi32(bb0, _mm512_mullo_epi32(_mm512_mullo_epi32(vb, vb), vt));
+            ab0 = _mm512_add_epi32(ab0, _mm512_mullo_epi32(_mm512_mullo_epi32(va, vb), vt));
+        }
+        _mm512_storeu_si512(out+x, a0);
+        _mm512_storeu_si512(out+len+x, b0);
+        _mm512_storeu_si512(out+2*len+x, aa0);
+        _mm512_storeu_si512(out+3*len+x, bb0);
+        _mm512_storeu_si512(out+4*len+x, ab0);
+    }
+    for (; x<len; ++x) {
+        INT_MOMENTS
+    }
+}
+
+
+/* exp(e*log|v|): log from the atanh series of the mantissa, exp from its Taylor polynomial */
+AVX512 IQA_NO_CONTRACT static void _pow_row_avx512(double *v, int len, double e)
+{
+    int x, i;
+    __m512i bits, sign, n_bits;
+    __m512d a, m, k, t, w, p, y, n, r;
+    __mmask8 big, ok;
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512i abs_mask = _mm512_set1_epi64(0x7fffffffffffffffLL);
+    for (x=0; x+8<=len; x+=8) {
+        a = _mm512_loadu_pd(v+x);
+        /* |v| = 2^k * m, with m in [sqrt(1/2), sqrt(2)) */
+        bits = _mm512_and_si512(_mm512_castpd_si512(a), abs_mask);
+        sign = _mm512_and_si512(_mm512_castpd_si512(a), _mm512_set1_epi64(0x8000000000000000LL));
+        a = _mm512_castsi512_pd(bits);
+        m = _mm512_castsi512_pd(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi64(0x000fffffffffffffLL)),
+            _mm512_set1_epi64(0x3ff0000000000000LL)));
+        /* The exponent field as the low bits of 2^52, minus 2^52 and the bias */
+        k = _mm512_sub_pd(_mm512_castsi512_pd(_mm512_or_si512(_mm512_srli_epi64(bits, 52), _mm512_set1_epi64(0x4330000000000000LL))),
+            _mm512_set1_pd(4503599627371519.0));
+        big = _mm512_cmp_pd_mask(m, _mm512_set1_pd(POW_SQRT2), _CMP_GT_OQ);
+        m = _mm512_mask_mul_pd(m, big, m, _mm512_set1_pd(0.5));
+        k = _mm512_mask_add_pd(k, big, k, one);
+
+        /* log(m) = 2*atanh(t), with |t| <= 0.1716 */
+        t = _mm512_div_pd(_mm512_sub_pd(m, one), _mm512_add_pd(m, one));
+        w = _mm512_mul_pd(t, t);
+        p = _mm512_set1_pd(1.0/21);
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/19));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/17));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/15));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/13));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/11));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/9));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/7));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/5));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), _mm512_set1_pd(1.0/3));
+        p = _mm512_add_pd(_mm512_mul_pd(p, w), one);
+        y = _mm512_mul_pd(_mm512_set1_pd(e), _mm512_add_pd(_mm512_mul_pd(k, _mm512_set1_pd(POW_LN2_HI)),
+            _mm512_add_pd(_mm512_mul_pd(_mm512_add_pd(t, t), p), _mm512_mul_pd(k, _mm512_set1_pd(POW_LN2_LO)))));
+
+        /* exp(y) = 2^n * exp(r), with |r| <= log(2)/2 */
+        n = _mm512_add_pd(_mm512_mul_pd(y, _mm512_set1_pd(POW_LOG2E)), _mm512_set1_pd(POW_ROUND));
+        n_bits = _mm512_castpd_si512(n);
+        n = _mm512_sub_pd(n, _mm512_set1_pd(POW_ROUND));
+        r = _mm512_sub_pd(_mm512_sub_pd(y, _mm512_mul_pd(n, _mm512_set1_pd(POW_LN2_HI))),
+            _mm512_mul_pd(n, _mm512_set1_pd(POW_LN2_LO)));
+        p = _mm512_set1_pd(1.0/6227020800.0);
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/479001600.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/39916800.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/3628800.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/362880.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/40320.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/5040.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/720.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/120.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/24.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/6.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), _mm512_set1_pd(1.0/2.0));
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), one);
+        p = _mm512_add_pd(_mm512_mul_pd(p, r), one);
+        p = _mm512_mul_pd(p, _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_add_epi64(n_bits, _mm512_set1_epi64(1023)), 52)));   /* 2^n */
+
+        ok = _mm512_cmp_pd_mask(a, _mm512_set1_pd(DBL_MIN), _CMP_GE_OQ) &
+            _mm512_cmp_pd_mask(a, _mm512_set1_pd(DBL_MAX), _CMP_LE_OQ) &
+            _mm512_cmp_pd_mask(_mm512_castsi512_pd(_mm512_and_si512(_mm512_castpd_si512(y), abs_mask)), _mm512_set1_pd(POW_Y_MAX), _CMP_LE_OQ);
+        if (ok == 0xFF)
+            _mm512_storeu_pd(v+x, _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(p), sign)));
+        else {
+            for (i=x; i<x+8; ++i) {
+                POW_SIGNED(i)
+            }
+        }
+    }
+    for (; x<len; ++x) {
+        POW_SIGNED(x)
+    }
+}
+
+AVX512 static double _sum_row_avx512(const double *v, int len)
+{
+    int x;
+    double sum;
+    __m512d acc = _mm512_setzero_pd();
+
+    for (x=0; x+8<=len; x+=8)
+        acc = _mm512_add_pd(acc, _mm512_loadu_pd(v+x));
+    sum = _mm512_reduce_add_pd(acc);
+    for (; x<len; ++x)
+        sum += v[x];
+    return sum;
+}
+
+AVX512 IQA_NO_CONTRACT static double _lcs_sum_row_avx512(const double *l, const double *c, const double *s,
+    int len, double *prod)
+{
+    int x;
+    double sum, p;
+    __m512d vp;
+    __m512d acc = _mm512_setzero_pd();
+
+    for (x=0; x+8<=len; x+=8) {
+        vp = _mm512_mul_pd(_mm512_mul_pd(_mm512_loadu_pd(l+x), _mm512_loadu_pd(c+x)), _mm512_loadu_pd(s+x));
+        if (prod)
+            _mm512_storeu_pd(prod+x, _mm512_abs_pd(vp));
+        acc = _mm512_add_pd(acc, vp);
+    }
+    sum = _mm512_reduce_add_pd(acc);
+    for (; x<len; ++x) {
+        p = l[x] * c[x] * s[x];
+        if (prod)
+            prod[x] = fabs(p);
+        sum += p;
+    }
+    return sum;
+}
+
+const struct _iqa_simd _iqa_simd_avx512 = {
+    IQA_SIMD_AVX512,
+    "avx512",
+    _u8_to_float_avx512,
+    _u16_to_float_avx512,
+    _filter_row_avx512,
+    _accum_row_avx512,
+    _accum_row_d_avx512,
+    _ssim_stats_row_avx512,
+    _ssim_cmp_stats_row_avx512,
+    _ssim_pool_row_avx512,
+    _ssim_terms_row_avx512,
+    _int_moments_row_avx512,
+    _pow_row_avx512,
+    _sum_row_avx512,
+    _lcs_sum_row_avx512
+};
+
+#endif /*IQA_SIMD_X86*/
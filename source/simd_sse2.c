@@ -0,0 +1,590 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "simd.h"
+#include <float.h>
+#include <math.h>
+
+#ifdef IQA_SIMD_X86
+
+#include <emmintrin.h>
+
+#define SSE2 IQA_TARGET("sse2")
+
+SSE2 static void _u8_to_float_sse2(const unsigned char *src, float *dst, int len)
+{
+    int x;
+    __m128i p, lo, hi, zero = _mm_setzero_si128();
+    for (x=0; x+16<=len; x+=16) {
+        p = _mm_loadu_si128((const __m128i*)(src+x));
+        lo = _mm_unpacklo_epi8(p, zero);
+        hi = _mm_unpackhi_epi8(p, zero);
+        _mm_storeu_ps(dst+x,    _mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_ps(dst+x+4,  _mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_ps(dst+x+8,  _mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_ps(dst+x+12, _mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)));
+    }
+    for (; x<len; ++x)
+        dst[x] = (float)src[x];
+}
+
+SSE2 static void _u16_to_float_sse2(const unsigned short *src, float *dst, int len, int shift)
+{
+    int x;
+    __m128i p, n = _mm_cvtsi32_si128(shift), zero = _mm_setzero_si128();
+    for (x=0; x+8<=len; x+=8) {
+        p = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(src+x)), n);
+        _mm_storeu_ps(dst+x,   _mm_cvtepi32_ps(_mm_unpacklo_epi16(p, zero)));
+        _mm_storeu_ps(dst+x+4, _mm_cvtepi32_ps(_mm_unpackhi_epi16(p, zero)));
+    }
+    for (; x<len; ++x)
+        dst[x] = (float)(src[x] >> shift);
+}
+
+SSE2 static void _filter_row_sse2(const float *src, float *dst, int len, const float *taps, int ntaps)
+{
+    int x,u;
+    float sum;
+    __m128 acc;
+    for (x=0; x+4<=len; x+=4) {
+        acc = _mm_setzero_ps();
+        for (u=0; u<ntaps; ++u)
+            acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(taps[u]), _mm_loadu_ps(src+x+u)));
+        _mm_storeu_ps(dst+x, acc);
+    }
+    for (; x<len; ++x) {
+        sum = 0.0f;
+        for (u=0; u<ntaps; ++u)
+            sum += taps[u] * src[x+u];
+        dst[x] = sum;
+    }
+}
+
+SSE2 static void _accum_row_sse2(const float *src, int step, float wt, float *dst, int len)
+{
+    int x;
+    const float *p;
+    __m128 w = _mm_set1_ps(wt);
+    __m128 v;
+    for (x=0; x+4<=len; x+=4) {
+        if (step == 1)
+            v = _mm_loadu_ps(src+x);
+        else {
+            p = src + x*step;
+            v = _mm_set_ps(p[3*step], p[2*step], p[step], p[0]);
+        }
+        _mm_storeu_ps(dst+x, _mm_add_ps(_mm_loadu_ps(dst+x), _mm_mul_ps(w, v)));
+    }
+    for (; x<len; ++x)
+        dst[x] += wt * src[x*step];
+}
+
+SSE2 static void _accum_row_d_sse2(const float *src, int step, float wt, double *dst, int len)
+{
+    int x;
+    const float *p;
+    __m128 w = _mm_set1_ps(wt);
+    __m128 v;
+    for (x=0; x+4<=len; x+=4) {
+        if (step == 1)
+            v = _mm_loadu_ps(src+x);
+        else {
+            p = src + x*step;
+            v = _mm_set_ps(p[3*step], p[2*step], p[step], p[0]);
+        }
+        v = _mm_mul_ps(w, v);
+        _mm_storeu_pd(dst+x, _mm_add_pd(_mm_loadu_pd(dst+x), _mm_cvtps_pd(v)));
+        _mm_storeu_pd(dst+x+2, _mm_add_pd(_mm_loadu_pd(dst+x+2), _mm_cvtps_pd(_mm_movehl_ps(v, v))));
+    }
+    for (; x<len; ++x)
+        dst[x] += wt * src[x*step];
+}
+
+/*
+ * Both passes are double precision and add the same products in the same
+ * order as the scalar code, so the results are identical.
+ */
+SSE2 IQA_NO_CONTRACT static void _ssim_stats_row_sse2(const float *ref, const float *cmp, int stride, int w,
+    const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+    double *col, float *stats)
+{
+    int x,u,v,i;
+    int dst_w = w - kw + 1;
+    double *c[5], sum[5];
+    float *s[5];
+    double wt, da, db;
+    float m1, m2;
+    const float *r, *q;
+    __m128d t, a, b, wa, wb, s0, s1, s2, s3, s4, sc;
+    __m128 f0, f1;
+
+    for (i=0; i<5; ++i) {
+        c[i] = col + i*w;
+        s[i] = stats + i*dst_w;
+    }
+    for (x=0; x<5*w; ++x)
+        col[x] = 0.0;
+
+    /* Vertical pass */
+    for (v=0; v<kh; ++v) {
+        r = ref + v*stride;
+        q = cmp + v*stride;
+        wt = taps_v[v];
+        t = _mm_set1_pd(wt);
+        for (x=0; x+2<=w; x+=2) {
+            a = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(r+x))));
+            b = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(q+x))));
+            wa = _mm_mul_pd(t, a);
+            wb = _mm_mul_pd(t, b);
+            _mm_storeu_pd(c[0]+x, _mm_add_pd(_mm_loadu_pd(c[0]+x), wa));
+            _mm_storeu_pd(c[1]+x, _mm_add_pd(_mm_loadu_pd(c[1]+x), wb));
+            _mm_storeu_pd(c[2]+x, _mm_add_pd(_mm_loadu_pd(c[2]+x), _mm_mul_pd(wa, a)));
+            _mm_storeu_pd(c[3]+x, _mm_add_pd(_mm_loadu_pd(c[3]+x), _mm_mul_pd(wb, b)));
+            _mm_storeu_pd(c[4]+x, _mm_add_pd(_mm_loadu_pd(c[4]+x), _mm_mul_pd(wa, b)));
+        }
+        for (; x<w; ++x) {
+            da = r[x];
+            db = q[x];
+            c[0][x] += wt * da;
+            c[1][x] += wt * db;
+            c[2][x] += wt * da * da;
+            c[3][x] += wt * db * db;
+            c[4][x] += wt * da * db;
+        }
+    }
+
+    /* Horizontal pass. The variances are formed in single precision. */
+    sc = _mm_set1_pd(scale);
+    for (x=0; x+2<=dst_w; x+=2) {
+        s0 = s1 = s2 = s3 = s4 = _mm_setzero_pd();
+        for (u=0; u<kw; ++u) {
+            t = _mm_set1_pd(taps_h[u]);
+            s0 = _mm_add_pd(s0, _mm_mul_pd(t, _mm_loadu_pd(c[0]+x+u)));
+            s1 = _mm_add_pd(s1, _mm_mul_pd(t, _mm_loadu_pd(c[1]+x+u)));
+            s2 = _mm_add_pd(s2, _mm_mul_pd(t, _mm_loadu_pd(c[2]+x+u)));
+            s3 = _mm_add_pd(s3, _mm_mul_pd(t, _mm_loadu_pd(c[3]+x+u)));
+            s4 = _mm_add_pd(s4, _mm_mul_pd(t, _mm_loadu_pd(c[4]+x+u)));
+        }
+        f0 = _mm_cvtpd_ps(_mm_mul_pd(s0, sc));
+        f1 = _mm_cvtpd_ps(_mm_mul_pd(s1, sc));
+        _mm_storel_pi((__m64*)(s[0]+x), f0);
+        _mm_storel_pi((__m64*)(s[1]+x), f1);
+        _mm_storel_pi((__m64*)(s[2]+x), _mm_sub_ps(_mm_cvtpd_ps(_mm_mul_pd(s2, sc)), _mm_mul_ps(f0, f0)));
+        _mm_storel_pi((__m64*)(s[3]+x), _mm_sub_ps(_mm_cvtpd_ps(_mm_mul_pd(s3, sc)), _mm_mul_ps(f1, f1)));
+        _mm_storel_pi((__m64*)(s[4]+x), _mm_sub_ps(_mm_cvtpd_ps(_mm_mul_pd(s4, sc)), _mm_mul_ps(f0, f1)));
+    }
+    for (; x<dst_w; ++x) {
+        for (i=0; i<5; ++i)
+            sum[i] = 0.0;
+        for (u=0; u<kw; ++u) {
+            wt = taps_h[u];
+            for (i=0; i<5; ++i)
+                sum[i] += wt * c[i][x+u];
+        }
+        m1 = (float)(sum[0] * scale);
+        m2 = (float)(sum[1] * scale);
+        s[0][x] = m1;
+        s[1][x] = m2;
+        s[2][x] = (float)(sum[2] * scale) - m1*m1;
+        s[3][x] = (float)(sum[3] * scale) - m2*m2;
+        s[4][x] = (float)(sum[4] * scale) - m1*m2;
+    }
+}
+
+SSE2 IQA_NO_CONTRACT static void _ssim_cmp_stats_row_sse2(const float *ref, const float *cmp, int stride, int w,
+    const float *taps_h, int kw, const float *taps_v, int kh, float scale,
+    double *col, float *stats)
+{
+    int x,u,v,i;
+    int dst_w = w - kw + 1;
+    double *c[3], sum[3];
+    float *s[5];
+    double wt, da, db;
+    float m1, m2;
+    const float *r, *q;
+    __m128d t, a, b, wa, wb, s1, s3, s4, sc;
+    __m128 f0, f1;
+
+    for (i=0; i<3; ++i)
+        c[i] = col + i*w;
+    for (i=0; i<5; ++i)
+        s[i] = stats + i*dst_w;
+    for (x=0; x<3*w; ++x)
+        col[x] = 0.0;
+
+    /* Vertical pass (mean cmp, E[cmp^2], E[ref*cmp]) */
+    for (v=0; v<kh; ++v) {
+        r = ref + v*stride;
+        q = cmp + v*stride;
+        wt = taps_v[v];
+        t = _mm_set1_pd(wt);
+        for (x=0; x+2<=w; x+=2) {
+            a = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(r+x))));
+            b = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(q+x))));
+            wa = _mm_mul_pd(t, a);
+            wb = _mm_mul_pd(t, b);
+            _mm_storeu_pd(c[0]+x, _mm_add_pd(_mm_loadu_pd(c[0]+x), wb));
+            _mm_storeu_pd(c[1]+x, _mm_add_pd(_mm_loadu_pd(c[1]+x), _mm_mul_pd(wb, b)));
+            _mm_storeu_pd(c[2]+x, _mm_add_pd(_mm_loadu_pd(c[2]+x), _mm_mul_pd(wa, b)));
+        }
+        for (; x<w; ++x) {
+            da = r[x];
+            db = q[x];
+            c[0][x] += wt * db;
+            c[1][x] += wt * db * db;
+            c[2][x] += wt * da * db;
+        }
+    }
+
+    /* Horizontal pass. The reference means are already in the first row. */
+    sc = _mm_set1_pd(scale);
+    for (x=0; x+2<=dst_w; x+=2) {
+        s1 = s3 = s4 = _mm_setzero_pd();
+        for (u=0; u<kw; ++u) {
+            t = _mm_set1_pd(taps_h[u]);
+            s1 = _mm_add_pd(s1, _mm_mul_pd(t, _mm_loadu_pd(c[0]+x+u)));
+            s3 = _mm_add_pd(s3, _mm_mul_pd(t, _mm_loadu_pd(c[1]+x+u)));
+            s4 = _mm_add_pd(s4, _mm_mul_pd(t, _mm_loadu_pd(c[2]+x+u)));
+        }
+        f0 = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(s[0]+x)));
+        f1 = _mm_cvtpd_ps(_mm_mul_pd(s1, sc));
+        _mm_storel_pi((__m64*)(s[1]+x), f1);
+        _mm_storel_pi((__m64*)(s[3]+x), _mm_sub_ps(_mm_cvtpd_ps(_mm_mul_pd(s3, sc)), _mm_mul_ps(f1, f1)));
+        _mm_storel_pi((__m64*)(s[4]+x), _mm_sub_ps(_mm_cvtpd_ps(_mm_mul_pd(s4, sc)), _mm_mul_ps(f0, f1)));
+    }
+    for (; x<dst_w; ++x) {
+        for (i=0; i<3; ++i)
+            sum[i] = 0.0;
+        for (u=0; u<kw; ++u) {
+            wt = taps_h[u];
+            for (i=0; i<3; ++i)
+                sum[i] += wt * c[i][x+u];
+        }
+        m1 = s[0][x];
+        m2 = (float)(sum[0] * scale);
+        s[1][x] = m2;
+        s[3][x] = (float)(sum[1] * scale) - m2*m2;
+        s[4][x] = (float)(sum[2] * scale) - m1*m2;
+    }
+}
+
+SSE2 static double _ssim_pool_row_sse2(const float *stats, int len, float C1, float C2)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22, s12;
+    double sum;
+    double part[2];
+    __m128 vm1, vm2, den;
+    __m128d m1d, m2d, s12d, num;
+    __m128 c1 = _mm_set1_ps(C1);
+    __m128 c2 = _mm_set1_ps(C2);
+    __m128d c1d = _mm_set1_pd(C1);
+    __m128d c2d = _mm_set1_pd(C2);
+    __m128d two = _mm_set1_pd(2.0);
+    __m128d acc = _mm_setzero_pd();
+
+    /*
+     * Matches the scalar rounding: the denominator terms are single precision
+     * and the numerator and the ratio are double precision.
+     */
+    for (x=0; x+2<=len; x+=2) {
+        vm1 = _mm_castpd_ps(_mm_load_sd((const double*)(mu1+x)));
+        vm2 = _mm_castpd_ps(_mm_load_sd((const double*)(mu2+x)));
+        den = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vm1, vm1), _mm_mul_ps(vm2, vm2)), c1),
+            _mm_add_ps(_mm_add_ps(_mm_castpd_ps(_mm_load_sd((const double*)(v11+x))),
+            _mm_castpd_ps(_mm_load_sd((const double*)(v22+x)))), c2));
+        m1d = _mm_cvtps_pd(vm1);
+        m2d = _mm_cvtps_pd(vm2);
+        s12d = _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*)(v12+x))));
+        num = _mm_mul_pd(_mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, m1d), m2d), c1d),
+            _mm_add_pd(_mm_mul_pd(two, s12d), c2d));
+        acc = _mm_add_pd(acc, _mm_div_pd(num, _mm_cvtps_pd(den)));
+    }
+    _mm_storeu_pd(part, acc);
+    sum = part[0] + part[1];
+    for (; x<len; ++x) {
+        m1 = mu1[x];
+        m2 = mu2[x];
+        s11 = v11[x];
+        s22 = v22[x];
+        s12 = v12[x];
+        sum += ((2.0 * m1 * m2 + C1) * (2.0 * s12 + C2)) /
+            ((m1*m1 + m2*m2 + C1) * (s11 + s22 + C2));
+    }
+    return sum;
+}
+
+/* The vector version of SSIM_TERMS(), 2 pixels at a time */
+SSE2 IQA_NO_CONTRACT static void _ssim_terms_row_sse2(const float *stats, int len, float C1, float C2, float C3,
+    double *l, double *c, double *s)
+{
+    int x;
+    const float *mu1=stats, *mu2=stats+len, *v11=stats+2*len, *v22=stats+3*len, *v12=stats+4*len;
+    float m1, m2, s11, s22;
+    double root;
+    int guarded = C1 == 0 || C2 == 0 || C3 == 0;
+    __m128 vm1, vm2, vs11, vs22, zero = _mm_setzero_ps();
+    __m128 c1 = _mm_set1_ps(C1), c2 = _mm_set1_ps(C2), c3 = _mm_set1_ps(C3);
+    __m128d c1d = _mm_set1_pd(C1), c2d = _mm_set1_pd(C2), c3d = _mm_set1_pd(C3);
+    __m128d two = _mm_set1_pd(2.0), one = _mm_set1_pd(1.0), dzero = _mm_setzero_pd();
+    __m128d vroot, lv, cv, sv, d11, d22, flat, mask;
+
+    for (x=0; x+2<=len; x+=2) {
+        vm1 = _mm_castpd_ps(_mm_load_sd((const double*)(mu1+x)));
+        vm2 = _mm_castpd_ps(_mm_load_sd((const double*)(mu2+x)));
+        vs11 = _mm_max_ps(zero, _mm_castpd_ps(_mm_load_sd((const double*)(v11+x))));
+        vs22 = _mm_max_ps(zero, _mm_castpd_ps(_mm_load_sd((const double*)(v22+x))));
+        vroot = _mm_sqrt_pd(_mm_cvtps_pd(_mm_mul_ps(vs11, vs22)));
+        lv = _mm_div_pd(_mm_add_pd(_mm_mul_pd(_mm_mul_pd(two, _mm_cvtps_pd(vm1)), _mm_cvtps_pd(vm2)), c1d),
+            _mm_cvtps_pd(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vm1, vm1), _mm_mul_ps(vm2, vm2)), c1)));
+        cv = _mm_div_pd(_mm_add_pd(_mm_mul_pd(two, vroot), c2d),
+            _mm_cvtps_pd(_mm_add_ps(_mm_add_ps(vs11, vs22), c2)));
+        sv = _mm_div_pd(_mm_cvtps_pd(_mm_add_ps(_mm_castpd_ps(_mm_load_sd((const double*)(v12+x))), c3)),
+            _mm_add_pd(vroot, c3d));
+        if (guarded) {
+            if (C1 == 0) {
+                mask = _mm_and_pd(_mm_cmpeq_pd(_mm_cvtps_pd(_mm_mul_ps(vm1, vm1)), dzero),
+                    _mm_cmpeq_pd(_mm_cvtps_pd(_mm_mul_ps(vm2, vm2)), dzero));
+                lv = _mm_or_pd(_mm_and_pd(mask, one), _mm_andnot_pd(mask, lv));
+            }
+            if (C2 == 0) {
+                mask = _mm_cmpeq_pd(_mm_cvtps_pd(_mm_add_ps(vs11, vs22)), dzero);
+                cv = _mm_or_pd(_mm_and_pd(mask, one), _mm_andnot_pd(mask, cv));
+            }
+            if (C3 == 0) {
+                d11 = _mm_cmpeq_pd(_mm_cvtps_pd(vs11), dzero);
+                d22 = _mm_cmpeq_pd(_mm_cvtps_pd(vs22), dzero);
+                flat = _mm_cmpeq_pd(vroot, dzero);
+                mask = _mm_and_pd(flat, _mm_or_pd(d11, d22));
+                sv = _mm_andnot_pd(mask, sv);
+                mask = _mm_and_pd(flat, _mm_and_pd(d11, d22));
+                sv = _mm_or_pd(_mm_and_pd(mask, one), _mm_andnot_pd(mask, sv));
+            }
+        }
+        _mm_storeu_pd(l+x, lv);
+        _mm_storeu_pd(c+x, cv);
+        _mm_storeu_pd(s+x, sv);
+    }
+    for (; x<len; ++x) {
+        SSIM_TERMS(1)
+    }
+}
+
+/* Adds the 32-bit products of the unsigned 16-bit lanes of v and t to lo/hi */
+#define MUL_ADD_U16(v, t, lo, hi) \
+    pl = _mm_mullo_epi16(v, t); \
+    ph = _mm_mulhi_epu16(v, t); \
+    lo = _mm_add_epi32(lo, _mm_unpacklo_epi16(pl, ph)); \
+    hi = _mm_add_epi32(hi, _mm_unpackhi_epi16(pl, ph));
+
+/* 8 pixels at a time in unsigned 16-bit lanes (a*a fits, but not in pmaddwd's signed lanes) */
+SSE2 static void _int_moments_row_sse2(const unsigned char *a, const unsigned char *b, int len,
+    const int *taps, int ntaps, int *out)
+{
+    int x, u;
+    unsigned int t, pa, pb, sa, sb, saa, sbb, sab;
+    __m128i va, vb, vt, pl, ph, zero = _mm_setzero_si128();
+    __m128i a0, a1, b0, b1, aa0, aa1, bb0, bb1, ab0, ab1;
+
+    for (x=0; x+8<=len; x+=8) {
+        a0 = a1 = b0 = b1 = aa0 = aa1 = bb0 = bb1 = ab0 = ab1 = zero;
+        for (u=0; u<ntaps; ++u) {
+            vt = _mm_set1_epi16((short)taps[u]);
+            va = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(a+x+u)), zero);
+            vb = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(b+x+u)), zero);
+            MUL_ADD_U16(va, vt, a0, a1)
+            MUL_ADD_U16(vb, vt, b0, b1)
+            MUL_ADD_U16(_mm_mullo_epi16(va, va), vt, aa0, aa1)
+            MUL_ADD_U16(_mm_mullo_epi16(vb, vb), vt, bb0, bb1)
+            MUL_ADD_U16(_mm_mullo_epi16(va, vb), vt, ab0, ab1)
+        }
+        _mm_storeu_si128((__m128i*)(out+x), a0);
+        _mm_storeu_si128((__m128i*)(out+x+4), a1);
+        _mm_storeu_si128((__m128i*)(out+len+x), b0);
+        _mm_storeu_si128((__m128i*)(out+len+x+4), b1);
+        _mm_storeu_si128((__m128i*)(out+2*len+x), aa0);
+        _mm_storeu_si128((__m128i*)(out+2*len+x+4), aa1);
+        _mm_storeu_si128((__m128i*)(out+3*len+x), bb0);
+        _mm_storeu_si128((__m128i*)(out+3*len+x+4), bb1);
+        _mm_storeu_si128((__m128i*)(out+4*len+x), ab0);
+        _mm_storeu_si128((__m128i*)(out+4*len+x+4), ab1);
+    }
+    for (; x<len; ++x) {
+        INT_MOMENTS
+    }
+}
+
+#undef MUL_ADD_U16
+
+
+/* exp(e*log|v|): log from the atanh series of the mantissa, exp from its Taylor polynomial */
+SSE2 IQA_NO_CONTRACT static void _pow_row_sse2(double *v, int len, double e)
+{
+    int x, i;
+    __m128i bits, sign, n_bits;
+    __m128d a, m, k, t, w, p, y, n, r;
+    __m128d big, ok;
+    const __m128d one = _mm_set1_pd(1.0);
+    const __m128i abs_mask = _mm_set1_epi64x(0x7fffffffffffffffLL);
+    for (x=0; x+2<=len; x+=2) {
+        a = _mm_loadu_pd(v+x);
+        /* |v| = 2^k * m, with m in [sqrt(1/2), sqrt(2)) */
+        bits = _mm_and_si128(_mm_castpd_si128(a), abs_mask);
+        sign = _mm_and_si128(_mm_castpd_si128(a), _mm_set1_epi64x(0x8000000000000000LL));
+        a = _mm_castsi128_pd(bits);
+        m = _mm_castsi128_pd(_mm_or_si128(_mm_and_si128(bits, _mm_set1_epi64x(0x000fffffffffffffLL)),
+            _mm_set1_epi64x(0x3ff0000000000000LL)));
+        /* The exponent field as the low bits of 2^52, minus 2^52 and the bias */
+        k = _mm_sub_pd(_mm_castsi128_pd(_mm_or_si128(_mm_srli_epi64(bits, 52), _mm_set1_epi64x(0x4330000000000000LL))),
+            _mm_set1_pd(4503599627371519.0));
+        big = _mm_cmpgt_pd(m, _mm_set1_pd(POW_SQRT2));
+        m = _mm_or_pd(_mm_andnot_pd(big, m), _mm_and_pd(big, _mm_mul_pd(m, _mm_set1_pd(0.5))));
+        k = _mm_add_pd(k, _mm_and_pd(big, one));
+
+        /* log(m) = 2*atanh(t), with |t| <= 0.1716 */
+        t = _mm_div_pd(_mm_sub_pd(m, one), _mm_add_pd(m, one));
+        w = _mm_mul_pd(t, t);
+        p = _mm_set1_pd(1.0/21);
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/19));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/17));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/15));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/13));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/11));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/9));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/7));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/5));
+        p = _mm_add_pd(_mm_mul_pd(p, w), _mm_set1_pd(1.0/3));
+        p = _mm_add_pd(_mm_mul_pd(p, w), one);
+        y = _mm_mul_pd(_mm_set1_pd(e), _mm_add_pd(_mm_mul_pd(k, _mm_set1_pd(POW_LN2_HI)),
+            _mm_add_pd(_mm_mul_pd(_mm_add_pd(t, t), p), _mm_mul_pd(k, _mm_set1_pd(POW_LN2_LO)))));
+
+        /* exp(y) = 2^n * exp(r), with |r| <= log(2)/2 */
+        n = _mm_add_pd(_mm_mul_pd(y, _mm_set1_pd(POW_LOG2E)), _mm_set1_pd(POW_ROUND));
+        n_bits = _mm_castpd_si128(n);
+        n = _mm_sub_pd(n, _mm_set1_pd(POW_ROUND));
+        r = _mm_sub_pd(_mm_sub_pd(y, _mm_mul_pd(n, _mm_set1_pd(POW_LN2_HI))),
+            _mm_mul_pd(n, _mm_set1_pd(POW_LN2_LO)));
+        p = _mm_set1_pd(1.0/6227020800.0);
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/479001600.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/39916800.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/3628800.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/362880.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/40320.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/5040.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/720.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/120.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/24.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/6.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), _mm_set1_pd(1.0/2.0));
+        p = _mm_add_pd(_mm_mul_pd(p, r), one);
+        p = _mm_add_pd(_mm_mul_pd(p, r), one);
+        p = _mm_mul_pd(p, _mm_castsi128_pd(_mm_slli_epi64(_mm_add_epi64(n_bits, _mm_set1_epi64x(1023)), 52)));   /* 2^n */
+
+        ok = _mm_and_pd(_mm_and_pd(_mm_cmpge_pd(a, _mm_set1_pd(DBL_MIN)), _mm_cmple_pd(a, _mm_set1_pd(DBL_MAX))),
+            _mm_cmple_pd(_mm_castsi128_pd(_mm_and_si128(_mm_castpd_si128(y), abs_mask)), _mm_set1_pd(POW_Y_MAX)));
+        if (_mm_movemask_pd(ok) == 0x3)
+            _mm_storeu_pd(v+x, _mm_castsi128_pd(_mm_or_si128(_mm_castpd_si128(p), sign)));
+        else {
+            for (i=x; i<x+2; ++i) {
+                POW_SIGNED(i)
+            }
+        }
+    }
+    for (; x<len; ++x) {
+        POW_SIGNED(x)
+    }
+}
+
+SSE2 static double _sum_row_sse2(const double *v, int len)
+{
+    int x;
+    double sum;
+    double part[2];
+    __m128d acc = _mm_setzero_pd();
+
+    for (x=0; x+2<=len; x+=2)
+        acc = _mm_add_pd(acc, _mm_loadu_pd(v+x));
+    _mm_storeu_pd(part, acc);
+    sum = part[0] + part[1];
+    for (; x<len; ++x)
+        sum += v[x];
+    return sum;
+}
+
+SSE2 IQA_NO_CONTRACT static double _lcs_sum_row_sse2(const double *l, const double *c, const double *s,
+    int len, double *prod)
+{
+    int x;
+    double sum, p;
+    double part[2];
+    __m128d vp;
+    __m128d acc = _mm_setzero_pd();
+    const __m128d sign = _mm_set1_pd(-0.0);
+
+    for (x=0; x+2<=len; x+=2) {
+        vp = _mm_mul_pd(_mm_mul_pd(_mm_loadu_pd(l+x), _mm_loadu_pd(c+x)), _mm_loadu_pd(s+x));
+        if (prod)
+            _mm_storeu_pd(prod+x, _mm_andnot_pd(sign, vp));
+        acc = _mm_add_pd(acc, vp);
+    }
+    _mm_storeu_pd(part, acc);
+    sum = part[0] + part[1];
+    for (; x<len; ++x) {
+        p = l[x] * c[x] * s[x];
+        if (prod)
+            prod[x] = fabs(p);
+        sum += p;
+    }
+    return sum;
+}
+
+const struct _iqa_simd _iqa_simd_sse2 = {
+    IQA_SIMD_SSE2,
+    "sse2",
+    _u8_to_float_sse2,
+    _u16_to_float_sse2,
+    _filter_row_sse2,
+    _accum_row_sse2,
+    _accum_row_d_sse2,
+    _ssim_stats_row_sse2,
+    _ssim_cmp_stats_row_sse2,
+    _ssim_pool_row_sse2,
+    _ssim_terms_row_sse2,
+    _int_moments_row_sse2,
+    _pow_row_sse2,
+    _sum_row_sse2,
+    _lcs_sum_row_sse2
+};
+
+#endif /*IQA_SIMD_X86*/
@@ -36,16 +36,26 @@
 #include "decimate.h"
 #include "math_utils.h"
 #include "ssim.h"
+#include "simd.h"
+#include "parallel.h"
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 
 /* Forward declarations. */
-IQA_INLINE static double _calc_luminance(float, float, float, float);
-IQA_INLINE static double _calc_contrast(double, float, float, float, float);
-IQA_INLINE static double _calc_structure(float, double, float, float, float, float);
-static int _ssim_map(const struct _ssim_int *, void *);
-static float _ssim_reduce(int, int, void *);
+static void _mr_split(const struct _map_reduce *, void *);
+static void _mr_merge(const struct _map_reduce *, void *, const void *);
+static int _mr_map(const struct _map_reduce *, const double *, const double *, const double *, int, void *);
+static float _mr_reduce(const struct _map_reduce *, int, int, void *);
+static struct iqa_ssim_plan *_plan_create(int, int, int, int, const struct iqa_ssim_plan_options *);
+static int _plan_load(struct iqa_ssim_plan *, const void *, float *, int *, int *);
+static float _plan_run(struct iqa_ssim_plan *, const float *, const float *, int, int, int,
+    const struct _ssim_ref_stats *, const struct iqa_ssim_maps *);
+static float _plan_score(struct iqa_ssim_plan *, int, int, const struct _ssim_ref_stats *,
+    const struct iqa_ssim_maps *);
+static float _ssim_run(const float *, const float *, int, int, int, const struct _kernel *,
+    const struct _map_reduce *, const struct iqa_ssim_args *, int, const struct _ssim_ref_stats *, const struct iqa_ssim_maps *, void *);
 
 /* 
  * SSIM(x,y)=(2*ux*uy + C1)*(2sxy + C2) / (ux^2 + uy^2 + C1)*(sx^2 + sy^2 + C2)
@@ -59,264 +69,2187 @@ static float _ssim_reduce(int, int, void *);
 float iqa_ssim(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
     int gaussian, const struct iqa_ssim_args *args)
 {
-    int scale;
-    int x,y,src_offset,offset;
-    float *ref_f,*cmp_f;
-    struct _kernel low_pass;
-    struct _kernel window;
+    struct iqa_ssim_plan *plan;
+    struct iqa_ssim_plan_options opts;
     float result;
-    double ssim_sum=0.0;
+
+    opts.gaussian = gaussian;
+    opts.args = args;
+    plan = iqa_ssim_plan_create(w, h, stride, &opts);
+    if (!plan)
+        return INFINITY;
+    result = iqa_ssim_plan_execute(plan, ref, cmp);
+    iqa_ssim_plan_destroy(plan);
+    return result;
+}
+
+/*
+ * Everything iqa_ssim() needs for one image size. All the buffers live in a
+ * single aligned block so executing the plan doesn't allocate.
+ */
+struct iqa_ssim_plan {
+    int w, h, stride;
+    int wide, shift;                /* 16-bit samples, and their shift (see _iqa_depth()) */
+    int L;                          /* Dynamic range without args */
+    int scale;                      /* Downsampling factor */
+    int has_args;
+    struct iqa_ssim_args args;      /* Copy of the caller's arguments */
+    struct _kernel window;
+    struct _kernel low_pass;        /* Only used if scale > 1 */
+    float *ref_f, *cmp_f;           /* Converted (and downsampled) images */
+    int fstride;                    /* Floats between their rows (see _iqa_row_stride()) */
+    void *scratch;                  /* Row buffers for decimation and SSIM */
+    void *block;
+};
+
+/*
+ * Sets the scale, window and low-pass filter of a plan for a 'w' x 'h'
+ * image. The low-pass kernel values are left to the caller.
+ */
+static void _plan_init(struct iqa_ssim_plan *plan, int w, int h,
+    const struct iqa_ssim_plan_options *opts)
+{
+    plan->w = w;
+    plan->h = h;
+    plan->wide = 0;
+    plan->shift = 0;
+    plan->L = 255;
+
+    /* Initialize algorithm parameters */
+    plan->scale = _max( 1, _round( (float)_min(w,h) / 256.0f ) );
+    if (opts && opts->args) {
+        plan->has_args = 1;
+        plan->args = *opts->args;
+        if (plan->args.f)
+            plan->scale = plan->args.f;
+    }
+    plan->window.kernel = (float*)g_square_window;
+    plan->window.w = plan->window.h = SQUARE_LEN;
+    plan->window.normalized = 1;
+    plan->window.bnd_opt = KBND_SYMMETRIC;
+    plan->window.kernel_h = (float*)g_square_window_1d;
+    plan->window.kernel_v = (float*)g_square_window_1d;
+    if (!opts || opts->gaussian) {
+        plan->window.kernel = (float*)g_gaussian_window;
+        plan->window.w = plan->window.h = GAUSSIAN_LEN;
+        plan->window.kernel_h = (float*)g_gaussian_window_1d;
+        plan->window.kernel_v = (float*)g_gaussian_window_1d;
+    }
+
+    /* Simple low-pass filter for the downsampling */
+    plan->low_pass.w = plan->low_pass.h = plan->scale;
+    plan->low_pass.normalized = 1;
+    plan->low_pass.bnd_opt = KBND_SYMMETRIC;
+    plan->low_pass.kernel_h = 0;
+    plan->low_pass.kernel_v = 0;
+}
+
+/*
+ * Creates a plan for images with 8-bit samples (depth 0) or 16-bit samples in
+ * the format 'depth' (see IQA_MSB_ALIGNED).
+ */
+static struct iqa_ssim_plan *_plan_create(int w, int h, int stride, int depth,
+    const struct iqa_ssim_plan_options *opts)
+{
+    struct iqa_ssim_plan *plan;
+    int offset, sw, sh, bits=8, shift=0;
+    size_t img_size, lpf_size, scratch_size, dec_size;
+    unsigned char *mem;
+
+    if (depth && _iqa_depth(depth, &bits, &shift))
+        return 0;
+    if (w < 1 || h < 1 || stride < (depth ? 2*w : w))
+        return 0;
+    plan = (struct iqa_ssim_plan*)calloc(1, sizeof(struct iqa_ssim_plan));
+    if (!plan)
+        return 0;
+    _plan_init(plan, w, h, opts);
+    plan->stride = stride;
+    if (depth) {
+        plan->wide = 1;
+        plan->shift = shift;
+        plan->L = (1 << bits) - 1;
+    }
+
+    /* Buffer sizes */
+    sw = w;
+    sh = h;
+    img_size = IQA_ALIGN_SIZE(_iqa_row_stride(w)*h*sizeof(float));
+    lpf_size = IQA_ALIGN_SIZE(plan->scale*plan->scale*sizeof(float));
+    scratch_size = 0;
+    if (plan->scale > 1) {
+        scratch_size = _iqa_decimate_scratch(w, plan->scale, &plan->low_pass);
+        sw = w/plan->scale + (w&1);
+        sh = h/plan->scale + (h&1);
+    }
+    plan->fstride = _iqa_row_stride(sw);
+    dec_size = _iqa_ssim_scratch(sw, sh, &plan->window);
+    if (dec_size > scratch_size)
+        scratch_size = dec_size;
+
+    plan->block = _iqa_malloc_aligned(2*img_size + lpf_size + scratch_size);
+    if (!plan->block) {
+        free(plan);
+        return 0;
+    }
+    mem = (unsigned char*)plan->block;
+    plan->ref_f = (float*)mem;
+    plan->cmp_f = (float*)(mem + img_size);
+    plan->low_pass.kernel = (float*)(mem + 2*img_size);
+    plan->scratch = mem + 2*img_size + lpf_size;
+    for (offset=0; offset<plan->scale*plan->scale; ++offset)
+        plan->low_pass.kernel[offset] = 1.0f/(plan->scale*plan->scale);
+
+    return plan;
+}
+
+/* iqa_ssim_plan_create */
+struct iqa_ssim_plan *iqa_ssim_plan_create(int w, int h, int stride,
+    const struct iqa_ssim_plan_options *opts)
+{
+    return _plan_create(w, h, stride, 0, opts);
+}
+
+/*
+ * Converts an image in the plan's sample format into 'dst' and scales it down
+ * like iqa_ssim(). Returns 0 on success, with the resulting size in 'rw' and
+ * 'rh'.
+ */
+static int _plan_load(struct iqa_ssim_plan *plan, const void *src, float *dst, int *rw, int *rh)
+{
+    int y;
+    int fstride = _iqa_row_stride(plan->w);
+    const unsigned char *row;
+    const struct _iqa_simd *simd = _iqa_simd_get();
+
+    /* Convert image values to floats, with padded rows */
+    for (y=0; y<plan->h; ++y) {
+        row = (const unsigned char*)src + y*plan->stride;
+        if (!plan->wide)
+            simd->u8_to_float(row, dst + y*fstride, plan->w);
+        else
+            simd->u16_to_float((const unsigned short*)row, dst + y*fstride, plan->w, plan->shift);
+    }
+
+    *rw = plan->w;
+    *rh = plan->h;
+    if (plan->scale > 1)
+        return _iqa_decimate_strided(dst, plan->w, plan->h, fstride, plan->scale, &plan->low_pass,
+            dst, plan->fstride, rw, rh, plan->scratch);
+    return 0;
+}
+
+/*
+ * Scores 'ref' and 'cmp' with the plan's settings. Rows of the images start
+ * 'stride' floats apart. 'rs' optionally holds the reference statistics, and
+ * 'maps' optionally receives the local values.
+ */
+static float _plan_run(struct iqa_ssim_plan *plan, const float *ref, const float *cmp, int w, int h,
+    int stride, const struct _ssim_ref_stats *rs, const struct iqa_ssim_maps *maps)
+{
+    struct _ssim_pool pool;
     struct _map_reduce mr;
 
+    if (!plan->has_args)
+        return _ssim_run(ref, cmp, w, h, stride, &plan->window, 0, 0, plan->L, rs, maps, plan->scratch);
+
+    memset(&pool, 0, sizeof(pool));
+    memset(&mr, 0, sizeof(mr));
+    mr.pool    = MR_MEAN;
+    mr.context = &pool;
+    return _ssim_run(ref, cmp, w, h, stride, &plan->window, &mr, &plan->args, plan->L, rs, maps, plan->scratch);
+}
+
+/* Scores the loaded images (see _plan_run()) */
+static float _plan_score(struct iqa_ssim_plan *plan, int w, int h, const struct _ssim_ref_stats *rs,
+    const struct iqa_ssim_maps *maps)
+{
+    return _plan_run(plan, plan->ref_f, plan->cmp_f, w, h, plan->fstride, rs, maps);
+}
+
+/*
+ * Whether the source images are identical, in which case every window has
+ * an SSIM of exactly 1 and nothing needs to be converted.
+ */
+static int _plan_same(const struct iqa_ssim_plan *plan, const void *ref, const void *cmp)
+{
+    int y;
+    size_t row = plan->wide ? 2*plan->w : plan->w;
+
+    for (y=0; y<plan->h; ++y) {
+        if (memcmp((const unsigned char*)ref + y*plan->stride, (const unsigned char*)cmp + y*plan->stride, row))
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Checks the arguments of every plan-based entry point. The map size is
+ * checked first, so a plan too small for its window fails for any input.
+ * Returns 0 if the images can be scored.
+ */
+static int _plan_check(const struct iqa_ssim_plan *plan, const void *ref, const void *cmp)
+{
+    return !plan || iqa_ssim_plan_map_size(plan, 0, 0) || !ref || !cmp;
+}
+
+/* iqa_ssim_plan_execute */
+float iqa_ssim_plan_execute(struct iqa_ssim_plan *plan, const unsigned char *ref,
+    const unsigned char *cmp)
+{
+    int w, h;
+
+    if (_plan_check(plan, ref, cmp))
+        return INFINITY;
+    if (_plan_same(plan, ref, cmp))
+        return 1.0f;
+    if (_plan_load(plan, ref, plan->ref_f, &w, &h) ||
+        _plan_load(plan, cmp, plan->cmp_f, &w, &h))
+        return INFINITY;
+    return _plan_score(plan, w, h, 0, 0);
+}
+
+/* iqa_ssim_plan_map_size */
+int iqa_ssim_plan_map_size(const struct iqa_ssim_plan *plan, int *mw, int *mh)
+{
+    int sw, sh;
+
+    if (!plan)
+        return 1;
+    sw = plan->w;
+    sh = plan->h;
+    if (plan->scale > 1) {
+        sw = plan->w/plan->scale + (plan->w&1);
+        sh = plan->h/plan->scale + (plan->h&1);
+    }
+    sw -= plan->window.w - 1;
+    sh -= plan->window.h - 1;
+    if (sw < 1 || sh < 1)
+        return 1;
+    if (mw) *mw = sw;
+    if (mh) *mh = sh;
+    return 0;
+}
+
+/* iqa_ssim_plan_execute_maps */
+float iqa_ssim_plan_execute_maps(struct iqa_ssim_plan *plan, const unsigned char *ref,
+    const unsigned char *cmp, const struct iqa_ssim_maps *maps)
+{
+    int w, h;
+
+    if (_plan_check(plan, ref, cmp))
+        return INFINITY;
+    if (_plan_load(plan, ref, plan->ref_f, &w, &h) ||
+        _plan_load(plan, cmp, plan->cmp_f, &w, &h))
+        return INFINITY;
+    return _plan_score(plan, w, h, 0, maps);
+}
+
+/* iqa_ssim_plan_destroy */
+void iqa_ssim_plan_destroy(struct iqa_ssim_plan *plan)
+{
+    if (!plan)
+        return;
+    _iqa_free_aligned(plan->block);
+    free(plan);
+}
+
+/* iqa_ssim_16 */
+float iqa_ssim_16(const unsigned short *ref, const unsigned short *cmp, int w, int h, int stride,
+    int depth, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct iqa_ssim_plan *plan;
+    struct iqa_ssim_plan_options opts;
+    float result = INFINITY;
+    int rw, rh;
+
+    if (!depth)
+        return INFINITY;
+    opts.gaussian = gaussian;
+    opts.args = args;
+    plan = _plan_create(w, h, stride, depth, &opts);
+    if (_plan_check(plan, ref, cmp)) {
+        iqa_ssim_plan_destroy(plan);
+        return INFINITY;
+    }
+    if (_plan_same(plan, ref, cmp))
+        result = 1.0f;
+    else if (!_plan_load(plan, ref, plan->ref_f, &rw, &rh) && !_plan_load(plan, cmp, plan->cmp_f, &rw, &rh))
+        result = _plan_score(plan, rw, rh, 0, 0);
+    iqa_ssim_plan_destroy(plan);
+    return result;
+}
+
+/*
+ * iqa_ssim_f32. The caller's planes are read where they are: at scale 1 they
+ * go straight to the window statistics, and otherwise the decimation reads
+ * them (strided) into the plan's downsampled images. Only the downsampled
+ * images and row buffers are allocated.
+ */
+float iqa_ssim_f32(const float *ref, const float *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args)
+{
+    struct iqa_ssim_plan plan;
+    struct iqa_ssim_plan_options opts;
+    float result = INFINITY;
+    int offset, fstride, sw, sh;
+    size_t img_size, lpf_size, scratch_size, dec_size;
+    unsigned char *mem;
+
+    if (!ref || !cmp || w < 1 || h < 1 || stride % (int)sizeof(float))
+        return INFINITY;
+    fstride = stride / (int)sizeof(float);
+    if (fstride < w)
+        return INFINITY;
+    opts.gaussian = gaussian;
+    opts.args = args;
+    memset(&plan, 0, sizeof(plan));
+    _plan_init(&plan, w, h, &opts);
+    plan.stride = stride;
+
+    /* Buffer sizes. Nothing full size unless the images are downsampled. */
+    sw = w;
+    sh = h;
+    img_size = lpf_size = scratch_size = 0;
+    if (plan.scale > 1) {
+        sw = w/plan.scale + (w&1);
+        sh = h/plan.scale + (h&1);
+        img_size = IQA_ALIGN_SIZE(_iqa_row_stride(sw)*sh*sizeof(float));
+        lpf_size = IQA_ALIGN_SIZE(plan.scale*plan.scale*sizeof(float));
+        scratch_size = _iqa_decimate_scratch(w, plan.scale, &plan.low_pass);
+    }
+    dec_size = _iqa_ssim_scratch(sw, sh, &plan.window);
+    if (dec_size > scratch_size)
+        scratch_size = dec_size;
+
+    plan.block = _iqa_malloc_aligned(2*img_size + lpf_size + scratch_size);
+    if (!plan.block)
+        return INFINITY;
+    mem = (unsigned char*)plan.block;
+    plan.scratch = mem + 2*img_size + lpf_size;
+    plan.fstride = _iqa_row_stride(sw);
+
+    if (plan.scale == 1)
+        result = _plan_run(&plan, ref, cmp, w, h, fstride, 0, 0);
+    else {
+        plan.ref_f = (float*)mem;
+        plan.cmp_f = (float*)(mem + img_size);
+        plan.low_pass.kernel = (float*)(mem + 2*img_size);
+        for (offset=0; offset<plan.scale*plan.scale; ++offset)
+            plan.low_pass.kernel[offset] = 1.0f/(plan.scale*plan.scale);
+        if (!_iqa_decimate_strided(ref, w, h, fstride, plan.scale, &plan.low_pass, plan.ref_f,
+                plan.fstride, &sw, &sh, plan.scratch) &&
+            !_iqa_decimate_strided(cmp, w, h, fstride, plan.scale, &plan.low_pass, plan.cmp_f,
+                plan.fstride, &sw, &sh, plan.scratch))
+            result = _plan_score(&plan, sw, sh, 0, 0);
+    }
+
+    _iqa_free_aligned(plan.block);
+    return result;
+}
+
+/* _iqa_roi_windows */
+void _iqa_roi_windows(int r0, int r1, int n, int kn, int *p0, int *p1)
+{
+    *p0 = r0 - kn/2;
+    *p1 = r1 - kn/2;
+    if (*p0 < 0)
+        *p0 = 0;
+    if (*p1 > n - kn + 1)
+        *p1 = n - kn + 1;
+    if (*p0 >= *p1) {
+        if (*p0 > n - kn)
+            *p0 = n - kn;
+        *p1 = *p0 + 1;
+    }
+}
+
+/*
+ * The part of the image one region of interest reads. The source view is
+ * converted (and downsampled), and the SSIM windows are then taken from a
+ * 'vw' x 'vh' view of the result at (px,py).
+ */
+struct _ssim_roi {
+    int ox, oy, w, h;       /* Source view */
+    int dw, dh;             /* Its size after downsampling */
+    int px, py, vw, vh;     /* SSIM input within the downsampled view */
+};
+
+/*
+ * Works out the views for the SSIM windows p0..p1-1 x q0..q1-1 of a plan whose
+ * downsampled image is 'sw' x 'sh'. When downsampling, the source view keeps
+ * a pixel of margin at the scaled size and starts on a multiple of 2*scale,
+ * so every value used is the same as when the whole image is downsampled.
+ */
+static void _roi_view_windows(const struct iqa_ssim_plan *plan, int p0, int p1, int q0, int q1,
+    struct _ssim_roi *v)
+{
+    int f = plan->scale;
+    int kw = plan->window.w, kh = plan->window.h;
+
+    v->vw = p1 - p0 + kw - 1;
+    v->vh = q1 - q0 + kh - 1;
+    if (f == 1) {
+        v->ox = p0;
+        v->oy = q0;
+        v->w = v->dw = v->vw;
+        v->h = v->dh = v->vh;
+        v->px = v->py = 0;
+        return;
+    }
+    v->ox = p0 > 0 ? ((p0-1)/2)*2*f : 0;
+    v->oy = q0 > 0 ? ((q0-1)/2)*2*f : 0;
+    v->w = _min((p1 + kw)*f, plan->w) - v->ox;
+    v->h = _min((q1 + kh)*f, plan->h) - v->oy;
+    v->dw = v->w/f + (v->w&1);
+    v->dh = v->h/f + (v->h&1);
+    v->px = p0 - v->ox/f;
+    v->py = q0 - v->oy/f;
+}
+
+/* The views of rectangle 'r'. The windows are those centred on it (see _iqa_roi_windows()). */
+static void _roi_view(const struct iqa_ssim_plan *plan, int sw, int sh, const struct iqa_rect *r,
+    struct _ssim_roi *v)
+{
+    int f = plan->scale;
+    int p0, p1, q0, q1;
+
+    /* Scaled pixel X sits at source pixel X*f */
+    _iqa_roi_windows((r->x + f-1)/f, (r->x + r->w + f-1)/f, sw, plan->window.w, &p0, &p1);
+    _iqa_roi_windows((r->y + f-1)/f, (r->y + r->h + f-1)/f, sh, plan->window.h, &q0, &q1);
+    _roi_view_windows(plan, p0, p1, q0, q1, v);
+}
+
+/* Grows the buffer sizes of _roi_alloc() to fit view 'v' */
+static void _roi_sizes(const struct iqa_ssim_plan *plan, const struct _ssim_roi *v, size_t *src_size,
+    size_t *dec_size, size_t *scratch_size)
+{
+    size_t size;
+
+    size = IQA_ALIGN_SIZE(_iqa_row_stride(v->w)*v->h*sizeof(float));
+    if (size > *src_size)
+        *src_size = size;
+    size = _iqa_ssim_scratch(v->vw, v->vh, &plan->window);
+    if (plan->scale > 1) {
+        if (_iqa_decimate_scratch(v->w, plan->scale, &plan->low_pass) > size)
+            size = _iqa_decimate_scratch(v->w, plan->scale, &plan->low_pass);
+        if (IQA_ALIGN_SIZE(_iqa_row_stride(v->dw)*v->dh*sizeof(float)) > *dec_size)
+            *dec_size = IQA_ALIGN_SIZE(_iqa_row_stride(v->dw)*v->dh*sizeof(float));
+    }
+    if (size > *scratch_size)
+        *scratch_size = size;
+}
+
+/*
+ * Allocates the plan block for views of up to the given sizes: the source
+ * views 'src' and downsampled views 'dec' of both images, the low-pass kernel
+ * and the scratch buffer. Returns 0 on success.
+ */
+static int _roi_alloc(struct iqa_ssim_plan *plan, size_t src_size, size_t dec_size,
+    size_t scratch_size, float **src, float **dec)
+{
+    int offset;
+    size_t size = IQA_ALIGN_SIZE(plan->scale*plan->scale*sizeof(float));
+    unsigned char *mem;
+
+    plan->block = _iqa_malloc_aligned(2*src_size + 2*dec_size + size + scratch_size);
+    if (!plan->block)
+        return 1;
+    mem = (unsigned char*)plan->block;
+    src[0] = (float*)mem;
+    src[1] = (float*)(mem + src_size);
+    dec[0] = (float*)(mem + 2*src_size);
+    dec[1] = (float*)(mem + 2*src_size + dec_size);
+    plan->low_pass.kernel = (float*)(mem + 2*src_size + 2*dec_size);
+    plan->scratch = mem + 2*src_size + 2*dec_size + size;
+    for (offset=0; offset<plan->scale*plan->scale; ++offset)
+        plan->low_pass.kernel[offset] = 1.0f/(plan->scale*plan->scale);
+    return 0;
+}
+
+/*
+ * Converts (and downsamples) view 'v' of both images and returns the mean SSIM
+ * of its windows, or INFINITY on error. The buffers are from _roi_alloc().
+ */
+static float _roi_score(struct iqa_ssim_plan *plan, const unsigned char *ref, const unsigned char *cmp,
+    int stride, const struct _ssim_roi *v, float **src, float **dec)
+{
+    int y, offset, as, ds;
+    const float *in[2];
+    const struct _iqa_simd *simd = _iqa_simd_get();
+
+    as = _iqa_row_stride(v->w);
+    for (y=0; y<v->h; ++y) {
+        offset = (v->oy + y)*stride + v->ox;
+        simd->u8_to_float(ref + offset, src[0] + y*as, v->w);
+        simd->u8_to_float(cmp + offset, src[1] + y*as, v->w);
+    }
+    in[0] = src[0];
+    in[1] = src[1];
+    if (plan->scale > 1) {
+        ds = _iqa_row_stride(v->dw);
+        if (_iqa_decimate_strided(src[0], v->w, v->h, as, plan->scale, &plan->low_pass, dec[0], ds,
+                0, 0, plan->scratch) ||
+            _iqa_decimate_strided(src[1], v->w, v->h, as, plan->scale, &plan->low_pass, dec[1], ds,
+                0, 0, plan->scratch))
+            return INFINITY;
+        in[0] = dec[0] + v->py*ds + v->px;
+        in[1] = dec[1] + v->py*ds + v->px;
+        as = ds;
+    }
+    return _plan_run(plan, in[0], in[1], v->vw, v->vh, as, 0, 0);
+}
+
+/*
+ * iqa_ssim_roi. Each rectangle converts, downsamples and scores only its own
+ * views, so the cost follows the area of the rectangles. The rectangles are
+ * pooled by their number of windows.
+ */
+float iqa_ssim_roi(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args, const struct iqa_rect *rects, int count)
+{
+    struct iqa_ssim_plan plan;
+    struct iqa_ssim_plan_options opts;
+    struct _ssim_roi v;
+    int i, sw, sh, windows;
+    size_t src_size=0, dec_size=0, scratch_size=0;
+    float *src[2], *dec[2];
+    double sum=0.0, n=0.0;
+    float mean;
+
+    if (!ref || !cmp || w < 1 || h < 1 || stride < w || _iqa_rects_valid(rects, count, w, h))
+        return INFINITY;
+    opts.gaussian = gaussian;
+    opts.args = args;
+    memset(&plan, 0, sizeof(plan));
+    _plan_init(&plan, w, h, &opts);
+    sw = w;
+    sh = h;
+    if (plan.scale > 1) {
+        sw = w/plan.scale + (w&1);
+        sh = h/plan.scale + (h&1);
+    }
+    if (sw < plan.window.w || sh < plan.window.h)
+        return INFINITY;
+
+    /* Buffers for the largest rectangle */
+    for (i=0; i<count; ++i) {
+        _roi_view(&plan, sw, sh, rects+i, &v);
+        _roi_sizes(&plan, &v, &src_size, &dec_size, &scratch_size);
+    }
+    if (_roi_alloc(&plan, src_size, dec_size, scratch_size, src, dec))
+        return INFINITY;
+
+    for (i=0; i<count; ++i) {
+        _roi_view(&plan, sw, sh, rects+i, &v);
+        mean = _roi_score(&plan, ref, cmp, stride, &v, src, dec);
+        if (mean == INFINITY)
+            break;
+        windows = (v.vw - plan.window.w + 1)*(v.vh - plan.window.h + 1);
+        sum += (double)mean * windows;
+        n += windows;
+    }
+
+    _iqa_free_aligned(plan.block);
+    if (i < count)
+        return INFINITY;
+    return (float)(sum / n);
+}
+
+/* Width and height of a tracker tile, in SSIM windows of the scaled image */
+#define TRACKER_TILE 32
+
+/*
+ * An SSIM tracker. The windows of the scaled image are split into tiles that
+ * each keep the SSIM sum of their windows, so an update only scores the tiles
+ * that a dirty rectangle can reach. Every tile is scored on its own views (see
+ * _roi_view_windows()), so the result doesn't depend on the update history.
+ */
+struct iqa_ssim_tracker {
+    struct iqa_ssim_plan plan;      /* Settings, plus the buffers of one tile */
+    int sw, sh;                     /* Scaled size */
+    int ww, wh;                     /* Number of SSIM windows */
+    int tw, th;                     /* Number of tiles */
+    int primed;                     /* Set once every tile has been scored */
+    double *sums;                   /* SSIM sum of each tile */
+    unsigned char *dirty;           /* Tiles to score on the next update */
+    float *src[2], *dec[2];
+};
+
+/* The views of tile (tx,ty) */
+static void _tracker_view(const struct iqa_ssim_tracker *t, int tx, int ty, struct _ssim_roi *v)
+{
+    _roi_view_windows(&t->plan, tx*TRACKER_TILE, _min((tx+1)*TRACKER_TILE, t->ww),
+        ty*TRACKER_TILE, _min((ty+1)*TRACKER_TILE, t->wh), v);
+}
+
+/*
+ * Works out the SSIM windows p0..p1-1 that source pixels r0..r1-1 can reach
+ * along an axis of 'n' source pixels ('sn' scaled) with windows 'kn' long.
+ * This errs on the large side: a scaled pixel is taken to read two pixels of
+ * margin around its low-pass filter, and the mirrored edges reach the whole
+ * last few pixels.
+ */
+static void _tracker_reach(int r0, int r1, int n, int sn, int f, int kn, int *p0, int *p1)
+{
+    int d0 = r0 < 2*f ? 0 : r0/f - 2;
+    int d1 = r1 + 2*f >= n ? sn : (r1-1)/f + 3;
+
+    *p0 = _max(d0 - kn + 1, 0);
+    *p1 = _min(d1, sn - kn + 1);
+}
+
+/* iqa_ssim_tracker_create */
+struct iqa_ssim_tracker *iqa_ssim_tracker_create(int w, int h, const struct iqa_ssim_plan_options *opts)
+{
+    struct iqa_ssim_tracker *t;
+    struct _ssim_roi v;
+    int tx, ty;
+    size_t src_size=0, dec_size=0, scratch_size=0;
+
+    if (w < 1 || h < 1)
+        return 0;
+    t = (struct iqa_ssim_tracker*)calloc(1, sizeof(struct iqa_ssim_tracker));
+    if (!t)
+        return 0;
+    _plan_init(&t->plan, w, h, opts);
+    t->sw = w;
+    t->sh = h;
+    if (t->plan.scale > 1) {
+        t->sw = w/t->plan.scale + (w&1);
+        t->sh = h/t->plan.scale + (h&1);
+    }
+    if (t->sw < t->plan.window.w || t->sh < t->plan.window.h) {
+        free(t);
+        return 0;
+    }
+    t->ww = t->sw - t->plan.window.w + 1;
+    t->wh = t->sh - t->plan.window.h + 1;
+    t->tw = (t->ww + TRACKER_TILE - 1)/TRACKER_TILE;
+    t->th = (t->wh + TRACKER_TILE - 1)/TRACKER_TILE;
+    t->sums = (double*)calloc(t->tw*t->th, sizeof(double));
+    t->dirty = (unsigned char*)calloc(t->tw*t->th, 1);
+
+    /* Buffers for the largest tile (the aligned views differ in size) */
+    for (ty=0; ty<t->th; ++ty) {
+        for (tx=0; tx<t->tw; ++tx) {
+            _tracker_view(t, tx, ty, &v);
+            _roi_sizes(&t->plan, &v, &src_size, &dec_size, &scratch_size);
+        }
+    }
+    if (!t->sums || !t->dirty || _roi_alloc(&t->plan, src_size, dec_size, scratch_size, t->src, t->dec)) {
+        iqa_ssim_tracker_destroy(t);
+        return 0;
+    }
+    return t;
+}
+
+/* iqa_ssim_tracker_update */
+float iqa_ssim_tracker_update(struct iqa_ssim_tracker *tracker, const unsigned char *ref,
+    const unsigned char *cmp, int stride, const struct iqa_rect *dirty, int count)
+{
+    struct iqa_ssim_tracker *t = tracker;
+    struct _ssim_roi v;
+    int i, tx, ty, p0, p1, q0, q1, f;
+    double sum=0.0;
+    float mean;
+
+    if (!t || !ref || !cmp || stride < t->plan.w || count < 0)
+        return INFINITY;
+    if (dirty && count && _iqa_rects_valid(dirty, count, t->plan.w, t->plan.h))
+        return INFINITY;
+
+    /* Mark the tiles the rectangles reach */
+    if (!t->primed || !dirty)
+        memset(t->dirty, 1, t->tw*t->th);
+    else {
+        f = t->plan.scale;
+        for (i=0; i<count; ++i) {
+            _tracker_reach(dirty[i].x, dirty[i].x + dirty[i].w, t->plan.w, t->sw, f, t->plan.window.w,
+                &p0, &p1);
+            _tracker_reach(dirty[i].y, dirty[i].y + dirty[i].h, t->plan.h, t->sh, f, t->plan.window.h,
+                &q0, &q1);
+            for (ty=q0/TRACKER_TILE; ty<=(q1-1)/TRACKER_TILE; ++ty)
+                for (tx=p0/TRACKER_TILE; tx<=(p1-1)/TRACKER_TILE; ++tx)
+                    t->dirty[ty*t->tw + tx] = 1;
+        }
+    }
+
+    for (ty=0; ty<t->th; ++ty) {
+        for (tx=0; tx<t->tw; ++tx) {
+            i = ty*t->tw + tx;
+            if (t->dirty[i]) {
+                _tracker_view(t, tx, ty, &v);
+                mean = _roi_score(&t->plan, ref, cmp, stride, &v, t->src, t->dec);
+                if (mean == INFINITY) {
+                    /* Score every tile next time */
+                    t->primed = 0;
+                    return INFINITY;
+                }
+                t->sums[i] = (double)mean * (v.vw - t->plan.window.w + 1)*(v.vh - t->plan.window.h + 1);
+                t->dirty[i] = 0;
+            }
+            sum += t->sums[i];
+        }
+    }
+    t->primed = 1;
+    return (float)(sum / ((double)t->ww*t->wh));
+}
+
+/* iqa_ssim_tracker_destroy */
+void iqa_ssim_tracker_destroy(struct iqa_ssim_tracker *tracker)
+{
+    if (!tracker)
+        return;
+    _iqa_free_aligned(tracker->plan.block);
+    free(tracker->sums);
+    free(tracker->dirty);
+    free(tracker);
+}
+
+/*
+ * A reference image that has been converted, scaled and had its window
+ * statistics calculated. The plan supplies the buffers and settings.
+ */
+struct iqa_ssim_ref {
+    struct iqa_ssim_plan *plan;
+    int w, h;                   /* Size after scaling */
+    struct _ssim_ref_stats rs;
+    void *block;
+};
+
+/* iqa_ssim_ref_prepare */
+struct iqa_ssim_ref *iqa_ssim_ref_prepare(const unsigned char *ref, int w, int h, int stride,
+    const struct iqa_ssim_plan_options *opts)
+{
+    struct iqa_ssim_ref *prep;
+    int dst_w, dst_h;
+    size_t size;
+
+    if (!ref)
+        return 0;
+    prep = (struct iqa_ssim_ref*)calloc(1, sizeof(struct iqa_ssim_ref));
+    if (!prep)
+        return 0;
+    prep->plan = iqa_ssim_plan_create(w, h, stride, opts);
+    if (!prep->plan || _plan_load(prep->plan, ref, prep->plan->ref_f, &prep->w, &prep->h)) {
+        iqa_ssim_ref_destroy(prep);
+        return 0;
+    }
+
+    dst_w = prep->w - prep->plan->window.w + 1;
+    dst_h = prep->h - prep->plan->window.h + 1;
+    if (dst_w < 1 || dst_h < 1) {
+        iqa_ssim_ref_destroy(prep);
+        return 0;
+    }
+    size = IQA_ALIGN_SIZE(dst_w*dst_h*sizeof(float));
+    prep->block = _iqa_malloc_aligned(2*size);
+    if (!prep->block) {
+        iqa_ssim_ref_destroy(prep);
+        return 0;
+    }
+    prep->rs.mu = (float*)prep->block;
+    prep->rs.sigma_sqd = (float*)((unsigned char*)prep->block + size);
+    if (_iqa_ssim_ref_stats(prep->plan->ref_f, prep->w, prep->h, prep->plan->fstride,
+        &prep->plan->window, &prep->rs, prep->plan->scratch)) {
+        iqa_ssim_ref_destroy(prep);
+        return 0;
+    }
+    return prep;
+}
+
+/* iqa_ssim_compare */
+float iqa_ssim_compare(struct iqa_ssim_ref *prepared, const unsigned char *cmp)
+{
+    int w, h;
+
+    /* The plan already holds the reference */
+    if (!prepared || _plan_check(prepared->plan, prepared->plan->ref_f, cmp))
+        return INFINITY;
+    if (_plan_load(prepared->plan, cmp, prepared->plan->cmp_f, &w, &h))
+        return INFINITY;
+    return _plan_score(prepared->plan, w, h, &prepared->rs, 0);
+}
+
+/* iqa_ssim_ref_destroy */
+void iqa_ssim_ref_destroy(struct iqa_ssim_ref *prepared)
+{
+    if (!prepared)
+        return;
+    iqa_ssim_plan_destroy(prepared->plan);
+    _iqa_free_aligned(prepared->block);
+    free(prepared);
+}
+
+
+/*
+ * Number of window statistics gathered per pixel: mean of the reference, mean
+ * of the distorted image, the variance of each and their covariance. Each
+ * statistic is stored as its own row of output pixels.
+ */
+#define STATS 5
+
+/*
+ * Stores the statistics of output pixel 'x' from the scaled window sums (the
+ * second moments are uncentered). The variances are formed in single
+ * precision.
+ */
+static void _ssim_store_stats(float *stats, int x, int dst_w,
+    double s0, double s1, double s2, double s3, double s4)
+{
+    float ref_mu = (float)s0;
+    float cmp_mu = (float)s1;
+    stats[x]         = ref_mu;
+    stats[x+dst_w]   = cmp_mu;
+    stats[x+2*dst_w] = (float)s2 - ref_mu*ref_mu;
+    stats[x+3*dst_w] = (float)s3 - cmp_mu*cmp_mu;
+    stats[x+4*dst_w] = (float)s4 - ref_mu*cmp_mu;
+}
+
+/*
+ * Calculates the window statistics for every output pixel in row 'y' (STATS
+ * rows of dst_w values in 'stats'). Both images are read once per window row,
+ * and all moments are accumulated together. For separable windows, 'col' must
+ * hold STATS*w doubles for the vertical pass.
+ */
+static void _ssim_row_stats(const float *ref, const float *cmp, int w, int stride, int y,
+    const struct _kernel *k, double scale, double *col, float *stats)
+{
+    int x,u,v,offset;
+    int dst_w = w - k->w + 1;
+    double a, b, wt, s0, s1, s2, s3, s4;
+    float fa, fb, fwt;
+    double *c;
+
+    if (k->kernel_h && k->kernel_v) {
+        /* Vertical pass over the window rows */
+        for (x=0; x<STATS*w; ++x)
+            col[x] = 0.0;
+        for (v=0; v<k->h; ++v) {
+            offset = (y+v)*stride;
+            wt = k->kernel_v[v];
+            for (x=0, c=col; x<w; ++x, ++offset, c+=STATS) {
+                a = ref[offset];
+                b = cmp[offset];
+                c[0] += wt * a;
+                c[1] += wt * b;
+                c[2] += wt * a * a;
+                c[3] += wt * b * b;
+                c[4] += wt * a * b;
+            }
+        }
+        /* Horizontal pass */
+        for (x=0; x<dst_w; ++x) {
+            s0 = s1 = s2 = s3 = s4 = 0.0;
+            for (u=0, c=col+x*STATS; u<k->w; ++u, c+=STATS) {
+                wt = k->kernel_h[u];
+                s0 += wt * c[0];
+                s1 += wt * c[1];
+                s2 += wt * c[2];
+                s3 += wt * c[3];
+                s4 += wt * c[4];
+            }
+            _ssim_store_stats(stats, x, dst_w, s0*scale, s1*scale, s2*scale,
+                s3*scale, s4*scale);
+        }
+        return;
+    }
+
+    /* Non-separable window. The products are single precision, as in
+     * convolving the images and their float products one at a time. */
+    for (x=0; x<dst_w; ++x) {
+        s0 = s1 = s2 = s3 = s4 = 0.0;
+        for (v=0; v<k->h; ++v) {
+            offset = (y+v)*stride + x;
+            for (u=0; u<k->w; ++u, ++offset) {
+                fwt = k->kernel[v*k->w + u];
+                fa = ref[offset];
+                fb = cmp[offset];
+                s0 += fa * fwt;
+                s1 += fb * fwt;
+                s2 += (fa * fa) * fwt;
+                s3 += (fb * fb) * fwt;
+                s4 += (fa * fb) * fwt;
+            }
+        }
+        _ssim_store_stats(stats, x, dst_w, s0*scale, s1*scale, s2*scale,
+            s3*scale, s4*scale);
+    }
+}
+
+/*
+ * Box window version of _ssim_row_stats(). The column sums in 'col' are kept
+ * between calls and slid down one row at a time, and a running (prefix) sum
+ * over the columns gives each window total with 2 lookups per statistic. The
+ * cost per pixel is therefore independent of the window size. Rows must be
+ * requested in order, and 'first' set for the first one (the column sums are
+ * then rebuilt). 'prefix' must hold STATS*(w+1) doubles.
+ */
+static void _ssim_box_row_stats(const float *ref, const float *cmp, int w, int stride, int y, int first,
+    const struct _kernel *k, double scale, double *col, double *prefix, float *stats)
+{
+    int x,v,offset,old_offset;
+    int dst_w = w - k->w + 1;
+    double a, b, wt;
+    double *c, *p, *q;
+
+    if (first) {
+        for (x=0; x<STATS*w; ++x)
+            col[x] = 0.0;
+        for (v=0; v<k->h; ++v) {
+            offset = (y+v)*stride;
+            for (x=0, c=col; x<w; ++x, ++offset, c+=STATS) {
+                a = ref[offset];
+                b = cmp[offset];
+                c[0] += a;
+                c[1] += b;
+                c[2] += a * a;
+                c[3] += b * b;
+                c[4] += a * b;
+            }
+        }
+    }
+    else {
+        /* Slide the window down: add the new row, remove the old one */
+        offset = (y+k->h-1)*stride;
+        old_offset = (y-1)*stride;
+        for (x=0, c=col; x<w; ++x, ++offset, ++old_offset, c+=STATS) {
+            a = ref[offset];
+            b = cmp[offset];
+            c[0] += a;
+            c[1] += b;
+            c[2] += a * a;
+            c[3] += b * b;
+            c[4] += a * b;
+            a = ref[old_offset];
+            b = cmp[old_offset];
+            c[0] -= a;
+            c[1] -= b;
+            c[2] -= a * a;
+            c[3] -= b * b;
+            c[4] -= a * b;
+        }
+    }
+
+    /* Running sum across the columns */
+    for (v=0; v<STATS; ++v)
+        prefix[v] = 0.0;
+    for (x=0, c=col, p=prefix; x<w; ++x, c+=STATS, p+=STATS) {
+        p[STATS+0] = p[0] + c[0];
+        p[STATS+1] = p[1] + c[1];
+        p[STATS+2] = p[2] + c[2];
+        p[STATS+3] = p[3] + c[3];
+        p[STATS+4] = p[4] + c[4];
+    }
+
+    wt = k->kernel[0] * scale;
+    for (x=0, p=prefix, q=prefix+k->w*STATS; x<dst_w; ++x, p+=STATS, q+=STATS) {
+        _ssim_store_stats(stats, x, dst_w, (q[0]-p[0])*wt, (q[1]-p[1])*wt,
+            (q[2]-p[2])*wt, (q[3]-p[3])*wt, (q[4]-p[4])*wt);
+    }
+}
+
+/*
+ * Stores the cmp statistics of output pixel 'x' when the reference mean and
+ * variance are cached. The reference mean must already be in the first row.
+ */
+static void _ssim_store_cmp_stats(float *stats, int x, int dst_w, double s1, double s3, double s4)
+{
+    float ref_mu = stats[x];
+    float cmp_mu = (float)s1;
+    stats[x+dst_w]   = cmp_mu;
+    stats[x+3*dst_w] = (float)s3 - cmp_mu*cmp_mu;
+    stats[x+4*dst_w] = (float)s4 - ref_mu*cmp_mu;
+}
+
+/*
+ * Version of _ssim_row_stats() for a cached reference. Only the cmp mean,
+ * E[cmp^2] and E[ref*cmp] are accumulated (for separable windows, 'col' needs
+ * 3*w doubles). The sums are formed in the same order, so the results are
+ * identical.
+ */
+static void _ssim_row_cmp_stats(const float *ref, const float *cmp, int w, int stride, int y,
+    const struct _kernel *k, double scale, double *col, float *stats)
+{
+    int x,u,v,offset;
+    int dst_w = w - k->w + 1;
+    double a, b, wt, s1, s3, s4;
+    float fa, fb, fwt;
+    double *c;
+
+    if (!k->kernel_h || !k->kernel_v) {
+        for (x=0; x<dst_w; ++x) {
+            s1 = s3 = s4 = 0.0;
+            for (v=0; v<k->h; ++v) {
+                offset = (y+v)*stride + x;
+                for (u=0; u<k->w; ++u, ++offset) {
+                    fwt = k->kernel[v*k->w + u];
+                    fa = ref[offset];
+                    fb = cmp[offset];
+                    s1 += fb * fwt;
+                    s3 += (fb * fb) * fwt;
+                    s4 += (fa * fb) * fwt;
+                }
+            }
+            _ssim_store_cmp_stats(stats, x, dst_w, s1*scale, s3*scale, s4*scale);
+        }
+        return;
+    }
+
+    for (x=0; x<3*w; ++x)
+        col[x] = 0.0;
+    for (v=0; v<k->h; ++v) {
+        offset = (y+v)*stride;
+        wt = k->kernel_v[v];
+        for (x=0, c=col; x<w; ++x, ++offset, c+=3) {
+            a = ref[offset];
+            b = cmp[offset];
+            c[0] += wt * b;
+            c[1] += wt * b * b;
+            c[2] += wt * a * b;
+        }
+    }
+    for (x=0; x<dst_w; ++x) {
+        s1 = s3 = s4 = 0.0;
+        for (u=0, c=col+x*3; u<k->w; ++u, c+=3) {
+            wt = k->kernel_h[u];
+            s1 += wt * c[0];
+            s3 += wt * c[1];
+            s4 += wt * c[2];
+        }
+        _ssim_store_cmp_stats(stats, x, dst_w, s1*scale, s3*scale, s4*scale);
+    }
+}
+
+/*
+ * Box window version of _ssim_row_cmp_stats(). Works like
+ * _ssim_box_row_stats() (rows in order, 'first' set on the first) with 3
+ * statistics.
+ */
+static void _ssim_box_row_cmp_stats(const float *ref, const float *cmp, int w, int stride, int y, int first,
+    const struct _kernel *k, double scale, double *col, double *prefix, float *stats)
+{
+    int x,v,offset,old_offset;
+    int dst_w = w - k->w + 1;
+    double a, b, wt;
+    double *c, *p, *q;
+
+    if (first) {
+        for (x=0; x<3*w; ++x)
+            col[x] = 0.0;
+        for (v=0; v<k->h; ++v) {
+            offset = (y+v)*stride;
+            for (x=0, c=col; x<w; ++x, ++offset, c+=3) {
+                a = ref[offset];
+                b = cmp[offset];
+                c[0] += b;
+                c[1] += b * b;
+                c[2] += a * b;
+            }
+        }
+    }
+    else {
+        offset = (y+k->h-1)*stride;
+        old_offset = (y-1)*stride;
+        for (x=0, c=col; x<w; ++x, ++offset, ++old_offset, c+=3) {
+            a = ref[offset];
+            b = cmp[offset];
+            c[0] += b;
+            c[1] += b * b;
+            c[2] += a * b;
+            a = ref[old_offset];
+            b = cmp[old_offset];
+            c[0] -= b;
+            c[1] -= b * b;
+            c[2] -= a * b;
+        }
+    }
+
+    prefix[0] = prefix[1] = prefix[2] = 0.0;
+    for (x=0, c=col, p=prefix; x<w; ++x, c+=3, p+=3) {
+        p[3] = p[0] + c[0];
+        p[4] = p[1] + c[1];
+        p[5] = p[2] + c[2];
+    }
+
+    wt = k->kernel[0] * scale;
+    for (x=0, p=prefix, q=prefix+k->w*3; x<dst_w; ++x, p+=3, q+=3)
+        _ssim_store_cmp_stats(stats, x, dst_w, (q[0]-p[0])*wt, (q[1]-p[1])*wt, (q[2]-p[2])*wt);
+}
+
+/*
+ * Calculates the window statistics of output row 'y' with whichever path
+ * suits the kernel. 'first' must be set when 'y' doesn't follow the previous
+ * call's row. If 'rs' is given, the reference mean and variance are
+ * copied from it and only the cmp side is calculated.
+ */
+static void _ssim_next_row(const float *ref, const float *cmp, int w, int stride, int y, int first,
+    const struct _kernel *k, double scale, int box, const struct _iqa_simd *simd,
+    const struct _ssim_ref_stats *rs, double *col, double *prefix, float *stats)
+{
+    int dst_w = w - k->w + 1;
+    int sep = k->kernel_h && k->kernel_v;
+
+    if (rs) {
+        memcpy(stats, rs->mu + y*dst_w, dst_w*sizeof(float));
+        memcpy(stats + 2*dst_w, rs->sigma_sqd + y*dst_w, dst_w*sizeof(float));
+        if (box)
+            _ssim_box_row_cmp_stats(ref, cmp, w, stride, y, first, k, scale, col, prefix, stats);
+        else if (sep && simd->ssim_cmp_stats_row)
+            simd->ssim_cmp_stats_row(ref+y*stride, cmp+y*stride, stride, w, k->kernel_h, k->w,
+                k->kernel_v, k->h, (float)scale, col, stats);
+        else
+            _ssim_row_cmp_stats(ref, cmp, w, stride, y, k, scale, col, stats);
+        return;
+    }
+
+    if (box)
+        _ssim_box_row_stats(ref, cmp, w, stride, y, first, k, scale, col, prefix, stats);
+    else if (sep && simd->ssim_stats_row)
+        simd->ssim_stats_row(ref+y*stride, cmp+y*stride, stride, w, k->kernel_h, k->w,
+            k->kernel_v, k->h, (float)scale, col, stats);
+    else
+        _ssim_row_stats(ref, cmp, w, stride, y, k, scale, col, stats);
+}
+
+/* Bytes of row buffers needed by one thread */
+static size_t _ssim_row_scratch(int w, const struct _kernel *k)
+{
+    int dst_w = w - k->w + 1;
+    if (dst_w < 1)
+        return 0;
+    return IQA_ALIGN_SIZE((STATS*w + STATS*(w+1) + 3*dst_w)*sizeof(double) + STATS*dst_w*sizeof(float));
+}
+
+/* _iqa_ssim_ref_stats */
+int _iqa_ssim_ref_stats(const float *ref, int w, int h, int stride, const struct _kernel *k,
+    struct _ssim_ref_stats *rs, void *scratch)
+{
+    int y, dst_w, dst_h, box;
+    double *col, *prefix;
+    float *stats;
+    double scale;
+    const struct _iqa_simd *simd = _iqa_simd_get();
+
+    dst_w = w - k->w + 1;
+    dst_h = h - k->h + 1;
+    if (dst_w < 1 || dst_h < 1)
+        return 1;
+
+    col = (double*)scratch;
+    if (!col && !(col = (double*)malloc(_ssim_row_scratch(w, k))))
+        return 1;
+    prefix = col + STATS*w;
+    stats = (float*)(prefix + STATS*(w+1));
+    scale = (double)_iqa_kernel_scale(k);
+    box = _iqa_kernel_is_uniform(k);
+
+    /*
+     * The reference statistics don't depend on the other image, so comparing
+     * the reference with itself gives exactly what _iqa_ssim_ws() would see.
+     */
+    for (y=0; y<dst_h; ++y) {
+        _ssim_next_row(ref, ref, w, stride, y, y==0, k, scale, box, simd, 0, col, prefix, stats);
+        memcpy(rs->mu + y*dst_w, stats, dst_w*sizeof(float));
+        memcpy(rs->sigma_sqd + y*dst_w, stats + 2*dst_w, dst_w*sizeof(float));
+    }
+
+    if (!scratch)
+        free(col);
+    return 0;
+}
+
+/*
+ * Output rows are processed in bands of this many rows. The bands are the
+ * unit of work for the thread pool, and their partial results are combined in
+ * band order, so the result doesn't depend on the number of threads.
+ */
+#define BAND_ROWS 64
+
+static int _band_count(int h, const struct _kernel *k)
+{
+    int dst_h = h - k->h + 1;
+    return dst_h < 1 ? 0 : (dst_h + BAND_ROWS - 1) / BAND_ROWS;
+}
+
+/* _iqa_ssim_scratch */
+size_t _iqa_ssim_scratch(int w, int h, const struct _kernel *k)
+{
+    return IQA_ALIGN_SIZE(_band_count(h, k)*sizeof(struct _ssim_band)) + _ssim_row_scratch(w, k);
+}
+
+/*
+ * Sets up everything in 'job' except the images and buffers. 'L' is the
+ * dynamic range used without 'args'. Returns 0 on success, or non-zero if the
+ * arguments are invalid or the images are smaller than the window.
+ */
+static int _ssim_job_init(struct _ssim_job *job, int w, int h, const struct _kernel *k,
+    const struct _map_reduce *mr, const struct iqa_ssim_args *args, int L,
+    const struct _ssim_ref_stats *rs)
+{
+    float K1=0.01f, K2=0.03f;
+
     /* Initialize algorithm parameters */
-    scale = _max( 1, _round( (float)_min(w,h) / 256.0f ) );
+    job->alpha = job->beta = job->gamma = 1.0f;
     if (args) {
-        if(args->f)
-            scale = args->f;
-        mr.map     = _ssim_map;
-        mr.reduce  = _ssim_reduce;
-        mr.context = (void*)&ssim_sum;
-    }
-    window.kernel = (float*)g_square_window;
-    window.w = window.h = SQUARE_LEN;
-    window.normalized = 1;
-    window.bnd_opt = KBND_SYMMETRIC;
-    if (gaussian) {
-        window.kernel = (float*)g_gaussian_window;
-        window.w = window.h = GAUSSIAN_LEN;
-    }
-
-    /* Convert image values to floats. Forcing stride = width. */
-    ref_f = (float*)malloc(w*h*sizeof(float));
-    cmp_f = (float*)malloc(w*h*sizeof(float));
-    if (!ref_f || !cmp_f) {
-        if (ref_f) free(ref_f);
-        if (cmp_f) free(cmp_f);
-        return INFINITY;
+        if (!mr)
+            return 1;
+        job->alpha = args->alpha;
+        job->beta  = args->beta;
+        job->gamma = args->gamma;
+        L          = args->L;
+        K1         = args->K1;
+        K2         = args->K2;
     }
-    for (y=0; y<h; ++y) {
-        src_offset = y*stride;
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset, ++src_offset) {
-            ref_f[offset] = (float)ref[src_offset];
-            cmp_f[offset] = (float)cmp[src_offset];
+    job->C1 = (K1*L)*(K1*L);
+    job->C2 = (K2*L)*(K2*L);
+    job->C3 = job->C2 / 2.0f;
+
+    /* The results are smaller by the kernel width and height */
+    job->dst_w = w - k->w + 1;
+    job->dst_h = h - k->h + 1;
+    if (job->dst_w < 1 || job->dst_h < 1)
+        return 1;
+
+    job->w = w;
+    job->stride = w;
+    job->k = k;
+    job->mr = mr;
+    job->args = args;
+    job->rs = rs;
+    job->simd = _iqa_simd_get();
+    job->scale = (double)_iqa_kernel_scale(k);
+    job->box = _iqa_kernel_is_uniform(k);
+    job->row_size = _ssim_row_scratch(w, k);
+    job->maps = 0;
+    job->components = 0;
+
+    /* Map functions that can't be split over bands are run in order */
+    job->direct = args && mr->pool == MR_CUSTOM &&
+        (!mr->split || !mr->merge || mr->context_size > MR_CONTEXT_MAX);
+    return 0;
+}
+
+/* Writes 'value' to pixel (x,y) of a caller's map, if it was requested */
+static void _store_map(const struct iqa_map *map, int x, int y, double value)
+{
+    unsigned char *row;
+
+    if (!map->data)
+        return;
+    row = (unsigned char*)map->data + y*map->stride;
+    if (map->format == IQA_MAP_U8) {
+        if (value < 0.0)
+            value = 0.0;
+        else if (value > 1.0)
+            value = 1.0;
+        row[x] = (unsigned char)(value*255.0 + 0.5);
+    }
+    else
+        ((float*)row)[x] = (float)value;
+}
+
+/*
+ * Raises a row of terms to the exponent 'e', keeping the sign. Only called for
+ * exponents other than 1. Uses the vector kernel when there is one.
+ */
+static void _pow_row(const struct _iqa_simd *simd, double *v, int len, float e)
+{
+    int x;
+    float sign;
+    if (simd->pow_row) {
+        simd->pow_row(v, len, (double)e);
+        return;
+    }
+    for (x=0; x<len; ++x) {
+        sign = v[x] < 0.0 ? -1.0f : 1.0f;
+        v[x] = sign * pow(fabs(v[x]),(double)e);
+    }
+}
+
+/* Whether input row 'y' is the same in both images (bit for bit) */
+static int _ssim_row_same(const struct _ssim_job *job, int y)
+{
+    return memcmp(job->ref + y*job->stride, job->cmp + y*job->stride, job->w*sizeof(float)) == 0;
+}
+
+/*
+ * Pools output row 'y' when all its windows are identical in both images: the
+ * luminance, contrast and structure terms (and their powers) are all 1.
+ * 'l', 'c' and 's' are the row buffers of _ssim_rows().
+ */
+static int _ssim_row_ones(const struct _ssim_job *job, int y, double *l, double *c, double *s,
+    double *sum, void *context)
+{
+    int x, dst_w = job->dst_w;
+
+    if (!job->args)
+        *sum += dst_w;
+    if (!job->args && !job->maps)
+        return 0;
+    for (x=0; x<dst_w; ++x)
+        l[x] = c[x] = s[x] = 1.0;
+    if (job->maps) {
+        for (x=0; x<dst_w; ++x) {
+            _store_map(&job->maps->ssim, x, y, 1.0);
+            _store_map(&job->maps->l, x, y, 1.0);
+            _store_map(&job->maps->c, x, y, 1.0);
+            _store_map(&job->maps->s, x, y, 1.0);
         }
     }
+    return job->args && _mr_map(job->mr, l, c, s, dst_w, context);
+}
 
-    /* Scale the images down if required */
-    if (scale > 1) {
-        /* Generate simple low-pass filter */
-        low_pass.kernel = (float*)malloc(scale*scale*sizeof(float));
-        if (!low_pass.kernel) {
-            free(ref_f);
-            free(cmp_f);
-            return INFINITY;
+/*
+ * Calculates SSIM for output rows [y0, y1), adding to '*sum' (default SSIM)
+ * or mapping into 'context'. 'first' is set if row y0 starts a band, which
+ * restarts the running window sums. '*same' carries the number of identical
+ * input rows ending on the last row of the previous call's windows, so a
+ * band calculated a row at a time compares each row once. It is only read
+ * when 'first' isn't set. Returns 0 on success.
+ *
+ * The per-pixel work is one of 3 loops, picked once per row: the default
+ * SSIM sum (ssim_pool_row), the unit-exponent terms (ssim_terms_row, which
+ * also covers the MS-SSIM* constants of 0) and the terms followed by a pow()
+ * pass for each exponent that isn't 1. Rows whose windows only cover input
+ * rows that are identical in both images skip all of it (see _ssim_row_ones()).
+ */
+static int _ssim_rows(const struct _ssim_job *job, int y0, int y1, int first, void *buf,
+    double *sum, void *context, int *same_rows)
+{
+    int x, y, v, pooled, same, skipped, dst_w = job->dst_w, kh = job->k->h;
+    float ref_mu,cmp_mu,ref_sigma_sqd,cmp_sigma_sqd,sigma_both;
+    double *col = (double*)buf;
+    double *prefix = col + STATS*job->w;
+    double *l = prefix + STATS*(job->w+1);     /* Terms of one row */
+    double *c = l + dst_w;
+    double *s = c + dst_w;
+    float *stats = (float*)(s + dst_w);
+    double ssim_sum, numerator, denominator, ssim_value;
+    float C1 = job->C1, C2 = job->C2, C3 = job->C3;
+
+    /*
+     * 'same' counts the identical input rows that end on the last row of the
+     * current windows. When continuing, it also tells whether row y0-1 was
+     * skipped, in which case the stats must be rebuilt.
+     */
+    same = first ? 0 : *same_rows;
+    for (v = y0; first && v < y0 + kh - 1; ++v)
+        same = _ssim_row_same(job, v) ? same+1 : 0;
+    skipped = !first && same >= kh;
+
+    ssim_sum = *sum;
+    for (y=y0; y<y1; ++y) {
+        same = _ssim_row_same(job, y + kh - 1) ? same+1 : 0;
+        if (same >= kh) {
+            /* Every window of the row is identical, so each local value is exactly 1 */
+            skipped = 1;
+            if (_ssim_row_ones(job, y, l, c, s, &ssim_sum, context))
+                return 1;
+            continue;
         }
-        low_pass.w = low_pass.h = scale;
-        low_pass.normalized = 0;
-        low_pass.bnd_opt = KBND_SYMMETRIC;
-        for (offset=0; offset<scale*scale; ++offset)
-            low_pass.kernel[offset] = 1.0f/(scale*scale);
-
-        /* Resample */
-        if (_iqa_decimate(ref_f, w, h, scale, &low_pass, 0, 0, 0) ||
-            _iqa_decimate(cmp_f, w, h, scale, &low_pass, 0, &w, &h)) { /* Update w/h */
-            free(ref_f);
-            free(cmp_f);
-            free(low_pass.kernel);
-            return INFINITY;
+
+        _ssim_next_row(job->ref, job->cmp, job->w, job->stride, y, (first && y==y0) || skipped, job->k,
+            job->scale, job->box, job->simd, job->rs, col, prefix, stats);
+        skipped = 0;
+
+        if (!job->args) {
+            /* The default case. The maps are filled in below, but the sum still comes from here. */
+            pooled = job->simd->ssim_pool_row != 0;
+            if (pooled)
+                ssim_sum += job->simd->ssim_pool_row(stats, dst_w, C1, C2);
+            if (!pooled || (job->maps && job->maps->ssim.data)) {
+                for (x=0; x<dst_w; ++x) {
+                    ref_mu = stats[x];
+                    cmp_mu = stats[x+dst_w];
+                    ref_sigma_sqd = stats[x+2*dst_w];
+                    cmp_sigma_sqd = stats[x+3*dst_w];
+                    sigma_both = stats[x+4*dst_w];
+                    numerator   = (2.0 * ref_mu * cmp_mu + C1) * (2.0 * sigma_both + C2);
+                    denominator = (ref_mu*ref_mu + cmp_mu*cmp_mu + C1) * 
+                        (ref_sigma_sqd + cmp_sigma_sqd + C2);
+                    ssim_value = numerator / denominator;
+                    if (!pooled)
+                        ssim_sum += ssim_value;
+                    if (job->maps)
+                        _store_map(&job->maps->ssim, x, y, ssim_value);
+                }
+            }
+            if (!job->components)
+                continue;
         }
-        free(low_pass.kernel);
-    }
 
-    result = _iqa_ssim(ref_f, cmp_f, w, h, &window, &mr, args);
-    
-    free(ref_f);
-    free(cmp_f);
+        /* User tweaked alpha, beta, or gamma (or wants the component maps) */
+        job->simd->ssim_terms_row(stats, dst_w, C1, C2, C3, l, c, s);
+        if (job->args) {
+            if (job->alpha != 1.0f)
+                _pow_row(job->simd, l, dst_w, job->alpha);
+            if (job->beta != 1.0f)
+                _pow_row(job->simd, c, dst_w, job->beta);
+            if (job->gamma != 1.0f)
+                _pow_row(job->simd, s, dst_w, job->gamma);
+        }
+        if (job->maps) {
+            for (x=0; x<dst_w; ++x) {
+                if (job->args)
+                    _store_map(&job->maps->ssim, x, y, l[x] * c[x] * s[x]);
+                _store_map(&job->maps->l, x, y, l[x]);
+                _store_map(&job->maps->c, x, y, c[x]);
+                _store_map(&job->maps->s, x, y, s[x]);
+            }
+        }
 
-    return result;
+        if (job->args && _mr_map(job->mr, l, c, s, dst_w, context))
+            return 1;
+    }
+    *sum = ssim_sum;
+    *same_rows = same;
+    return 0;
 }
 
+/* Thread pool task: one band of rows */
+static void _ssim_band_task(int band, int worker, void *ctx)
+{
+    const struct _ssim_job *job = (const struct _ssim_job*)ctx;
+    struct _ssim_band *b = job->bands + band;
+    int y0 = band*BAND_ROWS;
+    int y1 = y0 + BAND_ROWS < job->dst_h ? y0 + BAND_ROWS : job->dst_h;
+    void *buf = worker ? _iqa_parallel_scratch(worker, job->row_size) : job->rows;
+    void *context = b->context;
+    int same;
+
+    b->sum = 0.0;
+    b->error = 1;
+    if (!buf)
+        return;
+    if (job->direct)
+        context = job->mr->context;
+    else if (job->args)
+        _mr_split(job->mr, b->context);
+    b->error = _ssim_rows(job, y0, y1, 1, buf, &b->sum, context, &same);
+}
 
 /* _iqa_ssim */
 float _iqa_ssim(float *ref, float *cmp, int w, int h, const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args)
 {
-    float alpha=1.0f, beta=1.0f, gamma=1.0f;
-    int L=255;
-    float K1=0.01f, K2=0.03f;
-    float C1,C2,C3;
-    int x,y,offset;
-    float *ref_mu,*cmp_mu,*ref_sigma_sqd,*cmp_sigma_sqd,*sigma_both;
-    double ssim_sum, numerator, denominator;
-    double luminance_comp, contrast_comp, structure_comp, sigma_root;
-    struct _ssim_int sint;
+    return _iqa_ssim_ws(ref, cmp, w, h, k, mr, args, 0, 0);
+}
 
-    /* Initialize algorithm parameters */
-    if (args) {
-        if (!mr)
-            return INFINITY;
-        alpha = args->alpha;
-        beta  = args->beta;
-        gamma = args->gamma;
-        L     = args->L;
-        K1    = args->K1;
-        K2    = args->K2;
-    }
-    C1 = (K1*L)*(K1*L);
-    C2 = (K2*L)*(K2*L);
-    C3 = C2 / 2.0f;
-
-    ref_mu = (float*)malloc(w*h*sizeof(float));
-    cmp_mu = (float*)malloc(w*h*sizeof(float));
-    ref_sigma_sqd = (float*)malloc(w*h*sizeof(float));
-    cmp_sigma_sqd = (float*)malloc(w*h*sizeof(float));
-    sigma_both = (float*)malloc(w*h*sizeof(float));
-    if (!ref_mu || !cmp_mu || !ref_sigma_sqd || !cmp_sigma_sqd || !sigma_both) {
-        if (ref_mu) free(ref_mu);
-        if (cmp_mu) free(cmp_mu);
-        if (ref_sigma_sqd) free(ref_sigma_sqd);
-        if (cmp_sigma_sqd) free(cmp_sigma_sqd);
-        if (sigma_both) free(sigma_both);
+/* _iqa_ssim_ws */
+float _iqa_ssim_ws(float *ref, float *cmp, int w, int h, const struct _kernel *k,
+    const struct _map_reduce *mr, const struct iqa_ssim_args *args,
+    const struct _ssim_ref_stats *rs, void *scratch)
+{
+    return _ssim_run(ref, cmp, w, h, w, k, mr, args, 255, rs, 0, scratch);
+}
+
+/* _iqa_ssim_strided */
+float _iqa_ssim_strided(const float *ref, const float *cmp, int w, int h, int stride,
+    const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args,
+    const struct _ssim_ref_stats *rs, void *scratch)
+{
+    return _ssim_run(ref, cmp, w, h, stride, k, mr, args, 255, rs, 0, scratch);
+}
+
+/*
+ * _iqa_ssim_ws() that can also write the local values to 'maps'. Rows of the
+ * images start 'stride' floats apart. 'L' is the dynamic range used when there
+ * are no 'args'.
+ */
+static float _ssim_run(const float *ref, const float *cmp, int w, int h, int stride, const struct _kernel *k,
+    const struct _map_reduce *mr, const struct iqa_ssim_args *args, int L,
+    const struct _ssim_ref_stats *rs, const struct iqa_ssim_maps *maps, void *scratch)
+{
+    int band, bands, error=0;
+    float result;
+    void *buf = scratch;
+    struct _ssim_job job;
+
+    if (_ssim_job_init(&job, w, h, k, mr, args, L, rs))
         return INFINITY;
+    job.maps = maps;
+    job.components = maps && (maps->l.data || maps->c.data || maps->s.data);
+
+    /* Band results, then the row buffers of the calling thread */
+    bands = _band_count(h, k);
+    if (!buf && !(buf = _iqa_malloc_aligned(_iqa_ssim_scratch(w, h, k))))
+        return INFINITY;
+    job.bands = (struct _ssim_band*)buf;
+    job.rows = (unsigned char*)buf + IQA_ALIGN_SIZE(bands*sizeof(struct _ssim_band));
+    job.ref = ref;
+    job.cmp = cmp;
+    job.stride = stride;
+
+    if (!job.direct) {
+        _iqa_parallel_for(bands, _ssim_band_task, &job);
+        result = _iqa_ssim_job_result(&job);
+        if (!scratch)
+            _iqa_free_aligned(buf);
+        return result;
     }
 
-    /* Calculate mean */
-    _iqa_convolve(ref, w, h, k, ref_mu, 0, 0);
-    _iqa_convolve(cmp, w, h, k, cmp_mu, 0, 0);
+    for (band=0; band<bands && !error; ++band) {
+        _ssim_band_task(band, 0, &job);
+        error = job.bands[band].error;
+    }
+    if (!scratch)
+        _iqa_free_aligned(buf);
+    if (error)
+        return INFINITY;
+    return _mr_reduce(mr, job.dst_w, job.dst_h, mr->context);
+}
 
-    for (y=0; y<h; ++y) {
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset) {
-            ref_sigma_sqd[offset] = ref[offset] * ref[offset];
-            cmp_sigma_sqd[offset] = cmp[offset] * cmp[offset];
-            sigma_both[offset] = ref[offset] * cmp[offset];
-        }
+/* _iqa_ssim_job_init */
+int _iqa_ssim_job_init(struct _ssim_job *job, const float *ref, const float *cmp, int w, int h, int stride,
+    const struct _kernel *k, const struct _map_reduce *mr, const struct iqa_ssim_args *args,
+    const struct _ssim_ref_stats *rs, struct _ssim_band *bands, void *rows)
+{
+    if (_ssim_job_init(job, w, h, k, mr, args, 255, rs) || job->direct)
+        return 0;
+    job->ref = ref;
+    job->cmp = cmp;
+    job->stride = stride;
+    job->bands = bands;
+    job->rows = rows;
+    return _band_count(h, k);
+}
+
+/* _iqa_ssim_band */
+void _iqa_ssim_band(struct _ssim_job *job, int band, int worker)
+{
+    _ssim_band_task(band, worker, job);
+}
+
+/* _iqa_ssim_job_result */
+float _iqa_ssim_job_result(const struct _ssim_job *job)
+{
+    int band, bands = _band_count(job->dst_h + job->k->h - 1, job->k), error = 0;
+    double ssim_sum = 0.0;
+
+    /* Combine in band order */
+    for (band=0; band<bands; ++band) {
+        error |= job->bands[band].error;
+        if (job->args)
+            _mr_merge(job->mr, job->mr->context, job->bands[band].context);
+        else
+            ssim_sum += job->bands[band].sum;
     }
+    if (error)
+        return INFINITY;
+    if (!job->args)
+        return (float)(ssim_sum / ((double)job->dst_w*job->dst_h));
+    return _mr_reduce(job->mr, job->dst_w, job->dst_h, job->mr->context);
+}
+
+/* _iqa_ssim_band_count */
+int _iqa_ssim_band_count(int h, const struct _kernel *k)
+{
+    return _band_count(h, k);
+}
 
-    /* Calculate sigma */
-    _iqa_convolve(ref_sigma_sqd, w, h, k, 0, 0, 0);
-    _iqa_convolve(cmp_sigma_sqd, w, h, k, 0, 0, 0);
-    _iqa_convolve(sigma_both, w, h, k, 0, &w, &h); /* Update the width and height */
 
-    /* The convolution results are smaller by the kernel width and height */
-    for (y=0; y<h; ++y) {
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset) {
-            ref_sigma_sqd[offset] -= ref_mu[offset] * ref_mu[offset];
-            cmp_sigma_sqd[offset] -= cmp_mu[offset] * cmp_mu[offset];
-            sigma_both[offset] -= ref_mu[offset] * cmp_mu[offset];
+/*
+ * Approximate SSIM. The statistics of the sampled windows are gathered into 5
+ * compact rows and pooled like a row of the full calculation, keeping the sum
+ * of the local values and of their squares for the confidence interval.
+ */
+
+/* Adds the local SSIM of the 'n' windows in 'stats' to '*sum', and their squares to '*sqr' */
+static void _sample_pool(const struct _ssim_job *job, const float *stats, int n, double *l, double *c,
+    double *s, double *sum, double *sqr)
+{
+    int x;
+    float ref_mu,cmp_mu,ref_sigma_sqd,cmp_sigma_sqd,sigma_both;
+    float C1 = job->C1, C2 = job->C2;
+    double numerator, denominator, value;
+
+    if (!job->args) {
+        for (x=0; x<n; ++x) {
+            ref_mu = stats[x];
+            cmp_mu = stats[x+n];
+            ref_sigma_sqd = stats[x+2*n];
+            cmp_sigma_sqd = stats[x+3*n];
+            sigma_both = stats[x+4*n];
+            numerator   = (2.0 * ref_mu * cmp_mu + C1) * (2.0 * sigma_both + C2);
+            denominator = (ref_mu*ref_mu + cmp_mu*cmp_mu + C1) *
+                (ref_sigma_sqd + cmp_sigma_sqd + C2);
+            value = numerator / denominator;
+            *sum += value;
+            *sqr += value * value;
         }
+        return;
     }
 
-    ssim_sum = 0.0;
-    for (y=0; y<h; ++y) {
-        offset = y*w;
-        for (x=0; x<w; ++x, ++offset) {
-
-            if (!args) {
-                /* The default case */
-                numerator   = (2.0 * ref_mu[offset] * cmp_mu[offset] + C1) * (2.0 * sigma_both[offset] + C2);
-                denominator = (ref_mu[offset]*ref_mu[offset] + cmp_mu[offset]*cmp_mu[offset] + C1) * 
-                    (ref_sigma_sqd[offset] + cmp_sigma_sqd[offset] + C2);
-                ssim_sum += numerator / denominator;
+    job->simd->ssim_terms_row(stats, n, C1, C2, job->C3, l, c, s);
+    if (job->alpha != 1.0f)
+        _pow_row(job->simd, l, n, job->alpha);
+    if (job->beta != 1.0f)
+        _pow_row(job->simd, c, n, job->beta);
+    if (job->gamma != 1.0f)
+        _pow_row(job->simd, s, n, job->gamma);
+    for (x=0; x<n; ++x) {
+        value = l[x] * c[x] * s[x];
+        *sum += value;
+        *sqr += value * value;
+    }
+}
+
+/* Next value of a 32-bit linear congruential generator (its top 24 bits) */
+static unsigned int _sample_rand(unsigned long *state)
+{
+    *state = (*state * 1664525UL + 1013904223UL) & 0xffffffffUL;
+    return (unsigned int)(*state >> 8);
+}
+
+/* Uniform index in [0, n). Values in the last partial multiple of 'n' are
+ * drawn again, so no index is more likely than another. */
+static int _sample_index(unsigned long *state, int n)
+{
+    unsigned int limit = 0x1000000U - 0x1000000U % (unsigned int)n;
+    unsigned int r;
+
+    do {
+        r = _sample_rand(state);
+    } while (r >= limit);
+    return (int)(r % (unsigned int)n);
+}
+
+/* Puts the statistics of the window of output pixel (x, y) in column 'i' of
+ * the 'n' wide rows of 'stats' */
+static void _sample_window(const struct _ssim_job *job, int x, int y, double *col, float *stats, int i, int n)
+{
+    int p;
+    float one[STATS];
+
+    _ssim_row_stats(job->ref + x, job->cmp + x, job->k->w, job->stride, y, job->k, job->scale, col, one);
+    for (p=0; p<STATS; ++p)
+        stats[p*n + i] = one[p];
+}
+
+/*
+ * Samples the windows of the loaded (and downsampled) 'w' x 'h' images of
+ * 'plan'. See iqa_ssim_plan_sample().
+ */
+static float _plan_sample(struct iqa_ssim_plan *plan, int w, int h, const struct iqa_ssim_sampling *sampling,
+    struct iqa_ssim_estimate *est)
+{
+    struct _ssim_job job;
+    struct _map_reduce mr;
+    int x, y, i, m, n=0, step = sampling->step;
+    unsigned long state = sampling->seed;
+    double *col, *prefix, *l, *c, *s;
+    double sum=0.0, sqr=0.0, var, windows;
+    float *stats;
+    float mean, error;
+
+    memset(&mr, 0, sizeof(mr));
+    if (_ssim_job_init(&job, w, h, &plan->window, &mr, plan->has_args ? &plan->args : 0, plan->L, 0))
+        return INFINITY;
+    job.ref = plan->ref_f;
+    job.cmp = plan->cmp_f;
+    job.stride = plan->fstride;
+    col = (double*)plan->scratch;
+    prefix = col + STATS*w;
+    l = prefix + STATS*(w+1);
+    c = l + job.dst_w;
+    s = c + job.dst_w;
+    stats = (float*)(s + job.dst_w);
+    windows = (double)job.dst_w * job.dst_h;
+
+    if (sampling->count > 0) {
+        /* Random windows (with replacement), a row's worth at a time */
+        while (n < sampling->count) {
+            m = _min(sampling->count - n, job.dst_w);
+            for (i=0; i<m; ++i) {
+                x = _sample_index(&state, job.dst_w);
+                y = _sample_index(&state, job.dst_h);
+                _sample_window(&job, x, y, col, stats, i, m);
+            }
+            _sample_pool(&job, stats, m, l, c, s, &sum, &sqr);
+            n += m;
+        }
+    }
+    else {
+        /* Every 'step'th window of every 'step'th row. A step of 1 is every
+         * row in order, so the running window sums carry from row to row.
+         * Otherwise only the sampled windows are calculated. */
+        m = (job.dst_w + step - 1)/step;
+        for (y=0; y<job.dst_h; y+=step) {
+            if (step == 1) {
+                _ssim_next_row(job.ref, job.cmp, w, job.stride, y, y == 0, job.k, job.scale, job.box, job.simd, 0,
+                    col, prefix, stats);
             }
             else {
-                /* User tweaked alpha, beta, or gamma */
+                for (i=0; i<m; ++i)
+                    _sample_window(&job, i*step, y, col, stats, i, m);
+            }
+            _sample_pool(&job, stats, m, l, c, s, &sum, &sqr);
+            n += m;
+        }
+    }
+
+    /* 95% confidence interval of the mean. The grid is a sample without replacement. */
+    mean = (float)(sum / n);
+    error = 0.0f;
+    if (sampling->count > 0 || n < windows) {
+        error = INFINITY;
+        if (n > 1) {
+            var = (sqr - sum*sum/n) / (n - 1);
+            if (var < 0.0)
+                var = 0.0;
+            var /= n;
+            if (sampling->count <= 0)
+                var *= 1.0 - n/windows;
+            error = (float)(1.96 * sqrt(var));
+        }
+    }
+    if (est) {
+        est->mean = mean;
+        est->error = error;
+        est->samples = n;
+    }
+    return mean;
+}
+
+/* iqa_ssim_plan_sample */
+float iqa_ssim_plan_sample(struct iqa_ssim_plan *plan, const unsigned char *ref, const unsigned char *cmp,
+    const struct iqa_ssim_sampling *sampling, struct iqa_ssim_estimate *est)
+{
+    int w, h;
+
+    if (_plan_check(plan, ref, cmp) || !sampling || sampling->count < 0 ||
+        (!sampling->count && sampling->step < 1))
+        return INFINITY;
+    if (_plan_load(plan, ref, plan->ref_f, &w, &h) ||
+        _plan_load(plan, cmp, plan->cmp_f, &w, &h))
+        return INFINITY;
+    return _plan_sample(plan, w, h, sampling, est);
+}
+
+/* iqa_ssim_sampled */
+float iqa_ssim_sampled(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args, const struct iqa_ssim_sampling *sampling,
+    struct iqa_ssim_estimate *est)
+{
+    struct iqa_ssim_plan *plan;
+    struct iqa_ssim_plan_options opts;
+    float result;
+
+    opts.gaussian = gaussian;
+    opts.args = args;
+    plan = iqa_ssim_plan_create(w, h, stride, &opts);
+    if (!plan)
+        return INFINITY;
+    result = iqa_ssim_plan_sample(plan, ref, cmp, sampling, est);
+    iqa_ssim_plan_destroy(plan);
+    return result;
+}
 
-                /* passing a negative number to sqrt() cause a domain error */
-                if (ref_sigma_sqd[offset] < 0.0f)
-                    ref_sigma_sqd[offset] = 0.0f;
-                if (cmp_sigma_sqd[offset] < 0.0f)
-                    cmp_sigma_sqd[offset] = 0.0f;
-                sigma_root = sqrt(ref_sigma_sqd[offset] * cmp_sigma_sqd[offset]);
 
-                luminance_comp = _calc_luminance(ref_mu[offset], cmp_mu[offset], C1, alpha);
-                contrast_comp  = _calc_contrast(sigma_root, ref_sigma_sqd[offset], cmp_sigma_sqd[offset], C2, beta);
-                structure_comp = _calc_structure(sigma_both[offset], sigma_root, ref_sigma_sqd[offset], cmp_sigma_sqd[offset], C3, gamma);
+/*
+ * Streaming SSIM. Rows are converted, decimated and pooled as they arrive, and
+ * only the rows that the low-pass filter and the window still need are kept:
+ *  - 'src' holds the last 'src_rows' converted rows (only if scale > 1).
+ *  - 'dec' holds the last 'dec_rows' decimated rows twice over (slots n and
+ *    n+dec_rows), so any dec_rows consecutive rows are contiguous and can be
+ *    read like a small image.
+ * The output rows are pooled in the same bands and order as _iqa_ssim_ws(),
+ * so the final result is identical to iqa_ssim().
+ */
+struct iqa_ssim_stream {
+    struct iqa_ssim_plan cfg;       /* Settings only. No buffers. */
+    int sw, sh;                     /* Decimated size */
+    int ds;                         /* Floats between rows of 'dec' (see _iqa_row_stride()) */
+    int src_rows, dec_rows;         /* Ring sizes */
+    float *src[2], *dec[2];         /* Rings for the ref and cmp images */
+    const float **lp_rows;          /* Source rows of one decimated row */
+    double *lp_col;                 /* Decimation scratch */
+    void *rows;                     /* SSIM row buffers */
+    int received, decimated, pooled;
+    int band_open;
+    int same_rows;                  /* Identical input rows so far (see _ssim_rows()) */
+    int error;
+    double ssim_sum;                /* Completed bands (default SSIM) */
+    double band_sum;                /* Current band (default SSIM) */
+    struct _ssim_pool context;      /* Pooling context (with args) */
+    double band_context[MR_CONTEXT_MAX/sizeof(double)];
+    struct _map_reduce mr;
+    struct _ssim_job job;
+    void *block;
+};
 
-                sint.l = luminance_comp;
-                sint.c = contrast_comp;
-                sint.s = structure_comp;
+/* iqa_ssim_stream_create */
+struct iqa_ssim_stream *iqa_ssim_stream_create(int w, int h, const struct iqa_ssim_plan_options *opts)
+{
+    struct iqa_ssim_stream *s;
+    int offset, scale;
+    size_t src_size, dec_size, lpf_size, ptr_size, col_size;
+    unsigned char *mem;
 
-                if (mr->map(&sint, mr->context))
-                    return INFINITY;
+    if (w < 1 || h < 1)
+        return 0;
+    s = (struct iqa_ssim_stream*)calloc(1, sizeof(struct iqa_ssim_stream));
+    if (!s)
+        return 0;
+    _plan_init(&s->cfg, w, h, opts);
+    scale = s->cfg.scale;
+    s->sw = w;
+    s->sh = h;
+    if (scale > 1) {
+        s->sw = w/scale + (w&1);
+        s->sh = h/scale + (h&1);
+    }
+
+    if (s->cfg.has_args) {
+        s->mr.pool    = MR_MEAN;
+        s->mr.context = &s->context;
+    }
+    if (_ssim_job_init(&s->job, s->sw, s->sh, &s->cfg.window, &s->mr,
+        s->cfg.has_args ? &s->cfg.args : 0, 255, 0)) {
+        free(s);
+        return 0;
+    }
+    s->ds = _iqa_row_stride(s->sw);
+    s->job.stride = s->ds;
+
+    /* The low-pass filter reads 'scale' rows, and the window 1 more than its height */
+    s->src_rows = scale > 1 ? 2*scale : 0;
+    s->dec_rows = s->cfg.window.h + 1;
+    src_size = IQA_ALIGN_SIZE(s->src_rows*w*sizeof(float));
+    dec_size = IQA_ALIGN_SIZE(2*s->dec_rows*s->ds*sizeof(float));
+    lpf_size = IQA_ALIGN_SIZE(scale*scale*sizeof(float));
+    ptr_size = IQA_ALIGN_SIZE(scale*sizeof(float*));
+    col_size = IQA_ALIGN_SIZE((2*(w + 2*(scale/2) + 1) + 1)*sizeof(double));
+
+    s->block = _iqa_malloc_aligned(2*src_size + 2*dec_size + lpf_size + ptr_size + col_size + s->job.row_size);
+    if (!s->block) {
+        free(s);
+        return 0;
+    }
+    mem = (unsigned char*)s->block;
+    s->src[0] = (float*)mem;
+    s->src[1] = (float*)(mem + src_size);
+    mem += 2*src_size;
+    s->dec[0] = (float*)mem;
+    s->dec[1] = (float*)(mem + dec_size);
+    mem += 2*dec_size;
+    s->cfg.low_pass.kernel = (float*)mem;
+    s->lp_rows = (const float**)(mem + lpf_size);
+    s->lp_col = (double*)(mem + lpf_size + ptr_size);
+    s->rows = mem + lpf_size + ptr_size + col_size;
+    for (offset=0; offset<scale*scale; ++offset)
+        s->cfg.low_pass.kernel[offset] = 1.0f/(scale*scale);
+
+    return s;
+}
+
+/* Returns the first copy of decimated row 'y' of image 'i' */
+static float *_stream_dec_row(struct iqa_ssim_stream *s, int i, int y)
+{
+    return s->dec[i] + (y % s->dec_rows)*s->ds;
+}
+
+/* Pools the next output row, closing the band when it is full */
+static void _stream_pool_row(struct iqa_ssim_stream *s)
+{
+    int y = s->pooled;
+    int first = (y % BAND_ROWS) == 0;
+    int top = first ? y : y-1; /* Continuing a band also reads the row above */
+    struct _ssim_job *job = &s->job;
+
+    if (first) {
+        s->band_sum = 0.0;
+        if (job->args)
+            _mr_split(&s->mr, s->band_context);
+        s->band_open = 1;
+    }
+    job->ref = _stream_dec_row(s, 0, top);
+    job->cmp = _stream_dec_row(s, 1, top);
+    if (_ssim_rows(job, y-top, y-top+1, first, s->rows, &s->band_sum, s->band_context, &s->same_rows))
+        s->error = 1;
+    ++s->pooled;
+
+    if (s->pooled % BAND_ROWS == 0 || s->pooled == job->dst_h) {
+        if (job->args)
+            _mr_merge(&s->mr, s->mr.context, s->band_context);
+        else
+            s->ssim_sum += s->band_sum;
+        s->band_open = 0;
+    }
+}
+
+/* Stores the next decimated row (both copies) and pools every row it completes */
+static void _stream_add_row(struct iqa_ssim_stream *s)
+{
+    int i;
+    float *row;
+
+    for (i=0; i<2; ++i) {
+        row = _stream_dec_row(s, i, s->decimated);
+        memcpy(row + s->dec_rows*s->ds, row, s->sw*sizeof(float));
+    }
+    ++s->decimated;
+    while (!s->error && s->pooled < s->job.dst_h && s->decimated >= s->pooled + s->cfg.window.h)
+        _stream_pool_row(s);
+}
+
+/* Decimates every row whose source rows have all been received */
+static void _stream_decimate(struct iqa_ssim_stream *s)
+{
+    int i, v, r, last;
+    int h = s->cfg.h;
+    int scale = s->cfg.scale;
+    const struct _kernel *k = &s->cfg.low_pass;
+
+    while (!s->error && s->decimated < s->sh) {
+        last = s->decimated*scale + k->h - 1 - k->h/2;
+        if (last >= h)
+            last = h - 1;
+        if (last >= s->received)
+            break;
+        for (i=0; i<2; ++i) {
+            for (v=0; v<k->h; ++v) {
+                /* Rows outside the image are mirrored, like KBND_SYMMETRIC */
+                r = s->decimated*scale + v - k->h/2;
+                if (r < 0)
+                    r = -1 - r;
+                else if (r >= h)
+                    r = 2*h - 1 - r;
+                if (r < 0 || r < s->received - s->src_rows || r >= s->received) {
+                    s->error = 1;
+                    return;
+                }
+                s->lp_rows[v] = s->src[i] + (r % s->src_rows)*s->cfg.w;
             }
+            _iqa_decimate_box_row(s->lp_rows, s->cfg.w, scale, k,
+                _stream_dec_row(s, i, s->decimated), s->sw, s->lp_col);
         }
+        _stream_add_row(s);
     }
+}
 
-    free(ref_mu);
-    free(cmp_mu);
-    free(ref_sigma_sqd);
-    free(cmp_sigma_sqd);
-    free(sigma_both);
+/* iqa_ssim_stream_push */
+int iqa_ssim_stream_push(struct iqa_ssim_stream *stream, const unsigned char *ref,
+    const unsigned char *cmp, int stride, int rows)
+{
+    int y;
+    float *dst[2];
+    const struct _iqa_simd *simd = _iqa_simd_get();
+
+    if (!stream || !ref || !cmp || stride < stream->cfg.w || rows < 0 ||
+        rows > stream->cfg.h - stream->received || stream->error)
+        return 1;
+
+    for (y=0; y<rows; ++y) {
+        if (stream->cfg.scale > 1) {
+            dst[0] = stream->src[0] + (stream->received % stream->src_rows)*stream->cfg.w;
+            dst[1] = stream->src[1] + (stream->received % stream->src_rows)*stream->cfg.w;
+        }
+        else {
+            dst[0] = _stream_dec_row(stream, 0, stream->received);
+            dst[1] = _stream_dec_row(stream, 1, stream->received);
+        }
+        simd->u8_to_float(ref + y*stride, dst[0], stream->cfg.w);
+        simd->u8_to_float(cmp + y*stride, dst[1], stream->cfg.w);
+        ++stream->received;
 
-    if (!args)
-        return (float)(ssim_sum / (double)(w*h));
-    return mr->reduce(w, h, mr->context);
+        if (stream->cfg.scale > 1)
+            _stream_decimate(stream);
+        else
+            _stream_add_row(stream);
+        if (stream->error)
+            return 1;
+    }
+    return 0;
 }
 
+/* iqa_ssim_stream_result */
+float iqa_ssim_stream_result(const struct iqa_ssim_stream *stream, int *complete)
+{
+    double sum;
+    struct _ssim_pool context;
+
+    if (complete)
+        *complete = stream && !stream->error && stream->pooled == stream->job.dst_h;
+    if (!stream || stream->error || !stream->pooled)
+        return INFINITY;
+
+    /* Include the open band without closing it */
+    if (!stream->job.args) {
+        sum = stream->ssim_sum;
+        if (stream->band_open)
+            sum += stream->band_sum;
+        return (float)(sum / ((double)stream->job.dst_w*stream->pooled));
+    }
+    context = stream->context;
+    if (stream->band_open)
+        _mr_merge(&stream->mr, &context, stream->band_context);
+    return _mr_reduce(&stream->mr, stream->job.dst_w, stream->pooled, &context);
+}
 
-/* _ssim_map */
-int _ssim_map(const struct _ssim_int *si, void *ctx)
+/* iqa_ssim_stream_destroy */
+void iqa_ssim_stream_destroy(struct iqa_ssim_stream *stream)
 {
-    double *ssim_sum = (double*)ctx;
-    *ssim_sum += si->l * si->c * si->s;
-    return 0;
+    if (!stream)
+        return;
+    _iqa_free_aligned(stream->block);
+    free(stream);
 }
 
-/* _ssim_reduce */
-float _ssim_reduce(int w, int h, void *ctx)
+/* iqa_ssim_streamed */
+float iqa_ssim_streamed(int w, int h, const struct iqa_ssim_plan_options *opts,
+    iqa_row_reader read, void *ctx)
 {
-    double *ssim_sum = (double*)ctx;
-    return (float)(*ssim_sum / (double)(w*h));
+    struct iqa_ssim_stream *stream;
+    const unsigned char *ref, *cmp;
+    int y, complete;
+    float result = INFINITY;
+
+    if (!read)
+        return INFINITY;
+    stream = iqa_ssim_stream_create(w, h, opts);
+    if (!stream)
+        return INFINITY;
+    for (y=0; y<h; ++y) {
+        if (read(y, &ref, &cmp, ctx) || iqa_ssim_stream_push(stream, ref, cmp, w, 1))
+            break;
+    }
+    if (y == h) {
+        result = iqa_ssim_stream_result(stream, &complete);
+        if (!complete)
+            result = INFINITY;
+    }
+    iqa_ssim_stream_destroy(stream);
+    return result;
 }
 
 
-/* _calc_luminance */
-IQA_INLINE static double _calc_luminance(float mu1, float mu2, float C1, float alpha)
+/* _mr_split */
+void _mr_split(const struct _map_reduce *mr, void *band)
 {
-    double result;
-    float sign;
-    /* For MS-SSIM* */
-    if (C1 == 0 && mu1*mu1 == 0 && mu2*mu2 == 0)
-        return 1.0;
-    result = (2.0 * mu1 * mu2 + C1) / (mu1*mu1 + mu2*mu2 + C1);
-    if (alpha == 1.0f)
-        return result;
-    sign = result < 0.0 ? -1.0f : 1.0f;
-    return sign * pow(fabs(result),(double)alpha);
+    struct _ssim_pool *pool = (struct _ssim_pool*)band;
+
+    if (mr->pool == MR_CUSTOM) {
+        mr->split(mr->context, band);
+        return;
+    }
+    /* Same parameters, empty sums */
+    *pool = *(const struct _ssim_pool*)mr->context;
+    pool->l = 0.0;
+    pool->c = 0.0;
+    pool->s = 0.0;
 }
 
-/* _calc_contrast */
-IQA_INLINE static double _calc_contrast(double sigma_comb_12, float sigma1_sqd, float sigma2_sqd, float C2, float beta)
+/* _mr_merge */
+void _mr_merge(const struct _map_reduce *mr, void *ctx, const void *band)
 {
-    double result;
-    float sign;
-    /* For MS-SSIM* */
-    if (C2 == 0 && sigma1_sqd + sigma2_sqd == 0)
-        return 1.0;
-    result = (2.0 * sigma_comb_12 + C2) / (sigma1_sqd + sigma2_sqd + C2);
-    if (beta == 1.0f)
-        return result;
-    sign = result < 0.0 ? -1.0f : 1.0f;
-    return sign * pow(fabs(result),(double)beta);
+    struct _ssim_pool *pool = (struct _ssim_pool*)ctx;
+    const struct _ssim_pool *band_pool = (const struct _ssim_pool*)band;
+
+    if (mr->pool == MR_CUSTOM) {
+        mr->merge(ctx, band);
+        return;
+    }
+    pool->l += band_pool->l;
+    pool->c += band_pool->c;
+    pool->s += band_pool->s;
 }
 
-/* _calc_structure */
-IQA_INLINE static double _calc_structure(float sigma_12, double sigma_comb_12, float sigma1, float sigma2, float C3, float gamma)
+/* Pixels raised to the Minkowski exponent at a time */
+#define MINKOWSKI_SPAN 256
+
+/*
+ * _mr_map
+ *
+ * At the scalar level the built-in poolings keep the per-pixel accumulation
+ * order, so the results don't depend on the span length. The vector levels
+ * sum each span in lanes (sum_row, lcs_sum_row), and MR_MINKOWSKI raises the
+ * products to 'p' with pow_row.
+ */
+int _mr_map(const struct _map_reduce *mr, const double *l, const double *c, const double *s,
+    int n, void *ctx)
 {
-    double result;
-    float sign;
-    /* For MS-SSIM* */
-    if (C3 == 0 && sigma_comb_12 == 0) {
-        if (sigma1 == 0 && sigma2 == 0)
-            return 1.0;
-        else if (sigma1 == 0 || sigma2 == 0)
-            return 0.0;
-    }
-    result = (sigma_12 + C3) / (sigma_comb_12 + C3);
-    if (gamma == 1.0f)
-        return result;
-    sign = result < 0.0 ? -1.0f : 1.0f;
-    return sign * pow(fabs(result),(double)gamma);
-}
\ No newline at end of file
+    struct _ssim_pool *pool = (struct _ssim_pool*)ctx;
+    const struct _iqa_simd *simd = _iqa_simd_get();
+    double sum_l, sum_c, sum_s;
+    double prod[MINKOWSKI_SPAN];
+    int x, x0, len;
+
+    switch (mr->pool) {
+    case MR_MEAN:
+        if (simd->lcs_sum_row) {
+            pool->l += simd->lcs_sum_row(l, c, s, n, 0);
+            return 0;
+        }
+        sum_l = pool->l;
+        for (x=0; x<n; ++x)
+            sum_l += l[x] * c[x] * s[x];
+        pool->l = sum_l;
+        return 0;
+    case MR_MEAN_LCS:
+        if (simd->sum_row) {
+            pool->l += simd->sum_row(l, n);
+            pool->c += simd->sum_row(c, n);
+            pool->s += simd->sum_row(s, n);
+            return 0;
+        }
+        sum_l = pool->l;
+        sum_c = pool->c;
+        sum_s = pool->s;
+        for (x=0; x<n; ++x) {
+            sum_l += l[x];
+            sum_c += c[x];
+            sum_s += s[x];
+        }
+        pool->l = sum_l;
+        pool->c = sum_c;
+        pool->s = sum_s;
+        return 0;
+    case MR_MINKOWSKI:
+        sum_l = pool->l;
+        for (x0=0; x0<n; x0+=len) {
+            len = n-x0 < MINKOWSKI_SPAN ? n-x0 : MINKOWSKI_SPAN;
+            if (simd->lcs_sum_row)
+                simd->lcs_sum_row(l+x0, c+x0, s+x0, len, prod);
+            else {
+                for (x=0; x<len; ++x)
+                    prod[x] = fabs(l[x0+x] * c[x0+x] * s[x0+x]);
+            }
+            _pow_row(simd, prod, len, pool->p);
+            if (simd->sum_row)
+                sum_l += simd->sum_row(prod, len);
+            else {
+                for (x=0; x<len; ++x)
+                    sum_l += prod[x];
+            }
+        }
+        pool->l = sum_l;
+        return 0;
+    default:
+        return mr->map(l, c, s, n, ctx);
+    }
+}
+
+/* _mr_reduce */
+float _mr_reduce(const struct _map_reduce *mr, int w, int h, void *ctx)
+{
+    const struct _ssim_pool *pool = (const struct _ssim_pool*)ctx;
+    double size = (double)w*h;
+    double l, c, s;
+
+    switch (mr->pool) {
+    case MR_MEAN:
+        return (float)(pool->l / size);
+    case MR_MEAN_LCS:
+        l = pow(pool->l / size, (double)pool->alpha);
+        c = pow(pool->c / size, (double)pool->beta);
+        s = pow(fabs(pool->s / size), (double)pool->gamma);
+        return (float)(l * c * s);
+    case MR_MINKOWSKI:
+        return (float)pow(pool->l / size, 1.0 / (double)pool->p);
+    default:
+        return mr->reduce(w, h, ctx);
+    }
+}
+
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * Fixed-point SSIM engine for 8-bit images.
+ *
+ * The samples are never converted to float. Downsampling averages the pixels
+ * in integers (rounded back to 8 bits), the window's horizontal pass is done
+ * on the bytes with integer SIMD ('int_moments_row'), and the vertical pass
+ * sums those 31-bit results with taps of at most 2^14. Every vertical sum is
+ * below 2^53, so it is accumulated in doubles without any rounding. Only the
+ * final means, variances and ratio are rounded, in a fixed order and without
+ * contraction, so the result is the same on every machine and SIMD level.
+ */
+
+#include "iqa.h"
+#include "math_utils.h"
+#include "ssim.h"
+#include "simd.h"
+#include <stdlib.h>
+#include <math.h>
+
+/* Mirrors 'i' into [0,n) the same way as KBND_SYMMETRIC */
+static int _reflect(int i, int n)
+{
+    if (i < 0)
+        return -1-i;
+    if (i >= n)
+        return n-(i-n)-1;
+    return i;
+}
+
+/*
+ * Downsamples an 8-bit image by 'factor' with the same box window and
+ * boundaries as the float low-pass filter, rounding each average to the
+ * nearest integer. 'col' needs w+factor+1 values.
+ */
+static void _int_decimate(const unsigned char *img, int w, int h, int stride, int factor,
+    unsigned char *dst, int sw, int sh, unsigned int *col)
+{
+    int x, y, u, v;
+    int c = factor/2;
+    int even = (factor&1)?0:1;
+    int ext_w = w + 2*c + 1;   /* Columns from -c to w+c */
+    unsigned int area = (unsigned int)(factor*factor);
+    unsigned int sum;
+    const unsigned char *row;
+
+    for (y=0; y<sh; ++y) {
+        for (x=0; x<ext_w; ++x)
+            col[x] = 0;
+        for (v=-c; v<=c-even; ++v) {
+            row = img + _reflect(y*factor + v, h)*stride;
+            for (x=0; x<ext_w; ++x)
+                col[x] += row[_reflect(x - c, w)];
+        }
+        /* Window for output x spans columns x*factor-c to x*factor+c-even */
+        for (x=0; x<sw; ++x) {
+            sum = 0;
+            for (u=0; u<factor; ++u)
+                sum += col[x*factor + u];
+            dst[y*sw + x] = (unsigned char)((sum + area/2) / area);
+        }
+    }
+}
+
+/* Parameters of the final ratio */
+struct _int_terms {
+    double inv_area;            /* 1 / total window weight (a power of 2) */
+    float C1, C2, C3;
+    float alpha, beta, gamma;
+    int args;
+};
+
+/*
+ * Returns the sum of the SSIM values of one output row from its 5 window sums
+ * (ref, cmp, ref^2, cmp^2, ref*cmp). The terms follow the float engine, in
+ * double precision.
+ */
+IQA_NO_CONTRACT static double _int_ssim_row(const double *sums, int len, const struct _int_terms *t)
+{
+    int x;
+    double mu1, mu2, s11, s22, s12, root, l, c, s, value, row_sum=0.0;
+    double C1 = t->C1, C2 = t->C2, C3 = t->C3;
+
+    for (x=0; x<len; ++x) {
+        mu1 = sums[x] * t->inv_area;
+        mu2 = sums[len+x] * t->inv_area;
+        s11 = sums[2*len+x] * t->inv_area - mu1*mu1;
+        s22 = sums[3*len+x] * t->inv_area - mu2*mu2;
+        s12 = sums[4*len+x] * t->inv_area - mu1*mu2;
+
+        if (!t->args) {
+            value = ((2.0*mu1*mu2 + C1) * (2.0*s12 + C2)) /
+                ((mu1*mu1 + mu2*mu2 + C1) * (s11 + s22 + C2));
+            row_sum += value;
+            continue;
+        }
+
+        if (s11 < 0.0)
+            s11 = 0.0;
+        if (s22 < 0.0)
+            s22 = 0.0;
+        root = sqrt(s11*s22);
+        l = (2.0*mu1*mu2 + C1) / (mu1*mu1 + mu2*mu2 + C1);
+        c = (2.0*root + C2) / (s11 + s22 + C2);
+        s = (s12 + C3) / (root + C3);
+        /* For MS-SSIM* */
+        if (C1 == 0 && mu1 == 0 && mu2 == 0)
+            l = 1.0;
+        if (C2 == 0 && s11 + s22 == 0)
+            c = 1.0;
+        if (C3 == 0 && root == 0) {
+            if (s11 == 0 && s22 == 0)
+                s = 1.0;
+            else if (s11 == 0 || s22 == 0)
+                s = 0.0;
+        }
+        if (t->alpha != 1.0f)
+            l = (l < 0.0 ? -1.0 : 1.0) * pow(fabs(l), (double)t->alpha);
+        if (t->beta != 1.0f)
+            c = (c < 0.0 ? -1.0 : 1.0) * pow(fabs(c), (double)t->beta);
+        if (t->gamma != 1.0f)
+            s = (s < 0.0 ? -1.0 : 1.0) * pow(fabs(s), (double)t->gamma);
+        row_sum += l * c * s;
+    }
+    return row_sum;
+}
+
+/* iqa_ssim_int */
+float iqa_ssim_int(const unsigned char *ref, const unsigned char *cmp, int w, int h, int stride,
+    int gaussian, const struct iqa_ssim_args *args)
+{
+    int y, u, m, n, scale, sw, sh, sstride, dst_w, dst_h;
+    int L=255;
+    float K1=0.01f, K2=0.03f;
+    const int *taps;
+    const unsigned char *ref_s, *cmp_s;
+    const int *h_row;
+    int *h_rows;        /* Ring of n horizontal pass results (5 rows each) */
+    double *sums;       /* Vertical sums of one output row */
+    unsigned int *col;
+    unsigned char *small;
+    void *buf;
+    size_t sums_size, rows_size, col_size;
+    double tap, total;
+    struct _int_terms t;
+    const struct _iqa_simd *simd = _iqa_simd_get();
+
+    if (!ref || !cmp || w < 1 || h < 1 || stride < w)
+        return INFINITY;
+
+    scale = _max( 1, _round( (float)_min(w,h) / 256.0f ) );
+    t.alpha = t.beta = t.gamma = 1.0f;
+    t.args = args ? 1 : 0;
+    if (args) {
+        if (args->f)
+            scale = args->f;
+        t.alpha = args->alpha;
+        t.beta  = args->beta;
+        t.gamma = args->gamma;
+        L       = args->L;
+        K1      = args->K1;
+        K2      = args->K2;
+    }
+    t.C1 = (K1*L)*(K1*L);
+    t.C2 = (K2*L)*(K2*L);
+    t.C3 = t.C2 / 2.0f;
+
+    if (gaussian) {
+        taps = g_gaussian_window_1d_q;
+        n = GAUSSIAN_LEN;
+        t.inv_area = 1.0 / (double)(1 << (2*GAUSSIAN_Q_BITS));
+    }
+    else {
+        taps = g_square_window_1d_q;
+        n = SQUARE_LEN;
+        t.inv_area = 1.0 / (double)(SQUARE_LEN*SQUARE_LEN);
+    }
+
+    sw = w;
+    sh = h;
+    if (scale > 1) {
+        sw = w/scale + (w&1);
+        sh = h/scale + (h&1);
+    }
+    dst_w = sw - n + 1;
+    dst_h = sh - n + 1;
+    if (dst_w < 1 || dst_h < 1)
+        return INFINITY;
+
+    sums_size = 5*dst_w*sizeof(double);
+    rows_size = n*5*dst_w*sizeof(int);
+    col_size = scale > 1 ? (w + scale + 1)*sizeof(unsigned int) + 2*sw*sh : 0;
+    buf = malloc(sums_size + rows_size + col_size);
+    if (!buf)
+        return INFINITY;
+    sums = (double*)buf;
+    h_rows = (int*)((char*)buf + sums_size);
+
+    /* The original bytes are used as is unless they need downsampling */
+    ref_s = ref;
+    cmp_s = cmp;
+    sstride = stride;
+    if (scale > 1) {
+        col = (unsigned int*)((char*)h_rows + rows_size);
+        small = (unsigned char*)(col + w + scale + 1);
+        _int_decimate(ref, w, h, stride, scale, small, sw, sh, col);
+        _int_decimate(cmp, w, h, stride, scale, small + sw*sh, sw, sh, col);
+        ref_s = small;
+        cmp_s = small + sw*sh;
+        sstride = sw;
+    }
+
+    for (y=0; y<n-1; ++y)
+        simd->int_moments_row(ref_s + y*sstride, cmp_s + y*sstride, dst_w, taps, n, h_rows + y*5*dst_w);
+
+    total = 0.0;
+    for (y=0; y<dst_h; ++y) {
+        u = (y+n-1) % n;
+        simd->int_moments_row(ref_s + (y+n-1)*sstride, cmp_s + (y+n-1)*sstride, dst_w, taps, n,
+            h_rows + u*5*dst_w);
+
+        /* Window rows y to y+n-1 sit at ring positions y%n onwards */
+        for (m=0; m<5*dst_w; ++m)
+            sums[m] = 0.0;
+        for (u=0; u<n; ++u) {
+            tap = (double)taps[u];
+            h_row = h_rows + ((y+u) % n)*5*dst_w;
+            for (m=0; m<5*dst_w; ++m)
+                sums[m] += tap * (double)h_row[m];
+        }
+        total += _int_ssim_row(sums, dst_w, &t);
+    }
+
+    free(buf);
+    return (float)(total / (double)(dst_w*dst_h));
+}
@@ -37,6 +37,8 @@
 #include "test_psnr.h"
 #include "test_ssim.h"
 #include "test_ms_ssim.h"
+#include "test_simd.h"
+#include "test_parallel.h"
 #include <stdio.h>
 
 int main()
@@ -50,6 +52,8 @@ int main()
     failures += test_psnr();
     failures += test_ssim();
     failures += test_ms_ssim();
+    failures += test_simd();
+    failures += test_parallel();
 
     if (failures)
         printf("\n\nRESULT: *** FAIL (%i) ***\n\n", failures);
@@ -49,6 +49,8 @@ static float kernel_3x3[9] = {
     k3x3, k3x3, k3x3,
     k3x3, k3x3, k3x3
 };
+#define k3 1.0f/3.0f
+static float kernel_3[3] = { k3, k3, k3 };
 
 static float img_1x1[1] = {
     128.0f
@@ -72,6 +74,8 @@ static float img_4x4[16] = {
 static int _test_convolve_1x1_kernel();
 static int _test_convolve_2x2_kernel();
 static int _test_convolve_3x3_kernel();
+static int _test_convolve_3x3_separable();
+static int _test_convolve_strided();
 static int _test_img_filter_1x1_kernel();
 static int _test_img_filter_2x2_kernel();
 static int _test_img_filter_3x3_kernel();
@@ -87,6 +91,8 @@ int test_convolve()
     failure += _test_convolve_1x1_kernel();
     failure += _test_convolve_2x2_kernel();
     failure += _test_convolve_3x3_kernel();
+    failure += _test_convolve_3x3_separable();
+    failure += _test_convolve_strided();
     printf("\nImage Filter:\n");
     failure += _test_img_filter_1x1_kernel();
     failure += _test_img_filter_2x2_kernel();
@@ -113,6 +119,8 @@ int _test_convolve_1x1_kernel()
     k.w = k.h = 1;
     k.kernel = kernel_1x1;
     k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
 
     printf("\t1x1 image, 1x1 kernel:\n");
     printf("\t  w/ result no rw/rh: ");
@@ -191,6 +199,8 @@ int _test_convolve_2x2_kernel()
     k.w = k.h = 2;
     k.kernel = kernel_2x2;
     k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
 
     /* With result buffer, no rw or rh */
     printf("\t  w/ result no rw/rh: ");
@@ -233,6 +243,8 @@ int _test_convolve_3x3_kernel()
     k.w = k.h = 3;
     k.kernel = kernel_3x3;
     k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
 
     /* With result buffer, no rw or rh */
     printf("\t  w/ result no rw/rh: ");
@@ -257,6 +269,109 @@ int _test_convolve_3x3_kernel()
     return failures;
 }
 
+/*----------------------------------------------------------------------------
+ * _test_convolve_3x3_separable
+ *---------------------------------------------------------------------------*/
+int _test_convolve_3x3_separable()
+{
+    int rw, rh, passed, failures=0;
+    struct _kernel k;
+    float img_tmp_4x4[16];
+
+    float result_2x2[4] = {
+        106.444f, 99.333f,
+        99.333f, 127.667f
+    };
+
+    printf("\t4x4 image, 3x3 separable kernel:\n");
+    k.w = k.h = 3;
+    k.kernel = kernel_3x3;
+    k.normalized = 1;
+    k.kernel_h = kernel_3;
+    k.kernel_v = kernel_3;
+
+    /* With result buffer, WITH rw or rh */
+    printf("\t  w/ result w/ rw/rh: ");
+    memset(img_tmp_4x4,0,sizeof(img_tmp_4x4));
+    _iqa_convolve(img_4x4, 4, 4, &k, img_tmp_4x4, &rw, &rh);
+    passed = 0;
+    if (_matrix_cmp(img_tmp_4x4, result_2x2, 2, 2, 3) == 0 &&
+        rw == 2 &&
+        rh == 2)
+        passed = 1;
+    printf("[%i,%i]\t%s\n", rw, rh, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    /* In-place, no rw or rh */
+    printf("\t  in-place  no rw/rh: ");
+    memcpy(img_tmp_4x4, img_4x4, sizeof(img_4x4));
+    _iqa_convolve(img_tmp_4x4, 4, 4, &k, 0, 0, 0);
+    passed = 0;
+    if (_matrix_cmp(img_tmp_4x4, result_2x2, 2, 2, 3) == 0)
+        passed = 1;
+    printf("[-,-]\t%s\n", passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_convolve_strided
+ *---------------------------------------------------------------------------*/
+int _test_convolve_strided()
+{
+    int x, y, rw, rh, passed, failures=0;
+    struct _kernel k;
+    float src[4*6], dst[2*3], packed[4];
+
+    float result_2x2[4] = {
+        106.444f, 99.333f,
+        99.333f, 127.667f
+    };
+
+    /* 4x4 image in rows of 6, result in rows of 3. The padding must not be
+     * read or written. */
+    for (y=0; y<4; ++y) {
+        for (x=0; x<6; ++x)
+            src[y*6 + x] = x < 4 ? img_4x4[y*4 + x] : -1000.0f;
+    }
+
+    printf("\t4x4 image, 3x3 kernel, padded rows:\n");
+    k.w = k.h = 3;
+    k.kernel = kernel_3x3;
+    k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
+
+    printf("\t  non-separable:      ");
+    for (x=0; x<6; ++x)
+        dst[x] = -1.0f;
+    _iqa_convolve_strided(src, 4, 4, 6, &k, dst, 3, &rw, &rh);
+    for (y=0; y<2; ++y)
+        for (x=0; x<2; ++x)
+            packed[y*2 + x] = dst[y*3 + x];
+    passed = _matrix_cmp(packed, result_2x2, 2, 2, 3) == 0 && rw == 2 && rh == 2 &&
+        dst[2] == -1.0f && dst[5] == -1.0f;
+    printf("[%i,%i]\t%s\n", rw, rh, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t  separable:          ");
+    k.kernel_h = kernel_3;
+    k.kernel_v = kernel_3;
+    for (x=0; x<6; ++x)
+        dst[x] = -1.0f;
+    _iqa_convolve_strided(src, 4, 4, 6, &k, dst, 3, &rw, &rh);
+    for (y=0; y<2; ++y)
+        for (x=0; x<2; ++x)
+            packed[y*2 + x] = dst[y*3 + x];
+    passed = _matrix_cmp(packed, result_2x2, 2, 2, 3) == 0 && rw == 2 && rh == 2 &&
+        dst[2] == -1.0f && dst[5] == -1.0f;
+    printf("[%i,%i]\t%s\n", rw, rh, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    return failures;
+}
+
 /*----------------------------------------------------------------------------
  * _test_img_filter_1x1_kernel
  *---------------------------------------------------------------------------*/
@@ -275,6 +390,8 @@ int _test_img_filter_1x1_kernel()
     k.w = k.h = 1;
     k.kernel = kernel_1x1;
     k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
     k.bnd_opt = KBND_SYMMETRIC;
 
     /* 1x1 image, 1x1 kernel */
@@ -330,6 +447,8 @@ int _test_img_filter_2x2_kernel()
     k.w = k.h = 2;
     k.kernel = kernel_2x2;
     k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
     k.bnd_opt = KBND_SYMMETRIC;
 
     /* With result buffer */
@@ -375,6 +494,8 @@ int _test_img_filter_3x3_kernel()
     k.w = k.h = 3;
     k.kernel = kernel_3x3;
     k.normalized = 1;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
     k.bnd_opt = KBND_SYMMETRIC;
 
     /* With result buffer */
@@ -34,6 +34,7 @@
 #include "decimate.h"
 #include "test_decimate.h"
 #include "math_utils.h"
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -65,6 +66,8 @@ static float img_5x5[] = {
 static int _test_decimate_2x_4x4();
 static int _test_decimate_2x_5x5();
 static int _test_decimate_3x_5x5();
+static int _test_decimate_strided();
+static int _test_decimate_separable();
 
 
 /*----------------------------------------------------------------------------
@@ -78,6 +81,8 @@ int test_decimate()
     failure += _test_decimate_2x_4x4();
     failure += _test_decimate_2x_5x5();
     failure += _test_decimate_3x_5x5();
+    failure += _test_decimate_strided();
+    failure += _test_decimate_separable();
 
     return failure;
 }
@@ -104,11 +109,15 @@ int _test_decimate_2x_4x4()
     k_linear.w = k_linear.h = 2;
     k_linear.kernel = lpf_avg_2x2;
     k_linear.normalized = 1;
+    k_linear.kernel_h = 0;
+    k_linear.kernel_v = 0;
     k_linear.bnd_opt = KBND_SYMMETRIC;
 
     k_gaussian.w = k_gaussian.h = 3;
     k_gaussian.kernel = lpf_gaussian_3x3;
     k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = 0;
+    k_gaussian.kernel_v = 0;
     k_gaussian.bnd_opt = KBND_SYMMETRIC;
 
     printf("\t4x4 image, 2x2 linear filter, 2x factor:\n");
@@ -184,11 +193,15 @@ int _test_decimate_2x_5x5()
     k_linear.w = k_linear.h = 2;
     k_linear.kernel = lpf_avg_2x2;
     k_linear.normalized = 1;
+    k_linear.kernel_h = 0;
+    k_linear.kernel_v = 0;
     k_linear.bnd_opt = KBND_SYMMETRIC;
 
     k_gaussian.w = k_gaussian.h = 3;
     k_gaussian.kernel = lpf_gaussian_3x3;
     k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = 0;
+    k_gaussian.kernel_v = 0;
     k_gaussian.bnd_opt = KBND_SYMMETRIC;
 
     printf("\t5x5 image, 2x2 linear filter, 2x factor:\n");
@@ -257,6 +270,8 @@ int _test_decimate_3x_5x5()
     k_gaussian.w = k_gaussian.h = 3;
     k_gaussian.kernel = lpf_gaussian_3x3;
     k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = 0;
+    k_gaussian.kernel_v = 0;
     k_gaussian.bnd_opt = KBND_SYMMETRIC;
 
     printf("\t5x5 image, 3x3 Gaussian filter, 3x factor:\n");
@@ -284,3 +299,133 @@ int _test_decimate_3x_5x5()
 
     return failures;
 }
+
+/*----------------------------------------------------------------------------
+ * _test_decimate_strided
+ *---------------------------------------------------------------------------*/
+int _test_decimate_strided()
+{
+    int x, y, rw, rh, passed, failures=0;
+    struct _kernel k_linear, k_gaussian;
+    float src[5*7], dst[3*4], packed[9], expected[9];
+
+    k_linear.w = k_linear.h = 2;
+    k_linear.kernel = lpf_avg_2x2;
+    k_linear.normalized = 1;
+    k_linear.kernel_h = 0;
+    k_linear.kernel_v = 0;
+    k_linear.bnd_opt = KBND_SYMMETRIC;
+
+    k_gaussian.w = k_gaussian.h = 3;
+    k_gaussian.kernel = lpf_gaussian_3x3;
+    k_gaussian.normalized = 1;
+    k_gaussian.kernel_h = 0;
+    k_gaussian.kernel_v = 0;
+    k_gaussian.bnd_opt = KBND_SYMMETRIC;
+
+    /* 5x5 image in rows of 7, result in rows of 4. The padding must not be
+     * read or written. */
+    for (y=0; y<5; ++y) {
+        for (x=0; x<7; ++x)
+            src[y*7 + x] = x < 5 ? img_5x5[y*5 + x] : -1000.0f;
+    }
+
+    printf("\t5x5 image, padded rows, 2x factor (same as packed):\n");
+
+    printf("\t  2x2 linear filter:  ");
+    _iqa_decimate(img_5x5, 5, 5, 2, &k_linear, expected, 0, 0);
+    for (x=0; x<12; ++x)
+        dst[x] = -1.0f;
+    _iqa_decimate_strided(src, 5, 5, 7, 2, &k_linear, dst, 4, &rw, &rh, 0);
+    for (y=0; y<3; ++y)
+        for (x=0; x<3; ++x)
+            packed[y*3 + x] = dst[y*4 + x];
+    passed = memcmp(packed, expected, sizeof(expected)) == 0 && rw == 3 && rh == 3 &&
+        dst[3] == -1.0f && dst[7] == -1.0f && dst[11] == -1.0f;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t  3x3 Gaussian filter:");
+    _iqa_decimate(img_5x5, 5, 5, 2, &k_gaussian, expected, 0, 0);
+    for (x=0; x<12; ++x)
+        dst[x] = -1.0f;
+    _iqa_decimate_strided(src, 5, 5, 7, 2, &k_gaussian, dst, 4, &rw, &rh, 0);
+    for (y=0; y<3; ++y)
+        for (x=0; x<3; ++x)
+            packed[y*3 + x] = dst[y*4 + x];
+    passed = memcmp(packed, expected, sizeof(expected)) == 0 && rw == 3 && rh == 3 &&
+        dst[3] == -1.0f && dst[7] == -1.0f && dst[11] == -1.0f;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_decimate_separable
+ *
+ * A kernel that carries its 1-D taps takes the separable path, which must
+ * give the same result as the 2-D kernel, edges included.
+ *---------------------------------------------------------------------------*/
+int _test_decimate_separable()
+{
+    static const int factors[] = { 2, 3 };
+    float taps[5] = { -0.05f, 0.25f, 0.6f, 0.25f, -0.05f };
+    float kernel[5*5], src[11*9], expected[6*5], result[6*5];
+    float cmp[11*9], cmp_expected[6*5], cmp_result[6*5];
+    int x, y, f, rw, rh, ew, eh, passed, failures=0;
+    struct _kernel k_2d, k_sep;
+
+    for (y=0; y<5; ++y)
+        for (x=0; x<5; ++x)
+            kernel[y*5 + x] = taps[y]*taps[x];
+    for (y=0; y<9; ++y)
+        for (x=0; x<11; ++x)
+            src[y*11 + x] = (float)((x*37 + y*91 + x*y*13) % 256);
+
+    k_2d.w = k_2d.h = 5;
+    k_2d.kernel = kernel;
+    k_2d.normalized = 1;
+    k_2d.kernel_h = 0;
+    k_2d.kernel_v = 0;
+    k_2d.bnd_opt = KBND_SYMMETRIC;
+    k_sep = k_2d;
+    k_sep.kernel_h = taps;
+    k_sep.kernel_v = taps;
+
+    printf("	11x9 image, separable 5x5 filter (same as 2-D):\n");
+    for (f=0; f<(int)(sizeof(factors)/sizeof(factors[0])); ++f) {
+        printf("	  %dx factor:\t\t", factors[f]);
+        _iqa_decimate(src, 11, 9, factors[f], &k_2d, expected, &ew, &eh);
+        _iqa_decimate(src, 11, 9, factors[f], &k_sep, result, &rw, &rh);
+        passed = rw == ew && rh == eh;
+        for (y=0; passed && y<rw*rh; ++y)
+            if (fabs(result[y] - expected[y]) > 1e-3)
+                passed = 0;
+        printf("\t%s\n", passed?"PASS":"FAILED");
+        failures += passed?0:1;
+    }
+
+    /* Both images in one sweep give the same results as one at a time */
+    printf("\t  Pair (2x factor):\t");
+    for (y=0; y<9*11; ++y)
+        cmp[y] = 255.0f - src[y];
+    _iqa_decimate(cmp, 11, 9, 2, &k_sep, cmp_expected, 0, 0);
+    _iqa_decimate(src, 11, 9, 2, &k_sep, expected, 0, 0);
+    passed = _iqa_decimate_pair(src, cmp, 11, 9, 11, 2, &k_sep, result, cmp_result, 6, &rw, &rh, 0) == 0 &&
+        rw == 6 && rh == 5 && memcmp(result, expected, sizeof(result)) == 0 &&
+        memcmp(cmp_result, cmp_expected, sizeof(cmp_result)) == 0;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t  Pair, 2-D (2x factor):");
+    _iqa_decimate(cmp, 11, 9, 2, &k_2d, cmp_expected, 0, 0);
+    _iqa_decimate(src, 11, 9, 2, &k_2d, expected, 0, 0);
+    passed = _iqa_decimate_pair(src, cmp, 11, 9, 11, 2, &k_2d, result, cmp_result, 6, &rw, &rh, 0) == 0 &&
+        rw == 6 && rh == 5 && memcmp(result, expected, sizeof(result)) == 0 &&
+        memcmp(cmp_result, cmp_expected, sizeof(cmp_result)) == 0;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    return failures;
+}
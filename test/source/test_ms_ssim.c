@@ -39,6 +39,7 @@
 #include "math_utils.h"
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 
 
 static const int img_width = 22;
@@ -104,20 +105,20 @@ struct answer {
 
 static const struct answer ans_key_einstein_def[] = {
     {1.00000f, 5},  /* Identical */
-    {0.85324f, 5},  /* Blur */
-    {0.96787f, 5},  /* Contrast */
-    {0.12226f, 5},  /* Flip Vertical */
-    {0.92878f, 5},  /* Impulse */
-    {0.76612f, 5},  /* JPEG */
-    {0.99937f, 5},  /* Mean Shift */
+    {0.85307f, 5},  /* Blur */
+    {0.96786f, 5},  /* Contrast */
+    {0.12208f, 5},  /* Flip Vertical */
+    {0.92875f, 5},  /* Impulse */
+    {0.76404f, 5},  /* JPEG */
+    {0.99938f, 5},  /* Mean Shift */
 };
 
 static const struct answer ans_key_einstein_wang[] = {
     {1.00000f, 5},  /* Identical */
-    {0.91875f, 5},  /* Blur */
+    {0.91873f, 5},  /* Blur */
     {0.97275f, 5},  /* Contrast */
-    {0.25467f, 5},  /* Flip Vertical */
-    {0.95357f, 5},  /* Impulse */
+    {0.25460f, 5},  /* Flip Vertical */
+    {0.95356f, 5},  /* Impulse */
     {0.89226f, 4},  /* JPEG (rounding error on last digit) */
     {0.99938f, 5},  /* Mean Shift */
 };
@@ -134,17 +135,17 @@ static const struct answer ans_key_einstein_linear[] = {
 
 static const struct answer ans_key_einstein_scale4[] = {
     {1.00000f, 5},  /* Identical */
-    {0.72383f, 5},  /* Blur */
+    {0.72346f, 5},  /* Blur */
     {0.96678f, 5},  /* Contrast */
-    {0.09137f, 5},  /* Flip Vertical */
-    {0.88489f, 5},  /* Impulse */
-    {0.61626f, 4},  /* JPEG (rounding error on last digit) */
+    {0.09115f, 5},  /* Flip Vertical */
+    {0.88485f, 5},  /* Impulse */
+    {0.61177f, 4},  /* JPEG (rounding error on last digit) */
     {0.99863f, 5},  /* Mean Shift */
 };
 
 static const struct answer ans_key_courtright[] = {
     {1.00000f, 5},    /* Identical */
-    {0.59030f, 5},    /* Noise */
+    {0.58864f, 5},    /* Noise */
 };
 
 static const struct answer ans_key_skate[] = {
@@ -168,6 +169,13 @@ static int _test_einstein_bmp(const struct answer *answers, const struct iqa_ms_
 static int _test_courtright_bmp(const struct answer *answers, const struct iqa_ms_ssim_args *args, const char* str);
 static int _test_skate_bmp(const struct answer *answers, const struct iqa_ms_ssim_args *args, const char* str);
 static int _test_h_greater_than_w(const char* str); /* Regression test for bug 3349231 */
+static int _test_f32(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ms_ssim_args *args, const char* str);
+static int _test_16(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ms_ssim_args *args, const char* str);
+static int _test_prepared(const char *bmp_ref, const char **bmp_cmps, const struct iqa_ms_ssim_args *args, const char* str);
+static int _test_roi(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ms_ssim_args *args, const char* str);
+
+static const char *einstein_cmps[] = { BMP_BLUR, BMP_FLIPVERT, BMP_JPG, BMP_MEANSHIFT, 0 };
+static const char *courtright_cmps[] = { BMP_CR_NOISE, BMP_CR_ORIGINAL, 0 };
 
 /*----------------------------------------------------------------------------
  * TEST ENTRY POINT
@@ -185,6 +193,20 @@ int test_ms_ssim()
     failure += _test_courtright_bmp(ans_key_courtright, 0, "Rouse/Hemami");
     failure += _test_skate_bmp(ans_key_skate, 0, "Buffer overflow [#3288043]");
     failure += _test_h_greater_than_w("Height greater than width [#3349231]");
+    printf("\tPrepared reference (same result as iqa_ms_ssim):\n");
+    failure += _test_prepared(BMP_ORIGINAL, einstein_cmps, 0, "Einstein Rouse/Hemami");
+    failure += _test_prepared(BMP_ORIGINAL, einstein_cmps, &args_linear, "Einstein Linear");
+    failure += _test_prepared(BMP_ORIGINAL, einstein_cmps, &args_scale4, "Einstein scale = 4");
+    failure += _test_prepared(BMP_CR_ORIGINAL, courtright_cmps, 0, "Courtright");
+    printf("\t16-bit samples (8-bit same as iqa_ms_ssim, P010 same as 10-bit):\n");
+    failure += _test_16(BMP_ORIGINAL, BMP_JPG, 0, "Einstein Jpeg Rouse/Hemami");
+    printf("\tFloat samples (same as iqa_ms_ssim):\n");
+    failure += _test_f32(BMP_ORIGINAL, BMP_JPG, 0, "Einstein Jpeg Rouse/Hemami");
+    failure += _test_f32(BMP_CR_ORIGINAL, BMP_CR_NOISE, 0, "Courtright Noise");
+    printf("\tRegions of interest (whole image same as iqa_ms_ssim):\n");
+    failure += _test_roi(BMP_ORIGINAL, BMP_JPG, 0, "Einstein Jpeg Rouse/Hemami");
+    failure += _test_roi(BMP_ORIGINAL, BMP_JPG, &args_linear, "Einstein Jpeg Linear");
+    failure += _test_roi(BMP_CR_ORIGINAL, BMP_CR_NOISE, 0, "Courtright Noise");
 
     return failure;
 }
@@ -471,4 +493,254 @@ int _test_h_greater_than_w(const char* str)
 
     free_bmp(&orig);
     return failures;
-}
\ No newline at end of file
+}
+
+/*----------------------------------------------------------------------------
+ * _test_prepared
+ *---------------------------------------------------------------------------*/
+int _test_prepared(const char *bmp_ref, const char **bmp_cmps, const struct iqa_ms_ssim_args *args, const char* str)
+{
+    struct bmp orig, cmp;
+    struct iqa_ms_ssim_ref *prep;
+    int idx, passed=1;
+    float expected, result;
+    unsigned long long start, end;
+    double elapsed=0.0;
+
+    printf("\t  %s: ", str);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+
+    prep = iqa_ms_ssim_ref_prepare(orig.img, orig.w, orig.h, orig.stride, args);
+    if (!prep) {
+        printf("FAILED to prepare reference\n");
+        free_bmp(&orig);
+        return 1;
+    }
+
+    /* Several distorted images against the same reference */
+    for (idx=0; bmp_cmps[idx]; ++idx) {
+        if (load_bmp(bmp_cmps[idx], &cmp)) {
+            printf("FAILED to load \'%s\'\n", bmp_cmps[idx]);
+            passed = 0;
+            break;
+        }
+        expected = iqa_ms_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, args);
+        start = hpt_get_time();
+        result = iqa_ms_ssim_compare(prep, cmp.img);
+        end = hpt_get_time();
+        elapsed += hpt_elapsed_time(start,end,hpt_get_frequency());
+        if (result != expected)
+            passed = 0;
+        free_bmp(&cmp);
+    }
+    printf("\t%i images  (%.3lf ms)\t%s\n",
+        idx,
+        elapsed * 1000.0,
+        passed?"PASS":"FAILED");
+
+    iqa_ms_ssim_ref_destroy(prep);
+    free_bmp(&orig);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_16
+ *---------------------------------------------------------------------------*/
+
+/* Copies an 8-bit image into 16-bit words, shifted left by 'shift' */
+static void _to_16(const struct bmp *b, int shift, unsigned short *dst)
+{
+    int x, y;
+    for (y=0; y<b->h; ++y)
+        for (x=0; x<b->w; ++x)
+            dst[y*b->w + x] = (unsigned short)(b->img[y*b->stride + x] << shift);
+}
+
+int _test_16(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ms_ssim_args *args, const char* str)
+{
+    struct bmp orig, cmp;
+    unsigned short *buf;
+    int size, stride, passed=1;
+    float expected, result, result10, resultp010;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", str);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    size = orig.w*orig.h;
+    stride = orig.w*(int)sizeof(unsigned short);
+    buf = (unsigned short*)malloc(2*size*sizeof(unsigned short));
+    if (!buf) {
+        printf("FAILED (out of memory)\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+
+    expected = iqa_ms_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, args);
+    _to_16(&orig, 0, buf);
+    _to_16(&cmp, 0, buf + size);
+    result = iqa_ms_ssim_16(buf, buf + size, orig.w, orig.h, stride, 8, args);
+    if (result != expected)
+        passed = 0;
+
+    _to_16(&orig, 2, buf);
+    _to_16(&cmp, 2, buf + size);
+    start = hpt_get_time();
+    result10 = iqa_ms_ssim_16(buf, buf + size, orig.w, orig.h, stride, 10, args);
+    end = hpt_get_time();
+    _to_16(&orig, 8, buf);
+    _to_16(&cmp, 8, buf + size);
+    resultp010 = iqa_ms_ssim_16(buf, buf + size, orig.w, orig.h, stride, 10 | IQA_MSB_ALIGNED, args);
+    if (resultp010 != result10 || fabs(result10 - expected) > 1e-3)
+        passed = 0;
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result10,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free(buf);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_f32
+ *---------------------------------------------------------------------------*/
+
+/* Copies an 8-bit image into floats with rows 'fstride' apart. The padding is
+ * filled with a value that would show up if it were read. */
+static void _to_f32(const struct bmp *b, int fstride, float *dst)
+{
+    int x, y;
+    for (y=0; y<b->h; ++y) {
+        for (x=0; x<b->w; ++x)
+            dst[y*fstride + x] = (float)b->img[y*b->stride + x];
+        for (; x<fstride; ++x)
+            dst[y*fstride + x] = -1000.0f;
+    }
+}
+
+int _test_f32(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ms_ssim_args *args, const char* str)
+{
+    struct bmp orig, cmp;
+    float *buf;
+    int fstride, size, passed;
+    float expected, result;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", str);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    fstride = orig.w + 5;
+    size = fstride*orig.h;
+    buf = (float*)malloc(2*size*sizeof(float));
+    if (!buf) {
+        printf("FAILED (out of memory)\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+    _to_f32(&orig, fstride, buf);
+    _to_f32(&cmp, fstride, buf + size);
+
+    expected = iqa_ms_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, args);
+    start = hpt_get_time();
+    result = iqa_ms_ssim_f32(buf, buf + size, orig.w, orig.h, fstride*(int)sizeof(float), args);
+    end = hpt_get_time();
+    passed = result == expected;
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free(buf);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_roi
+ *---------------------------------------------------------------------------*/
+int _test_roi(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ms_ssim_args *args, const char* str)
+{
+    struct bmp orig, cmp;
+    struct iqa_rect rects[2];
+    struct iqa_ms_ssim_args deep;
+    int passed, failures=0;
+    float expected, result, r0, r1;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", str);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    rects[0].x = 0; rects[0].y = 0;
+    rects[0].w = orig.w; rects[0].h = orig.h;
+    expected = iqa_ms_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, args);
+    start = hpt_get_time();
+    result = iqa_ms_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, args, rects, 1);
+    end = hpt_get_time();
+    passed = result == expected;
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    /*
+     * Two small regions near opposite corners. Every window centred on them
+     * fits, so they are weighted by their area.
+     */
+    printf("\t  %s (two regions): ", str);
+    rects[0].x = 20; rects[0].y = 20;
+    rects[0].w = 40; rects[0].h = 30;
+    rects[1].x = orig.w - 90; rects[1].y = orig.h - 70;
+    rects[1].w = 64; rects[1].h = 48;
+    r0 = iqa_ms_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, args, rects, 1);
+    r1 = iqa_ms_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, args, rects+1, 1);
+    result = iqa_ms_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, args, rects, 2);
+    expected = (float)((r0*40.0*30.0 + r1*64.0*48.0) / (40.0*30.0 + 64.0*48.0));
+    passed = result > 0.0f && result <= 1.0f && !_cmp_float(result, expected, 5);
+
+    /* More scales than the image allows */
+    memset(&deep, 0, sizeof(deep));
+    deep.gaussian = 1;
+    deep.scales = 40;
+    if (iqa_ms_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, &deep, rects, 1) != INFINITY)
+        passed = 0;
+    printf("\t%.5f\t\t\t%s\n", result, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return failures;
+}
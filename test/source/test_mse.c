@@ -34,11 +34,15 @@
 #include "iqa.h"
 #include "test_mse.h"
 #include "hptime.h"
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
 static unsigned char img_1x1[1] = { 128 };
 static unsigned char img_2x2[4] = { 0, 128, 192, 255 };
+/* img_2x2 as 10-bit samples, LSB aligned (stride of 2 words) and MSB aligned (P010) */
+static unsigned short img_2x2_10[4] = { 0, 512, 768, 1020 };
+static unsigned short img_2x2_p010[4] = { 0, 512<<6, 768<<6, 1020<<6 };
 
 int test_mse()
 {
@@ -46,6 +50,8 @@ int test_mse()
     float result;
     unsigned long long start, end;
     unsigned char img2[4];
+    unsigned short img2_16[4];
+    struct iqa_rect rect;
 
     printf("\nMSE:\n");
 
@@ -97,5 +103,51 @@ int test_mse()
         passed?"PASS":"FAILED");
     failures += passed?0:1;
 
+    printf("\t2x2 Region: ");
+    rect.x = 0; rect.y = 1; rect.w = 2; rect.h = 1;
+    start = hpt_get_time();
+    result = iqa_mse_roi(img_2x2, img2, 2, 2, 2, &rect, 1);
+    end = hpt_get_time();
+    passed = result==84.5f ? 1 : 0;
+    printf("%.5f (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t2x2 Region outside: ");
+    rect.x = 1; rect.w = 2;
+    result = iqa_mse_roi(img_2x2, img2, 2, 2, 2, &rect, 1);
+    passed = result==INFINITY ? 1 : 0;
+    printf("%.5f\t\t%s\n", result, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t2x2 10-bit: ");
+    memcpy(img2_16, img_2x2_10, sizeof(img_2x2_10));
+    img2_16[2] -= 13*4;
+    start = hpt_get_time();
+    result = iqa_mse_16(img_2x2_10, img2_16, 2, 2, 2*sizeof(unsigned short), 10);
+    end = hpt_get_time();
+    passed = result==676.0f ? 1 : 0;
+    printf("%.5f (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t2x2 10-bit P010: ");
+    memcpy(img2_16, img_2x2_p010, sizeof(img_2x2_p010));
+    img2_16[2] -= (13*4)<<6;
+    img2_16[3] |= 0x3f; /* The low bits are ignored */
+    start = hpt_get_time();
+    result = iqa_mse_16(img_2x2_p010, img2_16, 2, 2, 2*sizeof(unsigned short), 10 | IQA_MSB_ALIGNED);
+    end = hpt_get_time();
+    passed = result==676.0f ? 1 : 0;
+    printf("%.5f (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
     return failures;
 }
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "iqa.h"
+#include "test_parallel.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#define IMG_W 320
+#define IMG_H 300
+
+static unsigned char img_ref[IMG_W*IMG_H];
+static unsigned char img_cmp[IMG_W*IMG_H];
+
+static const int g_thread_counts[] = { 2, 3, 4 };
+
+static void _fill_images();
+static int _test_threads(const char *name, float (*run)());
+static float _run_ssim();
+static float _run_ssim_box();
+static float _run_ssim_args();
+static float _run_ms_ssim();
+static float _run_ms_ssim_compare();
+
+
+/*----------------------------------------------------------------------------
+ * TEST ENTRY POINT
+ *---------------------------------------------------------------------------*/
+int test_parallel()
+{
+    int failure = 0;
+    int threads = iqa_get_num_threads();
+
+    printf("\nParallel:\n");
+    _fill_images();
+
+    failure += _test_threads("SSIM (Gaussian)", _run_ssim);
+    failure += _test_threads("SSIM (box)", _run_ssim_box);
+    failure += _test_threads("SSIM (a=0.5,b=1.34,g=0.2)", _run_ssim_args);
+    failure += _test_threads("MS-SSIM", _run_ms_ssim);
+    failure += _test_threads("MS-SSIM (prepared)", _run_ms_ssim_compare);
+
+    iqa_set_num_threads(threads);
+    return failure;
+}
+
+/*----------------------------------------------------------------------------
+ * _fill_images
+ *---------------------------------------------------------------------------*/
+void _fill_images()
+{
+    int x, y, v;
+    unsigned int seed = 54321;
+
+    /* A diagonal gradient plus a deterministic noise pattern */
+    for (y=0; y<IMG_H; ++y) {
+        for (x=0; x<IMG_W; ++x) {
+            seed = seed * 1103515245 + 12345;
+            v = ((x+y)*255)/(IMG_W+IMG_H);
+            img_ref[y*IMG_W + x] = (unsigned char)v;
+            v += (int)((seed >> 16) % 61) - 30;
+            img_cmp[y*IMG_W + x] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------
+ * _test_threads
+ *
+ * The result must be bit-identical to the single threaded one.
+ *---------------------------------------------------------------------------*/
+int _test_threads(const char *name, float (*run)())
+{
+    int idx, passed = 1;
+    float expected, result;
+
+    printf("\t%s: ", name);
+    iqa_set_num_threads(1);
+    expected = run();
+    for (idx=0; idx<(int)(sizeof(g_thread_counts)/sizeof(g_thread_counts[0])); ++idx) {
+        if (iqa_set_num_threads(g_thread_counts[idx]) != g_thread_counts[idx])
+            passed = 0;
+        result = run();
+        if (memcmp(&result, &expected, sizeof(float)) != 0)
+            passed = 0;
+    }
+    iqa_set_num_threads(1);
+    printf("\t%.5f\t%s\n", expected, passed?"PASS":"FAILED");
+    return passed?0:1;
+}
+
+float _run_ssim()
+{
+    return iqa_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 1, 0);
+}
+
+float _run_ssim_box()
+{
+    return iqa_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 0, 0);
+}
+
+float _run_ssim_args()
+{
+    struct iqa_ssim_args args;
+    args.alpha = 0.5f;
+    args.beta = 1.34f;
+    args.gamma = 0.2f;
+    args.L = 255;
+    args.K1 = 0.01f;
+    args.K2 = 0.03f;
+    args.f = 0;
+    return iqa_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 1, &args);
+}
+
+float _run_ms_ssim()
+{
+    return iqa_ms_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 0);
+}
+
+float _run_ms_ssim_compare()
+{
+    float result;
+    struct iqa_ms_ssim_ref *prepared = iqa_ms_ssim_ref_prepare(img_ref, IMG_W, IMG_H, IMG_W, 0);
+    if (!prepared)
+        return INFINITY;
+    result = iqa_ms_ssim_compare(prepared, img_cmp);
+    iqa_ms_ssim_ref_destroy(prepared);
+    return result;
+}
@@ -40,6 +40,9 @@
 
 static unsigned char img_1x1[1] = { 128 };
 static unsigned char img_2x2[4] = { 0, 128, 192, 255 };
+/* img_2x2 as 10-bit samples, LSB aligned (stride of 2 words) and MSB aligned (P010) */
+static unsigned short img_2x2_10[4] = { 0, 512, 768, 1020 };
+static unsigned short img_2x2_p010[4] = { 0, 512<<6, 768<<6, 1020<<6 };
 
 int test_psnr()
 {
@@ -47,6 +50,7 @@ int test_psnr()
     float result;
     unsigned long long start, end;
     unsigned char img2[4];
+    unsigned short img2_16[4];
 
     printf("\nPSNR:\n");
 
@@ -98,5 +102,32 @@ int test_psnr()
         passed?"PASS":"FAILED");
     failures += passed?0:1;
 
+    printf("\t2x2 10-bit: ");
+    memcpy(img2_16, img_2x2_10, sizeof(img_2x2_10));
+    img2_16[2] -= 13*4;
+    start = hpt_get_time();
+    result = iqa_psnr_16(img_2x2_10, img2_16, 2, 2, 2*sizeof(unsigned short), 10);
+    end = hpt_get_time();
+    passed = _cmp_float(result, 31.89805f, 5) ? 0 : 1;
+    printf("%.5f (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t2x2 10-bit P010: ");
+    memcpy(img2_16, img_2x2_p010, sizeof(img_2x2_p010));
+    img2_16[2] -= (13*4)<<6;
+    img2_16[3] |= 0x3f; /* The low bits are ignored */
+    start = hpt_get_time();
+    result = iqa_psnr_16(img_2x2_p010, img2_16, 2, 2, 2*sizeof(unsigned short), 10 | IQA_MSB_ALIGNED);
+    end = hpt_get_time();
+    passed = _cmp_float(result, 31.89805f, 5) ? 0 : 1;
+    printf("%.5f (%.3lf ms)\t%s\n", 
+        result, 
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
     return failures;
 }
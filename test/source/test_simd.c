@@ -0,0 +1,494 @@
+/*
+ * Copyright (c) 2011, Tom Distler (http://tdistler.com)
+ * All rights reserved.
+ *
+ * The BSD License
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * - Redistributions of source code must retain the above copyright notice, 
+ *   this list of conditions and the following disclaimer.
+ *
+ * - Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * - Neither the name of the tdistler.com nor the names of its contributors may
+ *   be used to endorse or promote products derived from this software without
+ *   specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE 
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "iqa.h"
+#include "convolve.h"
+#include "decimate.h"
+#include "ssim.h"
+#include "simd.h"
+#include "test_simd.h"
+#include "math_utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define IMG_W 197
+#define IMG_H 181
+
+static const char *g_level_names[] = { "scalar", "sse2", "avx2", "avx512" };
+
+static unsigned char img_ref[IMG_W*IMG_H];
+static unsigned char img_cmp[IMG_W*IMG_H];
+
+static void _fill_images();
+static int _test_simd_convolve(int level);
+static int _test_simd_decimate(int level);
+static int _test_simd_ssim(int level);
+static int _test_simd_stats(int level);
+static int _test_simd_terms(int level);
+static int _test_simd_int(int level);
+static int _test_simd_pow(int level);
+static int _test_simd_sums(int level);
+
+
+/*----------------------------------------------------------------------------
+ * TEST ENTRY POINT
+ *---------------------------------------------------------------------------*/
+int test_simd()
+{
+    int level, max, failure = 0;
+    int selected = _iqa_simd_get()->level;
+
+    printf("\nSIMD:\n");
+    max = _iqa_simd_detect();
+    printf("\tDetected: %s\n", g_level_names[max]);
+    _fill_images();
+
+    for (level=IQA_SIMD_SSE2; level<=max; ++level) {
+        printf("\t%s vs scalar:\n", g_level_names[level]);
+        failure += _test_simd_convolve(level);
+        failure += _test_simd_decimate(level);
+        failure += _test_simd_ssim(level);
+        failure += _test_simd_stats(level);
+        failure += _test_simd_terms(level);
+        failure += _test_simd_int(level);
+        failure += _test_simd_pow(level);
+        failure += _test_simd_sums(level);
+    }
+
+    _iqa_simd_set(selected);
+    return failure;
+}
+
+/*----------------------------------------------------------------------------
+ * _fill_images
+ *---------------------------------------------------------------------------*/
+void _fill_images()
+{
+    int x, y, v;
+    unsigned int seed = 12345;
+
+    /* A smooth gradient plus a deterministic noise pattern */
+    for (y=0; y<IMG_H; ++y) {
+        for (x=0; x<IMG_W; ++x) {
+            seed = seed * 1103515245 + 12345;
+            v = (x*255)/IMG_W;
+            img_ref[y*IMG_W + x] = (unsigned char)v;
+            v += (int)((seed >> 16) % 41) - 20;
+            img_cmp[y*IMG_W + x] = (unsigned char)(v < 0 ? 0 : (v > 255 ? 255 : v));
+        }
+    }
+    /* Saturated pixels for the integer kernels */
+    for (x=0; x<GAUSSIAN_LEN; ++x)
+        img_ref[x] = img_cmp[x] = 255;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_convolve
+ *---------------------------------------------------------------------------*/
+int _test_simd_convolve(int level)
+{
+    int x, passed, rw, rh;
+    float *img, *expected, *result;
+    double err, max_err;
+    struct _kernel k;
+
+    k.kernel = (float*)g_gaussian_window;
+    k.kernel_h = (float*)g_gaussian_window_1d;
+    k.kernel_v = (float*)g_gaussian_window_1d;
+    k.w = k.h = GAUSSIAN_LEN;
+    k.normalized = 1;
+    k.bnd_opt = KBND_SYMMETRIC;
+
+    printf("\t  Convolve 11x11 separable: ");
+    img = (float*)malloc(3*IMG_W*IMG_H*sizeof(float));
+    if (!img) {
+        printf("\tFAILED (out of memory)\n");
+        return 1;
+    }
+    expected = img + IMG_W*IMG_H;
+    result = expected + IMG_W*IMG_H;
+    for (x=0; x<IMG_W*IMG_H; ++x)
+        img[x] = (float)img_ref[x];
+
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    _iqa_convolve(img, IMG_W, IMG_H, &k, expected, 0, 0);
+    _iqa_simd_set(level);
+    _iqa_convolve(img, IMG_W, IMG_H, &k, result, &rw, &rh);
+
+    /* Single precision accumulation, so allow a small absolute error */
+    max_err = 0.0;
+    for (x=0; x<rw*rh; ++x) {
+        err = fabs((double)result[x] - (double)expected[x]);
+        if (err > max_err)
+            max_err = err;
+    }
+    passed = 0;
+    if (rw == IMG_W-GAUSSIAN_LEN+1 && rh == IMG_H-GAUSSIAN_LEN+1 && max_err < 1e-3)
+        passed = 1;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    free(img);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_decimate
+ *---------------------------------------------------------------------------*/
+int _test_simd_decimate(int level)
+{
+    int x, passed, rw, rh;
+    float *img, *expected, *result;
+    struct _kernel k;
+
+    /* The 2-D window, so the row accumulation path is taken */
+    k.kernel = (float*)g_gaussian_window;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
+    k.w = k.h = GAUSSIAN_LEN;
+    k.normalized = 1;
+    k.bnd_opt = KBND_SYMMETRIC;
+    k.bnd_const = 0.0f;
+
+    printf("\t  Decimate 11x11 (exact): ");
+    img = (float*)malloc(3*IMG_W*IMG_H*sizeof(float));
+    if (!img) {
+        printf("\tFAILED (out of memory)\n");
+        return 1;
+    }
+    expected = img + IMG_W*IMG_H;
+    result = expected + IMG_W*IMG_H;
+    for (x=0; x<IMG_W*IMG_H; ++x)
+        img[x] = (float)img_cmp[x] / 3.0f;
+
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    _iqa_decimate(img, IMG_W, IMG_H, 2, &k, expected, 0, 0);
+    _iqa_simd_set(level);
+    _iqa_decimate(img, IMG_W, IMG_H, 2, &k, result, &rw, &rh);
+
+    passed = rw == IMG_W/2+1 && rh == IMG_H/2+1;
+    for (x=0; passed && x<rw*rh; ++x) {
+        if (result[x] != expected[x])
+            passed = 0;
+    }
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    free(img);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_ssim
+ *---------------------------------------------------------------------------*/
+int _test_simd_ssim(int level)
+{
+    int passed, failures=0;
+    float expected, result;
+    struct iqa_ssim_ref *prepared;
+
+    printf("\t  SSIM (Gaussian): ");
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    expected = iqa_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 1, 0);
+    _iqa_simd_set(level);
+    result = iqa_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 1, 0);
+    passed = _cmp_float(result, expected, 5) ? 0 : 1;
+    printf("\t%.5f\t%s\n", result, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t  SSIM prepared: ");
+    _iqa_simd_set(level);
+    prepared = iqa_ssim_ref_prepare(img_ref, IMG_W, IMG_H, IMG_W, 0);
+    result = prepared ? iqa_ssim_compare(prepared, img_cmp) : INFINITY;
+    iqa_ssim_ref_destroy(prepared);
+    passed = _cmp_float(result, expected, 5) ? 0 : 1;
+    printf("\t%.5f\t%s\n", result, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    printf("\t  MS-SSIM: ");
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    expected = iqa_ms_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 0);
+    _iqa_simd_set(level);
+    result = iqa_ms_ssim(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 0);
+    passed = _cmp_float(result, expected, 4) ? 0 : 1;
+    printf("\t\t%.5f\t%s\n", result, passed?"PASS":"FAILED");
+    failures += passed?0:1;
+
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_stats
+ *
+ * Separable window statistics, through a custom map of the (exact) terms.
+ *---------------------------------------------------------------------------*/
+static int _sum_map(const double *l, const double *c, const double *s, int n, void *ctx)
+{
+    int x;
+    for (x=0; x<n; ++x)
+        *(double*)ctx += l[x] * c[x] * s[x];
+    return 0;
+}
+
+static float _sum_reduce(int w, int h, void *ctx)
+{
+    return (float)(*(double*)ctx / (double)(w*h));
+}
+
+int _test_simd_stats(int level)
+{
+    int x, passed;
+    float *img;
+    double expected, result;
+    struct _kernel k;
+    struct _map_reduce mr;
+    struct iqa_ssim_args args;
+
+    k.kernel = (float*)g_gaussian_window;
+    k.kernel_h = (float*)g_gaussian_window_1d;
+    k.kernel_v = (float*)g_gaussian_window_1d;
+    k.w = k.h = GAUSSIAN_LEN;
+    k.normalized = 1;
+    k.bnd_opt = KBND_SYMMETRIC;
+    k.bnd_const = 0.0f;
+
+    args.alpha = args.beta = args.gamma = 1.0f;
+    args.L = 255;
+    args.K1 = 0.01f;
+    args.K2 = 0.03f;
+    args.f = 1;
+
+    memset(&mr, 0, sizeof(mr));
+    mr.pool = MR_CUSTOM;
+    mr.map = _sum_map;
+    mr.reduce = _sum_reduce;
+
+    printf("\t  SSIM separable (exact): ");
+    img = (float*)malloc(2*IMG_W*IMG_H*sizeof(float));
+    if (!img) {
+        printf("\tFAILED (out of memory)\n");
+        return 1;
+    }
+    /* Not integers, so the products round */
+    for (x=0; x<IMG_W*IMG_H; ++x) {
+        img[x] = (float)img_ref[x] / 3.0f;
+        img[IMG_W*IMG_H + x] = (float)img_cmp[x] / 3.0f;
+    }
+
+    expected = result = 0.0;
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    mr.context = &expected;
+    _iqa_ssim(img, img + IMG_W*IMG_H, IMG_W, IMG_H, &k, &mr, &args);
+    _iqa_simd_set(level);
+    mr.context = &result;
+    _iqa_ssim(img, img + IMG_W*IMG_H, IMG_W, IMG_H, &k, &mr, &args);
+
+    passed = result == expected && expected != 0.0;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    free(img);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_terms
+ *---------------------------------------------------------------------------*/
+int _test_simd_terms(int level)
+{
+    /* An odd length so the remainder loops run too */
+    const int len = 37;
+    const float C[3][3] = { {6.5025f, 58.5225f, 29.26125f}, {0.0f, 0.0f, 0.0f}, {6.5025f, 0.0f, 0.0f} };
+    float stats[5*37];
+    double terms[6*37];
+    int x, i, passed = 1;
+    unsigned int seed = 54321;
+
+    /* Flat and negative variances hit the MS-SSIM* special cases */
+    for (x=0; x<5*len; ++x) {
+        seed = seed * 1103515245 + 12345;
+        stats[x] = (x % 7 == 0) ? 0.0f : (float)((int)((seed >> 16) % 2001) - 200) / 8.0f;
+    }
+    stats[0] = stats[len] = 0.0f;
+
+    printf("	  SSIM terms: ");
+    for (i=0; i<3; ++i) {
+        _iqa_simd_set(IQA_SIMD_SCALAR);
+        _iqa_simd_get()->ssim_terms_row(stats, len, C[i][0], C[i][1], C[i][2],
+            terms, terms+len, terms+2*len);
+        _iqa_simd_set(level);
+        _iqa_simd_get()->ssim_terms_row(stats, len, C[i][0], C[i][1], C[i][2],
+            terms+3*len, terms+4*len, terms+5*len);
+        for (x=0; x<3*len; ++x) {
+            /* Bit-identical, including NaN for a 0/0 */
+            if (terms[x] != terms[x+3*len] && (terms[x] == terms[x] || terms[x+3*len] == terms[x+3*len]))
+                passed = 0;
+        }
+    }
+    printf("		%s\n", passed?"PASS":"FAILED");
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_int
+ *---------------------------------------------------------------------------*/
+int _test_simd_int(int level)
+{
+    /* Enough columns for the vector loops plus a remainder */
+    const int len = IMG_W - GAUSSIAN_LEN + 1;
+    int *expected, *result;
+    int x, passed = 1;
+    float s1, s2;
+
+    printf("\t  Integer SSIM: ");
+    expected = (int*)malloc(10*len*sizeof(int));
+    if (!expected) {
+        printf("\tFAILED (out of memory)\n");
+        return 1;
+    }
+    result = expected + 5*len;
+
+    /* The kernel must be exact, including 255*255 with the largest taps */
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    _iqa_simd_get()->int_moments_row(img_ref, img_cmp, len, g_gaussian_window_1d_q, GAUSSIAN_LEN, expected);
+    _iqa_simd_set(level);
+    _iqa_simd_get()->int_moments_row(img_ref, img_cmp, len, g_gaussian_window_1d_q, GAUSSIAN_LEN, result);
+    for (x=0; x<5*len; ++x) {
+        if (result[x] != expected[x])
+            passed = 0;
+    }
+
+    _iqa_simd_set(IQA_SIMD_SCALAR);
+    s1 = iqa_ssim_int(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 1, 0);
+    _iqa_simd_set(level);
+    s2 = iqa_ssim_int(img_ref, img_cmp, IMG_W, IMG_H, IMG_W, 1, 0);
+    if (s1 != s2)
+        passed = 0;
+
+    printf("\t%.5f\t%s\n", s2, passed?"PASS":"FAILED");
+    free(expected);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_pow
+ *---------------------------------------------------------------------------*/
+int _test_simd_pow(int level)
+{
+    /* An odd length so the remainder loop runs too */
+    const int len = 203;
+    const float e[4] = { 0.5f, 2.0f, 0.1333f, 7.5f };
+    double in[203], v[203], expected[203], y, err, max_err = 0.0;
+    int x, i, passed = 1;
+    unsigned int seed = 24680;
+
+    printf("\t  Pow: ");
+    _iqa_simd_set(level);
+    if (!_iqa_simd_get()->pow_row) {
+        printf("\t\tFAILED (no kernel)\n");
+        return 1;
+    }
+    for (i=0; i<4; ++i) {
+        /* SSIM terms are in [-1,1], but cover a wider range and the pow() lanes */
+        for (x=0; x<len; ++x) {
+            seed = seed * 1103515245 + 12345;
+            v[x] = (double)((int)((seed >> 8) % 2000001) - 1000000) / 1000000.0;
+            if (x % 5 == 1)
+                v[x] *= 1e6;
+        }
+        v[3] = 0.0;
+        v[9] = -0.0;
+        v[18] = 1e-310;
+        v[27] = 1.0;
+        v[36] = -1.0;
+        v[45] = 1e300;
+        for (x=0; x<len; ++x) {
+            in[x] = v[x];
+            expected[x] = (v[x] < 0.0 ? -1.0 : 1.0) * pow(fabs(v[x]), (double)e[i]);
+        }
+        _iqa_simd_get()->pow_row(v, len, (double)e[i]);
+        for (x=0; x<len; ++x) {
+            if (v[x] == expected[x])
+                continue;
+            /* Relative to the rounding of e*log|v|. Also catches a NaN result. */
+            y = (double)e[i] * log(fabs(in[x]));
+            err = fabs(v[x] - expected[x]) / fabs(expected[x]) / (1.0 + fabs(y));
+            if (!(err <= max_err))
+                max_err = err;
+        }
+    }
+    /* A few units in the last place */
+    if (!(max_err < 1e-15))
+        passed = 0;
+    printf("\t\t%.2g\t%s\n", max_err, passed?"PASS":"FAILED");
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_simd_sums
+ *
+ * The pooling sums. The lanes change the order of the additions, so the
+ * sums are only close to the scalar ones.
+ *---------------------------------------------------------------------------*/
+int _test_simd_sums(int level)
+{
+    /* An odd length so the remainder loop runs too */
+    const int len = 203;
+    double l[203], c[203], s[203], prod[203];
+    double sum, lcs_sum, expected, lcs_expected;
+    int x, passed = 1;
+    unsigned int seed = 13579;
+
+    printf("\t  Pooling sums: ");
+    _iqa_simd_set(level);
+    if (!_iqa_simd_get()->sum_row || !_iqa_simd_get()->lcs_sum_row) {
+        printf("\tFAILED (no kernel)\n");
+        return 1;
+    }
+    expected = lcs_expected = 0.0;
+    for (x=0; x<len; ++x) {
+        seed = seed * 1103515245 + 12345;
+        l[x] = (double)((seed >> 8) % 1000001) / 1000000.0;
+        seed = seed * 1103515245 + 12345;
+        c[x] = (double)((seed >> 8) % 1000001) / 1000000.0;
+        seed = seed * 1103515245 + 12345;
+        s[x] = (double)((int)((seed >> 8) % 2000001) - 1000000) / 1000000.0;
+        expected += s[x];
+        lcs_expected += l[x] * c[x] * s[x];
+    }
+    sum = _iqa_simd_get()->sum_row(s, len);
+    lcs_sum = _iqa_simd_get()->lcs_sum_row(l, c, s, len, prod);
+    if (fabs(sum - expected) > 1e-12 || fabs(lcs_sum - lcs_expected) > 1e-12)
+        passed = 0;
+    for (x=0; x<len; ++x)
+        if (prod[x] != fabs(l[x] * c[x] * s[x]))
+            passed = 0;
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    return passed?0:1;
+}
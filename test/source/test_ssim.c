@@ -34,11 +34,14 @@
 #include "test_ssim.h"
 #include "iqa.h"
 #include "convolve.h"
+#include "ssim.h"
 #include "bmp.h"
 #include "hptime.h"
 #include "math_utils.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 static const int img_width = 22;
 static const int img_height = 15;
@@ -76,6 +79,17 @@ static const struct iqa_ssim_args ssim_args = {
     1           /* factor */
 };
 
+/* The default arguments without downsampling */
+static const struct iqa_ssim_args no_scale_args = {
+    1.0f,       /* alpha */
+    1.0f,       /* beta */
+    1.0f,       /* gamma */
+    255,        /* L */
+    0.01f,      /* K1 */
+    0.03f,      /* K2 */
+    1           /* factor */
+};
+
 
 /* Defines the answer format */
 struct answer {
@@ -86,7 +100,7 @@ struct answer {
 static const struct answer ans_key_22x15_gauss[] = {
     {1.00000f, 5},  /* Identical */
     {0.99668f, 5},  /* Mean Shift +7 */
-    {0.68944f, 5},  /* 2x2 low-pass filter */
+    {0.68943f, 5},  /* 2x2 low-pass filter */
 };
 
 static const struct answer ans_key_22x15_linear[] = {
@@ -103,11 +117,11 @@ static const struct answer ans_key_22x15_args[] = {
 
 static const struct answer ans_key_einstein_gauss[] = {
     {1.00000f, 5},  /* Identical */
-    {0.69408f, 5},  /* Blur */
+    {0.69399f, 5},  /* Blur */
     {0.91327f, 5},  /* Contrast */
-    {0.28771f, 5},  /* Flip Vertical */
-    {0.83957f, 5},  /* Impulse */
-    {0.66246f, 5},  /* JPEG */
+    {0.28761f, 5},  /* Flip Vertical */
+    {0.83956f, 5},  /* Impulse */
+    {0.66236f, 5},  /* JPEG */
     {0.98836f, 5},  /* Mean Shift */
 };
 
@@ -124,12 +138,12 @@ static const struct answer ans_key_einstein_linear[] = {
 /* NOTE: Values verified. Different from Octave due to float precision. */
 static const struct answer ans_key_einstein_args[] = {
     {1.00000f, 5},    /* Identical */
-    {0.56509f, 5},    /* Blur */
+    {0.56494f, 5},    /* Blur */
     {0.94412f, 5},    /* Contrast */
-    {0.13106f, 5},    /* Flip Vertical */
-    {0.81263f, 5},    /* Impulse */
-    {0.50202f, 4},    /* JPEG (rounding error on 64-bit)*/
-    {0.99542f, 5},    /* Mean Shift */
+    {0.13087f, 5},    /* Flip Vertical */
+    {0.81260f, 5},    /* Impulse */
+    {0.50394f, 4},    /* JPEG (rounding error on 64-bit)*/
+    {0.99543f, 5},    /* Mean Shift */
 };
 
 static const struct answer ans_key_courtright[] = {
@@ -148,9 +162,25 @@ static const struct answer ans_key_courtright[] = {
 #define BMP_CR_ORIGINAL "Courtright.bmp"
 #define BMP_CR_NOISE    "Courtright_Noise.bmp"
 
+static const char *einstein_cmps[] = { BMP_BLUR, BMP_CONTRAST, BMP_JPG, BMP_MEANSHIFT, 0 };
+static const char *courtright_cmps[] = { BMP_CR_NOISE, BMP_CR_ORIGINAL, 0 };
+
 static int _test_ssim_22x15(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
 static int _test_ssim_einstein_bmp(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
 static int _test_ssim_courtright_bmp(int gaussian, const struct answer *answers, const struct iqa_ssim_args *args);
+static int _test_ssim_window_2d(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ssim_args *args);
+static int _test_ssim_plan(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_prepared(const char *name, const char *bmp_ref, const char **bmp_cmps, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_maps(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_pooling(const char *bmp_ref, const char *bmp_cmp);
+static int _test_ssim_stream(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_16(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_f32(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_int(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_roi(const char *bmp_ref, const char *bmp_cmp);
+static int _test_ssim_tracker(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_letterbox(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
+static int _test_ssim_sampled(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args);
 
 
 /*----------------------------------------------------------------------------
@@ -168,6 +198,49 @@ int test_ssim()
     failure += _test_ssim_einstein_bmp(0, ans_key_einstein_linear, 0);
     failure += _test_ssim_einstein_bmp(1, ans_key_einstein_args, &ssim_args);
     failure += _test_ssim_courtright_bmp(1, ans_key_courtright, 0);
+    printf("\tSeparable Gaussian window (same as in 2-D):\n");
+    failure += _test_ssim_window_2d(BMP_ORIGINAL, BMP_JPG, &no_scale_args);
+    failure += _test_ssim_window_2d(BMP_ORIGINAL, BMP_JPG, &ssim_args);
+    printf("\tPlan (same result as iqa_ssim):\n");
+    failure += _test_ssim_plan("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_plan("Einstein Jpeg Linear", BMP_ORIGINAL, BMP_JPG, 0, 0);
+    failure += _test_ssim_plan("Einstein Blur Args", BMP_ORIGINAL, BMP_BLUR, 1, &ssim_args);
+    failure += _test_ssim_plan("Courtright Noise", BMP_CR_ORIGINAL, BMP_CR_NOISE, 1, 0);
+    printf("\tPrepared reference (same result as iqa_ssim):\n");
+    failure += _test_ssim_prepared("Einstein", BMP_ORIGINAL, einstein_cmps, 1, 0);
+    failure += _test_ssim_prepared("Einstein Linear", BMP_ORIGINAL, einstein_cmps, 0, 0);
+    failure += _test_ssim_prepared("Courtright", BMP_CR_ORIGINAL, courtright_cmps, 1, 0);
+    printf("\tMaps (mean of the SSIM map):\n");
+    failure += _test_ssim_maps("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_maps("Einstein Blur Args", BMP_ORIGINAL, BMP_BLUR, 1, &ssim_args);
+    printf("\tPooling:\n");
+    failure += _test_ssim_pooling(BMP_ORIGINAL, BMP_JPG);
+    printf("\tStreaming (same result as iqa_ssim):\n");
+    failure += _test_ssim_stream("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_stream("Courtright Noise", BMP_CR_ORIGINAL, BMP_CR_NOISE, 1, 0);
+    printf("\t16-bit samples (8-bit same as iqa_ssim, P010 same as 10-bit):\n");
+    failure += _test_ssim_16("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    printf("\tFloat samples (same as iqa_ssim):\n");
+    failure += _test_ssim_f32("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_f32("Courtright Noise", BMP_CR_ORIGINAL, BMP_CR_NOISE, 1, 0);
+    printf("\tInteger engine (close to iqa_ssim):\n");
+    failure += _test_ssim_int("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_int("Einstein Jpeg Linear", BMP_ORIGINAL, BMP_JPG, 0, 0);
+    failure += _test_ssim_int("Einstein Blur Args", BMP_ORIGINAL, BMP_BLUR, 1, &ssim_args);
+    failure += _test_ssim_int("Courtright Noise", BMP_CR_ORIGINAL, BMP_CR_NOISE, 1, 0);
+    printf("\tRegions of interest:\n");
+    failure += _test_ssim_roi(BMP_ORIGINAL, BMP_JPG);
+    failure += _test_ssim_roi(BMP_CR_ORIGINAL, BMP_CR_NOISE);
+    printf("\tDirty-rectangle tracker (same as a full update, close to iqa_ssim):\n");
+    failure += _test_ssim_tracker("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_tracker("Courtright Noise", BMP_CR_ORIGINAL, BMP_CR_NOISE, 1, 0);
+    printf("\tIdentical rows (letterbox):\n");
+    failure += _test_ssim_letterbox("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_letterbox("Einstein Jpeg Linear", BMP_ORIGINAL, BMP_JPG, 0, 0);
+    failure += _test_ssim_letterbox("Einstein Jpeg Args", BMP_ORIGINAL, BMP_JPG, 1, &no_scale_args);
+    printf("\tSampled windows (step 1, step 4, 4000 random):\n");
+    failure += _test_ssim_sampled("Einstein Jpeg", BMP_ORIGINAL, BMP_JPG, 1, 0);
+    failure += _test_ssim_sampled("Einstein Blur Args", BMP_ORIGINAL, BMP_BLUR, 1, &ssim_args);
 
     return failure;
 }
@@ -220,6 +293,8 @@ int _test_ssim_22x15(int gaussian, const struct answer *answers, const struct iq
     lpf.kernel = lpf_linear_2x2;
     lpf.w = lpf.h = 2;
     lpf.normalized = 1;
+    lpf.kernel_h = 0;
+    lpf.kernel_v = 0;
     lpf.bnd_opt = KBND_SYMMETRIC;
     for (y=0; y < img_height; ++y) {
         for (x=0; x < img_width; ++x) {
@@ -440,3 +515,964 @@ int _test_ssim_courtright_bmp(int gaussian, const struct answer *answers, const
     return failures;
 }
 
+/*----------------------------------------------------------------------------
+ * _test_ssim_window_2d
+ *
+ * iqa_ssim() applies the Gaussian window as two 1-D passes. The same window
+ * applied in 2-D must give the same result, also with the reference
+ * statistics cached.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_window_2d(const char *bmp_ref, const char *bmp_cmp, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct _kernel k;
+    struct _map_reduce mr;
+    struct _ssim_pool pool;
+    struct _ssim_ref_stats rs;
+    float *ref_f, *cmp_f, result, expected, cached;
+    int x, y, passed;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", args == &ssim_args ? "Einstein Jpeg Args" : "Einstein Jpeg");
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    ref_f = (float*)malloc(4*orig.w*orig.h*sizeof(float));
+    if (!ref_f) {
+        printf("FAILED (out of memory)\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+    cmp_f = ref_f + orig.w*orig.h;
+    rs.mu = cmp_f + orig.w*orig.h;
+    rs.sigma_sqd = rs.mu + orig.w*orig.h;
+    for (y=0; y<orig.h; ++y) {
+        for (x=0; x<orig.w; ++x) {
+            ref_f[y*orig.w + x] = (float)orig.img[y*orig.stride + x];
+            cmp_f[y*orig.w + x] = (float)cmp.img[y*cmp.stride + x];
+        }
+    }
+
+    k.kernel = (float*)g_gaussian_window;
+    k.w = k.h = GAUSSIAN_LEN;
+    k.normalized = 1;
+    k.bnd_opt = KBND_SYMMETRIC;
+    k.bnd_const = 0.0f;
+    k.kernel_h = 0;
+    k.kernel_v = 0;
+    memset(&mr, 0, sizeof(mr));
+    memset(&pool, 0, sizeof(pool));
+    mr.pool = MR_MEAN;
+    mr.context = &pool;
+    expected = _iqa_ssim(ref_f, cmp_f, orig.w, orig.h, &k, &mr, args);
+    memset(&pool, 0, sizeof(pool));
+    cached = _iqa_ssim_ref_stats(ref_f, orig.w, orig.h, orig.w, &k, &rs, 0) ? INFINITY :
+        _iqa_ssim_ws(ref_f, cmp_f, orig.w, orig.h, &k, &mr, args, &rs, 0);
+
+    start = hpt_get_time();
+    result = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, 1, args);
+    end = hpt_get_time();
+    passed = !_cmp_float(result, expected, 5) && cached == expected;
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free(ref_f);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_plan
+ *---------------------------------------------------------------------------*/
+int _test_ssim_plan(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_plan *plan, *small;
+    struct iqa_ssim_plan_options opts;
+    struct iqa_ssim_sampling sampling;
+    int passed=0;
+    float expected, result, result2;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    opts.gaussian = gaussian;
+    opts.args = args;
+    plan = iqa_ssim_plan_create(orig.w, orig.h, orig.stride, &opts);
+    if (!plan) {
+        printf("FAILED to create plan\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    result = iqa_ssim_plan_execute(plan, orig.img, orig.img);
+    start = hpt_get_time();
+    result2 = iqa_ssim_plan_execute(plan, orig.img, cmp.img);
+    end = hpt_get_time();
+    /* Identical images first, so the second run reuses dirty buffers */
+    if (result == 1.0f && result2 == expected)
+        passed = 1;
+
+    /* Every entry point rejects a plan smaller than its window */
+    small = iqa_ssim_plan_create(7, 7, orig.stride, &opts);
+    sampling.step = 1;
+    sampling.count = 0;
+    sampling.seed = 0;
+    if (small && (iqa_ssim_plan_execute(small, orig.img, cmp.img) != INFINITY ||
+        iqa_ssim_plan_execute_maps(small, orig.img, cmp.img, 0) != INFINITY ||
+        iqa_ssim_plan_sample(small, orig.img, cmp.img, &sampling, 0) != INFINITY))
+        passed = 0;
+    iqa_ssim_plan_destroy(small);
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result2,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    iqa_ssim_plan_destroy(plan);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_prepared
+ *---------------------------------------------------------------------------*/
+int _test_ssim_prepared(const char *name, const char *bmp_ref, const char **bmp_cmps, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_ref *prep;
+    struct iqa_ssim_plan_options opts;
+    int idx, passed=1;
+    float expected, result;
+    unsigned long long start, end;
+    double elapsed=0.0;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+
+    opts.gaussian = gaussian;
+    opts.args = args;
+    prep = iqa_ssim_ref_prepare(orig.img, orig.w, orig.h, orig.stride, &opts);
+    if (!prep) {
+        printf("FAILED to prepare reference\n");
+        free_bmp(&orig);
+        return 1;
+    }
+
+    /* Several candidates against the same reference */
+    for (idx=0; bmp_cmps[idx]; ++idx) {
+        if (load_bmp(bmp_cmps[idx], &cmp)) {
+            printf("FAILED to load \'%s\'\n", bmp_cmps[idx]);
+            passed = 0;
+            break;
+        }
+        expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+        start = hpt_get_time();
+        result = iqa_ssim_compare(prep, cmp.img);
+        end = hpt_get_time();
+        elapsed += hpt_elapsed_time(start,end,hpt_get_frequency());
+        if (result != expected)
+            passed = 0;
+        free_bmp(&cmp);
+    }
+    printf("\t%i images  (%.3lf ms)\t%s\n",
+        idx,
+        elapsed * 1000.0,
+        passed?"PASS":"FAILED");
+
+    iqa_ssim_ref_destroy(prep);
+    free_bmp(&orig);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_stream
+ *---------------------------------------------------------------------------*/
+struct _stream_images {
+    const struct bmp *ref;
+    const struct bmp *cmp;
+};
+
+static int _read_rows(int y, const unsigned char **ref, const unsigned char **cmp, void *ctx)
+{
+    const struct _stream_images *imgs = (const struct _stream_images*)ctx;
+    *ref = imgs->ref->img + y*imgs->ref->stride;
+    *cmp = imgs->cmp->img + y*imgs->cmp->stride;
+    return 0;
+}
+
+int _test_ssim_stream(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_stream *stream;
+    struct iqa_ssim_plan_options opts;
+    struct _stream_images imgs;
+    int y, rows, complete, passed=1;
+    float expected, partial, result, result2;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    opts.gaussian = gaussian;
+    opts.args = args;
+    stream = iqa_ssim_stream_create(orig.w, orig.h, &opts);
+    if (!stream) {
+        printf("FAILED to create stream\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+
+    /* Uneven chunks, checking the running result half way */
+    start = hpt_get_time();
+    partial = INFINITY;
+    for (y=0, rows=1; y<orig.h; y+=rows, rows=rows%13+5) {
+        if (rows > orig.h - y)
+            rows = orig.h - y;
+        if (iqa_ssim_stream_push(stream, orig.img + y*orig.stride, cmp.img + y*cmp.stride, orig.stride, rows)) {
+            passed = 0;
+            break;
+        }
+        if (partial == INFINITY && y >= orig.h/2) {
+            partial = iqa_ssim_stream_result(stream, &complete);
+            if (partial == INFINITY || complete)
+                passed = 0;
+        }
+    }
+    result = iqa_ssim_stream_result(stream, &complete);
+    end = hpt_get_time();
+    if (!complete || result != expected)
+        passed = 0;
+
+    /* Row callback */
+    imgs.ref = &orig;
+    imgs.cmp = &cmp;
+    result2 = iqa_ssim_streamed(orig.w, orig.h, &opts, _read_rows, &imgs);
+    if (result2 != expected)
+        passed = 0;
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    iqa_ssim_stream_destroy(stream);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_maps
+ *---------------------------------------------------------------------------*/
+int _test_ssim_maps(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_plan *plan;
+    struct iqa_ssim_plan_options opts;
+    struct iqa_ssim_maps maps;
+    int x, y, mw, mh, stride, passed=1;
+    float expected, result, value, *ssim, *l, *c, *s;
+    unsigned char *ssim_u8;
+    double sum;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    opts.gaussian = gaussian;
+    opts.args = args;
+    plan = iqa_ssim_plan_create(orig.w, orig.h, orig.stride, &opts);
+    if (!plan || iqa_ssim_plan_map_size(plan, &mw, &mh)) {
+        printf("FAILED to create plan\n");
+        iqa_ssim_plan_destroy(plan);
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+
+    /* Padded rows, to check the stride is honoured */
+    stride = mw + 3;
+    ssim = (float*)malloc(4*stride*mh*sizeof(float) + stride*mh);
+    if (!ssim) {
+        printf("FAILED (out of memory)\n");
+        iqa_ssim_plan_destroy(plan);
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+    l = ssim + stride*mh;
+    c = l + stride*mh;
+    s = c + stride*mh;
+    ssim_u8 = (unsigned char*)(s + stride*mh);
+
+    maps.ssim.data = ssim;
+    maps.ssim.stride = stride*sizeof(float);
+    maps.ssim.format = IQA_MAP_FLOAT;
+    maps.l.data = l;
+    maps.l.stride = stride*sizeof(float);
+    maps.l.format = IQA_MAP_FLOAT;
+    maps.c.data = c;
+    maps.c.stride = stride*sizeof(float);
+    maps.c.format = IQA_MAP_FLOAT;
+    maps.s.data = s;
+    maps.s.stride = stride*sizeof(float);
+    maps.s.format = IQA_MAP_FLOAT;
+
+    expected = iqa_ssim_plan_execute(plan, orig.img, cmp.img);
+    start = hpt_get_time();
+    result = iqa_ssim_plan_execute_maps(plan, orig.img, cmp.img, &maps);
+    end = hpt_get_time();
+    if (result != expected)
+        passed = 0;
+
+    /* The map averages to the result, and the components multiply to it */
+    sum = 0.0;
+    for (y=0; y<mh; ++y) {
+        for (x=0; x<mw; ++x) {
+            value = ssim[y*stride + x];
+            sum += value;
+            if (fabs(value - l[y*stride + x]*c[y*stride + x]*s[y*stride + x]) > 1e-4)
+                passed = 0;
+        }
+    }
+    if (_cmp_float((float)(sum/(mw*mh)), expected, 5))
+        passed = 0;
+
+    /* Quantized SSIM map only */
+    memset(&maps, 0, sizeof(maps));
+    maps.ssim.data = ssim_u8;
+    maps.ssim.stride = stride;
+    maps.ssim.format = IQA_MAP_U8;
+    if (iqa_ssim_plan_execute_maps(plan, orig.img, cmp.img, &maps) != expected)
+        passed = 0;
+    for (y=0; y<mh; ++y) {
+        for (x=0; x<mw; ++x) {
+            value = ssim[y*stride + x];
+            value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+            if (fabs(value*255.0f - ssim_u8[y*stride + x]) > 0.51f)
+                passed = 0;
+        }
+    }
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free(ssim);
+    iqa_ssim_plan_destroy(plan);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_pooling
+ *
+ * The built-in poolings against the same pooling done by a custom map.
+ *---------------------------------------------------------------------------*/
+struct _span_pool {
+    double sum;
+    double p;
+};
+
+static int _span_map(const double *l, const double *c, const double *s, int n, void *ctx)
+{
+    struct _span_pool *pool = (struct _span_pool*)ctx;
+    int x;
+    for (x=0; x<n; ++x)
+        pool->sum += pow(fabs(l[x] * c[x] * s[x]), pool->p);
+    return 0;
+}
+
+static float _span_reduce(int w, int h, void *ctx)
+{
+    struct _span_pool *pool = (struct _span_pool*)ctx;
+    return (float)pow(pool->sum / (double)(w*h), 1.0 / pool->p);
+}
+
+int _test_ssim_pooling(const char *bmp_ref, const char *bmp_cmp)
+{
+    struct bmp orig, cmp;
+    struct _kernel k;
+    struct _map_reduce mr, custom;
+    struct _ssim_pool pool;
+    struct _span_pool span;
+    struct iqa_ssim_args args;
+    float *ref_f, *cmp_f, result, expected;
+    int idx, x, y, passed=1;
+    static const float exponents[] = { 1.0f, 2.0f, 4.0f };
+
+    printf("\t  Built-in vs custom map: ");
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    ref_f = (float*)malloc(2*orig.w*orig.h*sizeof(float));
+    if (!ref_f) {
+        printf("FAILED (out of memory)\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+    cmp_f = ref_f + orig.w*orig.h;
+    for (y=0; y<orig.h; ++y) {
+        for (x=0; x<orig.w; ++x) {
+            ref_f[y*orig.w + x] = (float)orig.img[y*orig.stride + x];
+            cmp_f[y*orig.w + x] = (float)cmp.img[y*cmp.stride + x];
+        }
+    }
+
+    k.kernel = (float*)g_gaussian_window;
+    k.w = k.h = GAUSSIAN_LEN;
+    k.normalized = 1;
+    k.bnd_opt = KBND_SYMMETRIC;
+    k.bnd_const = 0.0f;
+    k.kernel_h = (float*)g_gaussian_window_1d;
+    k.kernel_v = (float*)g_gaussian_window_1d;
+
+    args.alpha = args.beta = args.gamma = 1.0f;
+    args.L = 255;
+    args.K1 = 0.01f;
+    args.K2 = 0.03f;
+    args.f = 1;
+
+    memset(&custom, 0, sizeof(custom));
+    custom.pool = MR_CUSTOM;
+    custom.map = _span_map;
+    custom.reduce = _span_reduce;
+    custom.context = &span;
+
+    for (idx=0; idx<(int)(sizeof(exponents)/sizeof(exponents[0])); ++idx) {
+        memset(&mr, 0, sizeof(mr));
+        memset(&pool, 0, sizeof(pool));
+        mr.pool = MR_MINKOWSKI;
+        mr.context = &pool;
+        pool.p = exponents[idx];
+        result = _iqa_ssim(ref_f, cmp_f, orig.w, orig.h, &k, &mr, &args);
+
+        span.sum = 0.0;
+        span.p = exponents[idx];
+        expected = _iqa_ssim(ref_f, cmp_f, orig.w, orig.h, &k, &custom, &args);
+        if (result == INFINITY || _cmp_float(result, expected, 5))
+            passed = 0;
+    }
+
+    /* The mean agrees with p=1, since the SSIM values here are nearly all positive */
+    memset(&mr, 0, sizeof(mr));
+    memset(&pool, 0, sizeof(pool));
+    mr.pool = MR_MEAN;
+    mr.context = &pool;
+    result = _iqa_ssim(ref_f, cmp_f, orig.w, orig.h, &k, &mr, &args);
+    span.sum = 0.0;
+    span.p = 1.0;
+    expected = _iqa_ssim(ref_f, cmp_f, orig.w, orig.h, &k, &custom, &args);
+    if (result == INFINITY || _cmp_float(result, expected, 4))
+        passed = 0;
+
+    printf("\t%s\n", passed?"PASS":"FAILED");
+    free(ref_f);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_f32
+ *---------------------------------------------------------------------------*/
+
+/* Copies an 8-bit image into floats with rows 'fstride' apart. The padding is
+ * filled with a value that would show up if it were read. */
+static void _to_f32(const struct bmp *b, int fstride, float *dst)
+{
+    int x, y;
+    for (y=0; y<b->h; ++y) {
+        for (x=0; x<b->w; ++x)
+            dst[y*fstride + x] = (float)b->img[y*b->stride + x];
+        for (; x<fstride; ++x)
+            dst[y*fstride + x] = -1000.0f;
+    }
+}
+
+int _test_ssim_f32(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    float *buf;
+    int fstride, size, passed;
+    float expected, result;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    fstride = orig.w + 5;
+    size = fstride*orig.h;
+    buf = (float*)malloc(2*size*sizeof(float));
+    if (!buf) {
+        printf("FAILED (out of memory)\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+    _to_f32(&orig, fstride, buf);
+    _to_f32(&cmp, fstride, buf + size);
+
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    start = hpt_get_time();
+    result = iqa_ssim_f32(buf, buf + size, orig.w, orig.h, fstride*(int)sizeof(float), gaussian, args);
+    end = hpt_get_time();
+    passed = result == expected;
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free(buf);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_int
+ *---------------------------------------------------------------------------*/
+int _test_ssim_int(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    int passed=0;
+    float expected, identical, result;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    identical = iqa_ssim_int(orig.img, orig.img, orig.w, orig.h, orig.stride, gaussian, args);
+    start = hpt_get_time();
+    result = iqa_ssim_int(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    end = hpt_get_time();
+    /* Quantized taps (and 8-bit downsampling), so only close to the float engine */
+    if (identical == 1.0f && fabs(result - expected) < 1e-3)
+        passed = 1;
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_16
+ *---------------------------------------------------------------------------*/
+
+/* Copies an 8-bit image into 16-bit words, shifted left by 'shift' */
+static void _to_16(const struct bmp *b, int shift, unsigned short *dst)
+{
+    int x, y;
+    for (y=0; y<b->h; ++y)
+        for (x=0; x<b->w; ++x)
+            dst[y*b->w + x] = (unsigned short)(b->img[y*b->stride + x] << shift);
+}
+
+int _test_ssim_16(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_args args_10;
+    const struct iqa_ssim_args *args10 = 0;
+    unsigned short *buf;
+    int size, stride, passed=1;
+    float expected, result, result10, resultp010;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    size = orig.w*orig.h;
+    stride = orig.w*(int)sizeof(unsigned short);
+    buf = (unsigned short*)malloc(2*size*sizeof(unsigned short));
+    if (!buf) {
+        printf("FAILED (out of memory)\n");
+        free_bmp(&orig);
+        free_bmp(&cmp);
+        return 1;
+    }
+    if (args) {
+        args_10 = *args;
+        args_10.L = args->L * 4;
+        args10 = &args_10;
+    }
+
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    _to_16(&orig, 0, buf);
+    _to_16(&cmp, 0, buf + size);
+    result = iqa_ssim_16(buf, buf + size, orig.w, orig.h, stride, 8, gaussian, args);
+    if (result != expected)
+        passed = 0;
+
+    /* 10-bit is close to 8-bit (the default L is 1023, not 4*255), and the
+     * same in either layout */
+    _to_16(&orig, 2, buf);
+    _to_16(&cmp, 2, buf + size);
+    start = hpt_get_time();
+    result10 = iqa_ssim_16(buf, buf + size, orig.w, orig.h, stride, 10, gaussian, args10);
+    end = hpt_get_time();
+    _to_16(&orig, 8, buf);
+    _to_16(&cmp, 8, buf + size);
+    resultp010 = iqa_ssim_16(buf, buf + size, orig.w, orig.h, stride, 10 | IQA_MSB_ALIGNED, gaussian, args10);
+    if (resultp010 != result10 || fabs(result10 - expected) > 1e-3)
+        passed = 0;
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result10,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free(buf);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_roi
+ *---------------------------------------------------------------------------*/
+int _test_ssim_roi(const char *bmp_ref, const char *bmp_cmp)
+{
+    struct bmp orig, cmp;
+    struct iqa_rect rects[2];
+    int offset, failures=0;
+    float expected, result;
+    unsigned long long start, end;
+
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    /* The whole image is the same as iqa_ssim() */
+    printf("\t  %dx%d Whole image: ", orig.w, orig.h);
+    rects[0].x = 0; rects[0].y = 0;
+    rects[0].w = orig.w; rects[0].h = orig.h;
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, 1, 0);
+    start = hpt_get_time();
+    result = iqa_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, 1, 0, rects, 1);
+    end = hpt_get_time();
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        result == expected?"PASS":"FAILED");
+    failures += result == expected ? 0 : 1;
+
+    /* The top and bottom halves pool the same windows as the whole image */
+    printf("\t  %dx%d Two halves: ", orig.w, orig.h);
+    rects[0].h = orig.h/2;
+    rects[1] = rects[0];
+    rects[1].y = rects[0].h;
+    rects[1].h = orig.h - rects[0].h;
+    result = iqa_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, 1, 0, rects, 2);
+    printf("\t%.5f\t\t\t%s\n", result, _cmp_float(result, expected, 5) ? "FAILED" : "PASS");
+    failures += _cmp_float(result, expected, 5) ? 1 : 0;
+
+    /* Without scaling, an interior region is the image around it */
+    printf("\t  %dx%d Interior (no scaling): ", orig.w, orig.h);
+    rects[0].x = 40; rects[0].y = 30;
+    rects[0].w = 64; rects[0].h = 48;
+    offset = (rects[0].y - 5)*orig.stride + rects[0].x - 5;
+    expected = iqa_ssim(orig.img + offset, cmp.img + offset, rects[0].w + 10, rects[0].h + 10,
+        orig.stride, 1, &no_scale_args);
+    result = iqa_ssim_roi(orig.img, cmp.img, orig.w, orig.h, orig.stride, 1, &no_scale_args, rects, 1);
+    printf("%.5f\t\t\t%s\n", result, result == expected ? "PASS" : "FAILED");
+    failures += result == expected ? 0 : 1;
+
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return failures;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_tracker
+ *
+ * Starts from identical frames and pastes regions of the distorted image into
+ * the copy, updating the tracker with only those regions.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_tracker(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_plan_options opts;
+    struct iqa_ssim_tracker *tracker=0, *full=0;
+    struct iqa_rect rects[3];
+    unsigned char *frame;
+    int i, y, passed=0;
+    float expected, fresh, result=INFINITY;
+    unsigned long long start=0, end=0;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    frame = (unsigned char*)malloc(orig.stride*orig.h);
+    opts.gaussian = gaussian;
+    opts.args = args;
+    if (frame) {
+        memcpy(frame, orig.img, orig.stride*orig.h);
+        tracker = iqa_ssim_tracker_create(orig.w, orig.h, &opts);
+        full = iqa_ssim_tracker_create(orig.w, orig.h, &opts);
+    }
+    if (!tracker || !full) {
+        printf("FAILED (out of memory)\n");
+        goto cleanup;
+    }
+    result = iqa_ssim_tracker_update(tracker, orig.img, frame, orig.stride, 0, 0);
+    if (result != iqa_ssim(orig.img, frame, orig.w, orig.h, orig.stride, gaussian, args))
+        goto done;
+
+    /* A small region, regions touching the edges, then all of them again */
+    rects[0].x = 37; rects[0].y = 41; rects[0].w = 20; rects[0].h = 9;
+    rects[1].x = orig.w - 50; rects[1].y = 0; rects[1].w = 50; rects[1].h = 31;
+    rects[2].x = 0; rects[2].y = orig.h/2; rects[2].w = 3; rects[2].h = orig.h/2;
+    for (i=0; i<4; ++i) {
+        const struct iqa_rect *r = i < 3 ? rects + i : rects;
+        int n = i < 3 ? 1 : 3;
+        int k;
+        for (k=0; k<n; ++k) {
+            for (y=r[k].y; y<r[k].y + r[k].h; ++y)
+                memcpy(frame + y*orig.stride + r[k].x, cmp.img + y*cmp.stride + r[k].x, r[k].w);
+        }
+        start = hpt_get_time();
+        result = iqa_ssim_tracker_update(tracker, orig.img, frame, orig.stride, r, n);
+        end = hpt_get_time();
+        fresh = iqa_ssim_tracker_update(full, orig.img, frame, orig.stride, 0, 0);
+        expected = iqa_ssim(orig.img, frame, orig.w, orig.h, orig.stride, gaussian, args);
+        if (result != fresh || _cmp_float(result, expected, 5))
+            goto done;
+    }
+
+    /* Nothing changed */
+    passed = iqa_ssim_tracker_update(tracker, orig.img, frame, orig.stride, rects, 0) == result;
+
+done:
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+cleanup:
+    iqa_ssim_tracker_destroy(tracker);
+    iqa_ssim_tracker_destroy(full);
+    free(frame);
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_letterbox
+ *
+ * The top and bottom 'bar' rows of the distorted image are replaced with the
+ * reference. Windows inside the bars are exactly 1, and the rest is the SSIM
+ * of the middle of the image (with enough rows for the windows). Both images
+ * must be small enough not to be scaled.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_letterbox(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    int y, k, bar=40, offset, dst_h, inner_h, passed;
+    float inner, result, identical, small, streamed;
+    double expected;
+    struct iqa_ssim_plan *plan;
+    struct iqa_ssim_stream *stream;
+    struct iqa_ssim_plan_options opts;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+    for (y=0; y<bar; ++y) {
+        memcpy(cmp.img + y*cmp.stride, orig.img + y*orig.stride, orig.w);
+        memcpy(cmp.img + (orig.h-1-y)*cmp.stride, orig.img + (orig.h-1-y)*orig.stride, orig.w);
+    }
+
+    k = gaussian ? 11 : 8;
+    dst_h = orig.h - k + 1;
+    inner_h = orig.h - 2*bar + 2*(k-1);
+    offset = (bar - k + 1)*orig.stride;
+    inner = iqa_ssim(orig.img + offset, cmp.img + offset, orig.w, inner_h, orig.stride, gaussian, args);
+    expected = (2.0*(bar - k + 1) + (double)inner*(inner_h - k + 1)) / dst_h;
+
+    start = hpt_get_time();
+    result = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    end = hpt_get_time();
+    identical = iqa_ssim(orig.img, orig.img, orig.w, orig.h, orig.stride, gaussian, args);
+
+    /* Streamed a row at a time, the skipped rows carry over between calls */
+    opts.gaussian = gaussian;
+    opts.args = args;
+    stream = iqa_ssim_stream_create(orig.w, orig.h, &opts);
+    for (y=0; stream && y<orig.h; ++y)
+        iqa_ssim_stream_push(stream, orig.img + y*orig.stride, cmp.img + y*cmp.stride, orig.stride, 1);
+    streamed = iqa_ssim_stream_result(stream, 0);
+    iqa_ssim_stream_destroy(stream);
+
+    /* A plan too small for its window fails, even for identical images */
+    plan = iqa_ssim_plan_create(k-1, k-1, orig.stride, &opts);
+    small = plan ? iqa_ssim_plan_execute(plan, orig.img, orig.img) : 0.0f;
+    iqa_ssim_plan_destroy(plan);
+
+    passed = !_cmp_float(result, (float)expected, 5) && identical == 1.0f && small == INFINITY &&
+        streamed == result;
+
+    printf("\t%.5f  (%.3lf ms)\t%s\n",
+        result,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}
+
+/*----------------------------------------------------------------------------
+ * _test_ssim_sampled
+ *
+ * A step of 1 is the full calculation. The estimates from a step of 4 and
+ * from random windows must be within twice their interval of it.
+ *---------------------------------------------------------------------------*/
+int _test_ssim_sampled(const char *name, const char *bmp_ref, const char *bmp_cmp, int gaussian, const struct iqa_ssim_args *args)
+{
+    struct bmp orig, cmp;
+    struct iqa_ssim_sampling sampling;
+    struct iqa_ssim_estimate all, grid, rnd, again;
+    int passed;
+    float expected;
+    unsigned long long start, end;
+
+    printf("\t  %s: ", name);
+    if (load_bmp(bmp_ref, &orig)) {
+        printf("FAILED to load \'%s\'\n", bmp_ref);
+        return 1;
+    }
+    if (load_bmp(bmp_cmp, &cmp)) {
+        printf("FAILED to load \'%s\'\n", bmp_cmp);
+        free_bmp(&orig);
+        return 1;
+    }
+
+    expected = iqa_ssim(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args);
+    memset(&sampling, 0, sizeof(sampling));
+    sampling.step = 1;
+    iqa_ssim_sampled(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args, &sampling, &all);
+    sampling.step = 4;
+    start = hpt_get_time();
+    iqa_ssim_sampled(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args, &sampling, &grid);
+    end = hpt_get_time();
+    sampling.count = 4000;
+    sampling.seed = 7;
+    iqa_ssim_sampled(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args, &sampling, &rnd);
+    iqa_ssim_sampled(orig.img, cmp.img, orig.w, orig.h, orig.stride, gaussian, args, &sampling, &again);
+
+    passed = !_cmp_float(all.mean, expected, 5) && all.error == 0.0f &&
+        grid.error > 0.0f && fabs(grid.mean - expected) <= 2.0f*grid.error &&
+        rnd.samples == 4000 && rnd.error > 0.0f && fabs(rnd.mean - expected) <= 2.0f*rnd.error &&
+        again.mean == rnd.mean && all.samples > 15*grid.samples;
+
+    printf("\t%.5f +/- %.5f  (%.3lf ms)\t%s\n",
+        grid.mean, grid.error,
+        hpt_elapsed_time(start,end,hpt_get_frequency()) * 1000.0,
+        passed?"PASS":"FAILED");
+
+    free_bmp(&orig);
+    free_bmp(&cmp);
+    return passed?0:1;
+}